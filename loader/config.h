@@ -2,6 +2,12 @@
 #define __CONFIG_H__
 
 #define DEBUG
+// #define IO_TRACE // Record every asset access to IO_TRACE_PATH
+// #define DUMP_SHADERS // Save the source of every new shader to DATA_PATH "/glsl" (must exist) for shaderperm
+// #define SO_LAZY_BIND // Look imports up on their first call rather than at load
+// #define SO_SNAPSHOT // Boot from the modules relocated by the last boot in SO_SNAPSHOT_PATH
+// #define SO_FIX_UNALIGNED "_ZN3QDT3M3D15DISPLAY_MANAGER*" // Rewrite the loads and stores that fault on misaligned data in the functions matching these patterns, only name the ones seen faulting
+// #define SO_PROFILE "_ZN3QDT3M3D15DISPLAY_MANAGER*" // Count the calls and time of the functions matching these patterns into SO_PROFILE_PATH for profreport
 
 #define LOAD_ADDRESS 0x98000000
 
@@ -12,6 +18,25 @@
 #define DATA_PATH "ux0:data/fahrenheit"
 #define SO_PATH DATA_PATH "/" "libFahrenheit.so"
 #define PSARC_PATH DATA_PATH "/" "obb.psarc"
+#define IO_TRACE_PATH DATA_PATH "/" "io_trace.bin"
+#define PREFETCH_PATH DATA_PATH "/" "prefetch.txt"
+#define GXP_PATH DATA_PATH "/" "gxp"
+#define GXP_PACK_PATH DATA_PATH "/" "gxp.pack"
+#define SHADER_PRECOMPILE_PATH DATA_PATH "/" "precompile"
+#define SO_SNAPSHOT_PATH DATA_PATH "/" "snapshot"
+#define SO_PROFILE_PATH DATA_PATH "/" "profile.bin"
+
+// fios_backend reads PSARC_PATH, sceio_backend reads an obb extracted to IO_SCEIO_ROOT "/psarc"
+#define IO_BACKEND fios_backend
+#define IO_SCEIO_ROOT DATA_PATH
+
+#define PREFETCH_AHEAD 8 // assets read ahead of the one being opened
+#define PREFETCH_POOL_MB 32
+#define PREFETCH_MAX_FILE_MB 4
+
+// Loose shaders live in GXP_PATH "/<name of the hash>", see shader_key.h for the others
+#define SHADER_KEY murmur3_key
+#define SHADER_CACHE_KB 2048 // compiled shaders kept alive after their program is deleted
 
 #define SCREEN_W 960
 #define SCREEN_H 544
@@ -13,6 +13,7 @@
 #include "main.h"
 #include "config.h"
 #include "fios.h"
+#include "io_backend.h"
 #include "so_util.h"
 
 #define MAX_PATH_LENGTH 256
@@ -97,3 +98,37 @@ void fios_terminate(void) {
 	free(g_RamCacheWorkBuffer);
 	sceFiosArchiveUnmountSync(NULL, g_ObbHandle);
 }
+
+static int fios_exists(const char *path) {
+	return sceFiosFileExistsSync(NULL, path);
+}
+
+static int fios_valid(int32_t fh) {
+	return sceFiosIsValidHandle(fh);
+}
+
+static int fios_open(const char *path, int32_t *fh) {
+	return sceFiosFHOpenSync(NULL, fh, path, NULL);
+}
+
+static int64_t fios_size(int32_t fh) {
+	return sceFiosFHGetSize(fh);
+}
+
+static int64_t fios_pread(int32_t fh, void *buf, int64_t len, int64_t off) {
+	return sceFiosFHPreadSync(NULL, fh, buf, len, off);
+}
+
+static void fios_close(int32_t fh) {
+	sceFiosFHCloseSync(NULL, fh);
+}
+
+const io_backend fios_backend = {
+	.name = "fios",
+	.exists = fios_exists,
+	.valid = fios_valid,
+	.open = fios_open,
+	.size = fios_size,
+	.pread = fios_pread,
+	.close = fios_close,
+};
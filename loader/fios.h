@@ -88,8 +88,11 @@ void sceFiosIOFilterCache();
 void sceFiosIOFilterPsarcDearchiver();
 int sceFiosFHOpenSync(const void *attr, int32_t *fh, const char *path, const void *params);
 int64_t sceFiosFHReadSync(const void *attr, int32_t fh, void *buf, int64_t length);
+int64_t sceFiosFHPreadSync(const void *attr, int32_t fh, void *buf, int64_t length, int64_t offset);
 int64_t sceFiosFHSeek(int32_t fh, int64_t offset, int32_t whence);
 int64_t sceFiosFHTell(int32_t fh);
+int64_t sceFiosFHGetSize(int32_t fh);
+int sceFiosFHCloseSync(const void *attr, int32_t fh);
 int sceFiosIsValidHandle(int32_t handle);
 int sceFiosFileExistsSync(const void *pAttr, const char *path);
 
@@ -0,0 +1,26 @@
+#ifndef __IO_BACKEND_H__
+#define __IO_BACKEND_H__
+
+#include <stdint.h>
+
+// Storage used by the asset readers, so that the layers above it do not
+// care whether the data comes from FIOS2 or anything else. Paths are the
+// virtual /psarc/ paths the game opens. Handles are never 0.
+typedef struct {
+	const char *name;
+	int (*exists)(const char *path);
+	int (*valid)(int32_t fh);
+	int (*open)(const char *path, int32_t *fh);
+	int64_t (*size)(int32_t fh);
+	int64_t (*pread)(int32_t fh, void *buf, int64_t len, int64_t off);
+	void (*close)(int32_t fh);
+} io_backend;
+
+extern const io_backend fios_backend;  // PSARC mounted through FIOS2, see fios.c
+extern const io_backend sceio_backend; // extracted obb read with sceIo, see io_sceio.c
+extern const io_backend posix_backend; // host only, pread on plain files, see io_posix.c
+extern const io_backend mmap_backend;  // host only, memory mapped plain files, see io_posix.c
+
+void io_posix_set_root(const char *root);
+
+#endif
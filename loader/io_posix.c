@@ -0,0 +1,152 @@
+/* io_posix.c -- asset backends over plain files, for running the file layer on a host
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "io_backend.h"
+
+// Handles are slot indices offset by HANDLE_BASE, so they are never 0 and
+// do not look like the small fds the rest of the program uses
+#define MAX_HANDLES 1024
+#define HANDLE_BASE 0x10000
+
+static struct {
+	int fd;
+	uint8_t *map;
+	int64_t size;
+} g_Handles[MAX_HANDLES];
+
+static const char *g_Root = ".";
+
+void io_posix_set_root(const char *root) {
+	g_Root = root;
+}
+
+static void posix_path(char *out, size_t size, const char *path) {
+	snprintf(out, size, "%s%s%s", g_Root, path[0] == '/' ? "" : "/", path);
+}
+
+static int handle_index(int32_t fh) {
+	int i = fh - HANDLE_BASE;
+	if (i < 0 || i >= MAX_HANDLES || g_Handles[i].fd <= 0)
+		return -1;
+	return i;
+}
+
+static int posix_exists(const char *path) {
+	char native[4096];
+	struct stat st;
+	posix_path(native, sizeof(native), path);
+	return stat(native, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static int posix_valid(int32_t fh) {
+	return handle_index(fh) >= 0;
+}
+
+static int open_common(const char *path, int32_t *fh, int map) {
+	char native[4096];
+	struct stat st;
+	int fd;
+
+	posix_path(native, sizeof(native), path);
+
+	fd = open(native, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (__sync_bool_compare_and_swap(&g_Handles[i].fd, 0, fd)) {
+			g_Handles[i].size = st.st_size;
+			g_Handles[i].map = NULL;
+			if (map && st.st_size > 0) {
+				void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (p != MAP_FAILED)
+					g_Handles[i].map = p;
+			}
+			*fh = HANDLE_BASE + i;
+			return 0;
+		}
+	}
+
+	close(fd);
+	return -1;
+}
+
+static int posix_open(const char *path, int32_t *fh) {
+	return open_common(path, fh, 0);
+}
+
+static int mmap_open(const char *path, int32_t *fh) {
+	return open_common(path, fh, 1);
+}
+
+static int64_t posix_size(int32_t fh) {
+	int i = handle_index(fh);
+	return i < 0 ? -1 : g_Handles[i].size;
+}
+
+static int64_t posix_pread(int32_t fh, void *buf, int64_t len, int64_t off) {
+	int i = handle_index(fh);
+	if (i < 0)
+		return -1;
+
+	// mmap_backend files that could not be mapped end up here as well
+	if (g_Handles[i].map) {
+		if (off >= g_Handles[i].size)
+			return 0;
+		if (len > g_Handles[i].size - off)
+			len = g_Handles[i].size - off;
+		memcpy(buf, g_Handles[i].map + off, len);
+		return len;
+	}
+
+	return pread(g_Handles[i].fd, buf, len, off);
+}
+
+static void posix_close(int32_t fh) {
+	int i = handle_index(fh);
+	if (i < 0)
+		return;
+
+	if (g_Handles[i].map)
+		munmap(g_Handles[i].map, g_Handles[i].size);
+	close(g_Handles[i].fd);
+	__sync_synchronize();
+	g_Handles[i].fd = 0;
+}
+
+const io_backend posix_backend = {
+	.name = "posix",
+	.exists = posix_exists,
+	.valid = posix_valid,
+	.open = posix_open,
+	.size = posix_size,
+	.pread = posix_pread,
+	.close = posix_close,
+};
+
+const io_backend mmap_backend = {
+	.name = "mmap",
+	.exists = posix_exists,
+	.valid = posix_valid,
+	.open = mmap_open,
+	.size = posix_size,
+	.pread = posix_pread,
+	.close = posix_close,
+};
@@ -0,0 +1,87 @@
+/* io_sceio.c -- asset backend reading an extracted obb with sceIo
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "io_backend.h"
+
+#define MAX_HANDLES 256
+
+// The game hands us every fd it has, so keep track of the ones that are ours
+static SceUID g_Handles[MAX_HANDLES];
+
+static void sceio_path(char *out, size_t size, const char *path) {
+	snprintf(out, size, "%s%s%s", IO_SCEIO_ROOT, path[0] == '/' ? "" : "/", path);
+}
+
+static int sceio_exists(const char *path) {
+	char native[512];
+	SceIoStat stat;
+	sceio_path(native, sizeof(native), path);
+	return sceIoGetstat(native, &stat) >= 0;
+}
+
+static int sceio_valid(int32_t fh) {
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (g_Handles[i] == fh)
+			return fh > 0;
+	}
+	return 0;
+}
+
+static int sceio_open(const char *path, int32_t *fh) {
+	char native[512];
+	sceio_path(native, sizeof(native), path);
+
+	SceUID fd = sceIoOpen(native, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (__sync_bool_compare_and_swap(&g_Handles[i], 0, fd)) {
+			*fh = fd;
+			return 0;
+		}
+	}
+
+	sceIoClose(fd);
+	return -1;
+}
+
+static int64_t sceio_size(int32_t fh) {
+	SceIoStat stat;
+	if (sceIoGetstatByFd(fh, &stat) < 0)
+		return -1;
+	return stat.st_size;
+}
+
+static int64_t sceio_pread(int32_t fh, void *buf, int64_t len, int64_t off) {
+	return sceIoPread(fh, buf, len, off);
+}
+
+static void sceio_close(int32_t fh) {
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (__sync_bool_compare_and_swap(&g_Handles[i], fh, 0))
+			break;
+	}
+	sceIoClose(fh);
+}
+
+const io_backend sceio_backend = {
+	.name = "sceio",
+	.exists = sceio_exists,
+	.valid = sceio_valid,
+	.open = sceio_open,
+	.size = sceio_size,
+	.pread = sceio_pread,
+	.close = sceio_close,
+};
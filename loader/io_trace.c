@@ -0,0 +1,235 @@
+/* io_trace.c -- binary trace of the game asset I/O
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "io_trace.h"
+
+#ifdef IO_TRACE
+
+#define RING_SIZE 8192 // records, must be a power of two
+#define RING_MASK (RING_SIZE - 1)
+#define FLUSH_INTERVAL_US (100 * 1000)
+
+#define MAX_HANDLES 1024 // matches the FIOS file handle storage
+
+static io_trace_record g_Ring[RING_SIZE];
+static volatile uint8_t g_Committed[RING_SIZE];
+static volatile uint32_t g_RingHead;
+static volatile uint32_t g_RingTail;
+static volatile uint32_t g_Dropped;
+
+// Every thread opening or reading assets goes through the handle table
+static SceKernelLwMutexWork g_HandlesLock __attribute__((aligned(8)));
+static struct {
+	int32_t fh;
+	uint32_t path_hash;
+} g_Handles[MAX_HANDLES];
+
+static SceUID g_TraceFd = -1;
+static uint64_t g_TraceStart;
+
+uint64_t io_trace_now(void) {
+	return sceKernelGetProcessTimeWide();
+}
+
+static uint32_t fnv1a(const char *s) {
+	uint32_t h = 0x811c9dc5;
+	while (*s) {
+		h ^= (uint8_t)*s++;
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+#define HANDLE_DEAD -1
+
+static int handle_find(int32_t fh) {
+	uint32_t i = ((uint32_t)fh * 0x9e3779b1) % MAX_HANDLES;
+	for (int n = 0; n < MAX_HANDLES && g_Handles[i].fh != 0; n++, i = (i + 1) % MAX_HANDLES) {
+		if (g_Handles[i].fh == fh)
+			return i;
+	}
+	return -1;
+}
+
+static void handle_insert(int32_t fh, uint32_t path_hash) {
+	int i = handle_find(fh);
+
+	// Closed handles leave a tombstone behind so probing chains stay intact
+	if (i < 0) {
+		i = ((uint32_t)fh * 0x9e3779b1) % MAX_HANDLES;
+		for (int n = 0; n < MAX_HANDLES; n++, i = (i + 1) % MAX_HANDLES) {
+			if (g_Handles[i].fh == 0 || g_Handles[i].fh == HANDLE_DEAD)
+				break;
+		}
+	}
+
+	g_Handles[i].fh = fh;
+	g_Handles[i].path_hash = path_hash;
+}
+
+// Reserve n consecutive records, or count them as dropped if the ring is full
+static int ring_reserve(uint32_t n, uint32_t *pos) {
+	uint32_t head;
+	do {
+		head = g_RingHead;
+		if (head + n - g_RingTail > RING_SIZE) {
+			__sync_fetch_and_add(&g_Dropped, n);
+			return -1;
+		}
+	} while (!__sync_bool_compare_and_swap(&g_RingHead, head, head + n));
+	*pos = head;
+	return 0;
+}
+
+static void ring_commit(uint32_t pos, uint32_t n) {
+	__sync_synchronize();
+	for (uint32_t i = 0; i < n; i++)
+		g_Committed[(pos + i) & RING_MASK] = 1;
+}
+
+static void emit(int op, int32_t fh, uint32_t path_hash, int64_t offset, uint32_t length, uint64_t start, int failed) {
+	uint32_t pos;
+	if (ring_reserve(1, &pos) < 0)
+		return;
+
+	io_trace_record *r = &g_Ring[pos & RING_MASK];
+	r->time = start - g_TraceStart;
+	r->offset = offset;
+	r->path_hash = path_hash;
+	r->length = length;
+	r->latency = (uint32_t)(io_trace_now() - start);
+	r->handle = (uint16_t)fh;
+	r->op = op;
+	r->failed = failed;
+
+	ring_commit(pos, 1);
+}
+
+static void emit_name(uint32_t path_hash, const char *path) {
+	uint32_t len = strlen(path);
+	uint32_t n = 1 + (len + sizeof(io_trace_record) - 1) / sizeof(io_trace_record);
+	uint32_t pos;
+
+	if (ring_reserve(n, &pos) < 0)
+		return;
+
+	io_trace_record *r = &g_Ring[pos & RING_MASK];
+	memset(r, 0, sizeof(io_trace_record));
+	r->time = io_trace_now() - g_TraceStart;
+	r->path_hash = path_hash;
+	r->length = len;
+	r->op = IO_TRACE_NAME;
+
+	// The payload may wrap around the end of the ring
+	for (uint32_t i = 1; i < n; i++) {
+		uint32_t chunk = len - (i - 1) * sizeof(io_trace_record);
+		if (chunk > sizeof(io_trace_record))
+			chunk = sizeof(io_trace_record);
+		memset(&g_Ring[(pos + i) & RING_MASK], 0, sizeof(io_trace_record));
+		memcpy(&g_Ring[(pos + i) & RING_MASK], path + (i - 1) * sizeof(io_trace_record), chunk);
+	}
+
+	ring_commit(pos, n);
+}
+
+void io_trace_open(int32_t fh, const char *path, uint64_t start, int failed) {
+	uint32_t path_hash = fnv1a(path);
+
+	emit_name(path_hash, path);
+	emit(IO_TRACE_OPEN, fh, path_hash, 0, 0, start, failed);
+
+	if (!failed) {
+		sceKernelLockLwMutex(&g_HandlesLock, 1, NULL);
+		handle_insert(fh, path_hash);
+		sceKernelUnlockLwMutex(&g_HandlesLock, 1);
+	}
+}
+
+void io_trace_op(int op, int32_t fh, int64_t offset, uint32_t length, uint64_t start, int failed) {
+	uint32_t path_hash = 0;
+
+	sceKernelLockLwMutex(&g_HandlesLock, 1, NULL);
+	int i = handle_find(fh);
+	if (i >= 0) {
+		path_hash = g_Handles[i].path_hash;
+		if (op == IO_TRACE_CLOSE)
+			g_Handles[i].fh = HANDLE_DEAD;
+	}
+	sceKernelUnlockLwMutex(&g_HandlesLock, 1);
+
+	emit(op, fh, path_hash, offset, length, start, failed);
+}
+
+static int io_trace_thread(SceSize args, void *argp) {
+	for (;;) {
+		sceKernelDelayThread(FLUSH_INTERVAL_US);
+
+		uint32_t dropped = g_Dropped;
+		if (dropped) {
+			__sync_fetch_and_sub(&g_Dropped, dropped);
+			emit(IO_TRACE_DROP, 0, 0, 0, dropped, io_trace_now(), 0);
+		}
+
+		// Write out every committed record, stopping at the first one still being filled
+		uint32_t tail = g_RingTail;
+		uint32_t head = g_RingHead;
+		uint32_t n = 0;
+		while (tail + n != head && g_Committed[(tail + n) & RING_MASK])
+			n++;
+
+		while (n > 0) {
+			uint32_t chunk = RING_SIZE - (tail & RING_MASK);
+			if (chunk > n)
+				chunk = n;
+
+			sceIoWrite(g_TraceFd, &g_Ring[tail & RING_MASK], chunk * sizeof(io_trace_record));
+			for (uint32_t i = 0; i < chunk; i++)
+				g_Committed[(tail + i) & RING_MASK] = 0;
+
+			__sync_synchronize();
+			tail += chunk;
+			g_RingTail = tail;
+			n -= chunk;
+		}
+	}
+
+	return 0;
+}
+
+void io_trace_init(void) {
+	io_trace_header hdr;
+
+	sceKernelCreateLwMutex(&g_HandlesLock, "io_trace", 0, 0, NULL);
+
+	g_TraceFd = sceIoOpen(IO_TRACE_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (g_TraceFd < 0) {
+		debugPrintf("io_trace: could not open %s (0x%08X)\n", IO_TRACE_PATH, g_TraceFd);
+		return;
+	}
+
+	hdr.magic = IO_TRACE_MAGIC;
+	hdr.version = IO_TRACE_VERSION;
+	hdr.record_size = sizeof(io_trace_record);
+	hdr.tick_freq = 1000000;
+	sceIoWrite(g_TraceFd, &hdr, sizeof(hdr));
+
+	g_TraceStart = io_trace_now();
+
+	SceUID thid = sceKernelCreateThread("io_trace", io_trace_thread, 0x10000100 + 32, 0x4000, 0, 0, NULL);
+	if (thid >= 0)
+		sceKernelStartThread(thid, 0, NULL);
+}
+
+#endif
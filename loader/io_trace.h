@@ -0,0 +1,53 @@
+#ifndef __IO_TRACE_H__
+#define __IO_TRACE_H__
+
+#include <stdint.h>
+
+#define IO_TRACE_MAGIC 0x52544f49 // IOTR
+#define IO_TRACE_VERSION 1
+
+enum {
+	IO_TRACE_OPEN = 1,
+	IO_TRACE_READ,
+	IO_TRACE_SEEK,
+	IO_TRACE_TELL,
+	IO_TRACE_GETC,
+	IO_TRACE_CLOSE,
+	IO_TRACE_NAME, // path follows in the next (length + 31) / 32 records
+	IO_TRACE_DROP, // length records were lost because the ring was full
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t tick_freq;
+} io_trace_header;
+
+typedef struct {
+	uint64_t time;      // start of the operation, in ticks
+	int64_t offset;     // file position before the operation, or seek target
+	uint32_t path_hash; // FNV-1a of the path given to fopen
+	uint32_t length;    // bytes requested, seek origin or path length
+	uint32_t latency;   // duration of the operation, in ticks
+	uint16_t handle;
+	uint8_t op;
+	uint8_t failed;
+} io_trace_record;
+
+#ifdef IO_TRACE
+uint64_t io_trace_now(void);
+void io_trace_init(void);
+void io_trace_open(int32_t fh, const char *path, uint64_t start, int failed);
+void io_trace_op(int op, int32_t fh, int64_t offset, uint32_t length, uint64_t start, int failed);
+
+#define IO_TRACE_BEGIN() uint64_t __io_trace_start = io_trace_now()
+#define IO_TRACE_OPEN(fh, path, failed) io_trace_open(fh, path, __io_trace_start, failed)
+#define IO_TRACE_OP(op, fh, offset, length, failed) io_trace_op(op, fh, offset, length, __io_trace_start, failed)
+#else
+#define IO_TRACE_BEGIN()
+#define IO_TRACE_OPEN(fh, path, failed)
+#define IO_TRACE_OP(op, fh, offset, length, failed)
+#endif
+
+#endif
@@ -42,11 +42,24 @@
 #include "config.h"
 #include "dialog.h"
 #include "so_util.h"
+#include "so_snapshot.h"
+#include "so_arena.h"
+#include "so_hook_table.h"
+#include "so_unaligned.h"
+#include "so_profile.h"
 #include "ogg_patch.h"
 #include "vorbis_patch.h"
 #include "sha1.h"
 #include "libc_bridge.h"
 #include "fios.h"
+#include "io_trace.h"
+#include "obb_file.h"
+#include "prefetch.h"
+#include "shader_pack.h"
+#include "shader_cache.h"
+#include "shader_compile.h"
+#include "shader_key.h"
+#include "shader_precompile.h"
 
 #ifdef DEBUG
 #define dlog printf
@@ -444,13 +457,22 @@ char *from_basic_string(void *basic_string) {
 		return basic_string + 1;
 }
 
+static const io_backend *asset_io = &IO_BACKEND;
+
 int ASL__FsApi__Obb__Vfs__fopen(void *this, void *filename_basic_string, void *mode_basic_string) {
 	char *filename = from_basic_string(filename_basic_string);
 	char *mode = from_basic_string(mode_basic_string);
 
+	IO_TRACE_BEGIN();
 	int f;
-	if (sceFiosFHOpenSync(NULL, &f, filename, NULL) < 0)
+	if (asset_io->open(filename, &f) < 0) {
+		IO_TRACE_OPEN(0, filename, 1);
 		return 0;
+	}
+
+	IO_TRACE_OPEN(f, filename, 0);
+
+	prefetch_bind(f, prefetch_open(filename));
 
 	return f;
 }
@@ -466,51 +488,54 @@ void ASL__FsApi__Obb__Vfs__nativeToVirtual(void *virtual_basic_string, void *thi
 	std__basic_string__init(virtual_basic_string, virtual, strlen(virtual));
 }
 
-int ASL__FsApi__Obb__File__fgetc(uintptr_t *this) {
-	uint8_t ch;
-	if (sceFiosFHReadSync(NULL, this[1], &ch, sizeof(ch)) != sizeof(ch))
-		return EOF;
+int ASL__FsApi__Obb__File__fgetc(obb_file *this) {
+	IO_TRACE_BEGIN();
+	int ch = obb_file_getc(this);
+	IO_TRACE_OP(IO_TRACE_GETC, this->fh, obb_file_tell(this) - (ch != EOF), 1, ch == EOF);
 	return ch;
 }
 
-int ASL__FsApi__Obb__File__ASL_getC(uintptr_t *this) {
+int ASL__FsApi__Obb__File__ASL_getC(obb_file *this) {
 	return ASL__FsApi__Obb__File__fgetc(this);
 }
 
-int ASL__FsApi__Obb__File__ungetc(uintptr_t *this) {
-	return -1;
+int ASL__FsApi__Obb__File__ungetc(obb_file *this, int ch) {
+	return obb_file_ungetc(this, ch);
 }
 
-size_t ASL__FsApi__Obb__File__fread(uintptr_t *this, void *ptr, size_t size, size_t count) {
+size_t ASL__FsApi__Obb__File__fread(obb_file *this, void *ptr, size_t size, size_t count) {
 	if (size == 0 || count == 0)
 		return 0;
 
-	int res = (int)sceFiosFHReadSync(NULL, this[1], ptr, size * count);
-	if (res <= 0) {
-		return 0;
-	}
+	IO_TRACE_BEGIN();
+	size_t res = obb_file_read(this, ptr, size * count);
+	IO_TRACE_OP(IO_TRACE_READ, this->fh, obb_file_tell(this) - res, size * count, res == 0);
 
 	return res / size;
 }
 
-int ASL__FsApi__Obb__File__fseek(uintptr_t *this, long offset, int origin) {
-	if (sceFiosFHSeek(this[1], offset, origin) < 0)
+int ASL__FsApi__Obb__File__fseek(obb_file *this, long offset, int origin) {
+	IO_TRACE_BEGIN();
+	if (obb_file_seek(this, offset, origin) < 0) {
+		IO_TRACE_OP(IO_TRACE_SEEK, this->fh, offset, origin, 1);
 		return -1;
+	}
+	IO_TRACE_OP(IO_TRACE_SEEK, this->fh, obb_file_tell(this), origin, 0);
 	return 0;
 }
 
-long ASL__FsApi__Obb__File__ftell(uintptr_t *this) {
-	long res = (long)sceFiosFHTell(this[1]);
-	if (res < 0)
-		return -1;
+long ASL__FsApi__Obb__File__ftell(obb_file *this) {
+	IO_TRACE_BEGIN();
+	long res = (long)obb_file_tell(this);
+	IO_TRACE_OP(IO_TRACE_TELL, this->fh, res, 0, 0);
 	return res;
 }
 
-int ASL__FsApi__Obb__File__fclose(uintptr_t *this) {
-	sceFiosFHCloseSync(NULL, this[1]);
-	this[0] = 0xdeadbeef;
-	this[1] = 0xdeadbeef;
-	free(this);
+int ASL__FsApi__Obb__File__fclose(obb_file *this) {
+	IO_TRACE_BEGIN();
+	int32_t fh = this->fh;
+	obb_file_close(this);
+	IO_TRACE_OP(IO_TRACE_CLOSE, fh, 0, 0, 0);
 	return 0;
 }
 
@@ -580,7 +605,7 @@ void *ASL__FsApi__lookupVfs(void *filename_basic_string) {
 	char *filename = from_basic_string(filename_basic_string);
 	char filename_with_slash[256];
 	snprintf(filename_with_slash, sizeof(filename_with_slash), "/psarc/%s", filename);
-	if (sceFiosFileExistsSync(NULL, filename_with_slash))
+	if (asset_io->exists(filename_with_slash))
 		return &ASL__FsApi__Obb__Vfs_vptr;
 	return NULL;
 }
@@ -588,12 +613,11 @@ void *ASL__FsApi__lookupVfs(void *filename_basic_string) {
 void ASL__FsApi__lookupFile(uintptr_t *obbfile, int fd) {
 	obbfile[0] = 0;
 	obbfile[1] = 0;
-	if (sceFiosIsValidHandle(fd)) {
-		uintptr_t *file = malloc(8);
-		file[0] = (uintptr_t)ASL__FsApi__Obb__File_vtable;
-		file[1] = fd;
-		obbfile[0] = file;
+	if (asset_io->valid(fd)) {
+		obbfile[0] = (uintptr_t)obb_file_new(ASL__FsApi__Obb__File_vtable, asset_io, fd);
 		obbfile[1] = 0;
+	} else {
+		prefetch_bind(fd, NULL);
 	}
 }
 
@@ -601,34 +625,50 @@ void GetHomeDir(char *dir) {
 	*dir = '\0';
 }
 
-void patch_game(void) {
-	if (ps2_mode)
-		hook_addr(so_symbol(&fahrenheit_mod, "ktxLoadTextureM"), (uintptr_t)&ret0);
+#ifdef SO_FIX_UNALIGNED
+static const char *const unaligned_allowlist[] = { SO_FIX_UNALIGNED };
+#endif
 
-	//hook_addr(so_symbol(&fahrenheit_mod, "_ZN3QDT3KRN8I_OUTPUT4PushEPKcb"), QDT__KRN__I_OUTPUT__Push);
+#ifdef SO_PROFILE
+static const char *const profile_patterns[] = { SO_PROFILE };
+#endif
 
-	hook_addr(so_symbol(&fahrenheit_mod, "rrmemset16"), (uintptr_t)&sceClibMemset);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrmemset32"), (uintptr_t)&sceClibMemset);
+static const so_hook_def ps2_hooks[] = {
+	SO_HOOK("ktxLoadTextureM", &ret0),
+};
+
+static const so_hook_def game_hooks[] = {
+	//SO_HOOK("_ZN3QDT3KRN8I_OUTPUT4PushEPKcb", QDT__KRN__I_OUTPUT__Push),
+
+	SO_HOOK("rrmemset16", &sceClibMemset),
+	SO_HOOK("rrmemset32", &sceClibMemset),
 
-	hook_addr(so_symbol(&fahrenheit_mod, "rrSemaphoreCreate"), (uintptr_t)&rrSemaphoreCreate);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrSemaphoreDestroy"), (uintptr_t)&rrSemaphoreDestroy);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrSemaphoreDecrementOrWait"), (uintptr_t)&rrSemaphoreDecrementOrWait);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrSemaphoreIncrement"), (uintptr_t)&rrSemaphoreIncrement);
+	SO_HOOK("rrSemaphoreCreate", &rrSemaphoreCreate),
+	SO_HOOK("rrSemaphoreDestroy", &rrSemaphoreDestroy),
+	SO_HOOK("rrSemaphoreDecrementOrWait", &rrSemaphoreDecrementOrWait),
+	SO_HOOK("rrSemaphoreIncrement", &rrSemaphoreIncrement),
 
-	hook_addr(so_symbol(&fahrenheit_mod, "rrMutexCreate"), (uintptr_t)&rrMutexCreate);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrMutexDestroy"), (uintptr_t)&rrMutexDestroy);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrMutexLock"), (uintptr_t)&rrMutexLock);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrMutexLockTimeout"), (uintptr_t)&rrMutexLockTimeout);
-	hook_addr(so_symbol(&fahrenheit_mod, "rrMutexUnlock"), (uintptr_t)&rrMutexUnlock);
+	SO_HOOK("rrMutexCreate", &rrMutexCreate),
+	SO_HOOK("rrMutexDestroy", &rrMutexDestroy),
+	SO_HOOK("rrMutexLock", &rrMutexLock),
+	SO_HOOK("rrMutexLockTimeout", &rrMutexLockTimeout),
+	SO_HOOK("rrMutexUnlock", &rrMutexUnlock),
 
-	hook_addr(so_symbol(&fahrenheit_mod, "_ZN3ASL5FsApi3Obb7initVfsEv"), (uintptr_t)&ret0);
-	display2d_hook = hook_addr(so_symbol(&fahrenheit_mod, "_ZN3QDT3M3D15DISPLAY_MANAGER9Display2DEv"), (uintptr_t)&Display2D);
+	SO_HOOK("_ZN3ASL5FsApi3Obb7initVfsEv", &ret0),
+	SO_HOOK_KEEP("_ZN3QDT3M3D15DISPLAY_MANAGER9Display2DEv", &Display2D, &display2d_hook),
+
+	SO_HOOK("_Z10GetHomeDirPc", &GetHomeDir),
+
+	SO_HOOK("_ZN3ASL5FsApi9lookupVfsERKNSt3__112basic_stringIcNS1_11char_traitsIcEENS1_9allocatorIcEEEE", &ASL__FsApi__lookupVfs),
+	SO_HOOK("_ZN3ASL5FsApi10lookupFileEP7__sFILE", &ASL__FsApi__lookupFile),
+};
 
-	hook_addr(so_symbol(&fahrenheit_mod, "_Z10GetHomeDirPc"), (uintptr_t)&GetHomeDir);
+void patch_game(so_hook_batch *batch) {
+	if (ps2_mode)
+		so_hook_batch_add(batch, ps2_hooks, SO_HOOK_COUNT(ps2_hooks));
+	so_hook_batch_add(batch, game_hooks, SO_HOOK_COUNT(game_hooks));
 
 	std__basic_string__init = (void *)so_symbol(&fahrenheit_mod, "_ZNSt3__112basic_stringIcNS_11char_traitsIcEENS_9allocatorIcEEE6__initEPKcj");
-	hook_addr(so_symbol(&fahrenheit_mod, "_ZN3ASL5FsApi9lookupVfsERKNSt3__112basic_stringIcNS1_11char_traitsIcEENS1_9allocatorIcEEEE"), (uintptr_t)&ASL__FsApi__lookupVfs);
-	hook_addr(so_symbol(&fahrenheit_mod, "_ZN3ASL5FsApi10lookupFileEP7__sFILE"), (uintptr_t)&ASL__FsApi__lookupFile);
 }
 
 extern void *__aeabi_atexit;
@@ -766,79 +806,85 @@ int ret99() {
 	return 99;
 }
 
-void glShaderSource_fake(GLuint shader, GLsizei count, const GLchar **string, const GLint *length) {
-	dlog("Shader with count %d\n", count);
-
+// Shaders cached before the keys changed are still named by their SHA-1, they are moved over on first use
+static FILE *open_legacy_gxp(const GLchar *src, size_t src_len, const char *gxp_path) {
 	uint32_t sha1[5];
 	SHA1_CTX ctx;
+	char legacy_path[128];
 
 	sha1_init(&ctx);
-	if (count > 1) {
-		sha1_update(&ctx, string[1], length ? length[1] : strlen(string[1]));
-	} else {
-		sha1_update(&ctx, string[0], length ? length[0] : strlen(string[0]));
+	sha1_update(&ctx, (const BYTE *)src, src_len);
+	sha1_final(&ctx, (BYTE *)sha1);
+
+	snprintf(legacy_path, sizeof(legacy_path), "%s/%08x%08x%08x%08x%08x.gxp", GXP_PATH, sha1[0], sha1[1], sha1[2], sha1[3], sha1[4]);
+	if (sceIoRename(legacy_path, gxp_path) < 0)
+		return NULL;
+
+	return fopen(gxp_path, "rb");
+}
+
+void glShaderSource_fake(GLuint shader, GLsizei count, const GLchar **string, const GLint *length) {
+	dlog("Shader with count %d\n", count);
+
+	shader_compile_poll();
+
+	uint32_t key[SHADER_KEY_WORDS];
+	char key_name[SHADER_KEY_CHARS + 1];
+
+	const GLchar *src = count > 1 ? string[1] : string[0];
+	size_t src_len = length ? length[count > 1 ? 1 : 0] : strlen(src);
+
+	SHADER_KEY.hash(src, src_len, key);
+	shader_key_name(key, key_name);
+
+#ifdef DUMP_SHADERS
+	// Samples for shaderperm, which learns the game's preludes from them
+	char dump_path[128];
+	snprintf(dump_path, sizeof(dump_path), "%s/%s.glsl", DATA_PATH "/glsl", key_name);
+	if (!file_exists(dump_path)) {
+		FILE *dump = fopen(dump_path, "wb");
+		if (dump) {
+			fwrite(src, 1, src_len, dump);
+			fclose(dump);
+		}
+	}
+#endif
+
+	GLuint cached = shader_cache_lookup(key);
+	if (cached) {
+		shader_cache_bind(shader, cached);
+		return;
+	}
+
+	size_t packed_size;
+	const void *packed = shader_pack_find(key, &packed_size);
+	if (packed) {
+		glShaderBinary(1, &shader, 0, packed, packed_size);
+		shader_cache_insert(key, shader, packed_size);
+		shader_cache_bind(shader, shader);
+		return;
 	}
-	sha1_final(&ctx, (uint8_t *)sha1);
 
-	char sha_name[64];
-	snprintf(sha_name, sizeof(sha_name), "%08x%08x%08x%08x%08x", sha1[0], sha1[1], sha1[2], sha1[3], sha1[4]);
-	char gxp_path[128], glsl_path[128];
-	snprintf(gxp_path, sizeof(gxp_path), "%s/%s.gxp", "ux0:data/fahrenheit/gxp", sha_name);
+	char gxp_path[128];
+	snprintf(gxp_path, sizeof(gxp_path), "%s/%s/%s.gxp", GXP_PATH, SHADER_KEY.name, key_name);
 
 	FILE *file = fopen(gxp_path, "rb");
+	if (!file)
+		file = open_legacy_gxp(src, src_len, gxp_path);
 	if (!file) {
-		char *tmp = string[1];
-		/*snprintf(glsl_path, sizeof(glsl_path), "%s/%s.glsl", "ux0:data/fahrenheit/glsl", sha_name);
-		file = fopen(glsl_path, "w");
-		fwrite(tmp, 1, strlen(tmp), file);
-		fclose(file);*/
-
-		//dlog("Auto translation attempt...\n");
-		char *tmp2 = vglMalloc(1 * 1024 * 1024);
-		//if (!tmp2)
-		//	dlog("OUT OF MEM (2)!!!!\n");
-		char *s = strstr(tmp, "#if defined GL_ES");
-		size_t shaderSize;
-		if (strstr(tmp, "u_modelViewProjectionMatrix")) { // Vertex shader
-			//dlog("Vertex shader detected\n");
-			sceClibMemcpy(tmp2, tmp, s - tmp);
-			char *p = tmp2 + (s - tmp);
-			sprintf(glsl_path, "ux0:data/fahrenheit/vert.cg");
-			file = fopen(glsl_path, "r");
-			fseek(file, 0, SEEK_END);
-			shaderSize = ftell(file);
-			fseek(file, 0, SEEK_SET);
-			fread(p, 1, shaderSize, file);
-			fclose(file);
-			p[shaderSize] = 0;
-		} else { // Fragment Shader
-			//dlog("Fragment shader detected\n");
-			sceClibMemcpy(tmp2, tmp, s - tmp);
-			char *p = tmp2 + (s - tmp);
-			sprintf(glsl_path, "ux0:data/fahrenheit/frag.cg");
-			file = fopen(glsl_path, "r");
-			fseek(file, 0, SEEK_END);
-			shaderSize = ftell(file);
-			fseek(file, 0, SEEK_SET);
-			fread(p, 1, shaderSize, file);
-			fclose(file);
-			p[shaderSize] = 0;
+		// Compiled on the worker, programs using it are linked once it is ready
+		if (shader_compile_submit(key, shader, src, src_len, gxp_path) == 0) {
+			shader_cache_insert(key, shader, 0);
+			shader_cache_bind(shader, shader);
+			return;
+		}
+
+		// Without the worker it is compiled here, and left uncached if that fails too
+		size_t size = shader_compile_now(shader, src, src_len, gxp_path);
+		if (size) {
+			shader_cache_insert(key, shader, size);
+			shader_cache_bind(shader, shader);
 		}
-		/*
-		sprintf(glsl_path, "ux0:data/fahrenheit/glsl/%s.cg", sha_name);
-		file = fopen(glsl_path, "w+");
-		fwrite(tmp2, 1, strlen(tmp2), file);
-		fclose(file);
-		*/
-		//dlog("Compiling resulting shader\n");
-		glShaderSource(shader, 1, &tmp2, NULL);
-		glCompileShader(shader);
-		vglGetShaderBinary(shader, 0x8000, &shaderSize, tmp2);
-		file = fopen(gxp_path, "w+");
-		fwrite(tmp2, 1, shaderSize, file);
-		fclose(file);
-		vglFree(tmp2);
-		//dlog("Auto translation completed!\n");
 	} else {
 		size_t shaderSize;
 		void *shaderBuf;
@@ -854,17 +900,62 @@ void glShaderSource_fake(GLuint shader, GLsizei count, const GLchar **string, co
 		glShaderBinary(1, &shader, 0, shaderBuf, shaderSize);
 
 		vglFree(shaderBuf);
+		shader_cache_insert(key, shader, shaderSize);
+		shader_cache_bind(shader, shader);
 	}
 }
 
+#ifdef SO_LAZY_BIND
+#define LAZY_REPORT_INTERVAL_US (60 * 1000 * 1000)
+
+// Imports are bound as the game first calls them, most never are
+static void report_lazy(void) {
+	so_lazy_report(&stdcpp_mod, "libc++_shared");
+	so_lazy_report(&iconv_mod, "libiconv");
+	so_lazy_report(&fahrenheit_mod, "libFahrenheit");
+}
+#endif
+
+void glLinkProgram_fake(GLuint prog) {
+	shader_compile_link(prog);
+}
+
+void glUseProgram_fake(GLuint prog) {
+	shader_compile_use(prog);
+}
+
+GLint glGetUniformLocation_fake(GLuint prog, const GLchar *name) {
+	return shader_compile_uniform_location(prog, name);
+}
+
+GLint glGetAttribLocation_fake(GLuint prog, const GLchar *name) {
+	return shader_compile_attrib_location(prog, name);
+}
+
+void glGetProgramiv_fake(GLuint prog, GLenum pname, GLint *params) {
+	shader_compile_program_iv(prog, pname, params);
+}
+
 void glDeleteProgram_fake(GLuint prog) {
+	shader_compile_forget(prog);
+
 	GLuint shaders[2];
 	GLsizei count;
 	glGetAttachedShaders(prog, 2, &count, shaders);
 	for (int i = 0; i < count; i++) {
-		glDeleteShader(shaders[i]);
+		if (!shader_cache_is_cached(shaders[i]))
+			glDeleteShader(shaders[i]);
 	}
 	glDeleteProgram(prog);
+	shader_cache_delete_program(prog);
+}
+
+void glAttachShader_fake(GLuint prog, GLuint shader) {
+	glAttachShader(prog, shader_cache_attach(prog, shader));
+}
+
+void glDeleteShader_fake(GLuint shader) {
+	shader_cache_delete_shader(shader);
 }
 
 void glScissor_fake(GLint x, GLint y, GLsizei width, GLsizei height) {
@@ -876,6 +967,15 @@ void glScissor_fake(GLint x, GLint y, GLsizei width, GLsizei height) {
 void SDL_GL_SwapWindow_fake(SDL_Window * window) {
 	SDL_GL_SwapWindow(window);
 	glScissor(0, 0, SCREEN_W, SCREEN_H);
+	shader_compile_poll();
+#ifdef SO_LAZY_BIND
+	static uint64_t last_report;
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (now - last_report >= LAZY_REPORT_INTERVAL_US) {
+		report_lazy();
+		last_report = now;
+	}
+#endif
 }
 
 void glDisable_fake(GLenum cap) {
@@ -889,21 +989,26 @@ static so_default_dynlib gl_hook[] = {
 	{"glCompileShader", (uintptr_t)&ret0},
 	{"glPixelStorei", (uintptr_t)&ret0},
 	{"glBlendColor", (uintptr_t)&ret0},
-	{"glDeleteShader", (uintptr_t)&ret0},
+	{"glAttachShader", (uintptr_t)&glAttachShader_fake},
+	{"glDeleteShader", (uintptr_t)&glDeleteShader_fake},
 	{"glDeleteProgram", (uintptr_t)&glDeleteProgram_fake},
+	{"glLinkProgram", (uintptr_t)&glLinkProgram_fake},
+	{"glUseProgram", (uintptr_t)&glUseProgram_fake},
+	{"glGetUniformLocation", (uintptr_t)&glGetUniformLocation_fake},
+	{"glGetAttribLocation", (uintptr_t)&glGetAttribLocation_fake},
+	{"glGetProgramiv", (uintptr_t)&glGetProgramiv_fake},
 	{"glReleaseShaderCompiler", (uintptr_t)&ret0},
 	{"glScissor", (uintptr_t)&glScissor_fake},
 	{"glDisable", (uintptr_t)&glDisable_fake},
 };
 static size_t gl_numhook = sizeof(gl_hook) / sizeof(*gl_hook);
+static so_dynlib_table gl_hook_table;
 
 void *SDL_GL_GetProcAddress_fake(const char *symbol) {
 	dlog("looking for symbol %s\n", symbol);
-	for (size_t i = 0; i < gl_numhook; ++i) {
-		if (!strcmp(symbol, gl_hook[i].symbol)) {
-			return (void *)gl_hook[i].func;
-		}
-	}
+	so_default_dynlib *hook = so_dynlib_find(&gl_hook_table, symbol);
+	if (hook)
+		return (void *)hook->func;
 	void *r = vglGetProcAddress(symbol);
 	if (!r) {
 		dlog("Cannot find symbol %s\n", symbol);
@@ -1431,15 +1536,14 @@ static so_default_dynlib default_dynlib[] = {
 	{ "raise", (uintptr_t)&raise },
 };
 static size_t numhooks = sizeof(default_dynlib) / sizeof(*default_dynlib);
+static so_dynlib_table default_dynlib_table;
 
 void *dlsym_hook( void *handle, const char *symbol) {
 	dlog("Searching for %s...\n", symbol);
 
-	for (size_t i = 0; i < numhooks; i++) {
-		if (!strcmp(symbol, default_dynlib[i].symbol)) {
-			return (void *)default_dynlib[i].func;
-		}
-	}
+	so_default_dynlib *hook = so_dynlib_find(&default_dynlib_table, symbol);
+	if (hook)
+		return (void *)hook->func;
 
 	dlog("Not Found!\n");
 	return NULL;
@@ -1678,6 +1782,26 @@ float CallStaticFloatMethodV(void *env, void *obj, int methodID, uintptr_t *args
 	}
 }
 
+// Snapshots are taken right after linking, before any hook or constructor runs
+static void load_module(so_module *mod, const char *path, const char *name, uintptr_t load_addr) {
+#ifdef SO_LAZY_BIND
+	int lazy = 1;
+#else
+	int lazy = 0;
+#endif
+#ifdef SO_SNAPSHOT
+	char snapshot_path[256];
+	snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s.bin", SO_SNAPSHOT_PATH, name);
+	if (so_snapshot_load(mod, path, snapshot_path, load_addr, &default_dynlib_table, lazy) < 0)
+		fatal_error("Error could not load %s.", path);
+#else
+	if (so_file_load(mod, path, load_addr) < 0)
+		fatal_error("Error could not load %s.", path);
+	if ((lazy ? so_link_lazy(mod, &default_dynlib_table, 0) : so_link(mod, &default_dynlib_table, 0)) < 0)
+		fatal_error("Error could not link %s.", path);
+#endif
+}
+
 int main(int argc, char *argv[]) {
 	SceAppUtilInitParam init_param;
 	SceAppUtilBootParam boot_param;
@@ -1705,42 +1829,83 @@ int main(int argc, char *argv[]) {
 	if (!file_exists("ur0:/data/libshacccg.suprx") && !file_exists("ur0:/data/external/libshacccg.suprx"))
 		fatal_error("Error libshacccg.suprx is not installed.");
 
+	if (so_dynlib_init(&default_dynlib_table, default_dynlib, numhooks) < 0 ||
+		so_dynlib_init(&gl_hook_table, gl_hook, gl_numhook) < 0)
+		fatal_error("Error could not index the imports.");
+
+	so_set_platform(&vita_platform);
+#ifdef SO_SNAPSHOT
+	sceIoMkdir(SO_SNAPSHOT_PATH, 0777);
+#endif
+
 	printf("Loading libc++_shared\n");
-	if (so_file_load(&stdcpp_mod, DATA_PATH "/libc++_shared.so", LOAD_ADDRESS) < 0)
-		fatal_error("Error could not load %s.", DATA_PATH "/libc++_shared.so");
-	so_relocate(&stdcpp_mod);
-	so_resolve(&stdcpp_mod, default_dynlib, sizeof(default_dynlib), 0);
+	load_module(&stdcpp_mod, DATA_PATH "/libc++_shared.so", "libc++_shared", LOAD_ADDRESS);
 
 	so_flush_caches(&stdcpp_mod);
 	so_initialize(&stdcpp_mod);
 
 	printf("Loading iconv\n");
-	if (so_file_load(&iconv_mod, DATA_PATH "/libiconv.so", LOAD_ADDRESS + 0x1000000) < 0)
-		fatal_error("Error could not load %s.", DATA_PATH "/libiconv.so");
-	so_relocate(&iconv_mod);
-	so_resolve(&iconv_mod, default_dynlib, sizeof(default_dynlib), 0);
+	load_module(&iconv_mod, DATA_PATH "/libiconv.so", "libiconv", LOAD_ADDRESS + 0x1000000);
 	so_flush_caches(&iconv_mod);
 	so_initialize(&iconv_mod);
 
 	printf("Loading libFahrenheit\n");
-	if (so_file_load(&fahrenheit_mod, SO_PATH, LOAD_ADDRESS + 0x2000000) < 0)
-		fatal_error("Error could not load %s.", SO_PATH);
-	so_relocate(&fahrenheit_mod);
-	so_resolve(&fahrenheit_mod, default_dynlib, sizeof(default_dynlib), 0);
-
-	patch_game();
-	patch_ogg();
-	patch_vorbis();
-	so_flush_caches(&fahrenheit_mod);
+	load_module(&fahrenheit_mod, SO_PATH, "libFahrenheit", LOAD_ADDRESS + 0x2000000);
+
+#ifdef SO_FIX_UNALIGNED
+	so_unaligned_stats unaligned;
+	so_fix_unaligned(&fahrenheit_mod, unaligned_allowlist, sizeof(unaligned_allowlist) / sizeof(*unaligned_allowlist), &unaligned);
+	so_unaligned_report("libFahrenheit", &unaligned);
+#endif
+
+	so_hook_batch hooks;
+	so_hook_batch_init(&hooks, &fahrenheit_mod);
+	patch_game(&hooks);
+	patch_ogg(&hooks);
+	patch_vorbis(&hooks);
+#ifdef SO_PROFILE
+	so_profile_add(&hooks, profile_patterns, sizeof(profile_patterns) / sizeof(*profile_patterns));
+#endif
+	so_hook_batch_commit(&hooks);
+#ifdef SO_PROFILE
+	so_profile_start(SO_PROFILE_PATH);
+#endif
+	so_arena_report(&fahrenheit_mod, "libFahrenheit");
 	so_initialize(&fahrenheit_mod);
+#ifdef SO_LAZY_BIND
+	report_lazy();
+	atexit(report_lazy);
+#endif
+
+	if (asset_io == &fios_backend) {
+		int r = fios_init();
+		if (r < 0)
+			fatal_error("Error could not initialize fios. (0x%08X)", r);
+	}
 
-	int r = fios_init();
-	if (r < 0)
-		fatal_error("Error could not initialize fios. (0x%08X)", r);
+	prefetch_init(asset_io, PREFETCH_PATH);
+
+	char gxp_dir[128];
+	snprintf(gxp_dir, sizeof(gxp_dir), "%s/%s", GXP_PATH, SHADER_KEY.name);
+	sceIoMkdir(GXP_PATH, 0777);
+	sceIoMkdir(gxp_dir, 0777);
+
+	int shaders = shader_pack_load(GXP_PACK_PATH, SHADER_KEY.id);
+	dlog("Loaded %d shaders from %s\n", shaders, GXP_PACK_PATH);
+
+#ifdef IO_TRACE
+	io_trace_init();
+#endif
 
 	vglInitWithCustomThreshold(0, SCREEN_W, SCREEN_H, MEMORY_VITAGL_THRESHOLD_MB * 1024 * 1024, 0, 0, 0, SCE_GXM_MULTISAMPLE_4X);
 	//vglInitExtended(0, SCREEN_W, SCREEN_H, MEMORY_VITAGL_THRESHOLD_MB * 1024 * 1024, SCE_GXM_MULTISAMPLE_4X); // Debug (Has common dialog usable)
 
+	int precompiled = shader_precompile(SHADER_PRECOMPILE_PATH, gxp_dir);
+	dlog("Precompiled %d shaders\n", precompiled);
+
+	if (shader_compile_init(DATA_PATH "/vert.cg", DATA_PATH "/frag.cg") < 0)
+		debugPrintf("Could not start the shader compiler, missing shaders will be compiled in place\n");
+
 	memset(fake_vm, 'A', sizeof(fake_vm));
 	*(uintptr_t *)(fake_vm + 0x00) = (uintptr_t)fake_vm; // just point to itself...
 	*(uintptr_t *)(fake_vm + 0x10) = (uintptr_t)ret0;
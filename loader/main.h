@@ -9,6 +9,8 @@ extern so_module fahrenheit_mod;
 
 int debugPrintf(char *text, ...);
 
+int file_exists(const char *path);
+
 int ret0();
 
 int sceKernelChangeThreadCpuAffinityMask(SceUID thid, int cpuAffinityMask);
@@ -0,0 +1,170 @@
+/* obb_file.c -- buffered reader behind the Obb File vtable
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "obb_file.h"
+
+obb_file *obb_file_new(void *vtable, const io_backend *io, int32_t fh) {
+	// The game sees a failed lookup, nothing would ever close the handle
+	obb_file *file = malloc(sizeof(obb_file));
+	if (!file) {
+		prefetch_entry *pf = prefetch_take(fh);
+		if (pf)
+			prefetch_release(pf);
+		io->close(fh);
+		return NULL;
+	}
+
+	file->vtable = (uintptr_t)vtable;
+	file->fh = fh;
+	file->io = io;
+	file->pos = 0;
+	file->buf_off = 0;
+	file->buf_len = 0;
+	file->pushback = -1;
+	file->pf = prefetch_take(fh);
+	return file;
+}
+
+void obb_file_close(obb_file *file) {
+	if (file->pf)
+		prefetch_release(file->pf);
+	file->io->close(file->fh);
+	file->vtable = 0xdeadbeef;
+	file->fh = 0xdeadbeef;
+	free(file);
+}
+
+static int64_t obb_file_pread(obb_file *file, void *buf, int64_t len, int64_t off) {
+	if (file->pf) {
+		if (off >= file->pf->size)
+			return 0;
+		if (len > file->pf->size - off)
+			len = file->pf->size - off;
+		memcpy(buf, file->pf->data + off, len);
+		return len;
+	}
+
+	return file->io->pread(file->fh, buf, len, off);
+}
+
+// Refill the buffer at the current position, returns the number of bytes available
+static int obb_file_fill(obb_file *file) {
+	int64_t res = obb_file_pread(file, file->buf, sizeof(file->buf), file->pos);
+	file->buf_off = file->pos;
+	file->buf_len = res > 0 ? (int32_t)res : 0;
+	return file->buf_len;
+}
+
+int obb_file_getc(obb_file *file) {
+	int ch = file->pushback;
+	if (ch >= 0) {
+		file->pushback = -1;
+		return ch;
+	}
+
+	int64_t i = file->pos - file->buf_off;
+	if (i < 0 || i >= file->buf_len) {
+		if (obb_file_fill(file) == 0)
+			return EOF;
+		i = 0;
+	}
+
+	file->pos++;
+	return file->buf[i];
+}
+
+int obb_file_ungetc(obb_file *file, int ch) {
+	if (ch == EOF || file->pushback >= 0)
+		return EOF;
+
+	// Stepping back inside the buffer keeps the fast path of getc
+	int64_t i = file->pos - file->buf_off;
+	if (i > 0 && i <= file->buf_len && file->buf[i - 1] == (uint8_t)ch) {
+		file->pos--;
+		return (uint8_t)ch;
+	}
+
+	file->pushback = (uint8_t)ch;
+	return (uint8_t)ch;
+}
+
+size_t obb_file_read(obb_file *file, void *ptr, size_t len) {
+	uint8_t *dst = (uint8_t *)ptr;
+	size_t done = 0;
+
+	if (len > 0 && file->pushback >= 0) {
+		dst[done++] = file->pushback;
+		file->pushback = -1;
+	}
+
+	while (done < len) {
+		int64_t i = file->pos - file->buf_off;
+
+		if (i >= 0 && i < file->buf_len) {
+			size_t n = file->buf_len - i;
+			if (n > len - done)
+				n = len - done;
+			memcpy(dst + done, file->buf + i, n);
+			file->pos += n;
+			done += n;
+			continue;
+		}
+
+		// Large reads bypass the buffer entirely
+		if (len - done >= sizeof(file->buf)) {
+			int64_t res = obb_file_pread(file, dst + done, len - done, file->pos);
+			if (res <= 0)
+				break;
+			file->pos += res;
+			done += res;
+			continue;
+		}
+
+		if (obb_file_fill(file) == 0)
+			break;
+	}
+
+	return done;
+}
+
+int obb_file_seek(obb_file *file, int64_t offset, int origin) {
+	int64_t target;
+
+	switch (origin) {
+	case SEEK_SET:
+		target = offset;
+		break;
+	case SEEK_CUR:
+		target = obb_file_tell(file) + offset;
+		break;
+	case SEEK_END:
+		target = file->pf ? file->pf->size : file->io->size(file->fh);
+		if (target < 0)
+			return -1;
+		target += offset;
+		break;
+	default:
+		return -1;
+	}
+
+	if (target < 0)
+		return -1;
+
+	// The buffer is kept, seeking back within it costs nothing
+	file->pushback = -1;
+	file->pos = target;
+	return 0;
+}
+
+int64_t obb_file_tell(obb_file *file) {
+	return file->pushback >= 0 ? file->pos - 1 : file->pos;
+}
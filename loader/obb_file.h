@@ -0,0 +1,35 @@
+#ifndef __OBB_FILE_H__
+#define __OBB_FILE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "io_backend.h"
+#include "prefetch.h"
+
+#define OBB_FILE_BUF_SIZE (16 * 1024)
+
+// Layout must start with the vtable, the game only ever dispatches through it
+typedef struct {
+	uintptr_t vtable;
+	int32_t fh;
+	const io_backend *io;
+	int64_t pos;      // position of the next byte in the file, ignoring pushback
+	int64_t buf_off;  // file offset of buf[0]
+	int32_t buf_len;
+	int32_t pushback; // character given back by ungetc, or -1
+	prefetch_entry *pf; // whole file already in memory, or NULL
+	uint8_t buf[OBB_FILE_BUF_SIZE];
+} obb_file;
+
+// Takes over fh and its prefetch binding, both closed if it returns NULL
+obb_file *obb_file_new(void *vtable, const io_backend *io, int32_t fh);
+void obb_file_close(obb_file *file);
+
+int obb_file_getc(obb_file *file);
+int obb_file_ungetc(obb_file *file, int ch);
+size_t obb_file_read(obb_file *file, void *ptr, size_t len);
+int obb_file_seek(obb_file *file, int64_t offset, int origin);
+int64_t obb_file_tell(obb_file *file);
+
+#endif
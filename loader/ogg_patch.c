@@ -12,53 +12,58 @@
 
 #include "main.h"
 #include "so_util.h"
+#include "so_hook_table.h"
 
-void patch_ogg(void) {
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_writetrunc"), (uintptr_t)oggpack_writetrunc);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_writeinit"), (uintptr_t)oggpack_writeinit);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_writecopy"), (uintptr_t)oggpack_writecopy);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_writeclear"), (uintptr_t)oggpack_writeclear);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_writealign"), (uintptr_t)oggpack_writealign);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_write"), (uintptr_t)oggpack_write);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_reset"), (uintptr_t)oggpack_reset);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_readinit"), (uintptr_t)oggpack_readinit);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_read1"), (uintptr_t)oggpack_read1);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_read"), (uintptr_t)oggpack_read);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_look1"), (uintptr_t)oggpack_look1);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_look"), (uintptr_t)oggpack_look);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_get_buffer"), (uintptr_t)oggpack_get_buffer);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_bytes"), (uintptr_t)oggpack_bytes);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_bits"), (uintptr_t)oggpack_bits);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_adv1"), (uintptr_t)oggpack_adv1);
-	hook_addr(so_symbol(&fahrenheit_mod, "oggpack_adv"), (uintptr_t)oggpack_adv);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_wrote"), (uintptr_t)ogg_sync_wrote);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_reset"), (uintptr_t)ogg_sync_reset);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_pageseek"), (uintptr_t)ogg_sync_pageseek);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_pageout"), (uintptr_t)ogg_sync_pageout);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_init"), (uintptr_t)ogg_sync_init);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_destroy"), (uintptr_t)ogg_sync_destroy);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_clear"), (uintptr_t)ogg_sync_clear);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_sync_buffer"), (uintptr_t)ogg_sync_buffer);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_reset_serialno"), (uintptr_t)ogg_stream_reset_serialno);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_reset"), (uintptr_t)ogg_stream_reset);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_pageout"), (uintptr_t)ogg_stream_pageout);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_pagein"), (uintptr_t)ogg_stream_pagein);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_packetpeek"), (uintptr_t)ogg_stream_packetpeek);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_packetout"), (uintptr_t)ogg_stream_packetout);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_packetin"), (uintptr_t)ogg_stream_packetin);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_init"), (uintptr_t)ogg_stream_init);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_flush"), (uintptr_t)ogg_stream_flush);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_eos"), (uintptr_t)ogg_stream_eos);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_destroy"), (uintptr_t)ogg_stream_destroy);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_stream_clear"), (uintptr_t)ogg_stream_clear);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_version"), (uintptr_t)ogg_page_version);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_serialno"), (uintptr_t)ogg_page_serialno);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_pageno"), (uintptr_t)ogg_page_pageno);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_packets"), (uintptr_t)ogg_page_packets);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_granulepos"), (uintptr_t)ogg_page_granulepos);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_eos"), (uintptr_t)ogg_page_eos);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_continued"), (uintptr_t)ogg_page_continued);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_checksum_set"), (uintptr_t)ogg_page_checksum_set);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_page_bos"), (uintptr_t)ogg_page_bos);
-	hook_addr(so_symbol(&fahrenheit_mod, "ogg_packet_clear"), (uintptr_t)ogg_packet_clear);
+static const so_hook_def ogg_hooks[] = {
+	SO_HOOK("oggpack_writetrunc", oggpack_writetrunc),
+	SO_HOOK("oggpack_writeinit", oggpack_writeinit),
+	SO_HOOK("oggpack_writecopy", oggpack_writecopy),
+	SO_HOOK("oggpack_writeclear", oggpack_writeclear),
+	SO_HOOK("oggpack_writealign", oggpack_writealign),
+	SO_HOOK("oggpack_write", oggpack_write),
+	SO_HOOK("oggpack_reset", oggpack_reset),
+	SO_HOOK("oggpack_readinit", oggpack_readinit),
+	SO_HOOK("oggpack_read1", oggpack_read1),
+	SO_HOOK("oggpack_read", oggpack_read),
+	SO_HOOK("oggpack_look1", oggpack_look1),
+	SO_HOOK("oggpack_look", oggpack_look),
+	SO_HOOK("oggpack_get_buffer", oggpack_get_buffer),
+	SO_HOOK("oggpack_bytes", oggpack_bytes),
+	SO_HOOK("oggpack_bits", oggpack_bits),
+	SO_HOOK("oggpack_adv1", oggpack_adv1),
+	SO_HOOK("oggpack_adv", oggpack_adv),
+	SO_HOOK("ogg_sync_wrote", ogg_sync_wrote),
+	SO_HOOK("ogg_sync_reset", ogg_sync_reset),
+	SO_HOOK("ogg_sync_pageseek", ogg_sync_pageseek),
+	SO_HOOK("ogg_sync_pageout", ogg_sync_pageout),
+	SO_HOOK("ogg_sync_init", ogg_sync_init),
+	SO_HOOK("ogg_sync_destroy", ogg_sync_destroy),
+	SO_HOOK("ogg_sync_clear", ogg_sync_clear),
+	SO_HOOK("ogg_sync_buffer", ogg_sync_buffer),
+	SO_HOOK("ogg_stream_reset_serialno", ogg_stream_reset_serialno),
+	SO_HOOK("ogg_stream_reset", ogg_stream_reset),
+	SO_HOOK("ogg_stream_pageout", ogg_stream_pageout),
+	SO_HOOK("ogg_stream_pagein", ogg_stream_pagein),
+	SO_HOOK("ogg_stream_packetpeek", ogg_stream_packetpeek),
+	SO_HOOK("ogg_stream_packetout", ogg_stream_packetout),
+	SO_HOOK("ogg_stream_packetin", ogg_stream_packetin),
+	SO_HOOK("ogg_stream_init", ogg_stream_init),
+	SO_HOOK("ogg_stream_flush", ogg_stream_flush),
+	SO_HOOK("ogg_stream_eos", ogg_stream_eos),
+	SO_HOOK("ogg_stream_destroy", ogg_stream_destroy),
+	SO_HOOK("ogg_stream_clear", ogg_stream_clear),
+	SO_HOOK("ogg_page_version", ogg_page_version),
+	SO_HOOK("ogg_page_serialno", ogg_page_serialno),
+	SO_HOOK("ogg_page_pageno", ogg_page_pageno),
+	SO_HOOK("ogg_page_packets", ogg_page_packets),
+	SO_HOOK("ogg_page_granulepos", ogg_page_granulepos),
+	SO_HOOK("ogg_page_eos", ogg_page_eos),
+	SO_HOOK("ogg_page_continued", ogg_page_continued),
+	SO_HOOK("ogg_page_checksum_set", ogg_page_checksum_set),
+	SO_HOOK("ogg_page_bos", ogg_page_bos),
+	SO_HOOK("ogg_packet_clear", ogg_packet_clear),
+};
+
+void patch_ogg(so_hook_batch *batch) {
+	so_hook_batch_add(batch, ogg_hooks, SO_HOOK_COUNT(ogg_hooks));
 }
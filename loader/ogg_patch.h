@@ -1,6 +1,8 @@
 #ifndef __OGG_PATCH_H__
 #define __OGG_PATCH_H__
 
-void patch_ogg(void);
+#include "so_hook_table.h"
+
+void patch_ogg(so_hook_batch *batch);
 
 #endif
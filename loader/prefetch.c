@@ -0,0 +1,374 @@
+/* prefetch.c -- read the next assets of a scene ahead of the game
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "prefetch.h"
+
+/*
+ * The manifest lists asset paths in the order the game first opens them,
+ * one per line, as written by `iotrace -o`. Whenever the game opens an
+ * asset from the manifest, the PREFETCH_AHEAD assets that follow it are
+ * read in the background into a pool of at most PREFETCH_POOL_MB. Opening
+ * one of those later serves every read from memory.
+ */
+
+#define QUEUE_SIZE 64
+#define MAX_BINDINGS 64
+
+static const io_backend *g_Backend;
+
+static prefetch_entry *g_Entries;
+static int g_NumEntries;
+static int *g_Sorted; // entry indices sorted by hash
+static char *g_Paths;
+
+static pthread_mutex_t g_Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_Queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_Loaded = PTHREAD_COND_INITIALIZER;
+
+static int g_Queue[QUEUE_SIZE];
+static unsigned int g_QueueHead;
+static unsigned int g_QueueTail;
+
+static int64_t g_PoolUsed;
+static int64_t g_PoolPeak;
+static int g_NumLoaded;
+static int g_NumEvicted;
+static uint32_t g_Clock;
+
+static struct {
+	int32_t fh;
+	prefetch_entry *e;
+} g_Bindings[MAX_BINDINGS];
+
+static uint32_t path_hash(const char *s) {
+	uint32_t h = 0x811c9dc5;
+	while (*s) {
+		h ^= (uint8_t)*s++;
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+static int cmp_hash(const void *a, const void *b) {
+	uint32_t ha = g_Entries[*(const int *)a].hash;
+	uint32_t hb = g_Entries[*(const int *)b].hash;
+	return ha < hb ? -1 : ha > hb;
+}
+
+static int find_entry(const char *path) {
+	uint32_t h = path_hash(path);
+	int lo = 0, hi = g_NumEntries;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (g_Entries[g_Sorted[mid]].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < g_NumEntries && g_Entries[g_Sorted[lo]].hash == h; lo++) {
+		if (strcmp(g_Entries[g_Sorted[lo]].path, path) == 0)
+			return g_Sorted[lo];
+	}
+
+	return -1;
+}
+
+// Drop idle data until size more bytes fit, lock held. Data the game read
+// already goes first, least recently used first, so that files read ahead are
+// not dropped before the game gets to them.
+static int make_room(int64_t size) {
+	while (g_PoolUsed + size > (int64_t)PREFETCH_POOL_MB * 1024 * 1024) {
+		prefetch_entry *victim = NULL;
+
+		for (int i = 0; i < g_NumEntries; i++) {
+			prefetch_entry *e = &g_Entries[i];
+			if (e->state != PREFETCH_READY || e->refs != 0)
+				continue;
+			if (!victim || e->opened > victim->opened ||
+				(e->opened == victim->opened && (int32_t)(e->last_use - victim->last_use) < 0))
+				victim = e;
+		}
+
+		if (!victim)
+			return -1;
+
+		free(victim->data);
+		victim->data = NULL;
+		victim->state = PREFETCH_IDLE;
+		g_PoolUsed -= victim->size;
+		g_NumEvicted++;
+	}
+
+	return 0;
+}
+
+static void load_entry(prefetch_entry *e) {
+	uint8_t *data = NULL;
+	int64_t size = -1;
+	int32_t fh;
+
+	if (g_Backend->open(e->path, &fh) >= 0) {
+		size = g_Backend->size(fh);
+
+		pthread_mutex_lock(&g_Lock);
+		if (size < 0 || size > PREFETCH_MAX_FILE_MB * 1024 * 1024 || make_room(size) < 0)
+			size = -1;
+		else
+			g_PoolUsed += size;
+		if (g_PoolUsed > g_PoolPeak)
+			g_PoolPeak = g_PoolUsed;
+		pthread_mutex_unlock(&g_Lock);
+
+		if (size >= 0) {
+			data = malloc(size ? size : 1);
+			int64_t done = 0;
+			while (data && done < size) {
+				int64_t res = g_Backend->pread(fh, data + done, size - done, done);
+				if (res <= 0)
+					break;
+				done += res;
+			}
+
+			if (!data || done != size) {
+				free(data);
+				data = NULL;
+			}
+		}
+
+		g_Backend->close(fh);
+	}
+
+	pthread_mutex_lock(&g_Lock);
+	if (data) {
+		e->data = data;
+		e->size = size;
+		e->last_use = ++g_Clock;
+		e->opened = 0;
+		e->state = PREFETCH_READY;
+		g_NumLoaded++;
+	} else {
+		if (size >= 0)
+			g_PoolUsed -= size;
+		e->state = PREFETCH_IDLE;
+	}
+	pthread_cond_broadcast(&g_Loaded);
+	pthread_mutex_unlock(&g_Lock);
+}
+
+static void *prefetch_thread(void *arg) {
+	(void)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&g_Lock);
+		while (g_QueueHead == g_QueueTail)
+			pthread_cond_wait(&g_Queued, &g_Lock);
+
+		prefetch_entry *e = &g_Entries[g_Queue[g_QueueTail++ % QUEUE_SIZE]];
+
+		// The game may have opened it by itself in the meantime
+		if (e->state != PREFETCH_QUEUED) {
+			pthread_mutex_unlock(&g_Lock);
+			continue;
+		}
+
+		e->state = PREFETCH_LOADING;
+		pthread_mutex_unlock(&g_Lock);
+
+		load_entry(e);
+	}
+
+	return NULL;
+}
+
+// Queue the assets that followed this one when the manifest was recorded, lock held
+static void schedule_ahead(int index) {
+	int last = index + PREFETCH_AHEAD;
+	if (last >= g_NumEntries)
+		last = g_NumEntries - 1;
+
+	for (int i = index + 1; i <= last; i++) {
+		prefetch_entry *e = &g_Entries[i];
+		if (e->state != PREFETCH_IDLE)
+			continue;
+		if (g_QueueHead - g_QueueTail == QUEUE_SIZE)
+			break;
+		e->state = PREFETCH_QUEUED;
+		g_Queue[g_QueueHead++ % QUEUE_SIZE] = i;
+	}
+
+	pthread_cond_signal(&g_Queued);
+}
+
+prefetch_entry *prefetch_open(const char *path) {
+	prefetch_entry *e = NULL;
+
+	if (g_NumEntries == 0)
+		return NULL;
+
+	int index = find_entry(path);
+	if (index < 0)
+		return NULL;
+
+	pthread_mutex_lock(&g_Lock);
+
+	schedule_ahead(index);
+
+	e = &g_Entries[index];
+
+	// Still waiting in the queue, a direct read is faster than waiting for it
+	if (e->state == PREFETCH_QUEUED)
+		e->state = PREFETCH_IDLE;
+
+	while (e->state == PREFETCH_LOADING)
+		pthread_cond_wait(&g_Loaded, &g_Lock);
+
+	if (e->state == PREFETCH_READY) {
+		e->refs++;
+		e->opened = 1;
+		e->last_use = ++g_Clock;
+	} else {
+		e = NULL;
+	}
+
+	pthread_mutex_unlock(&g_Lock);
+
+	return e;
+}
+
+void prefetch_release(prefetch_entry *e) {
+	pthread_mutex_lock(&g_Lock);
+	e->refs--;
+	pthread_mutex_unlock(&g_Lock);
+}
+
+// A handle number is only handed out again once it was closed, so whatever
+// is still bound to it belongs to a file the game never looked up
+void prefetch_bind(int32_t fh, prefetch_entry *e) {
+	prefetch_entry *stale = NULL;
+
+	pthread_mutex_lock(&g_Lock);
+	for (int i = 0; i < MAX_BINDINGS; i++) {
+		if (g_Bindings[i].e && g_Bindings[i].fh == fh) {
+			stale = g_Bindings[i].e;
+			g_Bindings[i].e = NULL;
+			break;
+		}
+	}
+	for (int i = 0; i < MAX_BINDINGS && e; i++) {
+		if (!g_Bindings[i].e) {
+			g_Bindings[i].fh = fh;
+			g_Bindings[i].e = e;
+			e = NULL;
+		}
+	}
+	pthread_mutex_unlock(&g_Lock);
+
+	if (stale)
+		prefetch_release(stale);
+
+	// No free slot, the file is simply read from storage
+	if (e)
+		prefetch_release(e);
+}
+
+prefetch_entry *prefetch_take(int32_t fh) {
+	prefetch_entry *e = NULL;
+
+	pthread_mutex_lock(&g_Lock);
+	for (int i = 0; i < MAX_BINDINGS; i++) {
+		if (g_Bindings[i].e && g_Bindings[i].fh == fh) {
+			e = g_Bindings[i].e;
+			g_Bindings[i].e = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_Lock);
+
+	return e;
+}
+
+void prefetch_get_stats(prefetch_stats *stats) {
+	pthread_mutex_lock(&g_Lock);
+	stats->pool_used = g_PoolUsed;
+	stats->pool_peak = g_PoolPeak;
+	stats->loaded = g_NumLoaded;
+	stats->evicted = g_NumEvicted;
+	pthread_mutex_unlock(&g_Lock);
+}
+
+int prefetch_init(const io_backend *backend, const char *manifest) {
+	FILE *f;
+	long len;
+	char *p;
+	int n = 0;
+
+	g_Backend = backend;
+
+	f = fopen(manifest, "rb");
+	if (!f)
+		return -1;
+
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (len < 0) {
+		fclose(f);
+		return -1;
+	}
+
+	g_Paths = malloc(len + 1);
+	if (!g_Paths || fread(g_Paths, 1, len, f) != (size_t)len) {
+		fclose(f);
+		free(g_Paths);
+		g_Paths = NULL;
+		return -1;
+	}
+	g_Paths[len] = '\0';
+	fclose(f);
+
+	for (p = g_Paths; *p; p++) {
+		if (*p == '\n')
+			n++;
+	}
+
+	g_Entries = calloc(n + 1, sizeof(prefetch_entry));
+	g_Sorted = malloc((n + 1) * sizeof(int));
+	if (!g_Entries || !g_Sorted)
+		return -1;
+
+	for (p = strtok(g_Paths, "\r\n"); p; p = strtok(NULL, "\r\n")) {
+		if (*p == '#' || *p == '\0')
+			continue;
+		g_Entries[g_NumEntries].path = p;
+		g_Entries[g_NumEntries].hash = path_hash(p);
+		g_Sorted[g_NumEntries] = g_NumEntries;
+		g_NumEntries++;
+	}
+
+	qsort(g_Sorted, g_NumEntries, sizeof(int), cmp_hash);
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 32 * 1024);
+	if (pthread_create(&t, &attr, prefetch_thread, NULL) != 0) {
+		g_NumEntries = 0;
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+
+	return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef __PREFETCH_H__
+#define __PREFETCH_H__
+
+#include <stdint.h>
+
+#include "io_backend.h"
+
+enum {
+	PREFETCH_IDLE,
+	PREFETCH_QUEUED,
+	PREFETCH_LOADING,
+	PREFETCH_READY,
+};
+
+typedef struct {
+	const char *path;
+	uint32_t hash;
+	int state;
+	int refs;
+	int opened; // by the game, since it was loaded
+	uint32_t last_use;
+	uint8_t *data;
+	int64_t size;
+} prefetch_entry;
+
+typedef struct {
+	int64_t pool_used;
+	int64_t pool_peak;
+	int loaded;
+	int evicted;
+} prefetch_stats;
+
+int prefetch_init(const io_backend *backend, const char *manifest);
+void prefetch_get_stats(prefetch_stats *stats);
+
+prefetch_entry *prefetch_open(const char *path);
+void prefetch_release(prefetch_entry *e);
+
+// Binds e, or nothing if it is NULL, to a newly opened fh until prefetch_take
+void prefetch_bind(int32_t fh, prefetch_entry *e);
+prefetch_entry *prefetch_take(int32_t fh);
+
+#endif
@@ -7,6 +7,11 @@
               Algorithm specification can be found here:
                * http://csrc.nist.gov/publications/fips/fips180-2/fips180-2withchangenotice.pdf
               This implementation uses little endian byte order.
+              Message words are loaded whole and byte swapped, the
+              80 rounds are unrolled, and where GCC vector extensions
+              map to NEON (or SSE2 on a host) the message schedule is
+              computed four words at a time. Define SHA1_NO_VECTOR to
+              force the scalar schedule.
 *********************************************************************/
 
 /*************************** HEADER FILES ***************************/
@@ -15,19 +20,107 @@
 #include "sha1.h"
 
 /****************************** MACROS ******************************/
-#define ROTLEFT(a, b) ((a << b) | (a >> (32 - b)))
+#define ROTLEFT(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+#if defined(__GNUC__) && !defined(SHA1_NO_VECTOR) && (defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__SSE2__))
+#define SHA1_VECTOR
+#endif
+
+#define K(i) ((i) < 20 ? 0x5a827999 : (i) < 40 ? 0x6ed9eba1 : (i) < 60 ? 0x8f1bbcdc : 0xca62c1d6)
+
+#define F0(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F1(b, c, d) ((b) ^ (c) ^ (d))
+#define F2(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+#define F(i, b, c, d) ((i) < 20 ? F0(b, c, d) : (i) < 40 || (i) >= 60 ? F1(b, c, d) : F2(b, c, d))
+
+#ifdef SHA1_VECTOR
+#define WK(i) wk[i]
+#else
+// Only the last 16 words of the schedule are ever live
+#define SCHED(i) (m[(i) & 15] = ROTLEFT(m[((i) - 3) & 15] ^ m[((i) - 8) & 15] ^ m[((i) - 14) & 15] ^ m[(i) & 15], 1))
+#define WK(i) (K(i) + ((i) < 16 ? m[(i) & 15] : SCHED(i)))
+#endif
+
+// The variables rotate through the argument list instead of being shuffled every round
+#define R(i, a, b, c, d, e) do { e += ROTLEFT(a, 5) + F(i, b, c, d) + WK(i); b = ROTLEFT(b, 30); } while (0)
+#define R5(i) \
+	R(i, a, b, c, d, e); \
+	R(i + 1, e, a, b, c, d); \
+	R(i + 2, d, e, a, b, c); \
+	R(i + 3, c, d, e, a, b); \
+	R(i + 4, b, c, d, e, a)
 
 /*********************** FUNCTION DEFINITIONS ***********************/
-void sha1_transform(SHA1_CTX *ctx, const BYTE data[])
+static inline WORD load_be32(const BYTE *p)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	WORD w;
+	memcpy(&w, p, 4);
+	return __builtin_bswap32(w);
+#else
+	return ((WORD)p[0] << 24) | ((WORD)p[1] << 16) | ((WORD)p[2] << 8) | p[3];
+#endif
+}
+
+#ifdef SHA1_VECTOR
+typedef WORD WORD4 __attribute__((vector_size(16)));
+
+static inline void store4(WORD *p, WORD4 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+#define ROTLEFT4(v, b) (((v) << (b)) | ((v) >> (32 - (b))))
+
+// Fills wk with the whole schedule, round constants already added
+static void sha1_schedule(WORD wk[80], const BYTE data[])
 {
-	WORD a, b, c, d, e, i, j, t, m[80];
+	const WORD4 zero = { 0, 0, 0, 0 };
+	WORD4 w0, w1, w2, w3, t;
+	int i;
+
+	// w0..w3 hold the last 16 words, oldest first
+	w0 = (WORD4){ load_be32(data), load_be32(data + 4), load_be32(data + 8), load_be32(data + 12) };
+	w1 = (WORD4){ load_be32(data + 16), load_be32(data + 20), load_be32(data + 24), load_be32(data + 28) };
+	w2 = (WORD4){ load_be32(data + 32), load_be32(data + 36), load_be32(data + 40), load_be32(data + 44) };
+	w3 = (WORD4){ load_be32(data + 48), load_be32(data + 52), load_be32(data + 56), load_be32(data + 60) };
+
+	store4(&wk[0], w0 + K(0));
+	store4(&wk[4], w1 + K(4));
+	store4(&wk[8], w2 + K(8));
+	store4(&wk[12], w3 + K(12));
 
-	for (i = 0, j = 0; i < 16; ++i, j += 4)
-		m[i] = (data[j] << 24) + (data[j + 1] << 16) + (data[j + 2] << 8) + (data[j + 3]);
-	for ( ; i < 80; ++i) {
-		m[i] = (m[i - 3] ^ m[i - 8] ^ m[i - 14] ^ m[i - 16]);
-		m[i] = (m[i] << 1) | (m[i] >> 31);
+	for (i = 16; i < 80; i += 4) {
+		// m[i - 3] ^ m[i - 8] ^ m[i - 14] ^ m[i - 16], with m[i] itself still unknown in lane 3
+		t = __builtin_shuffle(w3, zero, (WORD4){ 1, 2, 3, 4 }) ^ w2 ^
+			__builtin_shuffle(w0, w1, (WORD4){ 2, 3, 4, 5 }) ^ w0;
+		t = ROTLEFT4(t, 1);
+		// Lane 3 gets the missing term from lane 0, which is final by now
+		t ^= ROTLEFT4(__builtin_shuffle(t, zero, (WORD4){ 4, 4, 4, 0 }), 1);
+
+		store4(&wk[i], t + K(i));
+		w0 = w1;
+		w1 = w2;
+		w2 = w3;
+		w3 = t;
 	}
+}
+#endif
+
+void sha1_transform(SHA1_CTX *ctx, const BYTE data[])
+{
+	WORD a, b, c, d, e;
+#ifdef SHA1_VECTOR
+	WORD wk[80];
+
+	sha1_schedule(wk, data);
+#else
+	WORD m[16];
+	int i;
+
+	for (i = 0; i < 16; ++i)
+		m[i] = load_be32(data + i * 4);
+#endif
 
 	a = ctx->state[0];
 	b = ctx->state[1];
@@ -35,38 +128,10 @@ void sha1_transform(SHA1_CTX *ctx, const BYTE data[])
 	d = ctx->state[3];
 	e = ctx->state[4];
 
-	for (i = 0; i < 20; ++i) {
-		t = ROTLEFT(a, 5) + ((b & c) ^ (~b & d)) + e + ctx->k[0] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
-	for ( ; i < 40; ++i) {
-		t = ROTLEFT(a, 5) + (b ^ c ^ d) + e + ctx->k[1] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
-	for ( ; i < 60; ++i) {
-		t = ROTLEFT(a, 5) + ((b & c) ^ (b & d) ^ (c & d))  + e + ctx->k[2] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
-	for ( ; i < 80; ++i) {
-		t = ROTLEFT(a, 5) + (b ^ c ^ d) + e + ctx->k[3] + m[i];
-		e = d;
-		d = c;
-		c = ROTLEFT(b, 30);
-		b = a;
-		a = t;
-	}
+	R5(0); R5(5); R5(10); R5(15);
+	R5(20); R5(25); R5(30); R5(35);
+	R5(40); R5(45); R5(50); R5(55);
+	R5(60); R5(65); R5(70); R5(75);
 
 	ctx->state[0] += a;
 	ctx->state[1] += b;
@@ -84,25 +149,35 @@ void sha1_init(SHA1_CTX *ctx)
 	ctx->state[2] = 0x98BADCFE;
 	ctx->state[3] = 0x10325476;
 	ctx->state[4] = 0xc3d2e1f0;
-	ctx->k[0] = 0x5a827999;
-	ctx->k[1] = 0x6ed9eba1;
-	ctx->k[2] = 0x8f1bbcdc;
-	ctx->k[3] = 0xca62c1d6;
 }
 
 void sha1_update(SHA1_CTX *ctx, const BYTE data[], size_t len)
 {
-	size_t i;
-
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha1_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	// Top up a partial block first, then hash whole blocks straight from the input
+	if (ctx->datalen) {
+		size_t n = 64 - ctx->datalen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->data + ctx->datalen, data, n);
+		ctx->datalen += n;
+		data += n;
+		len -= n;
+		if (ctx->datalen < 64)
+			return;
+		sha1_transform(ctx, ctx->data);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
 	}
+
+	while (len >= 64) {
+		sha1_transform(ctx, data);
+		ctx->bitlen += 512;
+		data += 64;
+		len -= 64;
+	}
+
+	memcpy(ctx->data, data, len);
+	ctx->datalen = len;
 }
 
 void sha1_final(SHA1_CTX *ctx, BYTE hash[])
@@ -0,0 +1,312 @@
+/* shader_cache.c -- keep compiled shaders alive across programs
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <string.h>
+#include <vitaGL.h>
+
+#include "config.h"
+#include "shader_cache.h"
+
+/*
+ * The game creates a fresh shader object for every program, even when the
+ * source is one it has already seen. The first shader object created for a
+ * key becomes the cached one. Later shader objects with the same key are
+ * only handles: they are never uploaded to, and glAttachShader attaches the
+ * cached object in their place.
+ *
+ * A cached shader is referenced by every game handle that still points to it
+ * and by every program it is attached to. Unreferenced shaders stay around
+ * until the cache grows past SHADER_CACHE_KB, and then the least recently
+ * used ones are deleted.
+ */
+
+#define MAX_SHADERS 2048 // power of two
+#define MAX_HANDLES 4096 // power of two
+
+typedef struct {
+	uint32_t key[SHADER_KEY_WORDS];
+	GLuint shader;
+	uint32_t size;
+	uint32_t refs;
+	uint32_t last_use;
+} cache_entry;
+
+typedef struct {
+	GLuint handle;
+	GLuint shader;
+	GLuint prog;
+	int held; // the handle has not been deleted by the game yet
+} cache_handle;
+
+// Second index of the entries by key, the key being a hash already
+typedef struct {
+	uint32_t tag; // first word of the key
+	GLuint shader;
+} cache_key;
+
+static cache_entry g_Shaders[MAX_SHADERS];
+static cache_key g_Keys[MAX_SHADERS];
+static cache_handle g_Handles[MAX_HANDLES];
+static size_t g_CacheSize;
+static uint32_t g_Clock;
+
+static uint32_t shader_slot(GLuint shader) {
+	return (shader * 0x9e3779b1) & (MAX_SHADERS - 1);
+}
+
+static uint32_t handle_slot(GLuint handle) {
+	return (handle * 0x9e3779b1) & (MAX_HANDLES - 1);
+}
+
+static uint32_t key_slot(uint32_t tag) {
+	return tag & (MAX_SHADERS - 1);
+}
+
+// Entries are placed by shader object rather than key, so that handles resolve without hashing the key
+static cache_entry *find_shader(GLuint shader) {
+	for (uint32_t i = shader_slot(shader); g_Shaders[i].shader; i = (i + 1) & (MAX_SHADERS - 1)) {
+		if (g_Shaders[i].shader == shader)
+			return &g_Shaders[i];
+	}
+	return NULL;
+}
+
+static cache_handle *find_handle(GLuint handle) {
+	for (uint32_t i = handle_slot(handle); g_Handles[i].handle; i = (i + 1) & (MAX_HANDLES - 1)) {
+		if (g_Handles[i].handle == handle)
+			return &g_Handles[i];
+	}
+	return NULL;
+}
+
+static void insert_key(const uint32_t *key, GLuint shader) {
+	uint32_t i = key_slot(key[0]);
+	while (g_Keys[i].shader)
+		i = (i + 1) & (MAX_SHADERS - 1);
+
+	g_Keys[i].tag = key[0];
+	g_Keys[i].shader = shader;
+}
+
+// Linear probing with backward shift, so lookups never need tombstones
+static void remove_key(const uint32_t *key, GLuint shader) {
+	uint32_t i = key_slot(key[0]);
+	while (g_Keys[i].shader != shader) {
+		if (!g_Keys[i].shader)
+			return;
+		i = (i + 1) & (MAX_SHADERS - 1);
+	}
+
+	uint32_t j = i;
+	for (;;) {
+		j = (j + 1) & (MAX_SHADERS - 1);
+		if (!g_Keys[j].shader)
+			break;
+		uint32_t k = key_slot(g_Keys[j].tag);
+		if (((j - k) & (MAX_SHADERS - 1)) >= ((j - i) & (MAX_SHADERS - 1))) {
+			g_Keys[i] = g_Keys[j];
+			i = j;
+		}
+	}
+
+	memset(&g_Keys[i], 0, sizeof(cache_key));
+}
+
+static void remove_shader(cache_entry *e) {
+	uint32_t i = e - g_Shaders;
+	uint32_t j = i;
+
+	remove_key(e->key, e->shader);
+
+	for (;;) {
+		j = (j + 1) & (MAX_SHADERS - 1);
+		if (!g_Shaders[j].shader)
+			break;
+		uint32_t k = shader_slot(g_Shaders[j].shader);
+		if (((j - k) & (MAX_SHADERS - 1)) >= ((j - i) & (MAX_SHADERS - 1))) {
+			g_Shaders[i] = g_Shaders[j];
+			i = j;
+		}
+	}
+
+	memset(&g_Shaders[i], 0, sizeof(cache_entry));
+}
+
+static void remove_handle(cache_handle *h) {
+	uint32_t i = h - g_Handles;
+	uint32_t j = i;
+
+	for (;;) {
+		j = (j + 1) & (MAX_HANDLES - 1);
+		if (!g_Handles[j].handle)
+			break;
+		uint32_t k = handle_slot(g_Handles[j].handle);
+		if (((j - k) & (MAX_HANDLES - 1)) >= ((j - i) & (MAX_HANDLES - 1))) {
+			g_Handles[i] = g_Handles[j];
+			i = j;
+		}
+	}
+
+	memset(&g_Handles[i], 0, sizeof(cache_handle));
+}
+
+static void release(GLuint shader) {
+	cache_entry *e = find_shader(shader);
+	if (e && e->refs > 0)
+		e->refs--;
+}
+
+static void evict(size_t needed) {
+	while (g_CacheSize + needed > SHADER_CACHE_KB * 1024) {
+		cache_entry *victim = NULL;
+
+		for (int i = 0; i < MAX_SHADERS; i++) {
+			cache_entry *e = &g_Shaders[i];
+			if (e->shader && e->refs == 0 && (!victim || (int32_t)(e->last_use - victim->last_use) < 0))
+				victim = e;
+		}
+
+		if (!victim)
+			return;
+
+		glDeleteShader(victim->shader);
+		g_CacheSize -= victim->size;
+		remove_shader(victim);
+	}
+}
+
+GLuint shader_cache_lookup(const uint32_t *key) {
+	for (uint32_t i = key_slot(key[0]); g_Keys[i].shader; i = (i + 1) & (MAX_SHADERS - 1)) {
+		if (g_Keys[i].tag != key[0])
+			continue;
+
+		cache_entry *e = find_shader(g_Keys[i].shader);
+		if (e && memcmp(e->key, key, sizeof(e->key)) == 0) {
+			e->last_use = ++g_Clock;
+			return e->shader;
+		}
+	}
+	return 0;
+}
+
+void shader_cache_insert(const uint32_t *key, GLuint shader, size_t size) {
+	cache_entry *e = find_shader(shader);
+
+	// A shader inserted before its binary was ready keeps its references, and must not evict itself
+	if (e) {
+		e->refs++;
+		evict(size);
+		e = find_shader(shader); // eviction shifts entries around
+		e->refs--;
+		g_CacheSize += size - e->size;
+		e->size = size;
+		e->last_use = ++g_Clock;
+		return;
+	}
+
+	evict(size);
+
+	uint32_t i = shader_slot(shader);
+	uint32_t n = 0;
+	while (g_Shaders[i].shader && g_Shaders[i].shader != shader) {
+		i = (i + 1) & (MAX_SHADERS - 1);
+		if (++n == MAX_SHADERS)
+			return; // full, the shader simply stays uncached
+	}
+
+	if (g_Shaders[i].shader == shader)
+		g_CacheSize -= g_Shaders[i].size;
+
+	memcpy(g_Shaders[i].key, key, sizeof(g_Shaders[i].key));
+	g_Shaders[i].shader = shader;
+	g_Shaders[i].size = size;
+	g_Shaders[i].refs = 0;
+	g_Shaders[i].last_use = ++g_Clock;
+	g_CacheSize += size;
+	insert_key(key, shader);
+}
+
+void shader_cache_bind(GLuint handle, GLuint shader) {
+	cache_entry *e = find_shader(shader);
+	if (!e)
+		return;
+
+	cache_handle *h = find_handle(handle);
+	if (h) {
+		// The game sourced the same handle twice
+		if (h->held)
+			release(h->shader);
+	} else {
+		uint32_t i = handle_slot(handle);
+		uint32_t n = 0;
+		while (g_Handles[i].handle) {
+			i = (i + 1) & (MAX_HANDLES - 1);
+			if (++n == MAX_HANDLES)
+				return;
+		}
+		h = &g_Handles[i];
+		h->handle = handle;
+		h->prog = 0;
+	}
+
+	h->shader = shader;
+	h->held = 1;
+	e->refs++;
+}
+
+GLuint shader_cache_attach(GLuint prog, GLuint handle) {
+	cache_handle *h = find_handle(handle);
+	if (!h)
+		return handle;
+
+	cache_entry *e = find_shader(h->shader);
+	if (e)
+		e->refs++;
+
+	h->prog = prog;
+	return h->shader;
+}
+
+int shader_cache_is_cached(GLuint shader) {
+	return find_shader(shader) != NULL;
+}
+
+void shader_cache_delete_shader(GLuint handle) {
+	cache_handle *h = find_handle(handle);
+	if (!h || !h->held)
+		return;
+
+	release(h->shader);
+	h->held = 0;
+
+	// Still attached, the program deletion takes care of it
+	if (h->prog)
+		return;
+
+	if (h->handle != h->shader)
+		glDeleteShader(h->handle);
+	remove_handle(h);
+}
+
+void shader_cache_delete_program(GLuint prog) {
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		cache_handle *h = &g_Handles[i];
+		if (!h->handle || h->prog != prog)
+			continue;
+
+		release(h->shader);
+		if (h->held)
+			release(h->shader);
+		if (h->handle != h->shader)
+			glDeleteShader(h->handle);
+		remove_handle(h);
+
+		// The backward shift may have moved another handle into this slot
+		i--;
+	}
+}
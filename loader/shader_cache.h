@@ -0,0 +1,19 @@
+#ifndef __SHADER_CACHE_H__
+#define __SHADER_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vitaGL.h>
+
+#include "shader_key.h"
+
+GLuint shader_cache_lookup(const uint32_t *key);
+void shader_cache_insert(const uint32_t *key, GLuint shader, size_t size);
+
+void shader_cache_bind(GLuint handle, GLuint shader);
+GLuint shader_cache_attach(GLuint prog, GLuint handle);
+int shader_cache_is_cached(GLuint shader);
+void shader_cache_delete_shader(GLuint handle);
+void shader_cache_delete_program(GLuint prog);
+
+#endif
@@ -0,0 +1,516 @@
+/* shader_compile.c -- compile missing shaders on a worker thread
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+#include <vitashark.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "shader_cache.h"
+#include "shader_compile.h"
+
+/*
+ * A shader missing from the pack and from the gxp directory used to be
+ * compiled inside glShaderSource_fake, stalling the render thread for the
+ * whole compile. Now the source is only queued there, and the worker runs
+ * vitashark on it and writes the gxp back. A shader the worker cannot take
+ * is compiled in place as before; g_Compiler keeps the two apart
+ * (glCompileShader is stubbed out and shader_precompile is done before the
+ * game starts, so nothing else compiles at runtime).
+ *
+ * GL objects still belong to the render thread: the binary is uploaded from
+ * there when polled. A program linked while one of its shaders is in flight
+ * is not linked yet. Until it is, glUseProgram binds a fallback program that
+ * draws nothing, and attribute locations are handed out in order, then bound
+ * to those indices when the poll links the real program once both shaders
+ * are in. From then on the program is the game's own again. Uniform
+ * locations are kept by the game for good, so asking for one (or for the
+ * active uniforms) links the program on the spot rather than hand out
+ * locations that would need mapping for as long as it lives.
+ */
+
+#define MAX_JOBS 64
+#define MAX_ATTRIBS 16
+#define PROGRAM_BUCKETS 256 // looked up on glUseProgram while any is pending
+
+enum {
+	JOB_FREE,
+	JOB_QUEUED,
+	JOB_COMPILING,
+	JOB_DONE,
+	JOB_FAILED,
+};
+
+typedef struct {
+	int state;
+	uint32_t seq;
+	uint32_t key[SHADER_KEY_WORDS];
+	GLuint shader;
+	int vertex;
+	char *src; // the game's prelude followed by the Cg body
+	char gxp_path[128];
+	void *binary;
+	uint32_t size;
+} compile_job;
+
+typedef struct deferred_program {
+	struct deferred_program *next;
+	GLuint prog;
+	char *attribs[MAX_ATTRIBS];
+	int num_attribs;
+} deferred_program;
+
+static compile_job g_Jobs[MAX_JOBS];
+static uint32_t g_Seq;
+
+static pthread_mutex_t g_Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_Queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_Done = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t g_Compiler = PTHREAD_MUTEX_INITIALIZER; // vitashark is not reentrant
+
+// Only touched from the render thread, linked programs leave the table
+static deferred_program *g_Programs[PROGRAM_BUCKETS];
+static int g_NumPrograms;
+static GLuint g_Used;
+static GLuint g_Fallback;
+
+static char *g_Vert, *g_Frag;
+static size_t g_VertSize, g_FragSize;
+static int g_Ready;
+
+static char *load_file(const char *path, size_t *size) {
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char *buf = malloc(*size + 1);
+	if (buf) {
+		fread(buf, 1, *size, file);
+		buf[*size] = 0;
+	}
+	fclose(file);
+
+	return buf;
+}
+
+// Everything before the GLSL body is the game's prelude of #defines, which the Cg body understands too
+static char *splice(const char *src, size_t len, int *vertex) {
+	const char *body = strstr(src, "#if defined GL_ES");
+	size_t prelude = body ? (size_t)(body - src) : len;
+	*vertex = strstr(src, "u_modelViewProjectionMatrix") != NULL;
+	const char *cg = *vertex ? g_Vert : g_Frag;
+	size_t cg_size = *vertex ? g_VertSize : g_FragSize;
+	if (!cg)
+		return NULL;
+
+	char *full = malloc(prelude + cg_size + 1);
+	if (!full)
+		return NULL;
+	memcpy(full, src, prelude);
+	memcpy(full + prelude, cg, cg_size + 1);
+	return full;
+}
+
+// Returns a copy of the binary, the compiler keeps its own output
+static void *compile(const char *src, int vertex, uint32_t *size) {
+	void *binary = NULL;
+
+	pthread_mutex_lock(&g_Compiler);
+	SceGxmProgram *prog = shark_compile_shader(src, size, vertex ? SHARK_VERTEX_SHADER : SHARK_FRAGMENT_SHADER);
+	if (prog) {
+		binary = malloc(*size);
+		if (binary)
+			memcpy(binary, prog, *size);
+	}
+	shark_clear_output();
+	pthread_mutex_unlock(&g_Compiler);
+
+	return binary;
+}
+
+static void write_gxp(const char *path, const void *binary, uint32_t size) {
+	FILE *file = fopen(path, "wb");
+	if (file) {
+		fwrite(binary, 1, size, file);
+		fclose(file);
+	}
+}
+
+static void *compile_thread(void *arg) {
+	pthread_mutex_lock(&g_Lock);
+
+	for (;;) {
+		compile_job *job = NULL;
+		for (int i = 0; i < MAX_JOBS; i++) {
+			if (g_Jobs[i].state == JOB_QUEUED && (!job || (int32_t)(g_Jobs[i].seq - job->seq) < 0))
+				job = &g_Jobs[i];
+		}
+
+		if (!job) {
+			pthread_cond_wait(&g_Queued, &g_Lock);
+			continue;
+		}
+
+		job->state = JOB_COMPILING;
+		pthread_mutex_unlock(&g_Lock);
+
+		uint32_t size = 0;
+		void *binary = compile(job->src, job->vertex, &size);
+		if (binary)
+			write_gxp(job->gxp_path, binary, size);
+
+		free(job->src);
+		job->src = NULL;
+
+		pthread_mutex_lock(&g_Lock);
+		job->binary = binary;
+		job->size = size;
+		job->state = binary ? JOB_DONE : JOB_FAILED;
+		pthread_cond_broadcast(&g_Done);
+	}
+
+	return NULL;
+}
+
+static compile_job *find_job(GLuint shader) {
+	for (int i = 0; i < MAX_JOBS; i++) {
+		if ((g_Jobs[i].state == JOB_QUEUED || g_Jobs[i].state == JOB_COMPILING) && g_Jobs[i].shader == shader)
+			return &g_Jobs[i];
+	}
+	return NULL;
+}
+
+static int has_finished(void) {
+	for (int i = 0; i < MAX_JOBS; i++) {
+		if (g_Jobs[i].state == JOB_DONE || g_Jobs[i].state == JOB_FAILED)
+			return 1;
+	}
+	return 0;
+}
+
+static void upload(compile_job *job) {
+	if (job->state == JOB_DONE) {
+		// The game may have dropped every handle to it, letting the cache evict it meanwhile
+		if (shader_cache_lookup(job->key) == job->shader) {
+			glShaderBinary(1, &job->shader, 0, job->binary, job->size);
+			shader_cache_insert(job->key, job->shader, job->size);
+		}
+	} else {
+		debugPrintf("Could not compile %s\n", job->gxp_path);
+	}
+
+	free(job->binary);
+	job->binary = NULL;
+}
+
+// Returns the number of jobs uploaded
+static int upload_finished(void) {
+	compile_job *finished[MAX_JOBS];
+	int n = 0;
+
+	pthread_mutex_lock(&g_Lock);
+	for (int i = 0; i < MAX_JOBS; i++) {
+		if (g_Jobs[i].state == JOB_DONE || g_Jobs[i].state == JOB_FAILED)
+			finished[n++] = &g_Jobs[i];
+	}
+	pthread_mutex_unlock(&g_Lock);
+
+	// Only the render thread frees jobs, so the finished ones stay put while unlocked
+	for (int i = 0; i < n; i++)
+		upload(finished[i]);
+
+	pthread_mutex_lock(&g_Lock);
+	for (int i = 0; i < n; i++)
+		finished[i]->state = JOB_FREE;
+	pthread_mutex_unlock(&g_Lock);
+
+	return n;
+}
+
+int shader_compile_submit(const uint32_t *key, GLuint shader, const char *src, size_t len, const char *gxp_path) {
+	if (!g_Ready)
+		return -1;
+
+	int vertex;
+	char *full = splice(src, len, &vertex);
+	if (!full)
+		return -1;
+
+	compile_job *job;
+	for (;;) {
+		pthread_mutex_lock(&g_Lock);
+		for (job = g_Jobs; job < g_Jobs + MAX_JOBS && job->state != JOB_FREE; job++);
+		if (job < g_Jobs + MAX_JOBS)
+			break;
+
+		// Every slot is in flight, the render thread has to wait for one of them
+		while (!has_finished())
+			pthread_cond_wait(&g_Done, &g_Lock);
+		pthread_mutex_unlock(&g_Lock);
+		upload_finished();
+	}
+
+	memcpy(job->key, key, sizeof(job->key));
+	job->shader = shader;
+	job->vertex = vertex;
+	job->src = full;
+	job->seq = g_Seq++;
+	snprintf(job->gxp_path, sizeof(job->gxp_path), "%s", gxp_path);
+	job->state = JOB_QUEUED;
+
+	pthread_cond_signal(&g_Queued);
+	pthread_mutex_unlock(&g_Lock);
+	return 0;
+}
+
+size_t shader_compile_now(GLuint shader, const char *src, size_t len, const char *gxp_path) {
+	uint32_t size = 0;
+	int vertex;
+
+	char *full = splice(src, len, &vertex);
+	if (!full)
+		return 0;
+	void *binary = compile(full, vertex, &size);
+	free(full);
+	if (!binary)
+		return 0;
+
+	write_gxp(gxp_path, binary, size);
+	glShaderBinary(1, &shader, 0, binary, size);
+	free(binary);
+	return size;
+}
+
+static int is_pending(GLuint prog) {
+	GLuint shaders[2];
+	GLsizei count;
+	int pending = 0;
+
+	glGetAttachedShaders(prog, 2, &count, shaders);
+
+	pthread_mutex_lock(&g_Lock);
+	for (int i = 0; i < count; i++) {
+		if (find_job(shaders[i]))
+			pending = 1;
+	}
+	pthread_mutex_unlock(&g_Lock);
+
+	return pending;
+}
+
+static void wait_shaders(GLuint prog) {
+	GLuint shaders[2];
+	GLsizei count;
+
+	glGetAttachedShaders(prog, 2, &count, shaders);
+
+	pthread_mutex_lock(&g_Lock);
+	for (int i = 0; i < count; i++) {
+		while (find_job(shaders[i]))
+			pthread_cond_wait(&g_Done, &g_Lock);
+	}
+	pthread_mutex_unlock(&g_Lock);
+
+	upload_finished();
+}
+
+static deferred_program *find_program(GLuint prog) {
+	deferred_program *p = g_Programs[prog % PROGRAM_BUCKETS];
+	while (p && p->prog != prog)
+		p = p->next;
+	return p;
+}
+
+static void remove_program(GLuint prog) {
+	for (deferred_program **link = &g_Programs[prog % PROGRAM_BUCKETS]; *link; link = &(*link)->next) {
+		deferred_program *p = *link;
+		if (p->prog != prog)
+			continue;
+
+		for (int i = 0; i < p->num_attribs; i++)
+			free(p->attribs[i]);
+		*link = p->next;
+		g_NumPrograms--;
+		free(p);
+		return;
+	}
+}
+
+// The attributes handed out become the real locations, so nothing is left to map
+static void swap_in(deferred_program *p) {
+	GLuint prog = p->prog;
+
+	wait_shaders(prog);
+
+	for (int i = 0; i < p->num_attribs; i++)
+		glBindAttribLocation(prog, i, p->attribs[i]);
+	glLinkProgram(prog);
+	remove_program(prog);
+
+	if (g_Used == prog)
+		glUseProgram(prog);
+}
+
+void shader_compile_poll(void) {
+	if (upload_finished() == 0 || g_NumPrograms == 0)
+		return;
+
+	for (int i = 0; i < PROGRAM_BUCKETS; i++) {
+		deferred_program *next;
+		for (deferred_program *p = g_Programs[i]; p; p = next) {
+			next = p->next;
+			if (!is_pending(p->prog))
+				swap_in(p);
+		}
+	}
+}
+
+void shader_compile_link(GLuint prog) {
+	remove_program(prog);
+
+	deferred_program *p = NULL;
+	if (g_Fallback && is_pending(prog))
+		p = calloc(1, sizeof(deferred_program));
+	if (!p) {
+		wait_shaders(prog);
+		glLinkProgram(prog);
+		return;
+	}
+
+	p->prog = prog;
+	p->next = g_Programs[prog % PROGRAM_BUCKETS];
+	g_Programs[prog % PROGRAM_BUCKETS] = p;
+	g_NumPrograms++;
+}
+
+void shader_compile_use(GLuint prog) {
+	g_Used = prog;
+	glUseProgram(g_NumPrograms && find_program(prog) ? g_Fallback : prog);
+}
+
+GLint shader_compile_uniform_location(GLuint prog, const char *name) {
+	// Locations of the real program only, the game keeps them
+	deferred_program *p = g_NumPrograms ? find_program(prog) : NULL;
+	if (p)
+		swap_in(p);
+
+	return glGetUniformLocation(prog, name);
+}
+
+GLint shader_compile_attrib_location(GLuint prog, const char *name) {
+	deferred_program *p = g_NumPrograms ? find_program(prog) : NULL;
+	if (!p)
+		return glGetAttribLocation(prog, name);
+
+	for (int i = 0; i < p->num_attribs; i++) {
+		if (strcmp(p->attribs[i], name) == 0)
+			return i;
+	}
+
+	if (p->num_attribs == MAX_ATTRIBS)
+		return -1;
+
+	p->attribs[p->num_attribs] = strdup(name);
+	if (!p->attribs[p->num_attribs])
+		return -1;
+	return p->num_attribs++;
+}
+
+void shader_compile_program_iv(GLuint prog, GLenum pname, GLint *params) {
+	deferred_program *p = g_NumPrograms ? find_program(prog) : NULL;
+	if (p) {
+		switch (pname) {
+		case GL_LINK_STATUS:
+			*params = GL_TRUE;
+			return;
+		case GL_INFO_LOG_LENGTH:
+			*params = 0;
+			return;
+		case GL_ATTACHED_SHADERS:
+		{
+			GLuint shaders[2];
+			glGetAttachedShaders(prog, 2, params, shaders);
+			return;
+		}
+		default:
+			// The active uniforms and attributes are only known once it is linked
+			swap_in(p);
+			break;
+		}
+	}
+
+	glGetProgramiv(prog, pname, params);
+}
+
+void shader_compile_forget(GLuint prog) {
+	remove_program(prog);
+}
+
+// Puts every vertex out of view, it only needs to be valid
+static GLuint make_fallback(void) {
+	static const char vert[] = "float4 main() : POSITION { return float4(2.0, 2.0, 2.0, 1.0); }";
+	static const char frag[] = "float4 main() : COLOR { return float4(0.0, 0.0, 0.0, 0.0); }";
+	GLuint prog = glCreateProgram();
+	GLint linked = GL_FALSE;
+
+	for (int i = 0; i < 2; i++) {
+		uint32_t size;
+		SceGxmProgram *bin = shark_compile_shader(i ? frag : vert, &size, i ? SHARK_FRAGMENT_SHADER : SHARK_VERTEX_SHADER);
+		if (!bin) {
+			shark_clear_output();
+			glDeleteProgram(prog);
+			return 0;
+		}
+
+		GLuint shader = glCreateShader(i ? GL_FRAGMENT_SHADER : GL_VERTEX_SHADER);
+		glShaderBinary(1, &shader, 0, bin, size);
+		shark_clear_output();
+		glAttachShader(prog, shader);
+	}
+
+	glLinkProgram(prog);
+	glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		glDeleteProgram(prog);
+		return 0;
+	}
+
+	return prog;
+}
+
+int shader_compile_init(const char *vert_path, const char *frag_path) {
+	g_Vert = load_file(vert_path, &g_VertSize);
+	g_Frag = load_file(frag_path, &g_FragSize);
+	if (!g_Vert || !g_Frag)
+		return -1;
+
+	// Compiled before the worker starts, which then has the compiler to itself
+	g_Fallback = make_fallback();
+	if (!g_Fallback)
+		debugPrintf("Could not build the fallback program, programs will wait for their shaders\n");
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 256 * 1024); // the Cg compiler recurses deeply
+	if (pthread_create(&t, &attr, compile_thread, NULL) != 0)
+		return -1;
+	pthread_attr_destroy(&attr);
+
+	g_Ready = 1;
+	return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef __SHADER_COMPILE_H__
+#define __SHADER_COMPILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vitaGL.h>
+
+int shader_compile_init(const char *vert_path, const char *frag_path);
+
+// Queues the shader to the worker, returns -1 if it could not take it
+int shader_compile_submit(const uint32_t *key, GLuint shader, const char *src, size_t len, const char *gxp_path);
+// Compiles and uploads the shader on the calling thread, returns its size or 0
+size_t shader_compile_now(GLuint shader, const char *src, size_t len, const char *gxp_path);
+void shader_compile_poll(void);
+
+void shader_compile_link(GLuint prog);
+void shader_compile_use(GLuint prog);
+GLint shader_compile_uniform_location(GLuint prog, const char *name);
+GLint shader_compile_attrib_location(GLuint prog, const char *name);
+void shader_compile_program_iv(GLuint prog, GLenum pname, GLint *params);
+void shader_compile_forget(GLuint prog);
+
+#endif
@@ -0,0 +1,175 @@
+/* shader_key.c -- cache keys for shader sources
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sha1.h"
+#include "shader_key.h"
+
+/*
+ * Keys only have to tell apart the thousand or so shaders of the game, so a
+ * 128-bit non-cryptographic hash is plenty. MurmurHash3 x86_128 only needs
+ * 32-bit multiplies, which suits the Cortex-A9 better than the 64-bit ones of
+ * xxHash3 or wyhash. It is also free in the public domain.
+ */
+
+#define ROTL32(x, r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+static inline uint32_t load_le32(const uint8_t *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint32_t w;
+	memcpy(&w, p, 4);
+	return w;
+#else
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+#endif
+}
+
+static inline uint32_t fmix32(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+void murmur3_x86_128(const void *key, size_t len, uint32_t seed, uint32_t out[4]) {
+	const uint8_t *data = (const uint8_t *)key;
+	const uint8_t *tail = data + (len & ~(size_t)15);
+	const uint32_t c1 = 0x239b961b;
+	const uint32_t c2 = 0xab0e9789;
+	const uint32_t c3 = 0x38b34ae5;
+	const uint32_t c4 = 0xa1e38b93;
+	uint32_t h1 = seed, h2 = seed, h3 = seed, h4 = seed;
+	uint32_t k1, k2, k3, k4;
+
+	for (const uint8_t *p = data; p < tail; p += 16) {
+		k1 = load_le32(p);
+		k2 = load_le32(p + 4);
+		k3 = load_le32(p + 8);
+		k4 = load_le32(p + 12);
+
+		k1 *= c1; k1 = ROTL32(k1, 15); k1 *= c2; h1 ^= k1;
+		h1 = ROTL32(h1, 19); h1 += h2; h1 = h1 * 5 + 0x561ccd1b;
+		k2 *= c2; k2 = ROTL32(k2, 16); k2 *= c3; h2 ^= k2;
+		h2 = ROTL32(h2, 17); h2 += h3; h2 = h2 * 5 + 0x0bcaa747;
+		k3 *= c3; k3 = ROTL32(k3, 17); k3 *= c4; h3 ^= k3;
+		h3 = ROTL32(h3, 15); h3 += h4; h3 = h3 * 5 + 0x96cd1c35;
+		k4 *= c4; k4 = ROTL32(k4, 18); k4 *= c1; h4 ^= k4;
+		h4 = ROTL32(h4, 13); h4 += h1; h4 = h4 * 5 + 0x32ac3b17;
+	}
+
+	k1 = k2 = k3 = k4 = 0;
+	switch (len & 15) {
+	case 15: k4 ^= tail[14] << 16; /* fallthrough */
+	case 14: k4 ^= tail[13] << 8; /* fallthrough */
+	case 13: k4 ^= tail[12];
+		k4 *= c4; k4 = ROTL32(k4, 18); k4 *= c1; h4 ^= k4; /* fallthrough */
+	case 12: k3 ^= (uint32_t)tail[11] << 24; /* fallthrough */
+	case 11: k3 ^= tail[10] << 16; /* fallthrough */
+	case 10: k3 ^= tail[9] << 8; /* fallthrough */
+	case 9: k3 ^= tail[8];
+		k3 *= c3; k3 = ROTL32(k3, 17); k3 *= c4; h3 ^= k3; /* fallthrough */
+	case 8: k2 ^= (uint32_t)tail[7] << 24; /* fallthrough */
+	case 7: k2 ^= tail[6] << 16; /* fallthrough */
+	case 6: k2 ^= tail[5] << 8; /* fallthrough */
+	case 5: k2 ^= tail[4];
+		k2 *= c2; k2 = ROTL32(k2, 16); k2 *= c3; h2 ^= k2; /* fallthrough */
+	case 4: k1 ^= (uint32_t)tail[3] << 24; /* fallthrough */
+	case 3: k1 ^= tail[2] << 16; /* fallthrough */
+	case 2: k1 ^= tail[1] << 8; /* fallthrough */
+	case 1: k1 ^= tail[0];
+		k1 *= c1; k1 = ROTL32(k1, 15); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len; h2 ^= len; h3 ^= len; h4 ^= len;
+
+	h1 += h2; h1 += h3; h1 += h4;
+	h2 += h1; h3 += h1; h4 += h1;
+
+	h1 = fmix32(h1);
+	h2 = fmix32(h2);
+	h3 = fmix32(h3);
+	h4 = fmix32(h4);
+
+	h1 += h2; h1 += h3; h1 += h4;
+	h2 += h1; h3 += h1; h4 += h1;
+
+	out[0] = h1;
+	out[1] = h2;
+	out[2] = h3;
+	out[3] = h4;
+}
+
+static void murmur3_hash(const void *data, size_t len, uint32_t key[SHADER_KEY_WORDS]) {
+	murmur3_x86_128(data, len, 0, key);
+}
+
+// The first four words of the key the loader used to name its <sha1>.gxp files
+static void sha1_hash(const void *data, size_t len, uint32_t key[SHADER_KEY_WORDS]) {
+	uint32_t digest[5];
+	SHA1_CTX ctx;
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, (const BYTE *)data, len);
+	sha1_final(&ctx, (BYTE *)digest);
+
+	memcpy(key, digest, SHADER_KEY_WORDS * sizeof(uint32_t));
+}
+
+const shader_key_hash murmur3_key = {
+	.name = "murmur3",
+	.id = 2,
+	.hash = murmur3_hash,
+};
+
+const shader_key_hash sha1_key = {
+	.name = "sha1",
+	.id = 1,
+	.hash = sha1_hash,
+};
+
+static const shader_key_hash *g_Hashes[] = { &murmur3_key, &sha1_key };
+
+const shader_key_hash *shader_key_find(const char *name) {
+	for (size_t i = 0; i < sizeof(g_Hashes) / sizeof(*g_Hashes); i++) {
+		if (strcmp(g_Hashes[i]->name, name) == 0)
+			return g_Hashes[i];
+	}
+	return NULL;
+}
+
+void shader_key_name(const uint32_t key[SHADER_KEY_WORDS], char name[SHADER_KEY_CHARS + 1]) {
+	for (int i = 0; i < SHADER_KEY_WORDS; i++)
+		snprintf(name + i * 8, 9, "%08x", (unsigned int)key[i]);
+}
+
+// Takes the name alone or as <key>.gxp, a longer name is another hash
+int shader_key_parse(const char *name, uint32_t key[SHADER_KEY_WORDS]) {
+	size_t len = strlen(name);
+
+	if (len != SHADER_KEY_CHARS && (len != SHADER_KEY_CHARS + 4 || strcmp(name + SHADER_KEY_CHARS, ".gxp") != 0))
+		return -1;
+
+	for (int i = 0; i < SHADER_KEY_WORDS; i++) {
+		uint32_t word = 0;
+		for (int j = 0; j < 8; j++) {
+			char c = name[i * 8 + j];
+			if (!isxdigit((unsigned char)c))
+				return -1;
+			word = (word << 4) | (isdigit((unsigned char)c) ? c - '0' : (c | 0x20) - 'a' + 10);
+		}
+		key[i] = word;
+	}
+
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef __SHADER_KEY_H__
+#define __SHADER_KEY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHADER_KEY_WORDS 4
+#define SHADER_KEY_CHARS (SHADER_KEY_WORDS * 8) // hex digits of a loose <key>.gxp name
+
+// Turns a shader source into its cache key. The id is stored in gxp.pack and
+// the name picks the loose gxp directory, so shaders cached under one hash are
+// never looked up with another.
+typedef struct {
+	const char *name;
+	uint32_t id;
+	void (*hash)(const void *data, size_t len, uint32_t key[SHADER_KEY_WORDS]);
+} shader_key_hash;
+
+extern const shader_key_hash murmur3_key;
+extern const shader_key_hash sha1_key;
+
+const shader_key_hash *shader_key_find(const char *name);
+
+void murmur3_x86_128(const void *key, size_t len, uint32_t seed, uint32_t out[4]);
+
+void shader_key_name(const uint32_t key[SHADER_KEY_WORDS], char name[SHADER_KEY_CHARS + 1]);
+int shader_key_parse(const char *name, uint32_t key[SHADER_KEY_WORDS]);
+
+#endif
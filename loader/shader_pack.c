@@ -0,0 +1,87 @@
+/* shader_pack.c -- all precompiled shaders in a single indexed file
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "shader_pack.h"
+
+static uint8_t *g_Pack;
+static const shader_pack_entry *g_Table;
+static uint32_t g_Count;
+
+int shader_pack_load(const char *path, uint32_t key_hash) {
+	shader_pack_header *hdr;
+	size_t size;
+	FILE *file;
+
+	file = fopen(path, "rb");
+	if (!file)
+		return -1;
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	// The whole pack stays resident, lookups hand out pointers into it
+	g_Pack = memalign(SHADER_PACK_ALIGN, size);
+	if (!g_Pack || fread(g_Pack, 1, size, file) != size) {
+		fclose(file);
+		goto err;
+	}
+	fclose(file);
+
+	hdr = (shader_pack_header *)g_Pack;
+	if (size < sizeof(shader_pack_header) || hdr->magic != SHADER_PACK_MAGIC ||
+		hdr->version != SHADER_PACK_VERSION || hdr->key_words != SHADER_KEY_WORDS || hdr->key_hash != key_hash ||
+		hdr->count > (size - sizeof(shader_pack_header)) / sizeof(shader_pack_entry))
+		goto err;
+
+	g_Table = (const shader_pack_entry *)(g_Pack + sizeof(shader_pack_header));
+	for (uint32_t i = 0; i < hdr->count; i++) {
+		if (g_Table[i].offset > size || g_Table[i].size > size - g_Table[i].offset)
+			goto err;
+	}
+
+	g_Count = hdr->count;
+	return g_Count;
+
+err:
+	free(g_Pack);
+	g_Pack = NULL;
+	g_Table = NULL;
+	return -1;
+}
+
+static int cmp_key(const uint32_t *a, const uint32_t *b) {
+	for (int i = 0; i < SHADER_KEY_WORDS; i++) {
+		if (a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+const void *shader_pack_find(const uint32_t key[SHADER_KEY_WORDS], size_t *size) {
+	uint32_t lo = 0, hi = g_Count;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		int res = cmp_key(g_Table[mid].key, key);
+		if (res == 0) {
+			*size = g_Table[mid].size;
+			return g_Pack + g_Table[mid].offset;
+		}
+		if (res < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef __SHADER_PACK_H__
+#define __SHADER_PACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shader_key.h"
+
+#define SHADER_PACK_MAGIC 0x4b505847 // GXPK
+#define SHADER_PACK_VERSION 2
+#define SHADER_PACK_ALIGN 16
+
+// All fields are little endian. The table is sorted by key, word by word,
+// and is followed by the blobs, each starting on a SHADER_PACK_ALIGN boundary.
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t key_words;
+	uint32_t key_hash; // id of the shader_key_hash the keys were made with
+} shader_pack_header;
+
+typedef struct {
+	uint32_t key[SHADER_KEY_WORDS]; // as used for the loose <key>.gxp names
+	uint32_t offset; // from the start of the pack
+	uint32_t size;
+} shader_pack_entry;
+
+int shader_pack_load(const char *path, uint32_t key_hash);
+const void *shader_pack_find(const uint32_t key[SHADER_KEY_WORDS], size_t *size);
+
+#endif
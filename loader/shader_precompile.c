@@ -0,0 +1,101 @@
+/* shader_precompile.c -- compile the shaders prepared by shaderperm at startup
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "shader_key.h"
+#include "shader_precompile.h"
+
+#define MAX_SHADER_SIZE (1 * 1024 * 1024)
+
+/*
+ * src_dir holds <key>.cg files, each being exactly the source the loader
+ * would compile on a miss of that key. Compiling them here instead of in
+ * glShaderSource_fake keeps the compiler away from gameplay. Every source
+ * is deleted once its gxp exists, so the work is only ever done once. The
+ * ones that fail to compile or to be written stay for inspection.
+ */
+int shader_precompile(const char *src_dir, const char *gxp_dir) {
+	char src_path[256], gxp_path[256];
+	SceIoDirent dirent;
+	int compiled = 0;
+	SceUID dfd;
+
+	dfd = sceIoDopen(src_dir);
+	if (dfd < 0)
+		return 0;
+
+	char *buf = vglMalloc(MAX_SHADER_SIZE);
+	if (!buf) {
+		sceIoDclose(dfd);
+		return -1;
+	}
+
+	while (sceIoDread(dfd, &dirent) > 0) {
+		size_t len = strlen(dirent.d_name);
+		if (len != SHADER_KEY_CHARS + 3 || strcmp(dirent.d_name + SHADER_KEY_CHARS, ".cg") != 0)
+			continue;
+
+		snprintf(src_path, sizeof(src_path), "%s/%s", src_dir, dirent.d_name);
+		snprintf(gxp_path, sizeof(gxp_path), "%s/%.*s.gxp", gxp_dir, SHADER_KEY_CHARS, dirent.d_name);
+
+		if (!file_exists(gxp_path)) {
+			FILE *file = fopen(src_path, "rb");
+			if (!file)
+				continue;
+
+			size_t size = fread(buf, 1, MAX_SHADER_SIZE - 1, file);
+			fclose(file);
+			buf[size] = 0;
+
+			GLenum type = strstr(buf, "u_modelViewProjectionMatrix") ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER;
+			GLuint shader = glCreateShader(type);
+			const char *src = buf;
+			glShaderSource(shader, 1, &src, NULL);
+			glCompileShader(shader);
+
+			GLint ok = 0;
+			glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+			if (ok) {
+				vglGetShaderBinary(shader, MAX_SHADER_SIZE, &size, buf);
+				file = fopen(gxp_path, "wb");
+				if (file) {
+					ok = fwrite(buf, 1, size, file) == size;
+					ok = fclose(file) == 0 && ok;
+				} else {
+					ok = 0;
+				}
+
+				// A partial gxp would be taken for a good one on the next boot
+				if (!ok) {
+					sceIoRemove(gxp_path);
+					debugPrintf("Could not write %s\n", gxp_path);
+				}
+			} else {
+				debugPrintf("Could not compile %s\n", src_path);
+			}
+
+			glDeleteShader(shader);
+			if (!ok)
+				continue;
+			compiled++;
+		}
+
+		sceIoRemove(src_path);
+	}
+
+	sceIoDclose(dfd);
+	vglFree(buf);
+
+	return compiled;
+}
@@ -0,0 +1,6 @@
+#ifndef __SHADER_PRECOMPILE_H__
+#define __SHADER_PRECOMPILE_H__
+
+int shader_precompile(const char *src_dir, const char *gxp_dir);
+
+#endif
@@ -0,0 +1,269 @@
+/* so_arena.c -- pooled allocator for trampolines next to a module
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_util.h"
+#include "so_arena.h"
+#include "so_platform.h"
+
+/*
+ * Small blocks are rounded up to a power of two size class, so that a freed
+ * block fits the next allocation of its class wherever it came from. Blocks
+ * are carved off the patch arena under the text segment, then off the cave
+ * in the text segment padding, then off overflow arenas allocated on demand
+ * around the module. Everything has to stay within branch range of the code
+ * it serves, so each of those is only used when it is in range.
+ */
+
+static int size_class(size_t sz) {
+	int c = 0;
+	size_t class_sz = SO_ARENA_MIN_CLASS;
+
+	while (c < SO_ARENA_CLASSES && class_sz < sz) {
+		class_sz <<= 1;
+		c++;
+	}
+
+	return c;
+}
+
+static size_t class_size(int c, size_t sz) {
+	return c < SO_ARENA_CLASSES ? (size_t)SO_ARENA_MIN_CLASS << c : ALIGN_MEM(sz, 4);
+}
+
+static uintptr_t distance(uintptr_t a, uintptr_t b) {
+	return a > b ? a - b : b - a;
+}
+
+static int in_range(uintptr_t addr, size_t sz, uintptr_t range, uintptr_t dst) {
+	return range == 0 || (distance(addr, dst) <= range && distance(addr + sz, dst) <= range);
+}
+
+static uintptr_t carve(uintptr_t *head, uintptr_t base, size_t size, size_t sz, uintptr_t range, uintptr_t dst) {
+	if (size - (*head - base) < sz || !in_range(*head, sz, range, dst))
+		return 0;
+
+	*head += sz;
+	return *head - sz;
+}
+
+static so_arena_pool *get_pool(so_module *mod) {
+	if (!mod->arena) {
+		mod->arena = calloc(1, sizeof(so_arena_pool));
+		if (mod->arena) {
+			mod->arena->stats.capacity = mod->patch_size + mod->cave_size;
+			mod->arena->stats.num_arenas = 2;
+		}
+	}
+
+	return mod->arena;
+}
+
+// Lowest and highest addresses the module and its arenas occupy
+static void module_bounds(so_module *mod, uintptr_t *low, uintptr_t *high) {
+	so_arena_pool *pool = mod->arena;
+
+	*low = mod->patch_base;
+	*high = mod->text_base + mod->text_block_size;
+	for (int i = 0; i < mod->n_data; i++) {
+		if (mod->data_block_base[i] + mod->data_block_size[i] > *high)
+			*high = mod->data_block_base[i] + mod->data_block_size[i];
+	}
+	for (int i = 0; i < pool->num_extra; i++) {
+		if (pool->extra[i].base < *low)
+			*low = pool->extra[i].base;
+		if (pool->extra[i].base + pool->extra[i].size > *high)
+			*high = pool->extra[i].base + pool->extra[i].size;
+	}
+}
+
+// Allocates an overflow arena wholly in range of dst, below the module first
+static so_arena_extra *add_extra(so_module *mod, size_t sz, uintptr_t range, uintptr_t dst) {
+	const so_platform *platform = so_get_platform();
+	so_arena_pool *pool = mod->arena;
+	size_t size = ALIGN_MEM(sz, SO_ARENA_EXTRA_SZ);
+	uintptr_t low, high;
+
+	if (pool->num_extra == SO_ARENA_MAX_EXTRA)
+		return NULL;
+
+	module_bounds(mod, &low, &high);
+
+	for (int side = 0; side < 2; side++) {
+		for (int i = 0; i < SO_ARENA_EXTRA_TRIES; i++) {
+			uintptr_t addr = side == 0 ? low - (i + 1) * size : high + i * size;
+			if (!in_range(addr, size, range, dst))
+				continue;
+
+			void *base;
+			int blockid = platform->alloc(1, addr, size, &base);
+			if (blockid < 0)
+				continue;
+			if ((uintptr_t)base != addr) {
+				platform->free(blockid);
+				continue;
+			}
+
+			so_arena_extra *extra = &pool->extra[pool->num_extra++];
+			extra->blockid = blockid;
+			extra->base = extra->head = addr;
+			extra->size = size;
+			pool->stats.capacity += size;
+			pool->stats.num_arenas++;
+			platform->debug("overflow arena: %d bytes (@0x%08X).\n", (int)size, (unsigned)addr);
+			return extra;
+		}
+	}
+
+	return NULL;
+}
+
+static int list_push(so_arena_list *list, uintptr_t addr, size_t size) {
+	if (list->num == list->cap) {
+		int cap = list->cap ? list->cap * 2 : 16;
+		so_arena_block *blocks = realloc(list->blocks, cap * sizeof(so_arena_block));
+		if (!blocks)
+			return -1;
+		list->blocks = blocks;
+		list->cap = cap;
+	}
+
+	list->blocks[list->num].addr = addr;
+	list->blocks[list->num].size = size;
+	list->num++;
+	return 0;
+}
+
+// Most recently freed first, large blocks only when the size matches
+static uintptr_t list_take(so_arena_list *list, size_t size, uintptr_t range, uintptr_t dst) {
+	for (int i = list->num - 1; i >= 0; i--) {
+		so_arena_block *block = &list->blocks[i];
+		if (block->size != size || !in_range(block->addr, size, range, dst))
+			continue;
+
+		uintptr_t addr = block->addr;
+		*block = list->blocks[--list->num];
+		return addr;
+	}
+
+	return 0;
+}
+
+uintptr_t so_alloc_arena(so_module *mod, uintptr_t range, uintptr_t dst, size_t sz) {
+	so_arena_pool *pool = get_pool(mod);
+	if (!pool)
+		return 0;
+
+	int c = size_class(sz);
+	sz = class_size(c, sz);
+
+	uintptr_t addr = list_take(&pool->free[c], sz, range, dst);
+	if (addr) {
+		pool->stats.free -= sz;
+		pool->stats.reused++;
+	} else {
+		addr = carve(&mod->patch_head, mod->patch_base, mod->patch_size, sz, range, dst);
+		if (!addr)
+			addr = carve(&mod->cave_head, mod->cave_base, mod->cave_size, sz, range, dst);
+		for (int i = 0; !addr && i < pool->num_extra; i++)
+			addr = carve(&pool->extra[i].head, pool->extra[i].base, pool->extra[i].size, sz, range, dst);
+		if (!addr) {
+			so_arena_extra *extra = add_extra(mod, sz, range, dst);
+			if (extra)
+				addr = carve(&extra->head, extra->base, extra->size, sz, range, dst);
+		}
+		if (!addr) {
+			pool->stats.failed++;
+			return 0;
+		}
+		pool->stats.carved += sz;
+	}
+
+	pool->stats.allocs++;
+	pool->stats.live[c]++;
+	pool->stats.in_use += sz;
+	if (pool->stats.in_use > pool->stats.peak)
+		pool->stats.peak = pool->stats.in_use;
+
+	return addr;
+}
+
+void so_free_arena(so_module *mod, uintptr_t addr, size_t sz) {
+	so_arena_pool *pool = mod->arena;
+	if (!pool || !addr)
+		return;
+
+	int c = size_class(sz);
+	sz = class_size(c, sz);
+
+	if (list_push(&pool->free[c], addr, sz) < 0)
+		return;
+
+	pool->stats.frees++;
+	pool->stats.live[c]--;
+	pool->stats.in_use -= sz;
+	pool->stats.free += sz;
+}
+
+void so_arena_get_stats(so_module *mod, so_arena_stats *stats) {
+	if (mod->arena) {
+		*stats = mod->arena->stats;
+	} else {
+		memset(stats, 0, sizeof(so_arena_stats));
+		stats->capacity = mod->patch_size + mod->cave_size;
+		stats->num_arenas = 2;
+	}
+}
+
+void so_arena_report(so_module *mod, const char *name) {
+	const so_platform *platform = so_get_platform();
+	so_arena_stats stats;
+
+	so_arena_get_stats(mod, &stats);
+	platform->debug("%s arenas: %d bytes in use (peak %d) of %d in %d arenas, %d free to reuse, %d allocs, %d frees, %d reused, %d failed\n",
+		name, (int)stats.in_use, (int)stats.peak, (int)stats.capacity, stats.num_arenas, (int)stats.free,
+		stats.allocs, stats.frees, stats.reused, stats.failed);
+	for (int c = 0; c <= SO_ARENA_CLASSES; c++) {
+		if (stats.live[c] == 0)
+			continue;
+		if (c < SO_ARENA_CLASSES)
+			platform->debug("  %d byte blocks: %d\n", SO_ARENA_MIN_CLASS << c, stats.live[c]);
+		else
+			platform->debug("  larger blocks: %d\n", stats.live[c]);
+	}
+}
+
+void so_arena_foreach(so_module *mod, void (*flush)(uintptr_t addr, size_t size)) {
+	if (mod->patch_head != mod->patch_base)
+		flush(mod->patch_base, mod->patch_head - mod->patch_base);
+	if (mod->cave_head != mod->cave_base)
+		flush(mod->cave_base, mod->cave_head - mod->cave_base);
+	if (!mod->arena)
+		return;
+	for (int i = 0; i < mod->arena->num_extra; i++) {
+		so_arena_extra *extra = &mod->arena->extra[i];
+		if (extra->head != extra->base)
+			flush(extra->base, extra->head - extra->base);
+	}
+}
+
+void so_arena_release(so_module *mod) {
+	const so_platform *platform = so_get_platform();
+	so_arena_pool *pool = mod->arena;
+	if (!pool)
+		return;
+
+	for (int i = 0; i < pool->num_extra; i++)
+		platform->free(pool->extra[i].blockid);
+	for (int c = 0; c <= SO_ARENA_CLASSES; c++)
+		free(pool->free[c].blocks);
+	free(pool);
+	mod->arena = NULL;
+}
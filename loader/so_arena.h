@@ -0,0 +1,62 @@
+#ifndef __SO_ARENA_H__
+#define __SO_ARENA_H__
+
+#include "so_util.h"
+
+#define SO_ARENA_CLASSES 4 // 16, 32, 64 and 128 bytes, larger blocks are carved to size
+#define SO_ARENA_MIN_CLASS 16
+#define SO_ARENA_MAX_EXTRA 8
+#define SO_ARENA_EXTRA_SZ 0x10000 // overflow arenas, allocated next to the module
+#define SO_ARENA_EXTRA_TRIES 16 // placements tried on each side of the module
+
+typedef struct {
+  uintptr_t addr;
+  size_t size;
+} so_arena_block;
+
+typedef struct {
+  so_arena_block *blocks;
+  int num, cap;
+} so_arena_list;
+
+typedef struct {
+  int blockid;
+  uintptr_t base, head;
+  size_t size;
+} so_arena_extra;
+
+typedef struct {
+  size_t capacity; // bytes in the patch arena, the cave and the overflow arenas
+  size_t carved; // bytes ever taken off an arena head
+  size_t in_use; // bytes allocated and not freed
+  size_t free; // bytes in the free lists
+  size_t peak; // highest in_use
+  int num_arenas;
+  int allocs, frees, reused, failed;
+  int live[SO_ARENA_CLASSES + 1]; // allocations in use per class, large ones last
+} so_arena_stats;
+
+// Per module, created on its first allocation
+typedef struct so_arena_pool {
+  so_arena_list free[SO_ARENA_CLASSES + 1];
+  so_arena_extra extra[SO_ARENA_MAX_EXTRA];
+  int num_extra;
+  so_arena_stats stats;
+} so_arena_pool;
+
+/*
+ * so_alloc_arena: allocates sz bytes of executable memory for trampolines
+ * range: maximum distance from the allocation to dst (ignored if 0)
+ * dst: address the allocation has to be reachable from, usually by a branch
+ * Returns 0 when nothing is left within range.
+ */
+uintptr_t so_alloc_arena(so_module *mod, uintptr_t range, uintptr_t dst, size_t sz);
+// Hands an allocation back, sz as it was allocated
+void so_free_arena(so_module *mod, uintptr_t addr, size_t sz);
+void so_arena_get_stats(so_module *mod, so_arena_stats *stats);
+void so_arena_report(so_module *mod, const char *name);
+// Calls flush on every range trampolines were carved from
+void so_arena_foreach(so_module *mod, void (*flush)(uintptr_t addr, size_t size));
+void so_arena_release(so_module *mod);
+
+#endif
@@ -0,0 +1,75 @@
+/* so_dynlib.c -- hash index over the symbols provided to .so modules
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_dynlib.h"
+
+// Same function as DT_GNU_HASH
+uint32_t so_gnu_hash(const char *name) {
+	uint32_t h = 5381;
+	while (*name)
+		h = h * 33 + (uint8_t)*name++;
+	return h;
+}
+
+/*
+ * Open addressing over a power of two at least twice the entry count, so a
+ * lookup is one hash and, nearly always, a single strcmp. When a symbol is
+ * listed twice the first entry wins, as it did with the linear scans.
+ */
+int so_dynlib_init(so_dynlib_table *table, so_default_dynlib *entries, int num_entries) {
+	uint32_t size = 16;
+	while (size < (uint32_t)num_entries * 2)
+		size *= 2;
+
+	table->slots = malloc(size * sizeof(so_dynlib_slot));
+	if (!table->slots)
+		return -1;
+
+	table->entries = entries;
+	table->num_entries = num_entries;
+	table->mask = size - 1;
+
+	for (uint32_t i = 0; i < size; i++)
+		table->slots[i].index = -1;
+
+	for (int i = 0; i < num_entries; i++) {
+		uint32_t hash = so_gnu_hash(entries[i].symbol);
+		uint32_t j = hash & table->mask;
+
+		for (; table->slots[j].index >= 0; j = (j + 1) & table->mask) {
+			if (table->slots[j].hash == hash && strcmp(entries[table->slots[j].index].symbol, entries[i].symbol) == 0)
+				break;
+		}
+
+		if (table->slots[j].index < 0) {
+			table->slots[j].hash = hash;
+			table->slots[j].index = i;
+		}
+	}
+
+	return 0;
+}
+
+// hash is so_gnu_hash(symbol), shared with the lookups in so_symtab.c
+so_default_dynlib *so_dynlib_find_hash(const so_dynlib_table *table, const char *symbol, uint32_t hash) {
+	for (uint32_t j = hash & table->mask; table->slots[j].index >= 0; j = (j + 1) & table->mask) {
+		so_default_dynlib *e = &table->entries[table->slots[j].index];
+		if (table->slots[j].hash == hash && strcmp(e->symbol, symbol) == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+so_default_dynlib *so_dynlib_find(const so_dynlib_table *table, const char *symbol) {
+	return so_dynlib_find_hash(table, symbol, so_gnu_hash(symbol));
+}
@@ -0,0 +1,29 @@
+#ifndef __SO_DYNLIB_H__
+#define __SO_DYNLIB_H__
+
+#include <stdint.h>
+
+typedef struct {
+  char *symbol;
+  uintptr_t func;
+} so_default_dynlib;
+
+typedef struct {
+  uint32_t hash;
+  int index; // into entries, -1 for an empty slot
+} so_dynlib_slot;
+
+// Hash index over a so_default_dynlib array, built once before resolving
+typedef struct {
+  so_default_dynlib *entries;
+  int num_entries;
+  so_dynlib_slot *slots;
+  uint32_t mask;
+} so_dynlib_table;
+
+uint32_t so_gnu_hash(const char *name);
+int so_dynlib_init(so_dynlib_table *table, so_default_dynlib *entries, int num_entries);
+so_default_dynlib *so_dynlib_find(const so_dynlib_table *table, const char *symbol);
+so_default_dynlib *so_dynlib_find_hash(const so_dynlib_table *table, const char *symbol, uint32_t hash);
+
+#endif
@@ -0,0 +1,673 @@
+/* so_elf.c -- load, relocate and resolve .so modules
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_util.h"
+#include "so_arena.h"
+#include "so_platform.h"
+
+#define PATCH_SZ 0x10000 //64 KB-ish arenas
+
+static const so_platform *g_Platform;
+static so_module *head = NULL, *tail = NULL;
+
+void so_set_platform(const so_platform *platform) {
+	g_Platform = platform;
+}
+
+const so_platform *so_get_platform(void) {
+	return g_Platform;
+}
+
+void so_add_module(so_module *mod) {
+	if (!head && !tail) {
+		head = mod;
+		tail = mod;
+	} else {
+		tail->next = mod;
+		tail = mod;
+	}
+}
+
+so_module *so_last_module(void) {
+	return tail;
+}
+
+// Module whose text segment contains addr
+so_module *so_find_module(uintptr_t addr) {
+	for (so_module *mod = head; mod; mod = mod->next) {
+		if (addr >= mod->text_base && addr < mod->text_base + mod->text_size)
+			return mod;
+	}
+
+	return NULL;
+}
+
+int _so_load(so_module *mod, int so_blockid, void *so_data, uintptr_t load_addr) {
+	int res = 0;
+	uintptr_t data_addr = 0;
+
+	if (memcmp(so_data, ELFMAG, SELFMAG) != 0) {
+		res = -1;
+		goto err_free_so;
+	}
+
+	mod->ehdr = (Elf32_Ehdr *)so_data;
+	mod->phdr = (Elf32_Phdr *)((uintptr_t)so_data + mod->ehdr->e_phoff);
+	mod->shdr = (Elf32_Shdr *)((uintptr_t)so_data + mod->ehdr->e_shoff);
+
+	mod->shstr = (char *)((uintptr_t)so_data + mod->shdr[mod->ehdr->e_shstrndx].sh_offset);
+
+	for (int i = 0; i < mod->ehdr->e_phnum; i++) {
+		if (mod->phdr[i].p_type == PT_LOAD) {
+			void *prog_data;
+			size_t prog_size;
+
+			if ((mod->phdr[i].p_flags & PF_X) == PF_X) {
+				// Allocate arena for code patches, trampolines, etc
+				// Sits exactly under the desired allocation space
+				mod->patch_size = ALIGN_MEM(PATCH_SZ, mod->phdr[i].p_align);
+				res = mod->patch_blockid = g_Platform->alloc(1, load_addr - mod->patch_size, mod->patch_size, (void **)&mod->patch_base);
+				if (res < 0)
+					goto err_free_so;
+
+				mod->patch_head = mod->patch_base;
+
+				prog_size = ALIGN_MEM(mod->phdr[i].p_memsz, mod->phdr[i].p_align);
+				res = mod->text_blockid = g_Platform->alloc(1, load_addr, prog_size, &prog_data);
+				if (res < 0)
+					goto err_free_so;
+
+				mod->text_block_size = prog_size;
+				mod->phdr[i].p_vaddr += (Elf32_Addr)(uintptr_t)prog_data;
+
+				mod->text_base = mod->phdr[i].p_vaddr;
+				mod->text_size = mod->phdr[i].p_memsz;
+
+				// Use the .text segment padding as a code cave
+				// Word-align it to make it simpler for instruction arena allocation
+				mod->cave_size = ALIGN_MEM(prog_size - mod->phdr[i].p_memsz, 0x4);
+				mod->cave_base = mod->cave_head = (uintptr_t)prog_data + mod->phdr[i].p_memsz;
+				mod->cave_base = ALIGN_MEM(mod->cave_base, 0x4);
+				mod->cave_head = mod->cave_base;
+				g_Platform->debug("code cave: %d bytes (@0x%08X).\n", mod->cave_size, mod->cave_base);
+
+				data_addr = (uintptr_t)prog_data + prog_size;
+			} else {
+				if (data_addr == 0)
+					goto err_free_so;
+
+				if (mod->n_data >= MAX_DATA_SEG)
+					goto err_free_data;
+
+				prog_size = ALIGN_MEM(mod->phdr[i].p_memsz + mod->phdr[i].p_vaddr - (data_addr - mod->text_base), mod->phdr[i].p_align);
+
+				res = mod->data_blockid[mod->n_data] = g_Platform->alloc(0, data_addr, prog_size, &prog_data);
+				if (res < 0)
+					goto err_free_text;
+
+				mod->data_block_base[mod->n_data] = (uintptr_t)prog_data;
+				mod->data_block_size[mod->n_data] = prog_size;
+				data_addr = (uintptr_t)prog_data + prog_size;
+
+				mod->phdr[i].p_vaddr += (Elf32_Addr)mod->text_base;
+
+				mod->data_base[mod->n_data] = mod->phdr[i].p_vaddr;
+				mod->data_size[mod->n_data] = mod->phdr[i].p_memsz;
+				mod->n_data++;
+			}
+
+			char *zero = malloc(prog_size - mod->phdr[i].p_filesz);
+			memset(zero, 0, prog_size - mod->phdr[i].p_filesz);
+			g_Platform->copy(prog_data + mod->phdr[i].p_filesz, zero, prog_size - mod->phdr[i].p_filesz);
+			free(zero);
+
+			g_Platform->copy((void *)(uintptr_t)mod->phdr[i].p_vaddr, (void *)((uintptr_t)so_data + mod->phdr[i].p_offset), mod->phdr[i].p_filesz);
+		}
+	}
+
+	for (int i = 0; i < mod->ehdr->e_shnum; i++) {
+		char *sh_name = mod->shstr + mod->shdr[i].sh_name;
+		uintptr_t sh_addr = mod->text_base + mod->shdr[i].sh_addr;
+		size_t sh_size = mod->shdr[i].sh_size;
+		if (strcmp(sh_name, ".dynamic") == 0) {
+			mod->dynamic = (Elf32_Dyn *)sh_addr;
+			mod->num_dynamic = sh_size / sizeof(Elf32_Dyn);
+		} else if (strcmp(sh_name, ".dynstr") == 0) {
+			mod->dynstr = (char *)sh_addr;
+		} else if (strcmp(sh_name, ".dynsym") == 0) {
+			mod->dynsym = (Elf32_Sym *)sh_addr;
+			mod->num_dynsym = sh_size / sizeof(Elf32_Sym);
+		} else if (strcmp(sh_name, ".rel.dyn") == 0) {
+			mod->reldyn = (Elf32_Rel *)sh_addr;
+			mod->num_reldyn = sh_size / sizeof(Elf32_Rel);
+		} else if (strcmp(sh_name, ".rel.plt") == 0) {
+			mod->relplt = (Elf32_Rel *)sh_addr;
+			mod->num_relplt = sh_size / sizeof(Elf32_Rel);
+		} else if (strcmp(sh_name, ".init_array") == 0) {
+			mod->init_array = (void *)sh_addr;
+			mod->num_init_array = sh_size / sizeof(uint32_t);
+		} else if (strcmp(sh_name, ".hash") == 0) {
+			mod->hash = (void *)sh_addr;
+		} else if (strcmp(sh_name, ".gnu.hash") == 0) {
+			mod->gnu_hash = (void *)sh_addr;
+		}
+	}
+
+	if (mod->dynamic == NULL ||
+		mod->dynstr == NULL ||
+		mod->dynsym == NULL ||
+		mod->reldyn == NULL ||
+		mod->relplt == NULL) {
+		res = -2;
+		goto err_free_data;
+	}
+
+	for (int i = 0; i < mod->num_dynamic; i++) {
+		switch (mod->dynamic[i].d_tag) {
+		case DT_SONAME:
+			mod->soname = mod->dynstr + mod->dynamic[i].d_un.d_ptr;
+			break;
+		case DT_HASH:
+			mod->hash = (uint32_t *)(mod->text_base + mod->dynamic[i].d_un.d_ptr);
+			break;
+		case DT_GNU_HASH:
+			mod->gnu_hash = (uint32_t *)(mod->text_base + mod->dynamic[i].d_un.d_ptr);
+			break;
+		default:
+			break;
+		}
+	}
+
+	so_symtab_init(&mod->symtab, mod->dynsym, mod->num_dynsym, mod->dynstr, mod->hash, mod->gnu_hash);
+
+	g_Platform->free(so_blockid);
+
+	so_add_module(mod);
+
+	return 0;
+
+err_free_data:
+	for (int i = 0; i < mod->n_data; i++)
+		g_Platform->free(mod->data_blockid[i]);
+err_free_text:
+	g_Platform->free(mod->text_blockid);
+err_free_so:
+	g_Platform->free(so_blockid);
+
+	return res;
+}
+
+void so_unload(so_module *mod) {
+	so_module *prev = NULL;
+	for (so_module *curr = head; curr; prev = curr, curr = curr->next) {
+		if (curr != mod)
+			continue;
+		if (prev)
+			prev->next = mod->next;
+		else
+			head = mod->next;
+		if (tail == mod)
+			tail = prev;
+		break;
+	}
+
+	so_symtab_free(&mod->symtab);
+	so_arena_release(mod);
+	for (int i = 0; i < mod->n_data; i++)
+		g_Platform->free(mod->data_blockid[i]);
+	g_Platform->free(mod->text_blockid);
+	g_Platform->free(mod->patch_blockid);
+	memset(mod, 0, sizeof(so_module));
+}
+
+int so_mem_load(so_module *mod, void *buffer, size_t so_size, uintptr_t load_addr) {
+	int so_blockid;
+	void *so_data;
+
+	memset(mod, 0, sizeof(so_module));
+
+	so_blockid = g_Platform->alloc(0, 0, so_size, &so_data);
+	if (so_blockid < 0)
+		return so_blockid;
+
+	memcpy(so_data, buffer, so_size);
+
+	return _so_load(mod, so_blockid, so_data, load_addr);
+}
+
+int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr) {
+	int so_blockid;
+	void *so_data;
+	size_t so_size;
+
+	memset(mod, 0, sizeof(so_module));
+
+	so_blockid = g_Platform->read_file(filename, &so_data, &so_size);
+	if (so_blockid < 0)
+		return so_blockid;
+
+	return _so_load(mod, so_blockid, so_data, load_addr);
+}
+
+int so_relocate(so_module *mod) {
+	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		uint32_t *ptr = (uint32_t *)(mod->text_base + rel->r_offset);
+
+		int type = ELF32_R_TYPE(rel->r_info);
+		switch (type) {
+		case R_ARM_ABS32:
+			if (sym->st_shndx != SHN_UNDEF)
+				*ptr += mod->text_base + sym->st_value;
+			break;
+		case R_ARM_RELATIVE:
+			*ptr += mod->text_base;
+			break;
+		case R_ARM_GLOB_DAT:
+		case R_ARM_JUMP_SLOT:
+		{
+			if (sym->st_shndx != SHN_UNDEF)
+				*ptr = mod->text_base + sym->st_value;
+			break;
+		}
+		default:
+			g_Platform->fatal("Error unknown relocation type %x\n", type);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+// hash is so_gnu_hash(symbol), computed once for all the dependencies
+static uintptr_t so_resolve_link(so_module *mod, const char *symbol, uint32_t hash) {
+	for (int i = 0; i < mod->num_dynamic; i++) {
+		switch (mod->dynamic[i].d_tag) {
+		case DT_NEEDED:
+		{
+			so_module *curr = head;
+			while (curr) {
+				if (curr != mod && strcmp(curr->soname, mod->dynstr + mod->dynamic[i].d_un.d_ptr) == 0) {
+					int index = so_symtab_lookup_hash(&curr->symtab, symbol, hash);
+					if (index != -1)
+						return curr->text_base + curr->dynsym[index].st_value;
+				}
+				curr = curr->next;
+			}
+
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+void reloc_err(uintptr_t got0)
+{
+	// Find to which module this missing symbol belongs
+	int found = 0;
+	so_module *curr = head;
+	while (curr && !found) {
+		for (int i = 0; i < curr->n_data; i++)
+			if ((got0 >= curr->data_base[i]) && (got0 < curr->data_base[i] + curr->data_size[i]))
+				found = 1;
+
+		if (!found)
+			curr = curr->next;
+	}
+
+	if (curr) {
+		// Attempt to find symbol name and then display error
+		for (int i = 0; i < curr->num_reldyn + curr->num_relplt; i++) {
+			Elf32_Rel *rel = i < curr->num_reldyn ? &curr->reldyn[i] : &curr->relplt[i - curr->num_reldyn];
+			Elf32_Sym *sym = &curr->dynsym[ELF32_R_SYM(rel->r_info)];
+			uintptr_t ptr = curr->text_base + rel->r_offset;
+
+			int type = ELF32_R_TYPE(rel->r_info);
+			switch (type) {
+				case R_ARM_JUMP_SLOT:
+				{
+					if (got0 == ptr) {
+						g_Platform->fatal("Unknown symbol \"%s\" (%p).\n", curr->dynstr + sym->st_name, (void*)got0);
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	// Ooops, this shouldn't have happened.
+	g_Platform->fatal("Unknown symbol \"???\" (%p).\n", (void*)got0);
+}
+
+int so_resolve(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only) {
+	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		uint32_t *ptr = (uint32_t *)(mod->text_base + rel->r_offset);
+
+		int type = ELF32_R_TYPE(rel->r_info);
+		switch (type) {
+		case R_ARM_ABS32:
+		case R_ARM_GLOB_DAT:
+		case R_ARM_JUMP_SLOT:
+		{
+			if (sym->st_shndx == SHN_UNDEF) {
+				const char *name = mod->dynstr + sym->st_name;
+				uint32_t hash = so_gnu_hash(name);
+				int resolved = 0;
+				if (!default_dynlib_only) {
+					uintptr_t link = so_resolve_link(mod, name, hash);
+					if (link) {
+						// debugPrintf("Resolved from dependencies: %s\n", mod->dynstr + sym->st_name);
+						if (type == R_ARM_ABS32)
+							*ptr += link;
+						else
+							*ptr = link;
+						resolved = 1;
+					}
+				}
+
+				so_default_dynlib *lib = so_dynlib_find_hash(default_dynlib, name, hash);
+				if (lib) {
+					*ptr = lib->func;
+					resolved = 1;
+				}
+
+				if (!resolved) {
+					if (type == R_ARM_JUMP_SLOT) {
+						g_Platform->debug("Unresolved import: %s\n", mod->dynstr + sym->st_name);
+						*ptr = (uintptr_t)g_Platform->unresolved;
+					}
+					else {
+						//g_Platform->debug("Unresolved import: %s\n", mod->dynstr + sym->st_name);
+					}
+				}
+			}
+
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+// How so_link bound an undefined symbol, shared by all its relocations
+typedef struct {
+	uint32_t link; // from a DT_NEEDED module, 0 if none
+	so_default_dynlib *lib; // overrides link
+	int looked_up;
+	int reported;
+} so_import;
+
+static void so_link_rels(so_module *mod, Elf32_Rel *rels, int num_rels, so_import *imports, so_dynlib_table *default_dynlib, int default_dynlib_only, int lazy) {
+	uintptr_t base = mod->text_base;
+
+	for (int i = 0; i < num_rels; i++) {
+		uint32_t *ptr = (uint32_t *)(base + rels[i].r_offset);
+		int type = ELF32_R_TYPE(rels[i].r_info);
+
+		if (type == R_ARM_RELATIVE) {
+			*ptr += base;
+			continue;
+		}
+
+		if (type != R_ARM_ABS32 && type != R_ARM_GLOB_DAT && type != R_ARM_JUMP_SLOT)
+			g_Platform->fatal("Error unknown relocation type %x\n", type);
+
+		int index = ELF32_R_SYM(rels[i].r_info);
+		Elf32_Sym *sym = &mod->dynsym[index];
+
+		if (sym->st_shndx != SHN_UNDEF) {
+			if (type == R_ARM_ABS32)
+				*ptr += base + sym->st_value;
+			else
+				*ptr = base + sym->st_value;
+			continue;
+		}
+
+		if (lazy && type == R_ARM_JUMP_SLOT) {
+			*ptr = mod->lazy_resolver;
+			mod->num_lazy++;
+			continue;
+		}
+
+		so_import *imp = &imports[index];
+		if (!imp->looked_up) {
+			const char *name = mod->dynstr + sym->st_name;
+			uint32_t hash = so_gnu_hash(name);
+			if (!default_dynlib_only)
+				imp->link = so_resolve_link(mod, name, hash);
+			imp->lib = so_dynlib_find_hash(default_dynlib, name, hash);
+			imp->looked_up = 1;
+		}
+
+		if (imp->lib) {
+			*ptr = imp->lib->func;
+		} else if (imp->link) {
+			if (type == R_ARM_ABS32)
+				*ptr += imp->link;
+			else
+				*ptr = imp->link;
+		} else if (type == R_ARM_JUMP_SLOT) {
+			if (!imp->reported)
+				g_Platform->debug("Unresolved import: %s\n", mod->dynstr + sym->st_name);
+			imp->reported = 1;
+			*ptr = (uintptr_t)g_Platform->unresolved;
+		}
+	}
+}
+
+/*
+ * so_relocate followed by so_resolve in a single pass over .rel.dyn and
+ * .rel.plt. Every relocation is decoded once, and every import is looked up
+ * once however many relocations use it.
+ */
+static int so_link_all(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only, int lazy) {
+	so_import *imports = calloc(mod->num_dynsym, sizeof(so_import));
+	if (!imports)
+		return -1;
+
+	so_link_rels(mod, mod->reldyn, mod->num_reldyn, imports, default_dynlib, default_dynlib_only, lazy);
+	so_link_rels(mod, mod->relplt, mod->num_relplt, imports, default_dynlib, default_dynlib_only, lazy);
+
+	free(imports);
+	return 0;
+}
+
+int so_link(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only) {
+	return so_link_all(mod, default_dynlib, default_dynlib_only, 0);
+}
+
+/*
+ * Lazy binding: so_link_lazy links like so_link, except that every undefined
+ * R_ARM_JUMP_SLOT is left pointing at a resolver in the patch arena. PLT
+ * entries load their slot with "ldr pc, [ip, #x]!", so ip holds the slot
+ * address when the resolver runs, as plt0_stub relies on too. The resolver
+ * has so_lazy_bind look the import up and patch the slot, then jumps to the
+ * import with the caller's arguments. Imports never called are never looked
+ * up.
+ */
+static const uint32_t lazy_resolver[] = {
+	0xe92d500f, // push {r0-r3, ip, lr}
+	0xed2d0b10, // vpush {d0-d7}
+	0xe1a0000c, // mov r0, ip
+	0xe59f1014, // ldr r1, [pc, #20] ; mod
+	0xe59f2014, // ldr r2, [pc, #20] ; so_lazy_bind
+	0xe12fff32, // blx r2
+	0xecbd0b10, // vpop {d0-d7}
+	0xe58d0010, // str r0, [sp, #16] ; popped into ip
+	0xe8bd500f, // pop {r0-r3, ip, lr}
+	0xe12fff1c, // bx ip
+};
+
+#define LAZY_RESOLVER_WORDS (sizeof(lazy_resolver) / sizeof(uint32_t))
+
+int so_lazy_init(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only) {
+	uint32_t code[LAZY_RESOLVER_WORDS + 2];
+	uintptr_t prev = mod->lazy_resolver;
+
+	uintptr_t resolver = so_alloc_arena(mod, 0, 0, sizeof(code));
+	if (!resolver)
+		return -1;
+
+	memcpy(code, lazy_resolver, sizeof(lazy_resolver));
+	code[LAZY_RESOLVER_WORDS] = (uint32_t)(uintptr_t)mod;
+	code[LAZY_RESOLVER_WORDS + 1] = (uint32_t)(uintptr_t)so_lazy_bind;
+	g_Platform->copy((void *)resolver, code, sizeof(code));
+
+	mod->lazy_resolver = resolver;
+	mod->lazy_dynlib = default_dynlib;
+	mod->lazy_dynlib_only = default_dynlib_only;
+	mod->num_lazy = 0;
+	mod->num_lazy_bound = 0;
+
+	// A restored snapshot still points at the resolver of the boot that saved it
+	if (prev) {
+		for (int i = 0; i < mod->num_relplt; i++) {
+			uint32_t *ptr = (uint32_t *)(mod->text_base + mod->relplt[i].r_offset);
+			if (ELF32_R_TYPE(mod->relplt[i].r_info) == R_ARM_JUMP_SLOT && *ptr == (uint32_t)prev) {
+				*ptr = resolver;
+				mod->num_lazy++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int so_link_lazy(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only) {
+	if (so_lazy_init(mod, default_dynlib, default_dynlib_only) < 0)
+		return -1;
+
+	return so_link_all(mod, default_dynlib, default_dynlib_only, 1);
+}
+
+// Where the import behind a lazy slot lives, 0 if nothing provides it
+static uintptr_t so_lazy_lookup(so_module *mod, uint32_t *slot) {
+	uint32_t offset = (uintptr_t)slot - mod->text_base;
+	Elf32_Rel *rel = NULL;
+
+	// .rel.plt is normally in the order of the GOT
+	int guess = (offset - mod->relplt[0].r_offset) / sizeof(uint32_t);
+	if (guess >= 0 && guess < mod->num_relplt && mod->relplt[guess].r_offset == offset) {
+		rel = &mod->relplt[guess];
+	} else {
+		for (int i = 0; i < mod->num_relplt && !rel; i++) {
+			if (mod->relplt[i].r_offset == offset)
+				rel = &mod->relplt[i];
+		}
+	}
+	if (!rel)
+		return 0;
+
+	Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+	const char *name = mod->dynstr + sym->st_name;
+	uint32_t hash = so_gnu_hash(name);
+
+	so_default_dynlib *lib = so_dynlib_find_hash(mod->lazy_dynlib, name, hash);
+	if (lib)
+		return lib->func;
+	if (!mod->lazy_dynlib_only)
+		return so_resolve_link(mod, name, hash);
+
+	return 0;
+}
+
+// Threads may race to bind the same slot, only the first one counts it
+static void so_lazy_set(so_module *mod, uint32_t *slot, uintptr_t target) {
+	if (__sync_bool_compare_and_swap(slot, (uint32_t)mod->lazy_resolver, (uint32_t)target))
+		__sync_fetch_and_add(&mod->num_lazy_bound, 1);
+}
+
+// Called by the resolver with the slot of the import being called
+uintptr_t so_lazy_bind(uint32_t *slot, so_module *mod) {
+	uintptr_t target = so_lazy_lookup(mod, slot);
+	if (!target)
+		reloc_err((uintptr_t)slot);
+
+	so_lazy_set(mod, slot, target);
+	return target;
+}
+
+// Binds every slot left to the resolver, like so_link would have
+void so_lazy_bind_all(so_module *mod) {
+	for (int i = 0; i < mod->num_relplt; i++) {
+		uint32_t *ptr = (uint32_t *)(mod->text_base + mod->relplt[i].r_offset);
+		if (!mod->lazy_resolver || *ptr != (uint32_t)mod->lazy_resolver)
+			continue;
+
+		uintptr_t target = so_lazy_lookup(mod, ptr);
+		if (!target) {
+			g_Platform->debug("Unresolved import: %s\n", mod->dynstr + mod->dynsym[ELF32_R_SYM(mod->relplt[i].r_info)].st_name);
+			target = (uintptr_t)g_Platform->unresolved;
+		}
+		so_lazy_set(mod, ptr, target);
+	}
+}
+
+// The slots of a module linked by so_link_lazy the game has called so far
+void so_lazy_report(so_module *mod, const char *name) {
+	if (!mod->lazy_resolver)
+		return;
+
+	g_Platform->debug("%s: %d of %d lazy imports bound\n", name, mod->num_lazy_bound, mod->num_lazy);
+}
+
+int so_resolve_with_dummy(so_module *mod, so_dynlib_table *default_dynlib) {
+	for (int i = 0; i < mod->num_reldyn + mod->num_relplt; i++) {
+		Elf32_Rel *rel = i < mod->num_reldyn ? &mod->reldyn[i] : &mod->relplt[i - mod->num_reldyn];
+		Elf32_Sym *sym = &mod->dynsym[ELF32_R_SYM(rel->r_info)];
+		uint32_t *ptr = (uint32_t *)(mod->text_base + rel->r_offset);
+
+		int type = ELF32_R_TYPE(rel->r_info);
+		switch (type) {
+		case R_ARM_ABS32:
+		case R_ARM_GLOB_DAT:
+		case R_ARM_JUMP_SLOT:
+		{
+			if (sym->st_shndx == SHN_UNDEF) {
+				if (so_dynlib_find(default_dynlib, mod->dynstr + sym->st_name))
+					*ptr = (uintptr_t)g_Platform->dummy;
+			}
+
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	return 0;
+}
+
+void so_initialize(so_module *mod) {
+	for (int i = 0; i < mod->num_init_array; i++) {
+		if (mod->init_array[i])
+			((int (*)(void))(uintptr_t)mod->init_array[i])();
+	}
+}
+
+uintptr_t so_symbol(so_module *mod, const char *symbol) {
+	int index = so_symtab_lookup(&mod->symtab, symbol);
+	if (index == -1)
+		return 0;
+
+	return mod->text_base + mod->dynsym[index].st_value;
+}
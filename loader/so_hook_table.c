@@ -0,0 +1,169 @@
+/* so_hook_table.c -- installs tables of hooks in one go
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <kubridge.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "dialog.h"
+#include "so_util.h"
+#include "so_hook_table.h"
+
+#define PAGE_SIZE 0x1000
+
+typedef struct {
+	uint32_t key; // hash bucket, so that lookups walk the tables in order
+	uint32_t hash;
+	int def;
+} lookup;
+
+static int lookup_cmp(const void *a, const void *b) {
+	const lookup *x = a, *y = b;
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->def - y->def;
+}
+
+static int patch_cmp(const void *a, const void *b) {
+	const so_hook_patch *x = a, *y = b;
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return 0;
+}
+
+static so_hook_patch *add_patch(so_hook_batch *batch) {
+	if (batch->num_patches == batch->cap_patches) {
+		int cap = batch->cap_patches ? batch->cap_patches * 2 : 64;
+		so_hook_patch *patches = realloc(batch->patches, cap * sizeof(so_hook_patch));
+		if (!patches)
+			fatal_error("Error could not allocate %d hooks.", cap);
+		batch->patches = patches;
+		batch->cap_patches = cap;
+	}
+
+	return &batch->patches[batch->num_patches++];
+}
+
+void so_hook_batch_init(so_hook_batch *batch, so_module *mod) {
+	memset(batch, 0, sizeof(so_hook_batch));
+	batch->mod = mod;
+}
+
+int so_hook_batch_add(so_hook_batch *batch, const so_hook_def *defs, int num) {
+	so_symtab *symtab = &batch->mod->symtab;
+	int missing = 0;
+
+	uint64_t start = sceKernelGetProcessTimeWide();
+
+	lookup *lookups = malloc(num * sizeof(lookup));
+	uintptr_t *addrs = malloc(num * sizeof(uintptr_t));
+	if (!lookups || !addrs)
+		fatal_error("Error could not allocate %d hooks.", num);
+
+	for (int i = 0; i < num; i++) {
+		lookups[i].hash = so_gnu_hash(defs[i].symbol);
+		lookups[i].key = symtab->gnu_hash ? lookups[i].hash % symtab->gnu_nbucket : lookups[i].hash;
+		lookups[i].def = i;
+	}
+	qsort(lookups, num, sizeof(lookup), lookup_cmp);
+
+	for (int i = 0; i < num; i++) {
+		int def = lookups[i].def;
+		int index = so_symtab_lookup_hash(symtab, defs[def].symbol, lookups[i].hash);
+		if (index == -1) {
+			debugPrintf("Hook %s: symbol not found\n", defs[def].symbol);
+			addrs[def] = 0;
+			missing++;
+			continue;
+		}
+		addrs[def] = batch->mod->text_base + batch->mod->dynsym[index].st_value;
+	}
+
+	uint64_t resolved = sceKernelGetProcessTimeWide();
+
+	for (int i = 0; i < num; i++) {
+		so_hook h;
+		if (!addrs[i])
+			continue;
+
+		// Only a hook kept for SO_CONTINUE needs a trampoline, nothing would free the others
+		so_hook_patch *patch = add_patch(batch);
+		patch->size = so_hook_prepare(&h, addrs[i], defs[i].dst, defs[i].hook != NULL, &patch->addr, patch->bytes);
+		if (defs[i].hook)
+			*defs[i].hook = h;
+	}
+
+	free(addrs);
+	free(lookups);
+
+	batch->resolve_time += resolved - start;
+	batch->prepare_time += sceKernelGetProcessTimeWide() - resolved;
+	batch->num_missing += missing;
+	return missing;
+}
+
+void so_hook_batch_add_patch(so_hook_batch *batch, uintptr_t addr, const void *bytes, size_t size) {
+	so_hook_patch *patch = add_patch(batch);
+	patch->addr = addr;
+	patch->size = size;
+	memcpy(patch->bytes, bytes, size);
+}
+
+int so_hook_batch_overlaps(so_hook_batch *batch, uintptr_t addr, size_t size) {
+	for (int i = 0; i < batch->num_patches; i++) {
+		if (batch->patches[i].addr < addr + size && addr < batch->patches[i].addr + batch->patches[i].size)
+			return 1;
+	}
+
+	return 0;
+}
+
+void so_hook_batch_commit(so_hook_batch *batch) {
+	static uint8_t page[PAGE_SIZE + SO_HOOK_PATCH_MAX];
+	int num_pages = 0;
+
+	uint64_t start = sceKernelGetProcessTimeWide();
+
+	qsort(batch->patches, batch->num_patches, sizeof(so_hook_patch), patch_cmp);
+
+	// Patches starting on the same page go out in a single copy, with the code
+	// in between them copied over unchanged
+	for (int i = 0; i < batch->num_patches;) {
+		uintptr_t base = batch->patches[i].addr;
+		uintptr_t end = base;
+		int j;
+
+		for (j = i; j < batch->num_patches && batch->patches[j].addr / PAGE_SIZE == base / PAGE_SIZE; j++) {
+			if (batch->patches[j].addr + batch->patches[j].size > end)
+				end = batch->patches[j].addr + batch->patches[j].size;
+		}
+
+		memcpy(page, (void *)base, end - base);
+		for (int k = i; k < j; k++)
+			memcpy(page + (batch->patches[k].addr - base), batch->patches[k].bytes, batch->patches[k].size);
+		kuKernelCpuUnrestrictedMemcpy((void *)base, page, end - base);
+
+		num_pages++;
+		i = j;
+	}
+
+	uint64_t written = sceKernelGetProcessTimeWide();
+	so_flush_caches(batch->mod);
+	uint64_t flushed = sceKernelGetProcessTimeWide();
+
+	debugPrintf("%d hooks (%d missing) on %d pages: resolve %llu us, prepare %llu us, write %llu us, flush %llu us\n",
+		batch->num_patches, batch->num_missing, num_pages, batch->resolve_time, batch->prepare_time,
+		written - start, flushed - written);
+
+	free(batch->patches);
+	batch->patches = NULL;
+	batch->num_patches = batch->cap_patches = 0;
+}
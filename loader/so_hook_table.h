@@ -0,0 +1,44 @@
+#ifndef __SO_HOOK_TABLE_H__
+#define __SO_HOOK_TABLE_H__
+
+#include "so_util.h"
+
+// One hook of a table: symbol of the module is redirected to dst
+typedef struct {
+  const char *symbol;
+  uintptr_t dst;
+  so_hook *hook; // receives the hook, for SO_CONTINUE, may be NULL
+} so_hook_def;
+
+#define SO_HOOK(symbol, dst) { symbol, (uintptr_t)(dst), NULL }
+#define SO_HOOK_KEEP(symbol, dst, hook) { symbol, (uintptr_t)(dst), hook }
+#define SO_HOOK_COUNT(defs) (sizeof(defs) / sizeof(defs[0]))
+
+typedef struct {
+  uintptr_t addr;
+  size_t size;
+  uint8_t bytes[SO_HOOK_PATCH_MAX];
+} so_hook_patch;
+
+// Hooks of a module collected before any of them is written
+typedef struct {
+  so_module *mod;
+  so_hook_patch *patches;
+  int num_patches, cap_patches;
+  int num_missing;
+  uint64_t resolve_time, prepare_time; // microseconds
+} so_hook_batch;
+
+void so_hook_batch_init(so_hook_batch *batch, so_module *mod);
+// Resolves the symbols of defs and sets up their hooks. Returns how many of
+// them the module does not export.
+int so_hook_batch_add(so_hook_batch *batch, const so_hook_def *defs, int num);
+// Queues the size bytes so_hook_prepare made to be written at addr
+void so_hook_batch_add_patch(so_hook_batch *batch, uintptr_t addr, const void *bytes, size_t size);
+// Whether a hook of the batch already overwrites some of [addr, addr + size)
+int so_hook_batch_overlaps(so_hook_batch *batch, uintptr_t addr, size_t size);
+// Writes every hook, a page at a time, flushes the caches of the module once
+// and reports how long it all took
+void so_hook_batch_commit(so_hook_batch *batch);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __SO_PLATFORM_H__
+#define __SO_PLATFORM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory and files under the ELF loader of so_elf.c, so that loading,
+// relocating and resolving modules can also run on a host. Block ids are
+// >= 0, errors < 0.
+typedef struct {
+	const char *name;
+	// Allocates size bytes at addr, or anywhere if addr is 0
+	int (*alloc)(int exec, uintptr_t addr, size_t size, void **base);
+	void (*free)(int block);
+	// Writes memory that may not be writable directly, like the text segment
+	void (*copy)(void *dst, const void *src, size_t size);
+	// Reads a whole file into a new block
+	int (*read_file)(const char *path, void **data, size_t *size);
+	// Size and modification time of a file, to tell when it has changed
+	int (*stat)(const char *path, uint64_t *size, uint64_t *mtime);
+	// Creates or truncates a file, then appends to it
+	int (*create)(const char *path);
+	int (*write)(int fd, const void *data, size_t size);
+	void (*close)(int fd);
+	void (*fatal)(const char *fmt, ...) __attribute__((noreturn));
+	int (*debug)(char *text, ...);
+	// Bound to the imports nothing provides, and to the ones stubbed out
+	void (*unresolved)();
+	int (*dummy)();
+} so_platform;
+
+extern const so_platform vita_platform; // kubridge memory blocks, see so_platform_vita.c
+extern const so_platform mmap_platform; // host only, anonymous mappings, see so_platform_posix.c
+
+#endif
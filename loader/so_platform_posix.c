@@ -0,0 +1,167 @@
+/* so_platform_posix.c -- anonymous mappings for the ELF loader, for running it on a host
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "so_platform.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+// Modules are only loaded and inspected here, never run, so nothing is
+// mapped executable. The relocated words are 32-bit, which is why blocks
+// asked for at a fixed address must land exactly there.
+#define MAX_BLOCKS 64
+
+static struct {
+	void *base;
+	size_t size;
+} g_Blocks[MAX_BLOCKS];
+
+static int mmap_alloc(int exec, uintptr_t addr, size_t size, void **base) {
+	int block;
+
+	(void)exec;
+
+	for (block = 0; block < MAX_BLOCKS; block++) {
+		if (!g_Blocks[block].base)
+			break;
+	}
+	if (block == MAX_BLOCKS)
+		return -1;
+
+	size = (size + 0xfff) & ~0xfff;
+	void *p = mmap((void *)addr, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | (addr ? MAP_FIXED_NOREPLACE : 0), -1, 0);
+	if (p == MAP_FAILED)
+		return -1;
+
+	if (addr && p != (void *)addr) {
+		munmap(p, size);
+		return -1;
+	}
+
+	g_Blocks[block].base = p;
+	g_Blocks[block].size = size;
+	*base = p;
+	return block;
+}
+
+static void mmap_free(int block) {
+	if (block < 0 || block >= MAX_BLOCKS || !g_Blocks[block].base)
+		return;
+
+	munmap(g_Blocks[block].base, g_Blocks[block].size);
+	g_Blocks[block].base = NULL;
+}
+
+static void mmap_copy(void *dst, const void *src, size_t size) {
+	memcpy(dst, src, size);
+}
+
+static int mmap_read_file(const char *path, void **data, size_t *size) {
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	*size = st.st_size;
+	int block = mmap_alloc(0, 0, *size ? *size : 1, data);
+	for (size_t done = 0; block >= 0 && done < *size;) {
+		ssize_t n = read(fd, (uint8_t *)*data + done, *size - done);
+		if (n <= 0) {
+			mmap_free(block);
+			block = -1;
+			break;
+		}
+		done += n;
+	}
+	close(fd);
+
+	return block;
+}
+
+static int mmap_stat(const char *path, uint64_t *size, uint64_t *mtime) {
+	struct stat st;
+	if (stat(path, &st) < 0)
+		return -1;
+
+	*size = st.st_size;
+	*mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	return 0;
+}
+
+static int mmap_create(const char *path) {
+	return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+}
+
+static int mmap_write(int fd, const void *data, size_t size) {
+	for (size_t done = 0; done < size;) {
+		ssize_t n = write(fd, (const uint8_t *)data + done, size - done);
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return size;
+}
+
+static void mmap_close(int fd) {
+	close(fd);
+}
+
+__attribute__((noreturn)) static void mmap_fatal(const char *fmt, ...) {
+	va_list list;
+
+	va_start(list, fmt);
+	vfprintf(stderr, fmt, list);
+	va_end(list);
+
+	exit(1);
+}
+
+static int mmap_debug(char *text, ...) {
+	(void)text;
+	return 0;
+}
+
+static void mmap_unresolved() {
+	mmap_fatal("Unresolved import called\n");
+}
+
+static int mmap_dummy() {
+	return 0;
+}
+
+const so_platform mmap_platform = {
+	.name = "mmap",
+	.alloc = mmap_alloc,
+	.free = mmap_free,
+	.copy = mmap_copy,
+	.read_file = mmap_read_file,
+	.stat = mmap_stat,
+	.create = mmap_create,
+	.write = mmap_write,
+	.close = mmap_close,
+	.fatal = mmap_fatal,
+	.debug = mmap_debug,
+	.unresolved = mmap_unresolved,
+	.dummy = mmap_dummy,
+};
@@ -0,0 +1,111 @@
+/* so_platform_vita.c -- memory blocks for the ELF loader through kubridge
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <kubridge.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "dialog.h"
+#include "so_util.h"
+#include "so_platform.h"
+
+#ifndef SCE_KERNEL_MEMBLOCK_TYPE_USER_RX
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RX                 (0x0C20D050)
+#endif
+
+static int vita_alloc(int exec, uintptr_t addr, size_t size, void **base) {
+	SceUID blockid;
+
+	if (addr) {
+		SceKernelAllocMemBlockKernelOpt opt;
+		memset(&opt, 0, sizeof(SceKernelAllocMemBlockKernelOpt));
+		opt.size = sizeof(SceKernelAllocMemBlockKernelOpt);
+		opt.attr = 0x1;
+		opt.field_C = (SceUInt32)addr;
+		if (exec)
+			blockid = kuKernelAllocMemBlock("rx_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RX, size, &opt);
+		else
+			blockid = kuKernelAllocMemBlock("rw_block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, size, &opt);
+	} else {
+		blockid = sceKernelAllocMemBlock("so block", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, (size + 0xfff) & ~0xfff, NULL);
+	}
+
+	if (blockid >= 0)
+		sceKernelGetMemBlockBase(blockid, base);
+
+	return blockid;
+}
+
+static void vita_free(int block) {
+	sceKernelFreeMemBlock(block);
+}
+
+static void vita_copy(void *dst, const void *src, size_t size) {
+	kuKernelCpuUnrestrictedMemcpy(dst, src, size);
+}
+
+static int vita_read_file(const char *path, void **data, size_t *size) {
+	SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+		return fd;
+
+	*size = sceIoLseek(fd, 0, SCE_SEEK_END);
+	sceIoLseek(fd, 0, SCE_SEEK_SET);
+
+	SceUID blockid = vita_alloc(0, 0, *size, data);
+	if (blockid >= 0)
+		sceIoRead(fd, *data, *size);
+	sceIoClose(fd);
+
+	return blockid;
+}
+
+static int vita_stat(const char *path, uint64_t *size, uint64_t *mtime) {
+	SceIoStat stat;
+	int res = sceIoGetstat(path, &stat);
+	if (res < 0)
+		return res;
+
+	SceDateTime *t = &stat.st_mtime;
+	*size = stat.st_size;
+	*mtime = ((uint64_t)t->year << 48) | ((uint64_t)t->month << 40) | ((uint64_t)t->day << 32) |
+		((uint64_t)t->hour << 24) | ((uint64_t)t->minute << 16) | ((uint64_t)t->second << 8);
+	*mtime ^= t->microsecond;
+	return 0;
+}
+
+static int vita_create(const char *path) {
+	return sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+}
+
+static int vita_write(int fd, const void *data, size_t size) {
+	return sceIoWrite(fd, data, size);
+}
+
+static void vita_close(int fd) {
+	sceIoClose(fd);
+}
+
+const so_platform vita_platform = {
+	.name = "vita",
+	.alloc = vita_alloc,
+	.free = vita_free,
+	.copy = vita_copy,
+	.read_file = vita_read_file,
+	.stat = vita_stat,
+	.create = vita_create,
+	.write = vita_write,
+	.close = vita_close,
+	.fatal = fatal_error,
+	.debug = debugPrintf,
+	.unresolved = plt0_stub,
+	.dummy = ret0,
+};
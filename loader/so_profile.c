@@ -0,0 +1,349 @@
+/* so_profile.c -- count the calls and time of hooked functions
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <kubridge.h>
+
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "dialog.h"
+#include "so_util.h"
+#include "so_arena.h"
+#include "so_hook_table.h"
+#include "so_profile.h"
+
+#ifdef SO_PROFILE
+
+#define MAX_THREADS 64 // threads that ever call a profiled function
+#define MAX_DEPTH 64 // profiled calls in progress per thread
+#define DUMP_INTERVAL_US (1000 * 1000)
+
+// Literals of the thunk, after its code
+enum {
+	THUNK_FUNCTION = 17,
+	THUNK_ENTER,
+	THUNK_CONTINUE,
+	THUNK_EXIT,
+	THUNK_WORDS,
+};
+
+#define THUNK_SIZE (THUNK_WORDS * 4)
+
+// Every profiled function is hooked to a copy of this. profile_enter keeps
+// the return address of the call, the function is called through its
+// trampoline, and profile_exit hands the return address back.
+static const uint32_t thunk_code[THUNK_FUNCTION] = {
+	0xe92d500f, // PUSH {R0-R3, R12, LR}
+	0xe59f0038, // LDR R0, function
+	0xe1a0100e, // MOV R1, LR
+	0xe59fc034, // LDR R12, enter
+	0xe12fff3c, // BLX R12
+	0xe58d0010, // STR R0, [SP, #0x10] ; popped into R12
+	0xe8bd500f, // POP {R0-R3, R12, LR}
+	0xe35c0000, // CMP R12, #0
+	0xe59fc024, // LDR R12, continue
+	0x112fff1c, // BXNE R12 ; not counted, returns straight to the caller
+	0xe12fff3c, // BLX R12
+	0xe92d0003, // PUSH {R0, R1}
+	0xe59fc018, // LDR R12, exit
+	0xe12fff3c, // BLX R12
+	0xe1a0c000, // MOV R12, R0
+	0xe8bd0003, // POP {R0, R1}
+	0xe12fff1c, // BX R12
+};
+
+typedef struct {
+	volatile uint32_t seq; // odd while its thread updates it
+	uint32_t calls;
+	uint32_t max_ticks;
+	uint64_t ticks;
+	uint64_t self_ticks;
+} counter;
+
+typedef struct {
+	uintptr_t lr;
+	uint32_t function;
+	uint64_t start;
+	uint64_t children; // ticks of the profiled calls made from this one
+} frame;
+
+typedef struct {
+	volatile SceUID thid;
+	int depth;
+	frame stack[MAX_DEPTH];
+	counter *counters; // one per function
+} thread_buffer;
+
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+	const char *name;
+} function;
+
+static function *g_Functions;
+static int g_NumFunctions;
+static int g_CapFunctions;
+
+static thread_buffer g_Threads[MAX_THREADS];
+static counter *volatile g_Counters; // set once the profile is open
+static volatile uint32_t g_Dropped;
+
+static so_profile_record *g_Records;
+static SceUID g_ProfileFd = -1;
+static uint64_t g_ProfileStart;
+
+// Threads keep their buffer once they have one, their counters are dumped
+// after they exit
+static thread_buffer *thread_get(void) {
+	SceUID thid = sceKernelGetThreadId();
+	uint32_t i = ((uint32_t)thid * 0x9e3779b1) % MAX_THREADS;
+
+	for (int n = 0; n < MAX_THREADS; n++, i = (i + 1) % MAX_THREADS) {
+		SceUID owner = g_Threads[i].thid;
+		if (owner == thid)
+			return &g_Threads[i];
+		if (owner == 0 && __sync_bool_compare_and_swap(&g_Threads[i].thid, 0, thid))
+			return &g_Threads[i];
+	}
+
+	return NULL;
+}
+
+// Returns 0 when the call is counted, the thunk then comes back through
+// profile_exit once it returns
+static uint32_t profile_enter(uint32_t function, uintptr_t lr) {
+	if (!g_Counters)
+		return 1;
+
+	thread_buffer *t = thread_get();
+	if (!t || t->depth == MAX_DEPTH) {
+		__sync_fetch_and_add(&g_Dropped, 1);
+		return 1;
+	}
+
+	frame *f = &t->stack[t->depth++];
+	f->lr = lr;
+	f->function = function;
+	f->children = 0;
+	f->start = sceKernelGetProcessTimeWide();
+	return 0;
+}
+
+static uintptr_t profile_exit(void) {
+	uint64_t now = sceKernelGetProcessTimeWide();
+	thread_buffer *t = thread_get();
+	frame *f = &t->stack[--t->depth];
+	counter *c = &t->counters[f->function];
+	uint64_t ticks = now - f->start;
+
+	c->seq++;
+	__sync_synchronize();
+	c->calls++;
+	c->ticks += ticks;
+	c->self_ticks += ticks - f->children;
+	if (ticks > c->max_ticks)
+		c->max_ticks = ticks > UINT32_MAX ? UINT32_MAX : ticks;
+	__sync_synchronize();
+	c->seq++;
+
+	if (t->depth > 0)
+		t->stack[t->depth - 1].children += ticks;
+
+	return f->lr;
+}
+
+static int matches(const char *name, const char *const *patterns, int num_patterns) {
+	for (int i = 0; i < num_patterns; i++) {
+		if (fnmatch(patterns[i], name, 0) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void add_function(uint32_t offset, uint32_t size, const char *name) {
+	if (g_NumFunctions == g_CapFunctions) {
+		int cap = g_CapFunctions ? g_CapFunctions * 2 : 64;
+		function *functions = realloc(g_Functions, cap * sizeof(function));
+		if (!functions)
+			fatal_error("Error could not allocate %d profiled functions.", cap);
+		g_Functions = functions;
+		g_CapFunctions = cap;
+	}
+
+	g_Functions[g_NumFunctions].offset = offset;
+	g_Functions[g_NumFunctions].size = size;
+	g_Functions[g_NumFunctions].name = name;
+	g_NumFunctions++;
+}
+
+int so_profile_add(so_hook_batch *batch, const char *const *patterns, int num_patterns) {
+	so_module *mod = batch->mod;
+	int matched = 0, hooked = 0, hooked_already = 0, too_short = 0, not_movable = 0;
+
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_shndx == SHN_UNDEF)
+			continue;
+
+		const char *name = mod->dynstr + sym->st_name;
+		if (!matches(name, patterns, num_patterns))
+			continue;
+		matched++;
+
+		// Aliases, like the complete and base object constructors, share an
+		// address and are only hooked once
+		uintptr_t addr = mod->text_base + sym->st_value;
+		size_t hook_size = (addr & 3) == 3 ? 10 : 8;
+		if (sym->st_size < hook_size) {
+			too_short++;
+			continue;
+		}
+		if (so_hook_batch_overlaps(batch, addr & ~1, hook_size)) {
+			hooked_already++;
+			continue;
+		}
+
+		uintptr_t thunk = so_alloc_arena(mod, 0, 0, THUNK_SIZE);
+		if (!thunk) {
+			not_movable++;
+			continue;
+		}
+
+		uint8_t patch[SO_HOOK_PATCH_MAX];
+		uintptr_t patch_addr;
+		so_hook h;
+		size_t patch_size = so_hook_prepare(&h, addr, thunk, 1, &patch_addr, patch);
+		if (!h.trampoline) {
+			so_free_arena(mod, thunk, THUNK_SIZE);
+			not_movable++;
+			continue;
+		}
+
+		uint32_t code[THUNK_WORDS];
+		memcpy(code, thunk_code, sizeof(thunk_code));
+		code[THUNK_FUNCTION] = g_NumFunctions;
+		code[THUNK_ENTER] = (uintptr_t)&profile_enter;
+		code[THUNK_CONTINUE] = h.trampoline;
+		code[THUNK_EXIT] = (uintptr_t)&profile_exit;
+		kuKernelCpuUnrestrictedMemcpy((void *)thunk, code, sizeof(code));
+
+		so_hook_batch_add_patch(batch, patch_addr, patch, patch_size);
+		add_function(sym->st_value, sym->st_size, name);
+		hooked++;
+	}
+
+	debugPrintf("Profiling %d of %d functions: %d hooked already, %d too short, %d not movable\n",
+		hooked, matched, hooked_already, too_short, not_movable);
+	return hooked;
+}
+
+// The thread owning c may be updating it, in which case it is read again
+static void read_counter(counter *c, counter *out) {
+	for (;;) {
+		uint32_t seq = c->seq;
+		__sync_synchronize();
+		memcpy(out, (void *)c, sizeof(counter));
+		__sync_synchronize();
+		if (!(seq & 1) && c->seq == seq)
+			return;
+	}
+}
+
+static void dump(void) {
+	so_profile_snapshot snapshot;
+	uint32_t n = 0;
+
+	for (int i = 0; i < MAX_THREADS; i++) {
+		thread_buffer *t = &g_Threads[i];
+		if (t->thid == 0)
+			continue;
+
+		for (int j = 0; j < g_NumFunctions; j++) {
+			counter c;
+			read_counter(&t->counters[j], &c);
+			if (c.calls == 0)
+				continue;
+
+			so_profile_record *r = &g_Records[n++];
+			r->function = j;
+			r->thread = t->thid;
+			r->calls = c.calls;
+			r->max_ticks = c.max_ticks;
+			r->ticks = c.ticks;
+			r->self_ticks = c.self_ticks;
+		}
+	}
+
+	snapshot.time = sceKernelGetProcessTimeWide() - g_ProfileStart;
+	snapshot.num_records = n;
+	snapshot.dropped = g_Dropped;
+	sceIoWrite(g_ProfileFd, &snapshot, sizeof(snapshot));
+	sceIoWrite(g_ProfileFd, g_Records, n * sizeof(so_profile_record));
+}
+
+static int profile_thread(SceSize args, void *argp) {
+	for (;;) {
+		sceKernelDelayThread(DUMP_INTERVAL_US);
+		dump();
+	}
+
+	return 0;
+}
+
+void so_profile_start(const char *path) {
+	so_profile_header hdr;
+	static const uint8_t pad[4];
+
+	if (g_NumFunctions == 0)
+		return;
+
+	counter *counters = calloc(MAX_THREADS * g_NumFunctions, sizeof(counter));
+	g_Records = malloc(MAX_THREADS * g_NumFunctions * sizeof(so_profile_record));
+	if (!counters || !g_Records)
+		fatal_error("Error could not allocate the profile of %d functions.", g_NumFunctions);
+
+	g_ProfileFd = sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (g_ProfileFd < 0) {
+		debugPrintf("so_profile: could not open %s (0x%08X)\n", path, g_ProfileFd);
+		return;
+	}
+
+	hdr.magic = SO_PROFILE_MAGIC;
+	hdr.version = SO_PROFILE_VERSION;
+	hdr.num_functions = g_NumFunctions;
+	hdr.tick_freq = 1000000;
+	sceIoWrite(g_ProfileFd, &hdr, sizeof(hdr));
+
+	for (int i = 0; i < g_NumFunctions; i++) {
+		so_profile_function f;
+		f.offset = g_Functions[i].offset;
+		f.size = g_Functions[i].size;
+		f.name_len = strlen(g_Functions[i].name);
+		sceIoWrite(g_ProfileFd, &f, sizeof(f));
+		sceIoWrite(g_ProfileFd, g_Functions[i].name, f.name_len);
+		sceIoWrite(g_ProfileFd, pad, -f.name_len & 3);
+	}
+
+	for (int i = 0; i < MAX_THREADS; i++)
+		g_Threads[i].counters = counters + i * g_NumFunctions;
+
+	g_ProfileStart = sceKernelGetProcessTimeWide();
+	__sync_synchronize();
+	g_Counters = counters;
+
+	SceUID thid = sceKernelCreateThread("so_profile", profile_thread, 0x10000100 + 32, 0x4000, 0, 0, NULL);
+	if (thid >= 0)
+		sceKernelStartThread(thid, 0, NULL);
+}
+
+#endif
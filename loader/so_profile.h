@@ -0,0 +1,60 @@
+#ifndef __SO_PROFILE_H__
+#define __SO_PROFILE_H__
+
+#include <stdint.h>
+
+#define SO_PROFILE_MAGIC 0x464f5250 // PROF
+#define SO_PROFILE_VERSION 1
+
+/*
+ * A profile starts with a so_profile_header and num_functions
+ * so_profile_function, each followed by its name padded to 4 bytes. A
+ * so_profile_snapshot and its records follow for every dump. Counters add up
+ * from so_profile_start, so two snapshots give the calls in between.
+ */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_functions;
+  uint32_t tick_freq;
+} so_profile_header;
+
+typedef struct {
+  uint32_t offset; // from text_base, bit 0 set for Thumb
+  uint32_t size;
+  uint32_t name_len;
+} so_profile_function;
+
+typedef struct {
+  uint64_t time; // since so_profile_start, in ticks
+  uint32_t num_records;
+  uint32_t dropped; // calls left uncounted: too many threads or too deep
+} so_profile_snapshot;
+
+// Calls of a function by a thread, only for the ones that made any
+typedef struct {
+  uint32_t function;
+  uint32_t thread; // SceUID
+  uint32_t calls;
+  uint32_t max_ticks; // longest single call
+  uint64_t ticks; // from entry to return
+  uint64_t self_ticks; // less the ticks of the profiled functions it called
+} so_profile_record;
+
+#ifdef SO_PROFILE
+#include "so_hook_table.h"
+
+/*
+ * Hooks the functions of the module of batch whose names match one of the
+ * fnmatch patterns with thunks counting their calls and time into per-thread
+ * buffers. Functions the batch hooks already, shorter than a hook, or whose
+ * prologue can not be moved are left out. Add it after the other hooks of the
+ * batch. Functions that exceptions or longjmp leave must not be profiled, the
+ * thunk would never see them return. Returns the number of functions hooked.
+ */
+int so_profile_add(so_hook_batch *batch, const char *const *patterns, int num_patterns);
+// Writes the function table to path, then a snapshot every second
+void so_profile_start(const char *path);
+#endif
+
+#endif
@@ -0,0 +1,297 @@
+/* so_snapshot.c -- save relocated modules and restore them on later boots
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_util.h"
+#include "so_snapshot.h"
+#include "so_platform.h"
+#include "shader_key.h"
+
+static void key_update(uint32_t key[4], const void *data, size_t size) {
+	uint32_t out[4];
+
+	murmur3_x86_128(data, size, key[0], out);
+	for (int i = 0; i < 4; i++)
+		key[i] ^= out[i];
+}
+
+// The key of a module mixes in the snapshot format, where it is loaded, the
+// size and modification time of its .so, every import with the address it is
+// bound to, whether it is bound lazily, and the key of the module loaded
+// before it, which it may import from. The .so is not hashed, so that a valid
+// snapshot never reads it.
+void so_snapshot_key(const char *so_path, uintptr_t load_addr, so_dynlib_table *default_dynlib, int lazy, uint32_t key[4]) {
+	const so_platform *platform = so_get_platform();
+	so_module *prev = so_last_module();
+	uint64_t file[2] = { 0, 0 };
+	uint32_t words[4];
+
+	memset(key, 0, 4 * sizeof(uint32_t));
+
+	words[0] = SO_SNAPSHOT_MAGIC;
+	words[1] = SO_SNAPSHOT_VERSION;
+	words[2] = (uint32_t)load_addr;
+	words[3] = default_dynlib->num_entries;
+	key_update(key, words, sizeof(words));
+
+	if (platform->stat(so_path, &file[0], &file[1]) < 0)
+		file[0] = file[1] = ~0ULL;
+	key_update(key, file, sizeof(file));
+
+	for (int i = 0; i < default_dynlib->num_entries; i++) {
+		so_default_dynlib *entry = &default_dynlib->entries[i];
+		uint32_t func = (uint32_t)entry->func;
+		key_update(key, entry->symbol, strlen(entry->symbol));
+		key_update(key, &func, sizeof(func));
+	}
+
+	words[0] = (uint32_t)(uintptr_t)platform->unresolved;
+	words[1] = (uint32_t)(uintptr_t)platform->dummy;
+	words[2] = prev ? prev->text_base : 0;
+	words[3] = lazy;
+	key_update(key, words, sizeof(words));
+	if (prev)
+		key_update(key, prev->snapshot_key, sizeof(prev->snapshot_key));
+}
+
+static uint32_t text_offset(so_module *mod, const void *ptr) {
+	return ptr ? (uint32_t)((uintptr_t)ptr - mod->text_base) : 0;
+}
+
+static void *text_pointer(so_module *mod, uint32_t offset) {
+	return offset ? (void *)(mod->text_base + offset) : NULL;
+}
+
+// Bytes of a block up to its last non-zero word
+static uint32_t stored_size(uintptr_t base, size_t size) {
+	const uint32_t *words = (const uint32_t *)base;
+	size_t n = size / 4;
+
+	while (n > 0 && words[n - 1] == 0)
+		n--;
+
+	return n * 4;
+}
+
+// Fills a block from the snapshot, zeroing what was trimmed off its end
+static void restore_block(const so_platform *platform, void *base, const uint8_t *data, size_t stored, size_t size) {
+	platform->copy(base, data, stored);
+	if (stored < size) {
+		void *zero = calloc(1, size - stored);
+		platform->copy((uint8_t *)base + stored, zero, size - stored);
+		free(zero);
+	}
+}
+
+int so_snapshot_save(so_module *mod, const char *snapshot_path) {
+	const so_platform *platform = so_get_platform();
+	so_snapshot_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SO_SNAPSHOT_MAGIC;
+	header.version = SO_SNAPSHOT_VERSION;
+	memcpy(header.key, mod->snapshot_key, sizeof(header.key));
+	header.load_addr = mod->text_base;
+	header.text_block_size = mod->text_block_size;
+	header.text_stored = stored_size(mod->text_base, mod->text_block_size);
+	header.file_size = sizeof(header) + header.text_stored;
+	header.text_size = mod->text_size;
+	header.patch_size = mod->patch_size;
+	header.n_data = mod->n_data;
+	for (int i = 0; i < mod->n_data; i++) {
+		header.data_block_base[i] = mod->data_block_base[i];
+		header.data_block_size[i] = mod->data_block_size[i];
+		header.data_stored[i] = stored_size(mod->data_block_base[i], mod->data_block_size[i]);
+		header.data_base[i] = mod->data_base[i];
+		header.data_size[i] = mod->data_size[i];
+		header.file_size += header.data_stored[i];
+	}
+	header.dynamic = text_offset(mod, mod->dynamic);
+	header.num_dynamic = mod->num_dynamic;
+	header.dynsym = text_offset(mod, mod->dynsym);
+	header.num_dynsym = mod->num_dynsym;
+	header.dynstr = text_offset(mod, mod->dynstr);
+	header.reldyn = text_offset(mod, mod->reldyn);
+	header.num_reldyn = mod->num_reldyn;
+	header.relplt = text_offset(mod, mod->relplt);
+	header.num_relplt = mod->num_relplt;
+	header.init_array = text_offset(mod, mod->init_array);
+	header.num_init_array = mod->num_init_array;
+	header.hash = text_offset(mod, mod->hash);
+	header.gnu_hash = text_offset(mod, mod->gnu_hash);
+	header.soname = text_offset(mod, mod->soname);
+	header.lazy_resolver = mod->lazy_resolver;
+
+	int fd = platform->create(snapshot_path);
+	if (fd < 0)
+		return fd;
+
+	// A short write leaves a file that fails the size check on restore
+	int res = 0;
+	if (platform->write(fd, &header, sizeof(header)) != sizeof(header) ||
+		platform->write(fd, (void *)mod->text_base, header.text_stored) != (int)header.text_stored)
+		res = -1;
+	for (int i = 0; res == 0 && i < mod->n_data; i++) {
+		if (platform->write(fd, (void *)mod->data_block_base[i], header.data_stored[i]) != (int)header.data_stored[i])
+			res = -1;
+	}
+	platform->close(fd);
+
+	return res;
+}
+
+int so_snapshot_restore(so_module *mod, const char *snapshot_path, const uint32_t key[4], uintptr_t load_addr) {
+	const so_platform *platform = so_get_platform();
+	so_snapshot_header *header;
+	uint8_t *data;
+	size_t size;
+	void *base;
+	int res;
+
+	memset(mod, 0, sizeof(so_module));
+
+	int snapshot_blockid = platform->read_file(snapshot_path, (void **)&data, &size);
+	if (snapshot_blockid < 0)
+		return snapshot_blockid;
+
+	header = (so_snapshot_header *)data;
+	if (size < sizeof(so_snapshot_header) ||
+		header->magic != SO_SNAPSHOT_MAGIC ||
+		header->version != SO_SNAPSHOT_VERSION ||
+		header->file_size != size ||
+		header->load_addr != load_addr ||
+		header->n_data > MAX_DATA_SEG ||
+		memcmp(header->key, key, sizeof(header->key)) != 0) {
+		res = -1;
+		goto err_free_snapshot;
+	}
+
+	size_t expected = sizeof(so_snapshot_header) + header->text_stored;
+	int sizes_ok = header->text_stored <= header->text_block_size;
+	for (uint32_t i = 0; i < header->n_data; i++) {
+		expected += header->data_stored[i];
+		sizes_ok &= header->data_stored[i] <= header->data_block_size[i];
+	}
+	if (!sizes_ok || expected != size) {
+		res = -1;
+		goto err_free_snapshot;
+	}
+
+	res = mod->patch_blockid = platform->alloc(1, load_addr - header->patch_size, header->patch_size, (void **)&mod->patch_base);
+	if (res < 0)
+		goto err_free_snapshot;
+	mod->patch_size = header->patch_size;
+	mod->patch_head = mod->patch_base;
+
+	// Every block has to land where it was relocated for
+	res = mod->text_blockid = platform->alloc(1, load_addr, header->text_block_size, &base);
+	if (res < 0)
+		goto err_free_patch;
+	if ((uintptr_t)base != load_addr) {
+		res = -1;
+		goto err_free_text;
+	}
+	mod->text_base = load_addr;
+	mod->text_size = header->text_size;
+	mod->text_block_size = header->text_block_size;
+
+	uint8_t *block = data + sizeof(so_snapshot_header);
+	restore_block(platform, base, block, header->text_stored, header->text_block_size);
+	block += header->text_stored;
+
+	for (uint32_t i = 0; i < header->n_data; i++) {
+		res = mod->data_blockid[i] = platform->alloc(0, header->data_block_base[i], header->data_block_size[i], &base);
+		if (res < 0)
+			goto err_free_data;
+		mod->n_data++;
+		if ((uintptr_t)base != header->data_block_base[i]) {
+			res = -1;
+			goto err_free_data;
+		}
+
+		restore_block(platform, base, block, header->data_stored[i], header->data_block_size[i]);
+		block += header->data_stored[i];
+
+		mod->data_block_base[i] = header->data_block_base[i];
+		mod->data_block_size[i] = header->data_block_size[i];
+		mod->data_base[i] = header->data_base[i];
+		mod->data_size[i] = header->data_size[i];
+	}
+
+	mod->cave_size = ALIGN_MEM(mod->text_block_size - mod->text_size, 0x4);
+	mod->cave_base = ALIGN_MEM(mod->text_base + mod->text_size, 0x4);
+	mod->cave_head = mod->cave_base;
+
+	mod->dynamic = text_pointer(mod, header->dynamic);
+	mod->num_dynamic = header->num_dynamic;
+	mod->dynsym = text_pointer(mod, header->dynsym);
+	mod->num_dynsym = header->num_dynsym;
+	mod->dynstr = text_pointer(mod, header->dynstr);
+	mod->reldyn = text_pointer(mod, header->reldyn);
+	mod->num_reldyn = header->num_reldyn;
+	mod->relplt = text_pointer(mod, header->relplt);
+	mod->num_relplt = header->num_relplt;
+	mod->init_array = text_pointer(mod, header->init_array);
+	mod->num_init_array = header->num_init_array;
+	mod->hash = text_pointer(mod, header->hash);
+	mod->gnu_hash = text_pointer(mod, header->gnu_hash);
+	mod->soname = text_pointer(mod, header->soname);
+	mod->lazy_resolver = header->lazy_resolver;
+	memcpy(mod->snapshot_key, key, sizeof(mod->snapshot_key));
+
+	so_symtab_init(&mod->symtab, mod->dynsym, mod->num_dynsym, mod->dynstr, mod->hash, mod->gnu_hash);
+
+	platform->free(snapshot_blockid);
+
+	so_add_module(mod);
+
+	return 0;
+
+err_free_data:
+	for (int i = 0; i < mod->n_data; i++)
+		platform->free(mod->data_blockid[i]);
+err_free_text:
+	platform->free(mod->text_blockid);
+err_free_patch:
+	platform->free(mod->patch_blockid);
+err_free_snapshot:
+	platform->free(snapshot_blockid);
+	memset(mod, 0, sizeof(so_module));
+
+	return res;
+}
+
+int so_snapshot_load(so_module *mod, const char *so_path, const char *snapshot_path, uintptr_t load_addr, so_dynlib_table *default_dynlib, int lazy) {
+	const so_platform *platform = so_get_platform();
+	uint32_t key[4];
+	int res;
+
+	so_snapshot_key(so_path, load_addr, default_dynlib, lazy, key);
+
+	if (so_snapshot_restore(mod, snapshot_path, key, load_addr) == 0) {
+		platform->debug("%s: restored from %s\n", so_path, snapshot_path);
+		if (mod->lazy_resolver)
+			return so_lazy_init(mod, default_dynlib, 0);
+		return 0;
+	}
+
+	res = so_file_load(mod, so_path, load_addr);
+	if (res < 0)
+		return res;
+	res = lazy ? so_link_lazy(mod, default_dynlib, 0) : so_link(mod, default_dynlib, 0);
+	if (res < 0)
+		return res;
+
+	memcpy(mod->snapshot_key, key, sizeof(mod->snapshot_key));
+	if (so_snapshot_save(mod, snapshot_path) < 0)
+		platform->debug("%s: could not save %s\n", so_path, snapshot_path);
+
+	return 0;
+}
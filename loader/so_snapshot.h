@@ -0,0 +1,53 @@
+#ifndef __SO_SNAPSHOT_H__
+#define __SO_SNAPSHOT_H__
+
+#include "so_util.h"
+
+#define SO_SNAPSHOT_MAGIC 0x4e534f53 // "SOSN"
+#define SO_SNAPSHOT_VERSION 2 // bump whenever the loader relocates differently
+
+// A module as so_link leaves it: the header, then its text block, then every
+// data block, each without its trailing zeros (.bss mostly). Pointers into the
+// module are stored as offsets from text_base.
+// key covers everything the relocated image depends on, see so_snapshot.c.
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t key[4];
+	uint32_t file_size;
+	uint32_t load_addr;
+	uint32_t text_block_size;
+	uint32_t text_stored;
+	uint32_t text_size;
+	uint32_t patch_size;
+	uint32_t n_data;
+	uint32_t data_block_base[MAX_DATA_SEG];
+	uint32_t data_block_size[MAX_DATA_SEG];
+	uint32_t data_stored[MAX_DATA_SEG];
+	uint32_t data_base[MAX_DATA_SEG];
+	uint32_t data_size[MAX_DATA_SEG];
+	uint32_t dynamic, num_dynamic;
+	uint32_t dynsym, num_dynsym;
+	uint32_t dynstr;
+	uint32_t reldyn, num_reldyn;
+	uint32_t relplt, num_relplt;
+	uint32_t init_array, num_init_array;
+	uint32_t hash;
+	uint32_t gnu_hash;
+	uint32_t soname;
+	uint32_t lazy_resolver; // 0 unless linked by so_link_lazy
+} so_snapshot_header;
+
+// Loads and links so_path like so_file_load followed by so_link, or by
+// so_link_lazy if lazy is set. Restores the relocated image from snapshot_path
+// when it was saved for the same module, imports and loader; otherwise links
+// from scratch and saves a new snapshot.
+// Load modules in the same order every boot, dependencies first.
+int so_snapshot_load(so_module *mod, const char *so_path, const char *snapshot_path, uintptr_t load_addr, so_dynlib_table *default_dynlib, int lazy);
+
+// Restores mod from snapshot_path if its key matches, returns < 0 otherwise
+int so_snapshot_restore(so_module *mod, const char *snapshot_path, const uint32_t key[4], uintptr_t load_addr);
+int so_snapshot_save(so_module *mod, const char *snapshot_path);
+void so_snapshot_key(const char *so_path, uintptr_t load_addr, so_dynlib_table *default_dynlib, int lazy, uint32_t key[4]);
+
+#endif
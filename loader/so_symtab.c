@@ -0,0 +1,147 @@
+/* so_symtab.c -- symbol lookup in the dynamic symbol table of .so modules
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "so_dynlib.h"
+#include "so_symtab.h"
+
+uint32_t so_hash(const uint8_t *name) {
+	uint64_t h = 0, g;
+	while (*name) {
+		h = (h << 4) + *name++;
+		if ((g = (h & 0xf0000000)) != 0)
+			h ^= g >> 24;
+		h &= 0x0fffffff;
+	}
+	return h;
+}
+
+static inline int is_defined(const Elf32_Sym *sym) {
+	return sym->st_shndx != SHN_UNDEF && sym->st_info != 0;
+}
+
+int so_symtab_init(so_symtab *tab, Elf32_Sym *dynsym, int num_dynsym, char *dynstr, uint32_t *hash, uint32_t *gnu_hash) {
+	memset(tab, 0, sizeof(so_symtab));
+
+	tab->dynsym = dynsym;
+	tab->num_dynsym = num_dynsym;
+	tab->dynstr = dynstr;
+	tab->hash = hash;
+
+	// The bloom filter of the 32-bit layout is indexed with a mask, which
+	// every linker allows for by emitting a power of two number of words
+	if (gnu_hash && gnu_hash[0] && gnu_hash[2] && (gnu_hash[2] & (gnu_hash[2] - 1)) == 0) {
+		tab->gnu_hash = gnu_hash;
+		tab->gnu_nbucket = gnu_hash[0];
+		tab->gnu_symoffset = gnu_hash[1];
+		tab->gnu_bloom_mask = gnu_hash[2] - 1;
+		tab->gnu_bloom_shift = gnu_hash[3];
+		tab->gnu_bloom = &gnu_hash[4];
+		tab->gnu_bucket = &tab->gnu_bloom[gnu_hash[2]];
+		tab->gnu_chain = &tab->gnu_bucket[tab->gnu_nbucket];
+	}
+
+	// A .gnu.hash lookup already costs about as much as a memo hit
+	if (!tab->gnu_hash) {
+		tab->memo = malloc(SO_SYMTAB_MEMO_SIZE * sizeof(so_symtab_memo));
+		if (tab->memo) {
+			for (int i = 0; i < SO_SYMTAB_MEMO_SIZE; i++)
+				tab->memo[i].index = -1;
+		}
+	}
+
+	return 0;
+}
+
+void so_symtab_free(so_symtab *tab) {
+	free(tab->memo);
+	tab->memo = NULL;
+}
+
+static int gnu_lookup(so_symtab *tab, const char *symbol, uint32_t h) {
+	uint32_t word = tab->gnu_bloom[(h >> 5) & tab->gnu_bloom_mask];
+	uint32_t mask = (1u << (h & 31)) | (1u << ((h >> tab->gnu_bloom_shift) & 31));
+
+	// Most misses end here, without touching the buckets or any string
+	if ((word & mask) != mask)
+		return -1;
+
+	uint32_t i = tab->gnu_bucket[h % tab->gnu_nbucket];
+	if (i < tab->gnu_symoffset)
+		return -1;
+
+	for (;; i++) {
+		uint32_t h2 = tab->gnu_chain[i - tab->gnu_symoffset];
+		if ((h | 1) == (h2 | 1) && is_defined(&tab->dynsym[i]) &&
+			strcmp(tab->dynstr + tab->dynsym[i].st_name, symbol) == 0)
+			return i;
+		if (h2 & 1)
+			return -1;
+	}
+}
+
+static int sysv_lookup(so_symtab *tab, const char *symbol) {
+	uint32_t hash = so_hash((const uint8_t *)symbol);
+	uint32_t nbucket = tab->hash[0];
+	uint32_t *bucket = &tab->hash[2];
+	uint32_t *chain = &bucket[nbucket];
+
+	for (int i = bucket[hash % nbucket]; i; i = chain[i]) {
+		if (is_defined(&tab->dynsym[i]) && strcmp(tab->dynstr + tab->dynsym[i].st_name, symbol) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static int linear_lookup(so_symtab *tab, const char *symbol) {
+	for (int i = 0; i < tab->num_dynsym; i++) {
+		if (is_defined(&tab->dynsym[i]) && strcmp(tab->dynstr + tab->dynsym[i].st_name, symbol) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/*
+ * gnu_hash is so_gnu_hash(symbol), so that a caller searching several modules
+ * for the same import hashes it only once. The hash tables list every
+ * exported symbol, so only a module without either of them is scanned.
+ */
+int so_symtab_lookup_hash(so_symtab *tab, const char *symbol, uint32_t gnu_hash) {
+	so_symtab_memo *memo = NULL;
+	int index;
+
+	if (tab->memo) {
+		memo = &tab->memo[gnu_hash & (SO_SYMTAB_MEMO_SIZE - 1)];
+		if (memo->index >= 0 && memo->hash == gnu_hash &&
+			strcmp(tab->dynstr + tab->dynsym[memo->index].st_name, symbol) == 0)
+			return memo->index;
+	}
+
+	if (tab->gnu_hash)
+		index = gnu_lookup(tab, symbol, gnu_hash);
+	else if (tab->hash)
+		index = sysv_lookup(tab, symbol);
+	else
+		index = linear_lookup(tab, symbol);
+
+	if (memo && index >= 0) {
+		memo->hash = gnu_hash;
+		memo->index = index;
+	}
+
+	return index;
+}
+
+int so_symtab_lookup(so_symtab *tab, const char *symbol) {
+	return so_symtab_lookup_hash(tab, symbol, so_gnu_hash(symbol));
+}
@@ -0,0 +1,43 @@
+#ifndef __SO_SYMTAB_H__
+#define __SO_SYMTAB_H__
+
+#include <stdint.h>
+
+#include "elf.h"
+
+#define SO_SYMTAB_MEMO_SIZE 1024 // power of two
+
+typedef struct {
+  uint32_t hash;
+  int index; // into dynsym, -1 for an empty slot
+} so_symtab_memo;
+
+// Symbol lookup state of a module, filled in once its sections are mapped
+typedef struct {
+  Elf32_Sym *dynsym;
+  char *dynstr;
+  int num_dynsym;
+
+  uint32_t *hash;     // DT_HASH, may be NULL
+  uint32_t *gnu_hash; // DT_GNU_HASH, may be NULL
+
+  // Parsed DT_GNU_HASH header
+  uint32_t gnu_nbucket;
+  uint32_t gnu_symoffset;
+  uint32_t gnu_bloom_mask; // bloom words - 1
+  uint32_t gnu_bloom_shift;
+  uint32_t *gnu_bloom;
+  uint32_t *gnu_bucket;
+  uint32_t *gnu_chain;
+
+  so_symtab_memo *memo; // last hit per hash, only without DT_GNU_HASH
+} so_symtab;
+
+uint32_t so_hash(const uint8_t *name);
+
+int so_symtab_init(so_symtab *tab, Elf32_Sym *dynsym, int num_dynsym, char *dynstr, uint32_t *hash, uint32_t *gnu_hash);
+void so_symtab_free(so_symtab *tab);
+int so_symtab_lookup(so_symtab *tab, const char *symbol);
+int so_symtab_lookup_hash(so_symtab *tab, const char *symbol, uint32_t gnu_hash);
+
+#endif
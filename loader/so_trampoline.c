@@ -0,0 +1,420 @@
+/* so_trampoline.c -- move hooked function prologues into trampolines
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <string.h>
+
+#include "so_trampoline.h"
+
+#define COND_AL 0xE
+
+#define ARM_LDR_PC_NEXT 0xe51ff004 // LDR PC, [PC, #-0x4]
+#define ARM_ADD_LR_PC_4 0xe28fe004 // ADD LR, PC, #4
+#define ARM_B_SKIP_WORD 0xea000000 // B over the next word
+
+#define THUMB_NOP 0xbf00
+#define THUMB_B_SKIP_4 0xe002 // B.N over a NOP and a word
+
+typedef struct {
+	uint8_t *out;
+	size_t len;
+} emitter;
+
+static void emit32(emitter *e, uint32_t w) {
+	memcpy(e->out + e->len, &w, sizeof(w));
+	e->len += sizeof(w);
+}
+
+static void emit16(emitter *e, uint16_t h) {
+	memcpy(e->out + e->len, &h, sizeof(h));
+	e->len += sizeof(h);
+}
+
+static void patch16(emitter *e, size_t at, uint16_t h) {
+	memcpy(e->out + at, &h, sizeof(h));
+}
+
+static int32_t sign_extend(uint32_t value, int bits) {
+	uint32_t m = 1u << (bits - 1);
+	value &= (1u << bits) - 1;
+	return (int32_t)((value ^ m) - m);
+}
+
+static uint32_t ror(uint32_t value, int shift) {
+	shift &= 31;
+	return shift ? (value >> shift) | (value << (32 - shift)) : value;
+}
+
+/*
+ * ARM: PC reads as the instruction address + 8. Conditional instructions are
+ * rewritten for AL and preceded by a branch over them on the inverse
+ * condition.
+ */
+
+// Body of an AL rewrite of insn into e, 0 if it needs none, -1 if unsupported
+static int arm_rewrite(emitter *e, uint32_t insn, uint32_t pc) {
+	uint32_t cond = insn >> 28;
+	int rn = (insn >> 16) & 0xF;
+	int rd = (insn >> 12) & 0xF;
+	int rm = insn & 0xF;
+
+	if (cond == 0xF) {
+		// BLX <imm>, switches to Thumb
+		if ((insn & 0xFE000000) == 0xFA000000) {
+			uint32_t target = pc + 8 + (sign_extend(insn, 24) << 2) + ((insn >> 23) & 2);
+			emit32(e, ARM_ADD_LR_PC_4);
+			emit32(e, ARM_LDR_PC_NEXT);
+			emit32(e, target | 1);
+			return 1;
+		}
+		// PLD and the like
+		return rn == 15 ? -1 : 0;
+	}
+
+	// B, BL
+	if ((insn & 0x0E000000) == 0x0A000000) {
+		uint32_t target = pc + 8 + (sign_extend(insn, 24) << 2);
+		if (insn & 0x01000000)
+			emit32(e, ARM_ADD_LR_PC_4);
+		emit32(e, ARM_LDR_PC_NEXT);
+		emit32(e, target);
+		return 1;
+	}
+
+	// LDR, LDRB <Rt>, [PC, #+/-imm12]: load the address, then through it
+	if ((insn & 0x0F3F0000) == 0x051F0000) {
+		uint32_t imm = insn & 0xFFF;
+		uint32_t addr = (insn & 0x00800000) ? pc + 8 + imm : pc + 8 - imm;
+		if (rd == 15)
+			return -1;
+		emit32(e, 0xe59f0004 | (rd << 12)); // LDR Rt, [PC, #4]
+		emit32(e, 0xe5900000 | (insn & 0x00400000) | (rd << 16) | (rd << 12)); // LDR(B) Rt, [Rt]
+		emit32(e, ARM_B_SKIP_WORD);
+		emit32(e, addr);
+		return 1;
+	}
+
+	// ADR: ADD, SUB <Rd>, PC, #imm
+	if ((insn & 0x0FFF0000) == 0x028F0000 || (insn & 0x0FFF0000) == 0x024F0000) {
+		uint32_t imm = ror(insn & 0xFF, ((insn >> 8) & 0xF) * 2);
+		uint32_t value = (insn & 0x00800000) ? pc + 8 + imm : pc + 8 - imm;
+		if (rd == 15) {
+			emit32(e, ARM_LDR_PC_NEXT);
+			emit32(e, value);
+		} else {
+			emit32(e, 0xe59f0000 | (rd << 12)); // LDR Rd, [PC, #0]
+			emit32(e, ARM_B_SKIP_WORD);
+			emit32(e, value);
+		}
+		return 1;
+	}
+
+	switch ((insn >> 25) & 7) {
+	case 0: // data processing (register), multiplies, extra loads and stores, misc
+		if ((insn & 0x0F900000) == 0x01000000) {
+			// MRS, MSR, BX, BLX, CLZ... only BX and BLX take a register that could be PC
+			if ((insn & 0x0FFFFFD0) == 0x012FFF10)
+				return rm == 15 ? -1 : 0;
+			return 0;
+		}
+		if ((insn & 0x0F0000F0) == 0x00000090) // multiplies
+			return 0;
+		if ((insn & 0x00000090) == 0x00000090) // LDRH, LDRD... PC as Rm is only a register when bit 22 is clear
+			return (rn == 15 || (!(insn & 0x00400000) && rm == 15)) ? -1 : 0;
+		if (rn == 15 || rm == 15 || ((insn & 0x10) && ((insn >> 8) & 0xF) == 15))
+			return -1;
+		return 0;
+	case 1: // data processing (immediate)
+		if ((insn & 0x0FB00000) == 0x03000000) // MOVW, MOVT
+			return 0;
+		return rn == 15 ? -1 : 0;
+	case 2: // LDR, STR (immediate)
+		return (rn == 15 || (rd == 15 && !(insn & 0x00100000))) ? -1 : 0;
+	case 3: // LDR, STR (register)
+		return (rn == 15 || rm == 15 || (rd == 15 && !(insn & 0x00100000))) ? -1 : 0;
+	case 4: // LDM, STM
+		return (rn == 15 || (!(insn & 0x00100000) && (insn & 0x8000))) ? -1 : 0;
+	case 6: // VLDR, VSTR, LDC...
+		return rn == 15 ? -1 : 0;
+	default:
+		return 0;
+	}
+}
+
+static int arm_build(const uint32_t *code, uint32_t pc, size_t size, emitter *e) {
+	size_t n = (size + 3) / 4;
+
+	for (size_t i = 0; i < n; i++) {
+		uint32_t insn = code[i];
+		uint32_t cond = insn >> 28;
+		size_t at = e->len;
+
+		if (cond != COND_AL && cond != 0xF)
+			emit32(e, 0); // branch over the body, once its length is known
+
+		int res = arm_rewrite(e, insn, pc + i * 4);
+		if (res < 0)
+			return -1;
+		if (res == 0) {
+			// Unchanged, keeps its own condition
+			e->len = at;
+			emit32(e, insn);
+			continue;
+		}
+
+		if (cond != COND_AL && cond != 0xF) {
+			uint32_t skip = (e->len - at - 8) / 4;
+			uint32_t b = ((cond ^ 1) << 28) | 0x0A000000 | (skip & 0xFFFFFF);
+			memcpy(e->out + at, &b, sizeof(b));
+		}
+	}
+
+	emit32(e, ARM_LDR_PC_NEXT);
+	emit32(e, pc + n * 4);
+	return 0;
+}
+
+/*
+ * Thumb: PC reads as the instruction address + 4, aligned down to a word for
+ * literal loads and ADR. Absolute addresses are loaded with LDR.W from a
+ * literal right behind the instruction, which a NOP keeps word aligned.
+ */
+
+static int thumb_is_32(uint16_t hw1) {
+	return (hw1 >> 11) >= 0x1D;
+}
+
+static void thumb_align(emitter *e) {
+	if (e->len & 2)
+		emit16(e, THUMB_NOP);
+}
+
+static void thumb_ldr_literal(emitter *e, int rt, int offset) {
+	emit16(e, 0xf8df); // LDR.W Rt, [PC, #offset]
+	emit16(e, (rt << 12) | offset);
+}
+
+static void thumb_jump(emitter *e, uint32_t target) {
+	thumb_align(e);
+	thumb_ldr_literal(e, 15, 0);
+	emit32(e, target);
+}
+
+static void thumb_call(emitter *e, uint32_t target) {
+	thumb_align(e);
+	emit16(e, 0xf20f); // ADDW LR, PC, #9: past the literal, with the Thumb bit
+	emit16(e, 0x0e09);
+	thumb_ldr_literal(e, 15, 0);
+	emit32(e, target);
+}
+
+// Loads value into rd, through it when load is set
+static void thumb_load_value(emitter *e, int rd, uint32_t value, int load) {
+	thumb_align(e);
+	if (load) {
+		thumb_ldr_literal(e, rd, 8);
+		emit16(e, 0xf8d0 | rd); // LDR.W Rt, [Rt]
+		emit16(e, rd << 12);
+	} else {
+		thumb_ldr_literal(e, rd, 4);
+	}
+	emit16(e, THUMB_B_SKIP_4);
+	emit16(e, THUMB_NOP);
+	emit32(e, value);
+}
+
+// Starts a branch over what follows, on the inverse of a condition
+static size_t thumb_skip_begin(emitter *e, uint16_t insn) {
+	size_t at = e->len;
+	emit16(e, insn);
+	return at;
+}
+
+static void thumb_skip_cond_end(emitter *e, size_t at, int cond) {
+	uint32_t skip = (e->len - at - 4) / 2;
+	patch16(e, at, 0xd000 | ((cond ^ 1) << 8) | (skip & 0xFF));
+}
+
+static void thumb_skip_cbz_end(emitter *e, size_t at, uint16_t cbz) {
+	uint32_t skip = (e->len - at - 4) / 2;
+	// Inverse of CBZ is CBNZ, the offset is i:imm5
+	patch16(e, at, ((cbz ^ 0x0800) & 0xFD07) | ((skip & 0x20) << 4) | ((skip & 0x1F) << 3));
+}
+
+static int thumb_rewrite16(emitter *e, uint16_t hw, uint32_t pc) {
+	uint32_t pc_align = (pc + 4) & ~3;
+
+	// B<c> <label>
+	if ((hw & 0xF000) == 0xD000 && ((hw >> 8) & 0xF) < 0xE) {
+		int cond = (hw >> 8) & 0xF;
+		size_t at = thumb_skip_begin(e, 0);
+		thumb_jump(e, (pc + 4 + (sign_extend(hw, 8) << 1)) | 1);
+		thumb_skip_cond_end(e, at, cond);
+		return 1;
+	}
+
+	// B <label>
+	if ((hw & 0xF800) == 0xE000) {
+		thumb_jump(e, (pc + 4 + (sign_extend(hw, 11) << 1)) | 1);
+		return 1;
+	}
+
+	// CBZ, CBNZ <Rn>, <label>
+	if ((hw & 0xF500) == 0xB100) {
+		uint32_t offset = ((hw >> 3) & 0x1F) << 1 | ((hw >> 9) & 1) << 6;
+		size_t at = thumb_skip_begin(e, 0);
+		thumb_jump(e, (pc + 4 + offset) | 1);
+		thumb_skip_cbz_end(e, at, hw);
+		return 1;
+	}
+
+	// LDR <Rt>, [PC, #imm8]
+	if ((hw & 0xF800) == 0x4800) {
+		thumb_load_value(e, (hw >> 8) & 7, pc_align + (hw & 0xFF) * 4, 1);
+		return 1;
+	}
+
+	// ADR <Rd>, <label>
+	if ((hw & 0xF800) == 0xA000) {
+		thumb_load_value(e, (hw >> 8) & 7, pc_align + (hw & 0xFF) * 4, 0);
+		return 1;
+	}
+
+	// ADD, CMP, MOV, BX, BLX with high registers
+	if ((hw & 0xFC00) == 0x4400) {
+		int op = (hw >> 8) & 3;
+		int rm = (hw >> 3) & 0xF;
+		int rdn = ((hw >> 4) & 8) | (hw & 7);
+		if (rm == 15 || (op < 2 && rdn == 15))
+			return -1;
+		return 0;
+	}
+
+	// IT: the instructions it covers would need moving along with it
+	if ((hw & 0xFF00) == 0xBF00 && (hw & 0xF) != 0)
+		return -1;
+
+	return 0;
+}
+
+static int thumb_rewrite32(emitter *e, uint16_t hw1, uint16_t hw2, uint32_t pc) {
+	uint32_t pc_align = (pc + 4) & ~3;
+	int rn = hw1 & 0xF;
+
+	// Branches and miscellaneous control
+	if ((hw1 & 0xF800) == 0xF000 && (hw2 & 0x8000)) {
+		uint32_t s = (hw1 >> 10) & 1;
+		uint32_t j1 = (hw2 >> 13) & 1;
+		uint32_t j2 = (hw2 >> 11) & 1;
+		int op = ((hw2 >> 13) & 2) | ((hw2 >> 12) & 1);
+
+		if (op == 0) {
+			int cond = (hw1 >> 6) & 0xF;
+			if (cond >= 0xE) // MSR, MRS, barriers...
+				return 0;
+			// B<c>.W <label>
+			uint32_t imm = (s << 20) | (j2 << 19) | (j1 << 18) | ((hw1 & 0x3F) << 12) | ((hw2 & 0x7FF) << 1);
+			uint32_t target = pc + 4 + sign_extend(imm, 21);
+			size_t at = thumb_skip_begin(e, 0);
+			thumb_jump(e, target | 1);
+			thumb_skip_cond_end(e, at, cond);
+			return 1;
+		}
+
+		uint32_t i1 = !(j1 ^ s);
+		uint32_t i2 = !(j2 ^ s);
+		uint32_t imm = (s << 24) | (i1 << 23) | (i2 << 22) | ((hw1 & 0x3FF) << 12) | ((hw2 & 0x7FF) << 1);
+		int32_t offset = sign_extend(imm, 25);
+
+		if (op == 1) // B.W <label>
+			thumb_jump(e, (pc + 4 + offset) | 1);
+		else if (op == 3) // BL <label>
+			thumb_call(e, (pc + 4 + offset) | 1);
+		else // BLX <label>, switches to ARM
+			thumb_call(e, (pc_align + offset) & ~3);
+		return 1;
+	}
+
+	// LDR.W <Rt>, [PC, #+/-imm12]
+	if ((hw1 & 0xFF7F) == 0xF85F) {
+		int rt = hw2 >> 12;
+		uint32_t imm = hw2 & 0xFFF;
+		if (rt == 15)
+			return -1;
+		thumb_load_value(e, rt, (hw1 & 0x80) ? pc_align + imm : pc_align - imm, 1);
+		return 1;
+	}
+
+	// ADR.W: ADDW, SUBW <Rd>, PC, #imm12
+	if (((hw1 & 0xFBFF) == 0xF20F || (hw1 & 0xFBFF) == 0xF2AF) && !(hw2 & 0x8000)) {
+		uint32_t imm = ((hw1 & 0x400) << 1) | ((hw2 & 0x7000) >> 4) | (hw2 & 0xFF);
+		thumb_load_value(e, (hw2 >> 8) & 0xF, (hw1 & 0xFBFF) == 0xF20F ? pc_align + imm : pc_align - imm, 0);
+		return 1;
+	}
+
+	// MOVW, MOVT keep an immediate where Rn would be
+	if ((hw1 & 0xFB70) == 0xF240 && !(hw2 & 0x8000))
+		return 0;
+
+	// MOV, MVN (ORR, ORN with Rn = PC) by immediate or shifted register
+	if ((hw1 & 0xFA00) == 0xF000 && !(hw2 & 0x8000) && ((hw1 >> 5) & 0xE) == 2)
+		return 0;
+	if ((hw1 & 0xFE00) == 0xEA00 && ((hw1 >> 5) & 0xE) == 2)
+		return 0;
+
+	// Anything else based on PC: LDRD, PLD, VLDR, TBB...
+	return rn == 15 ? -1 : 0;
+}
+
+static int thumb_build(const uint8_t *code, uint32_t pc, size_t size, emitter *e) {
+	size_t i = 0;
+
+	while (i < size) {
+		uint16_t hw1, hw2 = 0;
+		memcpy(&hw1, code + i, sizeof(hw1));
+		int wide = thumb_is_32(hw1);
+		if (wide)
+			memcpy(&hw2, code + i + 2, sizeof(hw2));
+
+		int res = wide ? thumb_rewrite32(e, hw1, hw2, pc + i) : thumb_rewrite16(e, hw1, pc + i);
+		if (res < 0)
+			return -1;
+		if (res == 0) {
+			emit16(e, hw1);
+			if (wide)
+				emit16(e, hw2);
+		}
+
+		i += wide ? 4 : 2;
+	}
+
+	thumb_jump(e, (pc + i) | 1);
+	return 0;
+}
+
+int so_trampoline_build(const void *code, uintptr_t pc, int thumb, size_t size, void *out) {
+	uint8_t buf[SO_TRAMPOLINE_MAX * 2];
+	emitter e = { buf, 0 };
+
+	// Every instruction may grow to 5 words, leave room before checking
+	if (size > SO_TRAMPOLINE_MAX / 6)
+		return -1;
+
+	if (thumb) {
+		if (thumb_build(code, pc & ~1, size, &e) < 0)
+			return -1;
+	} else {
+		if (arm_build(code, pc, size, &e) < 0)
+			return -1;
+	}
+
+	if (e.len > SO_TRAMPOLINE_MAX)
+		return -1;
+
+	memcpy(out, buf, e.len);
+	return e.len;
+}
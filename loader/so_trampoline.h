@@ -0,0 +1,17 @@
+#ifndef __SO_TRAMPOLINE_H__
+#define __SO_TRAMPOLINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SO_TRAMPOLINE_MAX 128 // bytes so_trampoline_build may write
+
+// Copies the instructions that make up the first size bytes of code, as if
+// it ran from pc, into out and ends with a jump back to the first instruction
+// that was not copied. PC-relative instructions (branches, calls, literal
+// loads, ADR) are rewritten to use absolute addresses, so that out works from
+// anywhere. out must be 4-byte aligned. Returns the bytes written, or -1 when
+// an instruction can not be moved (other uses of PC, IT blocks, TBB/TBH).
+int so_trampoline_build(const void *code, uintptr_t pc, int thumb, size_t size, void *out);
+
+#endif
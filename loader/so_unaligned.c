@@ -0,0 +1,537 @@
+/* so_unaligned.c -- rewrite loads and stores that fault on misaligned data
+ *
+ * Copyright (C) 2021 Andy Nguyen
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "so_util.h"
+#include "so_arena.h"
+#include "so_platform.h"
+#include "so_unaligned.h"
+
+#define ARM_LDR_PC_NEXT 0xe51ff004 // LDR PC, [PC, #-0x4]
+#define THUMB_NOP 0xbf00
+#define THUMB_LDR_PC_NEXT 0xf8dff000 // LDR.W PC, [PC]
+
+#define ARM_B_RANGE ((1 << 25) - 8)
+#define THUMB_B_RANGE ((1 << 24) - 4)
+
+static const char *kind_names[SO_UNALIGNED_KINDS] = {
+	"LDM", "STM", "LDRD", "STRD", "VLDM", "VSTM",
+};
+
+// Fields of the instruction, as far as its kind uses them
+typedef struct {
+	int kind;
+	int rn, rt, rt2;
+	int p, u, w;
+	int reg_offset; // LDRD/STRD with a register offset
+	uint32_t list; // LDM/STM
+	int imm; // LDRD/STRD bytes, VLDR/VSTR words, VLDM/VSTM words
+	int vd, dbl; // VLDM/VSTM first register, D or S
+} access;
+
+typedef struct {
+	uint8_t *out;
+	size_t len;
+	int thumb;
+} emitter;
+
+static void emit32(emitter *e, uint32_t w) {
+	memcpy(e->out + e->len, &w, sizeof(w));
+	e->len += sizeof(w);
+}
+
+static void emit16(emitter *e, uint16_t h) {
+	memcpy(e->out + e->len, &h, sizeof(h));
+	e->len += sizeof(h);
+}
+
+// Thumb-2 instructions go out first halfword first
+static void emit_thumb32(emitter *e, uint32_t insn) {
+	emit16(e, insn >> 16);
+	emit16(e, insn);
+}
+
+// ARM modified immediate of value, -1 if there is none
+static int arm_imm(uint32_t value) {
+	for (int rot = 0; rot < 16; rot++) {
+		uint32_t v = rot ? (value << (rot * 2)) | (value >> (32 - rot * 2)) : value;
+		if (v < 0x100)
+			return (rot << 8) | v;
+	}
+	return -1;
+}
+
+// LDR/STR Rt, [Rn, #offset]
+static int emit_ldst(emitter *e, int load, int rt, int rn, int offset) {
+	uint32_t imm = offset < 0 ? -offset : offset;
+
+	if (!e->thumb) {
+		if (imm > 0xFFF)
+			return -1;
+		emit32(e, 0xe5000000 | (offset >= 0) << 23 | load << 20 | rn << 16 | rt << 12 | imm);
+	} else if (offset >= 0) {
+		if (imm > 0xFFF)
+			return -1;
+		emit_thumb32(e, (load ? 0xf8d00000 : 0xf8c00000) | rn << 16 | rt << 12 | imm);
+	} else {
+		if (imm > 0xFF)
+			return -1;
+		emit_thumb32(e, (load ? 0xf8500c00 : 0xf8400c00) | rn << 16 | rt << 12 | imm);
+	}
+
+	return 0;
+}
+
+// ADD/SUB Rn, Rn, #delta, leaving the flags alone
+static int emit_adjust(emitter *e, int rn, int delta) {
+	uint32_t imm = delta < 0 ? -delta : delta;
+
+	if (delta == 0)
+		return 0;
+
+	if (!e->thumb) {
+		int enc = arm_imm(imm);
+		if (enc < 0)
+			return -1;
+		emit32(e, (delta > 0 ? 0xe2800000 : 0xe2400000) | rn << 16 | rn << 12 | enc);
+	} else {
+		if (imm > 0xFFF)
+			return -1;
+		// ADDW/SUBW Rn, Rn, #imm12
+		emit_thumb32(e, (delta > 0 ? 0xf2000000 : 0xf2a00000) | rn << 16 | (imm & 0x800) << 15 |
+			(imm & 0x700) << 4 | rn << 8 | (imm & 0xFF));
+	}
+
+	return 0;
+}
+
+// Advanced SIMD element and structure loads/stores are 0xF4 in ARM, 0xF9 in Thumb
+static void emit_simd(emitter *e, uint32_t arm_insn) {
+	if (e->thumb)
+		emit_thumb32(e, (arm_insn & 0x00FFFFFF) | 0xf9000000);
+	else
+		emit32(e, arm_insn);
+}
+
+// VLD1.8/VST1.8 {Dd-Dd+n-1}, [Rn]!, which takes any alignment
+static void emit_vldst_multi(emitter *e, int load, int d, int n, int rn) {
+	static const uint32_t types[] = { 0, 0x7, 0xA, 0x6, 0x2 };
+	emit_simd(e, 0xf4000000 | load << 21 | (d >> 4) << 22 | rn << 16 | (d & 0xF) << 12 | types[n] << 8 | 0xD);
+}
+
+// VLD1.32/VST1.32 {Dd[s & 1]}, [Rn]! for Ss
+static void emit_vldst_lane(emitter *e, int load, int s, int rn) {
+	int d = s >> 1;
+	emit_simd(e, 0xf4800800 | load << 21 | (d >> 4) << 22 | rn << 16 | (d & 0xF) << 12 | (s & 1) << 7 | 0xD);
+}
+
+static void emit_jump(emitter *e, uint32_t target) {
+	if (!e->thumb) {
+		emit32(e, ARM_LDR_PC_NEXT);
+		emit32(e, target);
+		return;
+	}
+
+	if (e->len & 2)
+		emit16(e, THUMB_NOP);
+	emit_thumb32(e, THUMB_LDR_PC_NEXT);
+	emit32(e, target | 1);
+}
+
+static int decode_vfp(uint32_t insn, access *a) {
+	a->p = (insn >> 24) & 1;
+	a->u = (insn >> 23) & 1;
+	a->w = (insn >> 21) & 1;
+	a->rn = (insn >> 16) & 0xF;
+	a->dbl = (insn >> 8) & 1;
+	a->imm = insn & 0xFF;
+	a->vd = a->dbl ? ((insn >> 18) & 0x10) | ((insn >> 12) & 0xF) : ((insn >> 11) & 0x1E) | ((insn >> 22) & 1);
+
+	// 64-bit VMOV between core and VFP registers, and undefined forms
+	if ((!a->p && !a->u && !a->w) || (a->p == a->u && a->w))
+		return -1;
+
+	return (insn & (1 << 20)) ? SO_UNALIGNED_VLDM : SO_UNALIGNED_VSTM;
+}
+
+static int decode_arm(uint32_t insn, access *a) {
+	memset(a, 0, sizeof(access));
+	a->rn = (insn >> 16) & 0xF;
+	a->rt = (insn >> 12) & 0xF;
+	a->rt2 = a->rt + 1;
+	a->p = (insn >> 24) & 1;
+	a->u = (insn >> 23) & 1;
+	a->w = (insn >> 21) & 1;
+
+	if ((insn >> 28) == 0xF)
+		return -1;
+
+	// LDM/STM, not the user mode ones
+	if ((insn & 0x0E400000) == 0x08000000) {
+		a->list = insn & 0xFFFF;
+		return (insn & (1 << 20)) ? SO_UNALIGNED_LDM : SO_UNALIGNED_STM;
+	}
+
+	// LDRD/STRD, immediate and register offset
+	if ((insn & 0x0E5000D0) == 0x004000D0 || (insn & 0x0E500FD0) == 0x000000D0) {
+		a->reg_offset = !(insn & (1 << 22));
+		a->imm = ((insn >> 4) & 0xF0) | (insn & 0xF);
+		return (insn & 0x20) ? SO_UNALIGNED_STRD : SO_UNALIGNED_LDRD;
+	}
+
+	if ((insn & 0x0E000E00) == 0x0C000A00)
+		return decode_vfp(insn, a);
+
+	return -1;
+}
+
+static int decode_thumb(uint32_t insn, access *a) {
+	uint16_t hw1 = insn >> 16;
+
+	memset(a, 0, sizeof(access));
+	a->rn = hw1 & 0xF;
+	a->w = (hw1 >> 5) & 1;
+
+	// LDM/STM.W: IA and DB
+	if ((hw1 & 0xFFC0) == 0xE880 || (hw1 & 0xFFC0) == 0xE900) {
+		a->u = (hw1 & 0xFFC0) == 0xE880;
+		a->p = !a->u;
+		a->list = insn & 0xFFFF;
+		return (hw1 & 0x10) ? SO_UNALIGNED_LDM : SO_UNALIGNED_STM;
+	}
+
+	// LDRD/STRD immediate, P and W both clear are the exclusive loads and TBB
+	if ((hw1 & 0xFE40) == 0xE840 && (hw1 & 0x0120)) {
+		a->p = (hw1 >> 8) & 1;
+		a->u = (hw1 >> 7) & 1;
+		a->rt = (insn >> 12) & 0xF;
+		a->rt2 = (insn >> 8) & 0xF;
+		a->imm = (insn & 0xFF) * 4;
+		return (hw1 & 0x10) ? SO_UNALIGNED_LDRD : SO_UNALIGNED_STRD;
+	}
+
+	if ((insn & 0xFE000E00) == 0xEC000A00)
+		return decode_vfp(insn, a);
+
+	return -1;
+}
+
+static int decode(uint32_t insn, int thumb, access *a) {
+	a->kind = thumb ? decode_thumb(insn, a) : decode_arm(insn, a);
+	return a->kind;
+}
+
+int so_unaligned_kind(uint32_t insn, int thumb) {
+	access a;
+	return decode(insn, thumb, &a);
+}
+
+static int build_ldm(emitter *e, const access *a, int load) {
+	int n = __builtin_popcount(a->list);
+	int pc_in = (a->list >> 15) & 1;
+	int base_in = (a->list >> a->rn) & 1;
+	int last = -1, last_offset = 0;
+
+	if (n == 0 || a->rn == 15 || (a->list & (1 << 13)))
+		return -1;
+	if (a->w && (base_in || pc_in))
+		return -1;
+	if (pc_in && (base_in || !load))
+		return -1;
+
+	int offset = a->u ? (a->p ? 4 : 0) : (a->p ? -4 * n : -4 * n + 4);
+	for (int r = 0; r < 16; r++) {
+		if (!(a->list & (1 << r)))
+			continue;
+		// The base and PC are loaded last, so that the rest still sees the base
+		if (load && (r == a->rn || r == 15)) {
+			last = r;
+			last_offset = offset;
+		} else if (emit_ldst(e, load, r, a->rn, offset) < 0) {
+			return -1;
+		}
+		offset += 4;
+	}
+
+	if (last >= 0 && emit_ldst(e, load, last, a->rn, last_offset) < 0)
+		return -1;
+
+	if (a->w)
+		return emit_adjust(e, a->rn, a->u ? 4 * n : -4 * n);
+
+	return 0;
+}
+
+static int build_ldrd(emitter *e, const access *a, int load) {
+	int offset = a->u ? a->imm : -a->imm;
+
+	if (a->reg_offset || a->rn == 15 || a->rt == 15 || a->rt2 == 15)
+		return -1;
+	if (!e->thumb && ((a->rt & 1) || a->rt == 14 || (!a->p && a->w)))
+		return -1;
+
+	if (a->p && !a->w) {
+		if (load && a->rt == a->rn) {
+			if (emit_ldst(e, load, a->rt2, a->rn, offset + 4) < 0 || emit_ldst(e, load, a->rt, a->rn, offset) < 0)
+				return -1;
+		} else {
+			if (emit_ldst(e, load, a->rt, a->rn, offset) < 0 || emit_ldst(e, load, a->rt2, a->rn, offset + 4) < 0)
+				return -1;
+		}
+		return 0;
+	}
+
+	// Pre and post indexed, writing the base back
+	if (a->rn == a->rt || a->rn == a->rt2)
+		return -1;
+	if (a->p && emit_adjust(e, a->rn, offset) < 0)
+		return -1;
+	if (emit_ldst(e, load, a->rt, a->rn, 0) < 0 || emit_ldst(e, load, a->rt2, a->rn, 4) < 0)
+		return -1;
+	if (!a->p && emit_adjust(e, a->rn, offset) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * VLD1/VST1 with writeback step the base through the registers, then the base
+ * is put where the original instruction leaves it. Nothing else is touched.
+ */
+static int build_vldm(emitter *e, const access *a, int load) {
+	int size = a->dbl ? 8 : 4;
+	int count, start, final;
+
+	if (a->rn == 15)
+		return -1;
+
+	if (a->p && !a->w) {
+		// VLDR/VSTR
+		count = 1;
+		start = a->u ? a->imm * 4 : -a->imm * 4;
+		final = 0;
+	} else {
+		// FLDMX/FSTMX have an odd word count
+		if (a->dbl && (a->imm & 1))
+			return -1;
+		count = a->dbl ? a->imm / 2 : a->imm;
+		start = a->p ? -count * size : 0;
+		final = a->w ? (a->p ? start : count * size) : 0;
+	}
+
+	// Lists running past the last register are UNPREDICTABLE
+	if (count == 0 || (a->dbl && count > 16) || a->vd + count > 32)
+		return -1;
+	if (emit_adjust(e, a->rn, start) < 0)
+		return -1;
+
+	for (int i = 0; i < count;) {
+		if (a->dbl) {
+			int n = count - i < 4 ? count - i : 4;
+			emit_vldst_multi(e, load, a->vd + i, n, a->rn);
+			i += n;
+		} else {
+			emit_vldst_lane(e, load, a->vd + i, a->rn);
+			i++;
+		}
+	}
+
+	return emit_adjust(e, a->rn, final - (start + count * size));
+}
+
+int so_unaligned_build(uint32_t insn, int thumb, uintptr_t pc, void *out) {
+	emitter e = { out, 0, thumb };
+	access a;
+	int res;
+
+	switch (decode(insn, thumb, &a)) {
+	case SO_UNALIGNED_LDM:
+	case SO_UNALIGNED_STM:
+		res = build_ldm(&e, &a, a.kind == SO_UNALIGNED_LDM);
+		break;
+	case SO_UNALIGNED_LDRD:
+	case SO_UNALIGNED_STRD:
+		res = build_ldrd(&e, &a, a.kind == SO_UNALIGNED_LDRD);
+		break;
+	case SO_UNALIGNED_VLDM:
+	case SO_UNALIGNED_VSTM:
+		res = build_vldm(&e, &a, a.kind == SO_UNALIGNED_VLDM);
+		break;
+	default:
+		return -1;
+	}
+
+	if (res < 0)
+		return -1;
+
+	emit_jump(&e, pc + 4);
+	return e.len;
+}
+
+// B<cond> from ARM code at pc
+static uint32_t arm_branch(uint32_t insn, uintptr_t pc, uintptr_t dst) {
+	return (insn & 0xF0000000) | 0x0A000000 | (((dst - (pc + 8)) >> 2) & 0xFFFFFF);
+}
+
+// B.W from Thumb code at pc
+static uint32_t thumb_branch(uintptr_t pc, uintptr_t dst) {
+	uint32_t offset = dst - (pc + 4);
+	uint32_t s = (offset >> 24) & 1;
+	uint32_t j1 = !((offset >> 23) & 1) ^ s;
+	uint32_t j2 = !((offset >> 22) & 1) ^ s;
+	return (0xf000 | s << 10 | ((offset >> 12) & 0x3FF)) << 16 | 0x9000 | j1 << 13 | j2 << 11 | ((offset >> 1) & 0x7FF);
+}
+
+static int allowed(const char *name, const char *const *allowlist, int num_allowlist) {
+	if (!allowlist)
+		return 1;
+
+	for (int i = 0; i < num_allowlist; i++) {
+		if (fnmatch(allowlist[i], name, 0) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void rewrite(so_module *mod, uintptr_t addr, uint32_t insn, int thumb, so_unaligned_stats *stats) {
+	const so_platform *platform = so_get_platform();
+	uint8_t code[SO_UNALIGNED_MAX] __attribute__((aligned(4)));
+
+	int size = so_unaligned_build(insn, thumb, addr, code);
+	if (size < 0) {
+		stats->unsupported++;
+		return;
+	}
+
+	uintptr_t trampoline = so_alloc_arena(mod, thumb ? THUMB_B_RANGE : ARM_B_RANGE, addr, size);
+	if (!trampoline) {
+		stats->no_space++;
+		return;
+	}
+
+	platform->copy((void *)trampoline, code, size);
+	if (thumb) {
+		uint32_t branch = thumb_branch(addr, trampoline);
+		uint16_t hw[2] = { branch >> 16, branch };
+		platform->copy((void *)addr, hw, sizeof(hw));
+	} else {
+		uint32_t branch = arm_branch(insn, addr, trampoline);
+		platform->copy((void *)addr, &branch, sizeof(branch));
+	}
+
+	stats->rewritten[so_unaligned_kind(insn, thumb)]++;
+}
+
+// Counts an instruction, and rewrites it if fix is set
+static void visit(so_module *mod, uintptr_t addr, uint32_t insn, int thumb, int fix, int in_it, so_unaligned_stats *stats) {
+	access a;
+
+	if (decode(insn, thumb, &a) < 0)
+		return;
+
+	if (a.rn == 13 || (a.rn == 15 && !a.reg_offset)) {
+		stats->stack++;
+		return;
+	}
+
+	stats->found[a.kind]++;
+	if (!fix)
+		return;
+
+	if (in_it)
+		stats->unsupported++;
+	else
+		rewrite(mod, addr, insn, thumb, stats);
+}
+
+static void scan_arm(so_module *mod, uintptr_t start, uintptr_t end, int fix, so_unaligned_stats *stats) {
+	for (uintptr_t addr = start; addr + 4 <= end; addr += 4)
+		visit(mod, addr, *(uint32_t *)addr, 0, fix, 0, stats);
+}
+
+static void scan_thumb(so_module *mod, uintptr_t start, uintptr_t end, int fix, so_unaligned_stats *stats) {
+	int it_left = 0;
+
+	for (uintptr_t addr = start; addr + 2 <= end;) {
+		uint16_t hw1 = *(uint16_t *)addr;
+		int in_it = it_left > 0;
+
+		if (it_left > 0)
+			it_left--;
+
+		if ((hw1 >> 11) >= 0x1D) {
+			if (addr + 4 > end)
+				break;
+			visit(mod, addr, (uint32_t)hw1 << 16 | *(uint16_t *)(addr + 2), 1, fix, in_it, stats);
+			addr += 4;
+			continue;
+		}
+
+		if ((hw1 & 0xFF00) == 0xBF00 && (hw1 & 0xF)) {
+			// IT: as many instructions follow as the mask has bits up to its lowest set one
+			it_left = 4 - __builtin_ctz(hw1 & 0xF);
+		} else if ((hw1 & 0xF000) == 0xC000) {
+			// 16-bit LDMIA/STMIA, no room for a branch
+			stats->found[(hw1 & 0x800) ? SO_UNALIGNED_LDM : SO_UNALIGNED_STM]++;
+			if (fix)
+				stats->unsupported++;
+		}
+		addr += 2;
+	}
+}
+
+// The dynamic tables come before .plt and .text in the text segment. Symbols
+// claiming to cover them are not code.
+static uintptr_t code_start(so_module *mod) {
+	uintptr_t start = (uintptr_t)(mod->dynsym + mod->num_dynsym);
+
+	if ((uintptr_t)(mod->reldyn + mod->num_reldyn) > start)
+		start = (uintptr_t)(mod->reldyn + mod->num_reldyn);
+	if ((uintptr_t)(mod->relplt + mod->num_relplt) > start)
+		start = (uintptr_t)(mod->relplt + mod->num_relplt);
+
+	return start;
+}
+
+void so_fix_unaligned(so_module *mod, const char *const *allowlist, int num_allowlist, so_unaligned_stats *stats) {
+	uintptr_t text_start = code_start(mod);
+
+	memset(stats, 0, sizeof(so_unaligned_stats));
+
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		if (ELF32_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_shndx == SHN_UNDEF || sym->st_size == 0)
+			continue;
+
+		uintptr_t start = mod->text_base + (sym->st_value & ~1);
+		uintptr_t end = start + sym->st_size;
+		if (start < text_start || end > mod->text_base + mod->text_size)
+			continue;
+
+		int fix = allowed(mod->dynstr + sym->st_name, allowlist, num_allowlist);
+		stats->functions++;
+		if (sym->st_value & 1)
+			scan_thumb(mod, start, end, fix, stats);
+		else
+			scan_arm(mod, start & ~3, end, fix, stats);
+	}
+}
+
+void so_unaligned_report(const char *name, const so_unaligned_stats *stats) {
+	const so_platform *platform = so_get_platform();
+
+	platform->debug("%s: %d functions scanned, %d on the stack, %d unsupported, %d out of trampoline space\n",
+		name, stats->functions, stats->stack, stats->unsupported, stats->no_space);
+	for (int k = 0; k < SO_UNALIGNED_KINDS; k++) {
+		if (stats->found[k])
+			platform->debug("  %-4s %6d found, %6d rewritten\n", kind_names[k], stats->found[k], stats->rewritten[k]);
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef __SO_UNALIGNED_H__
+#define __SO_UNALIGNED_H__
+
+#include "so_util.h"
+
+#define SO_UNALIGNED_MAX 160 // bytes so_unaligned_build may write
+
+// Loads and stores that fault on misaligned addresses even with alignment
+// checking off, unlike LDR, LDRH, STR, STRH and VLD1/VST1
+enum {
+  SO_UNALIGNED_LDM,
+  SO_UNALIGNED_STM,
+  SO_UNALIGNED_LDRD,
+  SO_UNALIGNED_STRD,
+  SO_UNALIGNED_VLDM, // and VLDR
+  SO_UNALIGNED_VSTM, // and VSTR
+  SO_UNALIGNED_KINDS,
+};
+
+typedef struct {
+  int functions; // functions scanned
+  int found[SO_UNALIGNED_KINDS]; // in every function, other than the ones below
+  int rewritten[SO_UNALIGNED_KINDS]; // in the functions of the allowlist
+  int stack; // based on SP or PC, which stay aligned, left alone
+  int unsupported; // 16-bit Thumb, IT blocks, register offsets and other forms left alone
+  int no_space; // no trampoline within branch range
+} so_unaligned_stats;
+
+/*
+ * Thumb instructions are passed as their first halfword << 16 | their second.
+ * so_unaligned_kind: SO_UNALIGNED_* of insn, -1 if it can not fault.
+ * so_unaligned_build: writes to out instructions doing what insn does with
+ * LDR, STR and VLD1/VST1 only, followed by a jump to the instruction after
+ * pc. out must be 4-byte aligned. Returns the bytes written, or -1 when insn
+ * is not one of the forms it rewrites.
+ */
+int so_unaligned_kind(uint32_t insn, int thumb);
+int so_unaligned_build(uint32_t insn, int thumb, uintptr_t pc, void *out);
+
+/*
+ * Scans every function of the module and replaces the instructions that may
+ * fault by branches to rewritten copies of them, in the functions matching
+ * one of the fnmatch patterns of allowlist (all of them if it is NULL). The
+ * others are only counted. Literal pools inside functions can look like code,
+ * so rewriting is best kept to the functions known to need it.
+ */
+void so_fix_unaligned(so_module *mod, const char *const *allowlist, int num_allowlist, so_unaligned_stats *stats);
+void so_unaligned_report(const char *name, const so_unaligned_stats *stats);
+
+#endif
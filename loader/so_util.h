@@ -2,25 +2,39 @@
 #define __SO_UTIL_H__
 
 #include "elf.h"
+#include "so_dynlib.h"
+#include "so_symtab.h"
+#include "so_platform.h"
 
 #define ALIGN_MEM(x, align) (((x) + ((align) - 1)) & ~((align) - 1))
 #define MAX_DATA_SEG 4
+#define SO_HOOK_PATCH_MAX 12 // bytes a hook overwrites, with the NOP in front of unaligned Thumb code
 
 typedef struct {
 	uintptr_t addr;
 	uintptr_t thumb_addr;
 	uint32_t orig_instr[2];
 	uint32_t patch_instr[2];
+	uint16_t orig_pad; // halfword the NOP replaced when thumb_addr is not 4-byte aligned
+	struct so_module *mod;
+	uintptr_t trampoline; // moved prologue jumping back into the function, 0 if it could not be moved
+	size_t trampoline_size;
 } so_hook;
 
 typedef struct so_module {
   struct so_module *next;
 
-  SceUID patch_blockid, text_blockid, data_blockid[MAX_DATA_SEG];
+  int patch_blockid, text_blockid, data_blockid[MAX_DATA_SEG];
   uintptr_t patch_base, patch_head, cave_base, cave_head, text_base, data_base[MAX_DATA_SEG];
   size_t patch_size, cave_size, text_size, data_size[MAX_DATA_SEG];
   int n_data;
 
+  // Whole blocks behind text_base and data_base, as so_snapshot.c saves them
+  size_t text_block_size;
+  uintptr_t data_block_base[MAX_DATA_SEG];
+  size_t data_block_size[MAX_DATA_SEG];
+  uint32_t snapshot_key[4];
+
   Elf32_Ehdr *ehdr;
   Elf32_Phdr *phdr;
   Elf32_Shdr *shdr;
@@ -30,8 +44,9 @@ typedef struct so_module {
   Elf32_Rel *reldyn;
   Elf32_Rel *relplt;
 
-  int (** init_array)(void);
+  uint32_t *init_array;
   uint32_t *hash;
+  uint32_t *gnu_hash;
 
   int num_dynamic;
   int num_dynsym;
@@ -42,34 +57,62 @@ typedef struct so_module {
   char *soname;
   char *shstr;
   char *dynstr;
-} so_module;
 
-typedef struct {
-  char *symbol;
-  uintptr_t func;
-} so_default_dynlib;
+  so_symtab symtab;
+
+  // so_link_lazy: JUMP_SLOTs still pointing at lazy_resolver are bound on first call
+  uintptr_t lazy_resolver;
+  so_dynlib_table *lazy_dynlib;
+  int lazy_dynlib_only;
+  int num_lazy, num_lazy_bound;
+
+  struct so_arena_pool *arena;
+} so_module;
 
 so_hook hook_thumb(uintptr_t addr, uintptr_t dst);
 so_hook hook_arm(uintptr_t addr, uintptr_t dst);
 so_hook hook_addr(uintptr_t addr, uintptr_t dst);
+// Sets up a hook of addr without installing it: fills in h and the bytes to
+// write at patch_addr, returns their number (0 if addr is 0). The trampoline
+// SO_CONTINUE calls through is only built if asked for.
+size_t so_hook_prepare(so_hook *h, uintptr_t addr, uintptr_t dst, int trampoline, uintptr_t *patch_addr, void *patch);
+// Puts the original instructions back and frees the trampoline
+void so_unhook(so_hook *h);
+// Takes an installed hook out and puts it back, see SO_CONTINUE
+void so_hook_disable(const so_hook *h);
+void so_hook_enable(const so_hook *h);
 
 void so_flush_caches(so_module *mod);
+void so_set_platform(const so_platform *platform);
+const so_platform *so_get_platform(void);
+void so_add_module(so_module *mod);
+so_module *so_last_module(void);
+so_module *so_find_module(uintptr_t addr);
 int so_file_load(so_module *mod, const char *filename, uintptr_t load_addr);
 int so_mem_load(so_module *mod, void * buffer, size_t so_size, uintptr_t load_addr);
+void so_unload(so_module *mod);
 int so_relocate(so_module *mod);
-int so_resolve(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
-int so_resolve_with_dummy(so_module *mod, so_default_dynlib *default_dynlib, int size_default_dynlib, int default_dynlib_only);
-void so_symbol_fix_ldmia(so_module *mod, const char *symbol);
+int so_resolve(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only);
+int so_link(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only);
+int so_link_lazy(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only);
+int so_lazy_init(so_module *mod, so_dynlib_table *default_dynlib, int default_dynlib_only);
+uintptr_t so_lazy_bind(uint32_t *slot, so_module *mod);
+void so_lazy_bind_all(so_module *mod);
+void so_lazy_report(so_module *mod, const char *name);
+int so_resolve_with_dummy(so_module *mod, so_dynlib_table *default_dynlib);
 void so_initialize(so_module *mod);
 uintptr_t so_symbol(so_module *mod, const char *symbol);
+void reloc_err(uintptr_t got0);
+void plt0_stub();
 
-#define SO_CONTINUE(type, h, ...) ({ \
-  kuKernelCpuUnrestrictedMemcpy((void *)h.addr, h.orig_instr, sizeof(h.orig_instr)); \
-  kuKernelFlushCaches((void *)h.addr, sizeof(h.orig_instr)); \
+// Calls the function h hooked. Goes through its trampoline, which any number
+// of threads can do at once. Without one, the hook is taken out for the
+// duration of the call, and other threads calling in meanwhile miss it.
+#define SO_CONTINUE(type, h, ...) (h.trampoline ? ((type(*)())h.trampoline)(__VA_ARGS__) : ({ \
+  so_hook_disable(&h); \
   type r = h.thumb_addr ? ((type(*)())h.thumb_addr)(__VA_ARGS__) : ((type(*)())h.addr)(__VA_ARGS__); \
-  kuKernelCpuUnrestrictedMemcpy((void *)h.addr, h.patch_instr, sizeof(h.patch_instr)); \
-  kuKernelFlushCaches((void *)h.addr, sizeof(h.patch_instr)); \
+  so_hook_enable(&h); \
   r; \
-})
+}))
 
 #endif
@@ -12,35 +12,40 @@
 
 #include "main.h"
 #include "so_util.h"
+#include "so_hook_table.h"
 
-void patch_vorbis(void) {
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_analysis"), (uintptr_t)vorbis_analysis);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_analysis_blockout"), (uintptr_t)vorbis_analysis_blockout);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_analysis_buffer"), (uintptr_t)vorbis_analysis_buffer);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_analysis_headerout"), (uintptr_t)vorbis_analysis_headerout);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_analysis_init"), (uintptr_t)vorbis_analysis_init);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_analysis_wrote"), (uintptr_t)vorbis_analysis_wrote);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_bitrate_addblock"), (uintptr_t)vorbis_bitrate_addblock);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_bitrate_flushpacket"), (uintptr_t)vorbis_bitrate_flushpacket);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_block_clear"), (uintptr_t)vorbis_block_clear);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_block_init"), (uintptr_t)vorbis_block_init);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_comment_add"), (uintptr_t)vorbis_comment_add);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_comment_add_tag"), (uintptr_t)vorbis_comment_add_tag);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_comment_clear"), (uintptr_t)vorbis_comment_clear);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_comment_init"), (uintptr_t)vorbis_comment_init);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_comment_query"), (uintptr_t)vorbis_comment_query);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_comment_query_count"), (uintptr_t)vorbis_comment_query_count);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_commentheader_out"), (uintptr_t)vorbis_commentheader_out);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_dsp_clear"), (uintptr_t)vorbis_dsp_clear);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_info_blocksize"), (uintptr_t)vorbis_info_blocksize);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_info_clear"), (uintptr_t)vorbis_info_clear);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_info_init"), (uintptr_t)vorbis_info_init);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_packet_blocksize"), (uintptr_t)vorbis_packet_blocksize);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_synthesis"), (uintptr_t)vorbis_synthesis);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_synthesis_blockin"), (uintptr_t)vorbis_synthesis_blockin);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_synthesis_headerin"), (uintptr_t)vorbis_synthesis_headerin);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_synthesis_init"), (uintptr_t)vorbis_synthesis_init);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_synthesis_pcmout"), (uintptr_t)vorbis_synthesis_pcmout);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_synthesis_read"), (uintptr_t)vorbis_synthesis_read);
-	hook_addr(so_symbol(&fahrenheit_mod, "vorbis_synthesis_trackonly"), (uintptr_t)vorbis_synthesis_trackonly);
+static const so_hook_def vorbis_hooks[] = {
+	SO_HOOK("vorbis_analysis", vorbis_analysis),
+	SO_HOOK("vorbis_analysis_blockout", vorbis_analysis_blockout),
+	SO_HOOK("vorbis_analysis_buffer", vorbis_analysis_buffer),
+	SO_HOOK("vorbis_analysis_headerout", vorbis_analysis_headerout),
+	SO_HOOK("vorbis_analysis_init", vorbis_analysis_init),
+	SO_HOOK("vorbis_analysis_wrote", vorbis_analysis_wrote),
+	SO_HOOK("vorbis_bitrate_addblock", vorbis_bitrate_addblock),
+	SO_HOOK("vorbis_bitrate_flushpacket", vorbis_bitrate_flushpacket),
+	SO_HOOK("vorbis_block_clear", vorbis_block_clear),
+	SO_HOOK("vorbis_block_init", vorbis_block_init),
+	SO_HOOK("vorbis_comment_add", vorbis_comment_add),
+	SO_HOOK("vorbis_comment_add_tag", vorbis_comment_add_tag),
+	SO_HOOK("vorbis_comment_clear", vorbis_comment_clear),
+	SO_HOOK("vorbis_comment_init", vorbis_comment_init),
+	SO_HOOK("vorbis_comment_query", vorbis_comment_query),
+	SO_HOOK("vorbis_comment_query_count", vorbis_comment_query_count),
+	SO_HOOK("vorbis_commentheader_out", vorbis_commentheader_out),
+	SO_HOOK("vorbis_dsp_clear", vorbis_dsp_clear),
+	SO_HOOK("vorbis_info_blocksize", vorbis_info_blocksize),
+	SO_HOOK("vorbis_info_clear", vorbis_info_clear),
+	SO_HOOK("vorbis_info_init", vorbis_info_init),
+	SO_HOOK("vorbis_packet_blocksize", vorbis_packet_blocksize),
+	SO_HOOK("vorbis_synthesis", vorbis_synthesis),
+	SO_HOOK("vorbis_synthesis_blockin", vorbis_synthesis_blockin),
+	SO_HOOK("vorbis_synthesis_headerin", vorbis_synthesis_headerin),
+	SO_HOOK("vorbis_synthesis_init", vorbis_synthesis_init),
+	SO_HOOK("vorbis_synthesis_pcmout", vorbis_synthesis_pcmout),
+	SO_HOOK("vorbis_synthesis_read", vorbis_synthesis_read),
+	SO_HOOK("vorbis_synthesis_trackonly", vorbis_synthesis_trackonly),
+};
+
+void patch_vorbis(so_hook_batch *batch) {
+	so_hook_batch_add(batch, vorbis_hooks, SO_HOOK_COUNT(vorbis_hooks));
 }
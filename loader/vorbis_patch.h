@@ -1,6 +1,8 @@
 #ifndef __VORBIS_PATCH_H__
 #define __VORBIS_PATCH_H__
 
-void patch_vorbis(void);
+#include "so_hook_table.h"
+
+void patch_vorbis(so_hook_batch *batch);
 
 #endif
@@ -0,0 +1,286 @@
+// Renames shaders cached under the old SHA-1 keys (loose <sha1>.gxp files or a
+// version 1 gxp.pack) to the keys of the current shader_key_hash, ready for
+// gxppack. A SHA-1 key cannot be turned into another hash, so the shader
+// sources are needed for that: capture them with DUMP_SHADERS in config.h.
+// Only the sha1 key hash can be migrated without sources.
+//
+// gcc -O2 -o gxpmigrate gxpmigrate.c ../loader/shader_key.c ../loader/sha1.c
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../loader/sha1.h"
+#include "../loader/shader_key.h"
+#include "../loader/shader_pack.h"
+
+// gxp.pack before the key hash became configurable
+#define LEGACY_PACK_VERSION 1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t key_words;
+} legacy_pack_header;
+
+typedef struct {
+	uint32_t key[5];
+	uint32_t offset;
+	uint32_t size;
+} legacy_pack_entry;
+
+typedef struct {
+	uint32_t sha1[5];
+	uint32_t key[SHADER_KEY_WORDS];
+} key_map;
+
+static const shader_key_hash *key_hash = &murmur3_key;
+static const char *out_dir;
+
+static key_map *map;
+static size_t num_map;
+
+static size_t migrated, unmatched;
+
+static uint8_t *read_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	uint8_t *buf = malloc(*size ? *size : 1);
+	if (fread(buf, 1, *size, f) != *size) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+
+	return buf;
+}
+
+static int cmp_map(const void *a, const void *b) {
+	return memcmp(((const key_map *)a)->sha1, ((const key_map *)b)->sha1, sizeof(((key_map *)0)->sha1));
+}
+
+static int add_sources(const char *dir) {
+	char path[4096];
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d) {
+		printf("Could not open %s\n", dir);
+		return -1;
+	}
+
+	while ((de = readdir(d))) {
+		size_t size;
+		SHA1_CTX ctx;
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		uint8_t *src = read_file(path, &size);
+		if (!src)
+			continue;
+
+		map = realloc(map, (num_map + 1) * sizeof(key_map));
+		sha1_init(&ctx);
+		sha1_update(&ctx, src, size);
+		sha1_final(&ctx, (BYTE *)map[num_map].sha1);
+		key_hash->hash(src, size, map[num_map].key);
+		num_map++;
+
+		free(src);
+	}
+
+	closedir(d);
+	qsort(map, num_map, sizeof(key_map), cmp_map);
+	return 0;
+}
+
+static int new_key(const uint32_t sha1[5], uint32_t key[SHADER_KEY_WORDS]) {
+	// The sha1 key hash keeps the leading words of the old key
+	if (key_hash == &sha1_key) {
+		memcpy(key, sha1, SHADER_KEY_WORDS * sizeof(uint32_t));
+		return 0;
+	}
+
+	key_map probe;
+	memcpy(probe.sha1, sha1, sizeof(probe.sha1));
+	key_map *m = bsearch(&probe, map, num_map, sizeof(key_map), cmp_map);
+	if (!m)
+		return -1;
+
+	memcpy(key, m->key, sizeof(m->key));
+	return 0;
+}
+
+static int migrate(const uint32_t sha1[5], const uint8_t *data, size_t size) {
+	uint32_t key[SHADER_KEY_WORDS];
+	char name[SHADER_KEY_CHARS + 1];
+	char path[4096];
+
+	if (new_key(sha1, key) < 0) {
+		unmatched++;
+		return 0;
+	}
+
+	shader_key_name(key, name);
+	snprintf(path, sizeof(path), "%s/%s.gxp", out_dir, name);
+
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		printf("Could not open %s\n", path);
+		return -1;
+	}
+	fwrite(data, 1, size, f);
+	fclose(f);
+
+	migrated++;
+	return 0;
+}
+
+static int migrate_pack(const char *path) {
+	size_t size;
+	uint8_t *pack = read_file(path, &size);
+	legacy_pack_header *hdr = (legacy_pack_header *)pack;
+
+	if (!pack || size < sizeof(legacy_pack_header) || hdr->magic != SHADER_PACK_MAGIC) {
+		printf("%s is not a gxp.pack\n", path);
+		return -1;
+	}
+
+	if (hdr->version != LEGACY_PACK_VERSION || hdr->key_words != 5 ||
+		hdr->count > (size - sizeof(legacy_pack_header)) / sizeof(legacy_pack_entry)) {
+		printf("%s: unsupported pack version %u\n", path, hdr->version);
+		return -1;
+	}
+
+	legacy_pack_entry *table = (legacy_pack_entry *)(pack + sizeof(legacy_pack_header));
+	for (uint32_t i = 0; i < hdr->count; i++) {
+		if (table[i].offset > size || table[i].size > size - table[i].offset) {
+			printf("%s: entry %u out of bounds\n", path, i);
+			return -1;
+		}
+		if (migrate(table[i].key, pack + table[i].offset, table[i].size) < 0)
+			return -1;
+	}
+
+	free(pack);
+	return 0;
+}
+
+static int migrate_dir(const char *dir) {
+	char path[4096];
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d) {
+		printf("Could not open %s\n", dir);
+		return -1;
+	}
+
+	while ((de = readdir(d))) {
+		uint32_t sha1[5];
+		char word[9];
+		size_t size;
+		int valid = 1;
+
+		if (strlen(de->d_name) != 44 || strcmp(de->d_name + 40, ".gxp") != 0)
+			continue;
+
+		for (int i = 0; i < 5 && valid; i++) {
+			char *end;
+			memcpy(word, de->d_name + i * 8, 8);
+			word[8] = '\0';
+			sha1[i] = strtoul(word, &end, 16);
+			valid = *end == '\0';
+		}
+		if (!valid)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		uint8_t *data = read_file(path, &size);
+		if (!data) {
+			printf("Could not read %s\n", path);
+			closedir(d);
+			return -1;
+		}
+
+		int res = migrate(sha1, data, size);
+		free(data);
+		if (res < 0) {
+			closedir(d);
+			return -1;
+		}
+	}
+
+	closedir(d);
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: ./gxpmigrate [-k hash] [-s sources_dir] out_dir input...\n");
+	printf("  input         directory of <sha1>.gxp files, or a version 1 gxp.pack\n");
+	printf("  -k hash       key hash to migrate to, murmur3 or sha1 (default murmur3)\n");
+	printf("  -s dir        shader sources captured with DUMP_SHADERS (may be repeated),\n");
+	printf("                required unless migrating to sha1\n");
+}
+
+int main(int argc, char *argv[]) {
+	struct stat st;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "k:s:")) != -1) {
+		switch (opt) {
+		case 'k':
+			key_hash = shader_key_find(optarg);
+			if (!key_hash) {
+				printf("Unknown key hash %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			if (add_sources(optarg) < 0)
+				return 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage();
+		return 1;
+	}
+
+	if (key_hash != &sha1_key && num_map == 0) {
+		printf("Migrating to %s needs the shader sources (-s)\n", key_hash->name);
+		return 1;
+	}
+
+	out_dir = argv[optind];
+	mkdir(out_dir, 0777);
+
+	for (int i = optind + 1; i < argc; i++) {
+		if (stat(argv[i], &st) < 0) {
+			printf("Could not open %s\n", argv[i]);
+			return 1;
+		}
+		if ((S_ISDIR(st.st_mode) ? migrate_dir(argv[i]) : migrate_pack(argv[i])) < 0)
+			return 1;
+	}
+
+	printf("Migrated %zu shaders to %s keys, %zu without a matching source\n", migrated, key_hash->name, unmatched);
+	return 0;
+}
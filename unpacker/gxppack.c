@@ -0,0 +1,192 @@
+// Builds the gxp.pack loaded by the loader (see loader/shader_pack.h) out of
+// directories of loose <key>.gxp files. Later directories override earlier ones.
+// Shaders still named by their SHA-1 have to go through gxpmigrate first.
+//
+// gcc -O2 -o gxppack gxppack.c ../loader/shader_key.c ../loader/sha1.c
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../loader/shader_pack.h"
+
+typedef struct {
+	uint32_t key[SHADER_KEY_WORDS];
+	uint8_t *data;
+	uint32_t size;
+	int src;
+} gxp_file;
+
+static gxp_file *files;
+static size_t num_files;
+static size_t cap_files;
+
+// <key>.gxp, as named by the loader
+static int parse_name(const char *name, uint32_t key[SHADER_KEY_WORDS]) {
+	if (strlen(name) != SHADER_KEY_CHARS + 4 || strcmp(name + SHADER_KEY_CHARS, ".gxp") != 0)
+		return -1;
+
+	return shader_key_parse(name, key);
+}
+
+static int cmp_file(const void *a, const void *b) {
+	const gxp_file *fa = (const gxp_file *)a;
+	const gxp_file *fb = (const gxp_file *)b;
+	for (int i = 0; i < SHADER_KEY_WORDS; i++) {
+		if (fa->key[i] != fb->key[i])
+			return fa->key[i] < fb->key[i] ? -1 : 1;
+	}
+	return fa->src - fb->src;
+}
+
+static int add_dir(const char *dir, int src) {
+	char path[4096];
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d) {
+		printf("Could not open %s\n", dir);
+		return -1;
+	}
+
+	while ((de = readdir(d))) {
+		gxp_file f;
+		FILE *fin;
+		long size;
+
+		if (parse_name(de->d_name, f.key) < 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		fin = fopen(path, "rb");
+		if (!fin) {
+			printf("Could not open %s\n", path);
+			closedir(d);
+			return -1;
+		}
+
+		fseek(fin, 0, SEEK_END);
+		size = ftell(fin);
+		fseek(fin, 0, SEEK_SET);
+
+		f.data = malloc(size ? size : 1);
+		f.size = size;
+		f.src = src;
+		if (fread(f.data, 1, size, fin) != (size_t)size) {
+			printf("Could not read %s\n", path);
+			fclose(fin);
+			closedir(d);
+			return -1;
+		}
+		fclose(fin);
+
+		if (num_files == cap_files) {
+			cap_files = cap_files ? cap_files * 2 : 1024;
+			files = realloc(files, cap_files * sizeof(gxp_file));
+		}
+		files[num_files++] = f;
+	}
+
+	closedir(d);
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: ./gxppack [-k hash] out_pack gxp_dir [gxp_dir...]\n");
+	printf("  -k hash   key hash the names were made with, murmur3 or sha1 (default murmur3)\n");
+}
+
+int main(int argc, char *argv[]) {
+	shader_pack_header hdr;
+	shader_pack_entry *table;
+	static const uint8_t pad[SHADER_PACK_ALIGN];
+	const shader_key_hash *key_hash = &murmur3_key;
+	const char *out_path;
+	uint64_t off;
+	size_t n = 0;
+	FILE *fout;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "k:")) != -1) {
+		switch (opt) {
+		case 'k':
+			key_hash = shader_key_find(optarg);
+			if (!key_hash) {
+				printf("Unknown key hash %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage();
+		return 1;
+	}
+
+	out_path = argv[optind];
+	for (int i = optind + 1; i < argc; i++) {
+		if (add_dir(argv[i], i) < 0)
+			return 1;
+	}
+
+	// Sorting by key then source puts the overriding copy last among duplicates
+	qsort(files, num_files, sizeof(gxp_file), cmp_file);
+	for (size_t i = 0; i < num_files; i++) {
+		if (n > 0 && memcmp(files[n - 1].key, files[i].key, sizeof(files[i].key)) == 0)
+			files[n - 1] = files[i];
+		else
+			files[n++] = files[i];
+	}
+
+	table = calloc(n ? n : 1, sizeof(shader_pack_entry));
+	off = sizeof(hdr) + n * sizeof(shader_pack_entry);
+	for (size_t i = 0; i < n; i++) {
+		off = (off + SHADER_PACK_ALIGN - 1) & ~(uint64_t)(SHADER_PACK_ALIGN - 1);
+		memcpy(table[i].key, files[i].key, sizeof(table[i].key));
+		table[i].offset = off;
+		table[i].size = files[i].size;
+		off += files[i].size;
+	}
+
+	if (off > UINT32_MAX) {
+		printf("Pack too large\n");
+		return 1;
+	}
+
+	fout = fopen(out_path, "wb");
+	if (!fout) {
+		printf("Could not open %s\n", out_path);
+		return 1;
+	}
+
+	hdr.magic = SHADER_PACK_MAGIC;
+	hdr.version = SHADER_PACK_VERSION;
+	hdr.count = n;
+	hdr.key_words = SHADER_KEY_WORDS;
+	hdr.key_hash = key_hash->id;
+	fwrite(&hdr, 1, sizeof(hdr), fout);
+	fwrite(table, sizeof(shader_pack_entry), n, fout);
+
+	off = sizeof(hdr) + n * sizeof(shader_pack_entry);
+	for (size_t i = 0; i < n; i++) {
+		fwrite(pad, 1, table[i].offset - off, fout);
+		fwrite(files[i].data, 1, files[i].size, fout);
+		off = table[i].offset + files[i].size;
+	}
+
+	if (fclose(fout) != 0) {
+		printf("Could not write %s\n", out_path);
+		return 1;
+	}
+
+	printf("Packed %zu shaders (%.2f KB) into %s\n", n, off / 1024.0, out_path);
+
+	return 0;
+}
@@ -0,0 +1,317 @@
+// Runs the loader's Obb file layer (obb_file.c, prefetch.c) on a host over
+// an extracted obb, so read strategies can be compared without a Vita.
+//
+// gcc -O2 -o iobench iobench.c ../loader/obb_file.c ../loader/prefetch.c ../loader/io_posix.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../loader/io_backend.h"
+#include "../loader/io_trace.h"
+#include "../loader/obb_file.h"
+#include "../loader/prefetch.h"
+
+#define MAX_HANDLES 65536
+#define MAX_PATH 4096
+
+static const io_backend *g_Inner;
+
+static struct {
+	uint64_t open;
+	uint64_t size;
+	uint64_t pread;
+	uint64_t close;
+	uint64_t bytes;
+} g_Calls;
+
+static int count_exists(const char *path) {
+	return g_Inner->exists(path);
+}
+
+static int count_valid(int32_t fh) {
+	return g_Inner->valid(fh);
+}
+
+static int count_open(const char *path, int32_t *fh) {
+	__sync_fetch_and_add(&g_Calls.open, 1);
+	return g_Inner->open(path, fh);
+}
+
+static int64_t count_size(int32_t fh) {
+	__sync_fetch_and_add(&g_Calls.size, 1);
+	return g_Inner->size(fh);
+}
+
+static int64_t count_pread(int32_t fh, void *buf, int64_t len, int64_t off) {
+	int64_t res = g_Inner->pread(fh, buf, len, off);
+	__sync_fetch_and_add(&g_Calls.pread, 1);
+	if (res > 0)
+		__sync_fetch_and_add(&g_Calls.bytes, res);
+	return res;
+}
+
+static void count_close(int32_t fh) {
+	__sync_fetch_and_add(&g_Calls.close, 1);
+	g_Inner->close(fh);
+}
+
+// Wraps the backend under test so every call that would be a syscall on the Vita is counted
+static const io_backend g_Counting = {
+	.name = "counting",
+	.exists = count_exists,
+	.valid = count_valid,
+	.open = count_open,
+	.size = count_size,
+	.pread = count_pread,
+	.close = count_close,
+};
+
+static uint64_t g_Files;
+static uint64_t g_Bytes;
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Same sequence as ASL__FsApi__Obb__Vfs__fopen followed by ASL__FsApi__lookupFile
+static obb_file *bench_open(const char *path) {
+	int32_t fh;
+
+	if (g_Counting.open(path, &fh) < 0) {
+		printf("Could not open %s\n", path);
+		return NULL;
+	}
+
+	prefetch_bind(fh, prefetch_open(path));
+
+	g_Files++;
+	return obb_file_new(NULL, &g_Counting, fh);
+}
+
+static int run_list(FILE *fin, int getc_mode, size_t chunk) {
+	char path[MAX_PATH];
+	uint8_t *buf = malloc(chunk);
+
+	while (fgets(path, sizeof(path), fin)) {
+		path[strcspn(path, "\r\n")] = '\0';
+		if (path[0] == '#' || path[0] == '\0')
+			continue;
+
+		obb_file *f = bench_open(path);
+		if (!f)
+			continue;
+
+		if (getc_mode) {
+			while (obb_file_getc(f) != EOF)
+				g_Bytes++;
+		} else {
+			size_t n;
+			while ((n = obb_file_read(f, buf, chunk)) > 0)
+				g_Bytes += n;
+		}
+
+		obb_file_close(f);
+	}
+
+	free(buf);
+	return 0;
+}
+
+static int run_trace(FILE *fin) {
+	static obb_file *files[MAX_HANDLES];
+	static struct {
+		uint32_t hash;
+		char *path;
+	} *names;
+	size_t num_names = 0;
+	io_trace_header hdr;
+	io_trace_record r;
+	uint8_t *buf = NULL;
+	size_t buf_len = 0;
+
+	if (fread(&hdr, 1, sizeof(hdr), fin) != sizeof(hdr) || hdr.version != IO_TRACE_VERSION ||
+		hdr.record_size != sizeof(io_trace_record)) {
+		printf("Unsupported trace\n");
+		return -1;
+	}
+
+	while (fread(&r, 1, sizeof(r), fin) == sizeof(r)) {
+		obb_file *f = files[r.handle];
+
+		if (r.op == IO_TRACE_NAME) {
+			uint32_t n = (r.length + sizeof(r) - 1) / sizeof(r);
+			char *path = malloc(n * sizeof(r) + 1);
+			if (fread(path, 1, n * sizeof(r), fin) != n * sizeof(r))
+				break;
+			path[r.length] = '\0';
+			names = realloc(names, (num_names + 1) * sizeof(*names));
+			names[num_names].hash = r.path_hash;
+			names[num_names].path = path;
+			num_names++;
+			continue;
+		}
+
+		if (r.failed)
+			continue;
+
+		switch (r.op) {
+		case IO_TRACE_OPEN:
+			for (size_t i = num_names; i > 0; i--) {
+				if (names[i - 1].hash == r.path_hash) {
+					if (f)
+						obb_file_close(f);
+					files[r.handle] = bench_open(names[i - 1].path);
+					break;
+				}
+			}
+			break;
+		case IO_TRACE_READ:
+			if (!f)
+				break;
+			if (r.length > buf_len) {
+				buf_len = r.length;
+				buf = realloc(buf, buf_len);
+			}
+			if (obb_file_tell(f) != r.offset)
+				obb_file_seek(f, r.offset, SEEK_SET);
+			g_Bytes += obb_file_read(f, buf, r.length);
+			break;
+		case IO_TRACE_GETC:
+			if (!f)
+				break;
+			if (obb_file_tell(f) != r.offset)
+				obb_file_seek(f, r.offset, SEEK_SET);
+			if (obb_file_getc(f) != EOF)
+				g_Bytes++;
+			break;
+		case IO_TRACE_SEEK:
+			if (f)
+				obb_file_seek(f, r.offset, SEEK_SET);
+			break;
+		case IO_TRACE_TELL:
+			if (f)
+				obb_file_tell(f);
+			break;
+		case IO_TRACE_CLOSE:
+			if (f)
+				obb_file_close(f);
+			files[r.handle] = NULL;
+			break;
+		}
+	}
+
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (files[i])
+			obb_file_close(files[i]);
+	}
+
+	free(buf);
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: ./iobench [options] root list_or_trace\n");
+	printf("  root         directory holding the extracted psarc/ tree\n");
+	printf("  list_or_trace  paths to read in order (one per line), or an io_trace.bin to replay\n");
+	printf("  -b backend   posix or mmap (default posix)\n");
+	printf("  -p manifest  prefetch with the given manifest\n");
+	printf("  -g           read lists with getc instead of fread\n");
+	printf("  -c size      fread chunk size for lists (default 4096)\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *manifest = NULL;
+	size_t chunk = 4096;
+	int getc_mode = 0;
+	uint32_t magic = 0;
+	double start, elapsed;
+	int opt;
+	int res;
+	FILE *fin;
+
+	g_Inner = &posix_backend;
+
+	while ((opt = getopt(argc, argv, "b:p:gc:")) != -1) {
+		switch (opt) {
+		case 'b':
+			if (strcmp(optarg, "posix") == 0)
+				g_Inner = &posix_backend;
+			else if (strcmp(optarg, "mmap") == 0)
+				g_Inner = &mmap_backend;
+			else {
+				printf("Unknown backend %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			manifest = optarg;
+			break;
+		case 'g':
+			getc_mode = 1;
+			break;
+		case 'c':
+			chunk = atoi(optarg);
+			if (chunk == 0) {
+				printf("Chunk size must not be 0\n");
+				return 1;
+			}
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage();
+		return 1;
+	}
+
+	io_posix_set_root(argv[optind]);
+
+	if (manifest && prefetch_init(&g_Counting, manifest) < 0) {
+		printf("Could not load %s\n", manifest);
+		return 1;
+	}
+
+	fin = fopen(argv[optind + 1], "rb");
+	if (!fin) {
+		printf("Could not open %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	fread(&magic, 1, sizeof(magic), fin);
+	fseek(fin, 0, SEEK_SET);
+
+	start = now();
+	if (magic == IO_TRACE_MAGIC)
+		res = run_trace(fin);
+	else
+		res = run_list(fin, getc_mode, chunk);
+	elapsed = now() - start;
+
+	fclose(fin);
+
+	if (res < 0)
+		return 1;
+
+	printf("%s%s: %llu files, %.2f MB in %.3f s, %.2f MB/s\n", g_Inner->name, manifest ? "+prefetch" : "",
+		(unsigned long long)g_Files, g_Bytes / (1024.0 * 1024.0), elapsed,
+		elapsed > 0 ? g_Bytes / (1024.0 * 1024.0) / elapsed : 0.0);
+	printf("backend calls: %llu open, %llu size, %llu pread, %llu close, %.2f MB read\n",
+		(unsigned long long)g_Calls.open, (unsigned long long)g_Calls.size,
+		(unsigned long long)g_Calls.pread, (unsigned long long)g_Calls.close,
+		g_Calls.bytes / (1024.0 * 1024.0));
+	if (g_Files)
+		printf("per asset: %.2f calls, %.1f KB read\n",
+			(double)(g_Calls.open + g_Calls.size + g_Calls.pread + g_Calls.close) / g_Files,
+			g_Calls.bytes / 1024.0 / g_Files);
+
+	return 0;
+}
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../loader/io_trace.h"
+
+#define HEAT_COLUMNS 32
+#define LATENCY_BUCKETS 24 // log2 microseconds
+#define MAX_HANDLES 65536
+
+static const char *op_names[] = {
+	[IO_TRACE_OPEN] = "open",
+	[IO_TRACE_READ] = "read",
+	[IO_TRACE_SEEK] = "seek",
+	[IO_TRACE_TELL] = "tell",
+	[IO_TRACE_GETC] = "getc",
+	[IO_TRACE_CLOSE] = "close",
+};
+
+#define NUM_OPS (IO_TRACE_CLOSE + 1)
+
+typedef struct {
+	uint32_t path_hash;
+	char *path;
+	uint64_t first_open;
+	uint64_t opens;
+	uint64_t reads;
+	uint64_t getcs;
+	uint64_t seeks;
+	uint64_t bytes;
+	uint64_t seq;
+	uint64_t random;
+	uint64_t extent;
+	uint64_t time;
+	uint32_t *heat; // accesses per 4KB page, grown on demand
+	uint64_t heat_pages;
+} trace_file;
+
+static trace_file *files;
+static size_t num_files;
+static size_t cap_files;
+
+static uint64_t latency[NUM_OPS][LATENCY_BUCKETS];
+static uint64_t op_count[NUM_OPS];
+static uint64_t op_failed[NUM_OPS];
+static uint64_t dropped;
+
+// Expected position of the next access on each handle
+static int64_t next_pos[MAX_HANDLES];
+
+static trace_file *get_file(uint32_t path_hash) {
+	for (size_t i = 0; i < num_files; i++) {
+		if (files[i].path_hash == path_hash)
+			return &files[i];
+	}
+
+	if (num_files == cap_files) {
+		cap_files = cap_files ? cap_files * 2 : 256;
+		files = realloc(files, cap_files * sizeof(trace_file));
+	}
+
+	trace_file *f = &files[num_files++];
+	memset(f, 0, sizeof(trace_file));
+	f->path_hash = path_hash;
+	f->first_open = UINT64_MAX;
+	return f;
+}
+
+static void add_heat(trace_file *f, uint64_t off, uint64_t len) {
+	uint64_t first = off / 4096;
+	uint64_t last = (off + len - 1) / 4096;
+
+	if (last >= f->heat_pages) {
+		uint64_t n = f->heat_pages ? f->heat_pages : 16;
+		while (n <= last)
+			n *= 2;
+		f->heat = realloc(f->heat, n * sizeof(uint32_t));
+		memset(f->heat + f->heat_pages, 0, (n - f->heat_pages) * sizeof(uint32_t));
+		f->heat_pages = n;
+	}
+
+	for (uint64_t p = first; p <= last; p++)
+		f->heat[p]++;
+}
+
+static int log2_bucket(uint32_t v) {
+	int b = 0;
+	while (v > 1 && b < LATENCY_BUCKETS - 1) {
+		v >>= 1;
+		b++;
+	}
+	return b;
+}
+
+static void account(io_trace_record *r, double tick_us) {
+	trace_file *f = get_file(r->path_hash);
+	uint32_t h = r->handle % MAX_HANDLES;
+	uint64_t len;
+
+	if (r->op >= NUM_OPS)
+		return;
+
+	op_count[r->op]++;
+	if (r->failed) {
+		op_failed[r->op]++;
+		return;
+	}
+
+	latency[r->op][log2_bucket((uint32_t)(r->latency * tick_us))]++;
+	f->time += r->latency;
+
+	switch (r->op) {
+	case IO_TRACE_OPEN:
+		f->opens++;
+		if (r->time < f->first_open)
+			f->first_open = r->time;
+		next_pos[h] = 0;
+		break;
+	case IO_TRACE_READ:
+	case IO_TRACE_GETC:
+		if (r->op == IO_TRACE_READ)
+			f->reads++;
+		else
+			f->getcs++;
+		len = r->length ? r->length : 1;
+		if (r->offset == next_pos[h])
+			f->seq++;
+		else
+			f->random++;
+		next_pos[h] = r->offset + len;
+		f->bytes += len;
+		if (r->offset + len > f->extent)
+			f->extent = r->offset + len;
+		add_heat(f, r->offset, len);
+		break;
+	case IO_TRACE_SEEK:
+		f->seeks++;
+		next_pos[h] = r->offset;
+		break;
+	}
+}
+
+static char heat_char(uint64_t v, uint64_t max) {
+	static const char ramp[] = " .:-=+*#%@";
+	if (v == 0)
+		return ramp[0];
+	return ramp[1 + v * (sizeof(ramp) - 3) / max];
+}
+
+static void print_heat(trace_file *f) {
+	uint64_t pages = (f->extent + 4095) / 4096;
+	uint64_t cols[HEAT_COLUMNS] = { 0 };
+	uint64_t max = 0;
+	int n = pages < HEAT_COLUMNS ? (int)pages : HEAT_COLUMNS;
+
+	if (n == 0)
+		return;
+
+	for (uint64_t p = 0; p < pages; p++) {
+		int c = (int)(p * n / pages);
+		cols[c] += f->heat[p];
+		if (cols[c] > max)
+			max = cols[c];
+	}
+
+	printf("    [");
+	for (int c = 0; c < n; c++)
+		putchar(heat_char(cols[c], max));
+	printf("]\n");
+}
+
+static int cmp_first_open(const void *a, const void *b) {
+	const trace_file *fa = (const trace_file *)a;
+	const trace_file *fb = (const trace_file *)b;
+	if (fa->first_open != fb->first_open)
+		return fa->first_open < fb->first_open ? -1 : 1;
+	return 0;
+}
+
+static int cmp_bytes(const void *a, const void *b) {
+	const trace_file *fa = (const trace_file *)a;
+	const trace_file *fb = (const trace_file *)b;
+	if (fa->bytes != fb->bytes)
+		return fa->bytes > fb->bytes ? -1 : 1;
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: ./iotrace [-n top] [-o order.txt] io_trace.bin\n");
+	printf("  -n top    number of files to report, default 20\n");
+	printf("  -o file   write paths in first-open order, for obb2psarc -t\n");
+}
+
+int main(int argc, char *argv[]) {
+	io_trace_header hdr;
+	io_trace_record r;
+	const char *order_path = NULL;
+	uint64_t total = 0;
+	uint64_t seq = 0, random = 0;
+	int top = 20;
+	int opt;
+	FILE *fin;
+
+	while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+		switch (opt) {
+		case 'n':
+			top = atoi(optarg);
+			break;
+		case 'o':
+			order_path = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 1) {
+		usage();
+		return 1;
+	}
+
+	fin = fopen(argv[optind], "rb");
+	if (!fin) {
+		printf("Could not open %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (fread(&hdr, 1, sizeof(hdr), fin) != sizeof(hdr) || hdr.magic != IO_TRACE_MAGIC) {
+		printf("Not an io trace\n");
+		return 1;
+	}
+
+	if (hdr.version != IO_TRACE_VERSION || hdr.record_size != sizeof(io_trace_record)) {
+		printf("Unsupported trace version %u\n", hdr.version);
+		return 1;
+	}
+
+	double tick_us = 1000000.0 / hdr.tick_freq;
+
+	while (fread(&r, 1, sizeof(r), fin) == sizeof(r)) {
+		total++;
+
+		if (r.op == IO_TRACE_NAME) {
+			uint32_t n = (r.length + sizeof(r) - 1) / sizeof(r);
+			char *path = malloc(n * sizeof(r) + 1);
+			if (fread(path, 1, n * sizeof(r), fin) != n * sizeof(r)) {
+				free(path);
+				break;
+			}
+			path[r.length] = '\0';
+
+			trace_file *f = get_file(r.path_hash);
+			if (!f->path)
+				f->path = path;
+			else
+				free(path);
+			continue;
+		}
+
+		if (r.op == IO_TRACE_DROP) {
+			dropped += r.length;
+			continue;
+		}
+
+		account(&r, tick_us);
+	}
+
+	fclose(fin);
+
+	printf("%llu records, %llu dropped, %zu files\n\n",
+		(unsigned long long)total, (unsigned long long)dropped, num_files);
+
+	printf("Operations:\n");
+	for (int op = 1; op < NUM_OPS; op++) {
+		if (op_count[op] == 0)
+			continue;
+		printf("  %-5s %10llu (%llu failed)\n", op_names[op],
+			(unsigned long long)op_count[op], (unsigned long long)op_failed[op]);
+	}
+
+	printf("\nLatency (us):\n");
+	for (int op = 1; op < NUM_OPS; op++) {
+		if (op_count[op] == op_failed[op])
+			continue;
+		printf("  %s\n", op_names[op]);
+		for (int b = 0; b < LATENCY_BUCKETS; b++) {
+			if (latency[op][b] == 0)
+				continue;
+			printf("    %8u - %-8u %10llu\n", b ? 1u << b : 0, (2u << b) - 1,
+				(unsigned long long)latency[op][b]);
+		}
+	}
+
+	for (size_t i = 0; i < num_files; i++) {
+		seq += files[i].seq;
+		random += files[i].random;
+	}
+
+	printf("\nAccess pattern: %llu sequential, %llu random (%.1f%% sequential)\n",
+		(unsigned long long)seq, (unsigned long long)random,
+		seq + random ? 100.0 * seq / (seq + random) : 0.0);
+
+	qsort(files, num_files, sizeof(trace_file), cmp_bytes);
+
+	printf("\nTop files by bytes read:\n");
+	for (size_t i = 0; i < num_files && (int)i < top; i++) {
+		trace_file *f = &files[i];
+		if (f->bytes == 0)
+			break;
+		printf("  %s\n", f->path ? f->path : "(unknown)");
+		printf("    %llu opens, %llu reads, %llu getc, %llu seeks, %.2f KB, %.1f%% sequential, %.2f ms\n",
+			(unsigned long long)f->opens, (unsigned long long)f->reads,
+			(unsigned long long)f->getcs, (unsigned long long)f->seeks, f->bytes / 1024.0,
+			f->seq + f->random ? 100.0 * f->seq / (f->seq + f->random) : 0.0,
+			f->time * tick_us / 1000.0);
+		print_heat(f);
+	}
+
+	if (order_path) {
+		FILE *fout = fopen(order_path, "w");
+		if (!fout) {
+			printf("Could not open %s\n", order_path);
+			return 1;
+		}
+
+		qsort(files, num_files, sizeof(trace_file), cmp_first_open);
+
+		fprintf(fout, "# first-open order from %s\n", argv[optind]);
+		for (size_t i = 0; i < num_files; i++) {
+			if (files[i].path && files[i].first_open != UINT64_MAX)
+				fprintf(fout, "%s\n", files[i].path);
+		}
+
+		fclose(fout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+// Times the shader key hashes of loader/shader_key.c against the full SHA-1
+// the loader used to key shaders with, on shader-sized inputs or on real
+// shader sources captured with DUMP_SHADERS.
+//
+// gcc -O2 -o keybench keybench.c ../loader/shader_key.c ../loader/sha1.c
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "../loader/sha1.h"
+#include "../loader/shader_key.h"
+
+typedef struct {
+	uint8_t *data;
+	size_t len;
+} sample;
+
+static sample *samples;
+static size_t num_samples;
+static volatile uint32_t sink;
+
+static void add_sample(uint8_t *data, size_t len) {
+	samples = realloc(samples, (num_samples + 1) * sizeof(sample));
+	samples[num_samples].data = data;
+	samples[num_samples].len = len;
+	num_samples++;
+}
+
+static int load_samples(const char *dir) {
+	char path[4096];
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d) {
+		printf("Could not open %s\n", dir);
+		return -1;
+	}
+
+	while ((de = readdir(d))) {
+		size_t n = strlen(de->d_name);
+		if (n < 5 || strcmp(de->d_name + n - 5, ".glsl") != 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		FILE *fin = fopen(path, "rb");
+		if (!fin)
+			continue;
+		fseek(fin, 0, SEEK_END);
+		long size = ftell(fin);
+		fseek(fin, 0, SEEK_SET);
+		uint8_t *data = malloc(size ? size : 1);
+		if (fread(data, 1, size, fin) == (size_t)size)
+			add_sample(data, size);
+		else
+			free(data);
+		fclose(fin);
+	}
+
+	closedir(d);
+	return 0;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// The key glShaderSource_fake computed before shader_key.c existed
+static void legacy_sha1(const void *data, size_t len, uint32_t key[SHADER_KEY_WORDS]) {
+	uint32_t digest[5];
+	SHA1_CTX ctx;
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, (const BYTE *)data, len);
+	sha1_final(&ctx, (BYTE *)digest);
+	key[0] = digest[0];
+}
+
+static double bench(void (*hash)(const void *, size_t, uint32_t *), int rounds) {
+	uint32_t key[SHADER_KEY_WORDS];
+	double start = now();
+
+	for (int r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < num_samples; i++) {
+			hash(samples[i].data, samples[i].len, key);
+			sink ^= key[0];
+		}
+	}
+
+	return now() - start;
+}
+
+// SMHasher's verification value for MurmurHash3_x86_128
+static int check_murmur3(void) {
+	uint8_t key[256], hashes[256 * 16];
+	uint32_t out[4];
+
+	for (int i = 0; i < 256; i++) {
+		key[i] = i;
+		murmur3_x86_128(key, i, 256 - i, (uint32_t *)(hashes + i * 16));
+	}
+	murmur3_x86_128(hashes, sizeof(hashes), 0, out);
+
+	return out[0] == 0xb3ece62a ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+	static const shader_key_hash *hashes[] = { &murmur3_key, &sha1_key };
+	size_t bytes = 0;
+	int rounds = 200;
+
+	if (check_murmur3() < 0) {
+		printf("murmur3 does not match the reference implementation\n");
+		return 1;
+	}
+
+	if (argc > 1) {
+		if (load_samples(argv[1]) < 0)
+			return 1;
+	} else {
+		// Same spread of sizes as the game's shaders
+		static const size_t sizes[] = { 1500, 3000, 4500, 6000, 9000 };
+		srand(2);
+		for (size_t i = 0; i < 200; i++) {
+			size_t len = sizes[i % 5];
+			uint8_t *data = malloc(len);
+			for (size_t j = 0; j < len; j++)
+				data[j] = ' ' + rand() % 95;
+			add_sample(data, len);
+		}
+	}
+
+	if (num_samples == 0) {
+		printf("No samples\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < num_samples; i++)
+		bytes += samples[i].len;
+
+	double calls = (double)rounds * num_samples;
+	double t_legacy = bench(legacy_sha1, rounds);
+
+	printf("%zu samples, %.1f KB on average\n", num_samples, bytes / (double)num_samples / 1024.0);
+	printf("%-8s %8.2f us per shader\n", "legacy", t_legacy * 1e6 / calls);
+	for (size_t h = 0; h < sizeof(hashes) / sizeof(*hashes); h++) {
+		double t = bench(hashes[h]->hash, rounds);
+		printf("%-8s %8.2f us per shader (%.2fx)\n", hashes[h]->name, t * 1e6 / calls, t_legacy / t);
+	}
+
+	return 0;
+}
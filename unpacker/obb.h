@@ -0,0 +1,157 @@
+#ifndef __OBB_H__
+#define __OBB_H__
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+// Size of the compressed and decompressed index windows. A single entry
+// (0x20 bytes of header plus its name) must always fit in a window.
+#define OBB_WINDOW (64 * 1024)
+
+#define OBB_TRAILER_SIZE (2 * sizeof(uint64_t))
+
+typedef struct {
+	char name[PATH_MAX];
+	uint64_t name_len;
+	uint64_t off;
+	uint64_t len;
+} obb_entry;
+
+typedef struct {
+	FILE *f;
+	z_stream z;
+	uint64_t comp_off;
+	uint64_t comp_remain;
+	uint64_t uncomp_len;
+	uint64_t uncomp_done;
+	size_t pos;
+	size_t len;
+	int finished;
+	uint8_t in[OBB_WINDOW];
+	uint8_t out[OBB_WINDOW];
+} obb_index;
+
+/*
+ * obb_index_open: read the trailer of an obb and prepare to stream its index.
+ * The index is inflated one window at a time by obb_index_next, so only the
+ * two fixed-size windows are ever resident regardless of the index size.
+ */
+static int obb_index_open(obb_index *idx, FILE *f) {
+	uint64_t idx_off;
+	uint64_t trailer_off;
+
+	memset(idx, 0, sizeof(obb_index));
+	idx->f = f;
+
+	if (fseeko(f, -(off_t)OBB_TRAILER_SIZE, SEEK_END) != 0)
+		return -1;
+	trailer_off = ftello(f);
+
+	if (fread(&idx_off, 1, sizeof(idx_off), f) != sizeof(idx_off) ||
+		fread(&idx->uncomp_len, 1, sizeof(idx->uncomp_len), f) != sizeof(idx->uncomp_len))
+		return -1;
+
+	if (idx_off > trailer_off)
+		return -1;
+
+	idx->comp_off = idx_off;
+	idx->comp_remain = trailer_off - idx_off;
+
+	if (inflateInit(&idx->z) != Z_OK)
+		return -1;
+
+	return 0;
+}
+
+static void obb_index_close(obb_index *idx) {
+	inflateEnd(&idx->z);
+}
+
+// Move the unparsed tail of the window to the front and inflate more after it
+static int obb_index_fill(obb_index *idx) {
+	size_t n;
+	int res;
+
+	if (idx->pos > 0) {
+		memmove(idx->out, idx->out + idx->pos, idx->len - idx->pos);
+		idx->len -= idx->pos;
+		idx->pos = 0;
+	}
+
+	while (!idx->finished && idx->len < sizeof(idx->out)) {
+		if (idx->z.avail_in == 0 && idx->comp_remain > 0) {
+			n = idx->comp_remain < sizeof(idx->in) ? idx->comp_remain : sizeof(idx->in);
+			// The file may be shared with the extractor, so always seek first
+			if (fseeko(idx->f, idx->comp_off, SEEK_SET) != 0 || fread(idx->in, 1, n, idx->f) != n)
+				return -1;
+			idx->comp_off += n;
+			idx->comp_remain -= n;
+			idx->z.next_in = idx->in;
+			idx->z.avail_in = n;
+		}
+
+		idx->z.next_out = idx->out + idx->len;
+		idx->z.avail_out = sizeof(idx->out) - idx->len;
+
+		res = inflate(&idx->z, Z_NO_FLUSH);
+		idx->len = sizeof(idx->out) - idx->z.avail_out;
+
+		if (res == Z_STREAM_END)
+			idx->finished = 1;
+		else if (res != Z_OK)
+			return -1;
+		else if (idx->z.avail_in == 0 && idx->comp_remain == 0 && idx->z.avail_out != 0)
+			return -1; // truncated stream
+	}
+
+	return 0;
+}
+
+/*
+ * obb_index_next: yield the next entry of the index.
+ * Returns 1 when an entry was read, 0 at the end of the index, -1 on error.
+ */
+static int obb_index_next(obb_index *idx, obb_entry *e) {
+	uint8_t *p;
+	uint64_t name_len;
+	uint64_t avail;
+
+	if (idx->uncomp_done + sizeof(uint64_t) >= idx->uncomp_len)
+		return 0;
+
+	if (idx->len - idx->pos < 0x10 && obb_index_fill(idx) < 0)
+		return -1;
+	if (idx->len - idx->pos < 0x10)
+		return -1;
+
+	p = idx->out + idx->pos;
+	memcpy(&name_len, p + 0x08, sizeof(name_len));
+	if (name_len >= PATH_MAX)
+		return -1;
+
+	if (idx->len - idx->pos < 0x20 + name_len) {
+		if (obb_index_fill(idx) < 0)
+			return -1;
+		p = idx->out + idx->pos;
+	}
+
+	avail = idx->len - idx->pos;
+	if (avail < 0x20 + name_len)
+		return -1;
+
+	memcpy(e->name, p + 0x10, name_len);
+	e->name[name_len] = '\0';
+	e->name_len = name_len;
+	memcpy(&e->off, p + 0x10 + name_len, sizeof(e->off));
+	memcpy(&e->len, p + 0x18 + name_len, sizeof(e->len));
+
+	idx->pos += 0x20 + name_len;
+	idx->uncomp_done += 0x20 + name_len;
+
+	return 1;
+}
+
+#endif
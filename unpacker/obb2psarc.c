@@ -0,0 +1,943 @@
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/time.h>
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#include "obb.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+// Must not exceed the work buffer given to the FIOS dearchiver (PSARCCACHEBLOCKSIZE in fios.c)
+#define PSARCCACHEBLOCKSIZE (192 * 1024)
+#define DEFAULT_BLOCK_SIZE (64 * 1024)
+
+// Granularity of the FIOS RAM cache sitting in front of the archive (RAMCACHEBLOCKSIZE in fios.c)
+#define RAMCACHEBLOCKSIZE (128 * 1024)
+
+#define MAX_INPUTS 8
+#define MAX_EXCLUDES 32
+#define MAX_THREADS 64
+#define SLOTS_PER_THREAD 4
+
+#define PSARC_HEADER_SIZE 32
+#define PSARC_TOC_ENTRY_SIZE 30
+#define PSARC_FLAG_ABSOLUTE 2
+
+enum {
+	COMP_ZLIB,
+	COMP_LZMA,
+};
+
+typedef struct {
+	char *name;
+	int src;
+	uint64_t off;
+	uint64_t len;
+	uint64_t seq;
+	uint64_t rank;
+	int dropped;
+	uint32_t first_block;
+	uint64_t out_off;
+} psarc_entry;
+
+typedef struct {
+	uint8_t *in;
+	uint8_t *out;
+	size_t in_len;
+	size_t out_len;
+	int stored;
+	int done;
+} psarc_slot;
+
+typedef struct {
+	int comp;
+	int level;
+	uint32_t block_size;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	psarc_slot *slots;
+	unsigned int num_slots;
+	uint64_t filled;
+	uint64_t next;
+	int finished;
+	int failed;
+} psarc_pipeline;
+
+/* MD5 (RFC 1321), only used to hash the toc names */
+
+typedef struct {
+	uint32_t state[4];
+	uint64_t len;
+	uint8_t buf[64];
+} md5_ctx;
+
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void md5_transform(md5_ctx *ctx, const uint8_t *data) {
+	uint32_t a, b, c, d, f, t, m[16];
+	int i, g;
+
+	for (i = 0; i < 16; i++)
+		m[i] = data[i * 4] | (data[i * 4 + 1] << 8) | (data[i * 4 + 2] << 16) | ((uint32_t)data[i * 4 + 3] << 24);
+
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+
+	for (i = 0; i < 64; i++) {
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) & 15;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) & 15;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) & 15;
+		}
+		t = d;
+		d = c;
+		c = b;
+		f += a + md5_k[i] + m[g];
+		b += (f << md5_r[i]) | (f >> (32 - md5_r[i]));
+		a = t;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+}
+
+static void md5(const void *data, size_t len, uint8_t hash[16]) {
+	const uint8_t *p = data;
+	md5_ctx ctx;
+	size_t rem;
+	int i;
+
+	ctx.state[0] = 0x67452301;
+	ctx.state[1] = 0xefcdab89;
+	ctx.state[2] = 0x98badcfe;
+	ctx.state[3] = 0x10325476;
+	ctx.len = len;
+
+	while (len >= 64) {
+		md5_transform(&ctx, p);
+		p += 64;
+		len -= 64;
+	}
+
+	rem = len;
+	memset(ctx.buf, 0, sizeof(ctx.buf));
+	memcpy(ctx.buf, p, rem);
+	ctx.buf[rem] = 0x80;
+	if (rem >= 56) {
+		md5_transform(&ctx, ctx.buf);
+		memset(ctx.buf, 0, sizeof(ctx.buf));
+	}
+	for (i = 0; i < 8; i++)
+		ctx.buf[56 + i] = (uint8_t)((ctx.len * 8) >> (i * 8));
+	md5_transform(&ctx, ctx.buf);
+
+	for (i = 0; i < 16; i++)
+		hash[i] = (uint8_t)(ctx.state[i / 4] >> ((i % 4) * 8));
+}
+
+/* Output helpers, psarc is big endian */
+
+static uint8_t *put_be(uint8_t *p, uint64_t v, int n) {
+	int i;
+	for (i = n - 1; i >= 0; i--) {
+		p[i] = (uint8_t)v;
+		v >>= 8;
+	}
+	return p + n;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* Block compression */
+
+static int compress_block(psarc_pipeline *pl, psarc_slot *s) {
+	size_t cap = pl->block_size + pl->block_size / 8 + 1024;
+
+	if (s->in_len == 0) {
+		s->out_len = 0;
+		s->stored = 1;
+		return 0;
+	}
+
+	if (pl->comp == COMP_ZLIB) {
+		uLongf out_len = cap;
+		if (compress2(s->out, &out_len, s->in, s->in_len, pl->level) != Z_OK)
+			return -1;
+		s->out_len = out_len;
+	} else {
+#ifdef HAVE_LZMA
+		lzma_options_lzma opt;
+		lzma_stream strm = LZMA_STREAM_INIT;
+		lzma_ret ret;
+
+		lzma_lzma_preset(&opt, pl->level);
+		if (lzma_alone_encoder(&strm, &opt) != LZMA_OK)
+			return -1;
+		strm.next_in = s->in;
+		strm.avail_in = s->in_len;
+		strm.next_out = s->out;
+		strm.avail_out = cap;
+		ret = lzma_code(&strm, LZMA_FINISH);
+		s->out_len = cap - strm.avail_out;
+		lzma_end(&strm);
+		if (ret != LZMA_STREAM_END)
+			return -1;
+#else
+		return -1;
+#endif
+	}
+
+	// Blocks that do not shrink are stored as is
+	s->stored = s->out_len >= s->in_len;
+	return 0;
+}
+
+// Stops the writer and every worker, all of them read failed under the lock
+static void pipeline_fail(psarc_pipeline *pl) {
+	pthread_mutex_lock(&pl->lock);
+	pl->failed = 1;
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
+}
+
+static int write_block(psarc_slot *s, uint32_t *size, FILE *fout) {
+	*size = s->stored ? s->in_len : s->out_len;
+	return fwrite(s->stored ? s->in : s->out, 1, *size, fout) == *size ? 0 : -1;
+}
+
+static void *compress_worker(void *arg) {
+	psarc_pipeline *pl = (psarc_pipeline *)arg;
+	psarc_slot *s;
+	uint64_t b;
+
+	for (;;) {
+		pthread_mutex_lock(&pl->lock);
+		while (pl->next == pl->filled && !pl->finished && !pl->failed)
+			pthread_cond_wait(&pl->cond, &pl->lock);
+		if (pl->next == pl->filled || pl->failed) {
+			pthread_mutex_unlock(&pl->lock);
+			break;
+		}
+		b = pl->next++;
+		pthread_mutex_unlock(&pl->lock);
+
+		s = &pl->slots[b % pl->num_slots];
+		if (compress_block(pl, s) < 0) {
+			printf("Compression failed\n");
+			pipeline_fail(pl);
+		}
+
+		pthread_mutex_lock(&pl->lock);
+		s->done = 1;
+		pthread_cond_broadcast(&pl->cond);
+		pthread_mutex_unlock(&pl->lock);
+	}
+
+	return NULL;
+}
+
+/* Entry table */
+
+static int cmp_entry_name(const void *a, const void *b) {
+	const psarc_entry *ea = *(const psarc_entry **)a;
+	const psarc_entry *eb = *(const psarc_entry **)b;
+	int res = strcmp(ea->name, eb->name);
+	if (res)
+		return res;
+	return ea->seq < eb->seq ? -1 : 1;
+}
+
+// Files present in several obbs (main + patch) are taken from the last one given
+static void drop_overridden(psarc_entry *entries, uint64_t num_entries) {
+	psarc_entry **sorted;
+	uint64_t i;
+
+	sorted = malloc(num_entries * sizeof(psarc_entry *));
+	if (!sorted)
+		return;
+
+	for (i = 0; i < num_entries; i++)
+		sorted[i] = &entries[i];
+
+	qsort(sorted, num_entries, sizeof(psarc_entry *), cmp_entry_name);
+
+	for (i = 0; i + 1 < num_entries; i++) {
+		if (strcmp(sorted[i]->name, sorted[i + 1]->name) == 0)
+			sorted[i]->dropped = 1;
+	}
+
+	free(sorted);
+}
+
+/* Access pattern aware layout */
+
+typedef struct {
+	uint64_t *seqs;
+	uint64_t num;
+	uint64_t max;
+} access_list;
+
+static int cmp_entry_rank(const void *a, const void *b) {
+	const psarc_entry *ea = (const psarc_entry *)a;
+	const psarc_entry *eb = (const psarc_entry *)b;
+	if (ea->rank != eb->rank)
+		return ea->rank < eb->rank ? -1 : 1;
+	return ea->seq < eb->seq ? -1 : 1;
+}
+
+static int cmp_name_key(const void *key, const void *elem) {
+	const psarc_entry *e = *(const psarc_entry **)elem;
+	return strcmp((const char *)key, e->name);
+}
+
+/*
+ * estimate_layout: replay the accesses against the current entry order and
+ * count how many distinct RAM cache blocks they touch and how often a file
+ * does not start in the block the previous one ended in (or the next one).
+ * Uncompressed sizes are used, so this is an estimate of the packed layout.
+ */
+static void estimate_layout(psarc_entry *entries, uint64_t num_entries, access_list *acc,
+                            uint64_t *blocks, uint64_t *seeks) {
+	uint64_t *off;
+	uint64_t *len;
+	uint8_t *touched;
+	uint64_t total = 0;
+	uint64_t last = (uint64_t)-2;
+	uint64_t first, end;
+	uint64_t i, b;
+
+	*blocks = 0;
+	*seeks = 0;
+
+	off = malloc(num_entries * sizeof(uint64_t));
+	len = malloc(num_entries * sizeof(uint64_t));
+	if (!off || !len)
+		goto out;
+
+	for (i = 0; i < num_entries; i++) {
+		if (entries[i].dropped)
+			continue;
+		off[entries[i].seq] = total;
+		len[entries[i].seq] = entries[i].len;
+		total += entries[i].len;
+	}
+
+	touched = calloc(total / RAMCACHEBLOCKSIZE + 1, 1);
+	if (!touched)
+		goto out;
+
+	for (i = 0; i < acc->num; i++) {
+		uint64_t seq = acc->seqs[i];
+
+		first = off[seq] / RAMCACHEBLOCKSIZE;
+		end = (off[seq] + (len[seq] ? len[seq] - 1 : 0)) / RAMCACHEBLOCKSIZE;
+		if (first != last && first != last + 1)
+			(*seeks)++;
+		for (b = first; b <= end; b++) {
+			if (!touched[b]) {
+				touched[b] = 1;
+				(*blocks)++;
+			}
+		}
+		last = end;
+	}
+
+	free(touched);
+out:
+	free(len);
+	free(off);
+}
+
+/*
+ * apply_layout: reorder the entries so that files are stored in the order
+ * they were first opened in a recorded access trace. Files opened together
+ * then share RAM cache blocks and sequential read-ahead pays off. Files never
+ * seen in the trace keep their relative order at the end of the archive.
+ *
+ * The trace is a text file with one path per line, as passed to the Obb Vfs
+ * fopen hook. A leading /psarc mount point is ignored.
+ */
+static int apply_layout(psarc_entry *entries, uint64_t num_entries, const char *trace, int relative) {
+	char line[PATH_MAX + 16];
+	psarc_entry **sorted;
+	access_list acc;
+	uint64_t blocks_before, seeks_before;
+	uint64_t blocks_after, seeks_after;
+	uint64_t num_sorted = 0;
+	uint64_t next_rank = 0;
+	uint64_t misses = 0;
+	uint64_t i;
+	FILE *f;
+
+	f = fopen(trace, "r");
+	if (!f) {
+		printf("Could not open %s\n", trace);
+		return -1;
+	}
+
+	sorted = malloc(num_entries * sizeof(psarc_entry *));
+	memset(&acc, 0, sizeof(acc));
+	if (!sorted) {
+		fclose(f);
+		return -1;
+	}
+
+	for (i = 0; i < num_entries; i++) {
+		entries[i].rank = UINT64_MAX;
+		if (!entries[i].dropped)
+			sorted[num_sorted++] = &entries[i];
+	}
+
+	qsort(sorted, num_sorted, sizeof(psarc_entry *), cmp_entry_name);
+
+	while (fgets(line, sizeof(line), f)) {
+		char *name = line;
+		char path[PATH_MAX + 16];
+		psarc_entry **found;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		if (strncmp(name, "/psarc/", 7) == 0)
+			name += 6;
+		while (*name == '/')
+			name++;
+		if (snprintf(path, sizeof(path), "%s%s", relative ? "" : "/", name) >= (int)sizeof(path)) {
+			printf("Trace path too long: %s\n", name);
+			continue;
+		}
+
+		found = bsearch(path, sorted, num_sorted, sizeof(psarc_entry *), cmp_name_key);
+		if (!found) {
+			misses++;
+			continue;
+		}
+
+		if ((*found)->rank == UINT64_MAX)
+			(*found)->rank = next_rank++;
+
+		if (acc.num == acc.max) {
+			acc.max = acc.max ? acc.max * 2 : 1024;
+			acc.seqs = realloc(acc.seqs, acc.max * sizeof(uint64_t));
+			if (!acc.seqs) {
+				printf("Could not allocate access list\n");
+				fclose(f);
+				free(sorted);
+				return -1;
+			}
+		}
+		acc.seqs[acc.num++] = (*found)->seq;
+	}
+
+	fclose(f);
+	free(sorted);
+
+	estimate_layout(entries, num_entries, &acc, &blocks_before, &seeks_before);
+	qsort(entries, num_entries, sizeof(psarc_entry), cmp_entry_rank);
+	estimate_layout(entries, num_entries, &acc, &blocks_after, &seeks_after);
+
+	printf("Layout: %llu of %llu files seen in %llu accesses (%llu unknown paths)\n",
+		(unsigned long long)next_rank, (unsigned long long)num_sorted,
+		(unsigned long long)acc.num, (unsigned long long)misses);
+	printf("Layout: %llu -> %llu cache blocks touched, %llu -> %llu non-sequential accesses (estimated)\n",
+		(unsigned long long)blocks_before, (unsigned long long)blocks_after,
+		(unsigned long long)seeks_before, (unsigned long long)seeks_after);
+
+	free(acc.seqs);
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: ./obb2psarc [options] out_psarc in_obb [in_obb...]\n");
+	printf("  -b size      block size in bytes (default %d, max %d)\n", DEFAULT_BLOCK_SIZE, PSARCCACHEBLOCKSIZE);
+	printf("  -z method    zlib or lzma (default zlib)\n");
+	printf("  -l level     compression level 0-9 (default 9)\n");
+	printf("  -j threads   number of compression threads (default 4)\n");
+	printf("  -p prefix    only pack files whose path starts with prefix\n");
+	printf("  -x pattern   exclude files matching pattern (may be repeated)\n");
+	printf("  -r           store relative instead of absolute paths\n");
+	printf("  -t trace     lay files out in the first access order of a trace\n");
+	printf("  -q           do not print every packed file\n");
+}
+
+int main(int argc, char *argv[]) {
+	static obb_index idx;
+	static obb_entry e;
+	const char *excludes[MAX_EXCLUDES];
+	const char *prefix = NULL;
+	const char *trace = NULL;
+	FILE *fin[MAX_INPUTS];
+	FILE *fout;
+	psarc_pipeline pl;
+	psarc_entry *entries = NULL;
+	uint64_t num_entries = 0;
+	uint64_t max_entries = 0;
+	uint64_t num_blocks = 0;
+	uint64_t num_toc;
+	uint64_t in_bytes = 0;
+	uint64_t out_bytes = 0;
+	uint64_t toc_len;
+	uint64_t out_off;
+	uint64_t written;
+	uint64_t b, i, j;
+	uint32_t *block_sizes;
+	uint8_t *toc, *p;
+	char *manifest;
+	size_t manifest_len = 0;
+	pthread_t threads[MAX_THREADS];
+	int num_threads = 4;
+	int num_excludes = 0;
+	int num_inputs;
+	int relative = 0;
+	int quiet = 0;
+	int width;
+	int opt;
+	int res;
+	int failed = 0;
+	double start, elapsed;
+
+	memset(&pl, 0, sizeof(pl));
+	pl.comp = COMP_ZLIB;
+	pl.level = 9;
+	pl.block_size = DEFAULT_BLOCK_SIZE;
+
+	while ((opt = getopt(argc, argv, "b:z:l:j:p:x:rt:q")) != -1) {
+		switch (opt) {
+		case 'b':
+			pl.block_size = strtoul(optarg, NULL, 0);
+			if (pl.block_size < 1024 || pl.block_size > PSARCCACHEBLOCKSIZE) {
+				printf("Block size must be between 1024 and %d\n", PSARCCACHEBLOCKSIZE);
+				return 1;
+			}
+			break;
+		case 'z':
+			if (strcmp(optarg, "zlib") == 0) {
+				pl.comp = COMP_ZLIB;
+			} else if (strcmp(optarg, "lzma") == 0) {
+#ifdef HAVE_LZMA
+				pl.comp = COMP_LZMA;
+#else
+				printf("lzma support was not compiled in, rebuild with -DHAVE_LZMA -llzma\n");
+				return 1;
+#endif
+			} else {
+				usage();
+				return 1;
+			}
+			break;
+		case 'l':
+			pl.level = atoi(optarg);
+			if (pl.level < 0 || pl.level > 9) {
+				printf("Compression level must be between 0 and 9\n");
+				return 1;
+			}
+			break;
+		case 'j':
+			num_threads = atoi(optarg);
+			if (num_threads < 1 || num_threads > MAX_THREADS) {
+				printf("Thread count must be between 1 and %d\n", MAX_THREADS);
+				return 1;
+			}
+			break;
+		case 'p':
+			prefix = optarg;
+			break;
+		case 'x':
+			if (num_excludes == MAX_EXCLUDES) {
+				printf("Too many exclude patterns\n");
+				return 1;
+			}
+			excludes[num_excludes++] = optarg;
+			break;
+		case 'r':
+			relative = 1;
+			break;
+		case 't':
+			trace = optarg;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	num_inputs = argc - optind - 1;
+	if (num_inputs < 1) {
+		usage();
+		return 1;
+	}
+	if (num_inputs > MAX_INPUTS) {
+		printf("Too many input files\n");
+		return 1;
+	}
+
+	start = now();
+
+	// Collect the entries of every obb, the toc has to be sized before any data is written
+	for (i = 0; i < num_inputs; i++) {
+		fin[i] = fopen(argv[optind + 1 + i], "rb");
+		if (!fin[i]) {
+			printf("Could not open %s\n", argv[optind + 1 + i]);
+			return 1;
+		}
+
+		if (obb_index_open(&idx, fin[i]) < 0) {
+			printf("Could not read index of %s\n", argv[optind + 1 + i]);
+			return 1;
+		}
+
+		while ((res = obb_index_next(&idx, &e)) > 0) {
+			if (prefix && strncmp(e.name, prefix, strlen(prefix)) != 0)
+				continue;
+
+			for (j = 0; j < num_excludes; j++) {
+				if (fnmatch(excludes[j], e.name, 0) == 0)
+					break;
+			}
+			if (j < num_excludes)
+				continue;
+
+			if (num_entries == max_entries) {
+				max_entries = max_entries ? max_entries * 2 : 1024;
+				entries = realloc(entries, max_entries * sizeof(psarc_entry));
+				if (!entries) {
+					printf("Could not allocate entry table\n");
+					return 1;
+				}
+			}
+
+			psarc_entry *pe = &entries[num_entries];
+			memset(pe, 0, sizeof(psarc_entry));
+			pe->name = malloc(e.name_len + 2);
+			if (!pe->name) {
+				printf("Could not allocate entry table\n");
+				return 1;
+			}
+			snprintf(pe->name, e.name_len + 2, "%s%s", relative ? "" : "/", e.name);
+			pe->src = i;
+			pe->off = e.off;
+			pe->len = e.len;
+			pe->seq = num_entries++;
+		}
+
+		obb_index_close(&idx);
+
+		if (res < 0) {
+			printf("Invalid index in %s\n", argv[optind + 1 + i]);
+			return 1;
+		}
+	}
+
+	drop_overridden(entries, num_entries);
+
+	if (trace && apply_layout(entries, num_entries, trace, relative) < 0)
+		return 1;
+
+	// Build the manifest, it is stored as the first toc entry
+	for (i = 0; i < num_entries; i++) {
+		if (!entries[i].dropped)
+			manifest_len += strlen(entries[i].name) + 1;
+	}
+
+	manifest = malloc(manifest_len + 1);
+	if (!manifest) {
+		printf("Could not allocate manifest\n");
+		return 1;
+	}
+
+	p = (uint8_t *)manifest;
+	num_toc = 1;
+	for (i = 0; i < num_entries; i++) {
+		if (entries[i].dropped)
+			continue;
+		if (num_toc > 1)
+			*p++ = '\n';
+		p += sprintf((char *)p, "%s", entries[i].name);
+		num_toc++;
+	}
+	manifest_len = (char *)p - manifest;
+
+	num_blocks = (manifest_len + pl.block_size - 1) / pl.block_size;
+	for (i = 0; i < num_entries; i++) {
+		if (!entries[i].dropped)
+			num_blocks += (entries[i].len + pl.block_size - 1) / pl.block_size;
+	}
+
+	// Width of a block size table entry, a full block is stored as 0
+	width = 1;
+	while (((uint64_t)1 << (8 * width)) < pl.block_size)
+		width++;
+
+	toc_len = PSARC_HEADER_SIZE + num_toc * PSARC_TOC_ENTRY_SIZE + num_blocks * width;
+	if (toc_len > UINT32_MAX) {
+		printf("Too many files\n");
+		return 1;
+	}
+
+	block_sizes = malloc(num_blocks * sizeof(uint32_t));
+	toc = malloc(toc_len);
+	if (!block_sizes || !toc) {
+		printf("Could not allocate toc\n");
+		return 1;
+	}
+
+	fout = fopen(argv[optind], "wb");
+	if (!fout) {
+		printf("Could not open %s\n", argv[optind]);
+		return 1;
+	}
+
+	// Data goes after the toc, which is filled in once all block sizes are known
+	if (fseeko(fout, toc_len, SEEK_SET) != 0) {
+		printf("Could not write %s\n", argv[optind]);
+		return 1;
+	}
+
+	pl.num_slots = num_threads * SLOTS_PER_THREAD;
+	pl.slots = calloc(pl.num_slots, sizeof(psarc_slot));
+	if (!pl.slots) {
+		printf("Could not allocate blocks\n");
+		return 1;
+	}
+
+	for (i = 0; i < pl.num_slots; i++) {
+		pl.slots[i].in = malloc(pl.block_size);
+		pl.slots[i].out = malloc(pl.block_size + pl.block_size / 8 + 1024);
+		if (!pl.slots[i].in || !pl.slots[i].out) {
+			printf("Could not allocate blocks\n");
+			return 1;
+		}
+	}
+
+	pthread_mutex_init(&pl.lock, NULL);
+	pthread_cond_init(&pl.cond, NULL);
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, compress_worker, &pl) != 0) {
+			printf("Could not create worker thread\n");
+			return 1;
+		}
+	}
+
+	b = 0;
+	written = 0;
+
+	// Feed blocks in archive order and write them back in the same order
+	for (i = 0; i <= num_entries && !failed; i++) {
+		psarc_entry *pe = NULL;
+		uint64_t len;
+		uint64_t pos = 0;
+
+		if (i == 0) {
+			len = manifest_len;
+		} else {
+			pe = &entries[i - 1];
+			if (pe->dropped)
+				continue;
+			len = pe->len;
+			pe->first_block = b;
+			if (fseeko(fin[pe->src], pe->off, SEEK_SET) != 0) {
+				printf("Could not read %s\n", pe->name);
+				pipeline_fail(&pl);
+				failed = 1;
+				break;
+			}
+			if (!quiet)
+				printf("Packing %s...\n", pe->name);
+		}
+
+		while (pos < len && !failed) {
+			psarc_slot *s = &pl.slots[b % pl.num_slots];
+
+			// Recycle the slot: wait for its previous block and write it out
+			if (b >= pl.num_slots) {
+				pthread_mutex_lock(&pl.lock);
+				while (!s->done && !pl.failed)
+					pthread_cond_wait(&pl.cond, &pl.lock);
+				failed = pl.failed;
+				pthread_mutex_unlock(&pl.lock);
+				if (failed)
+					break;
+
+				if (write_block(s, &block_sizes[written], fout) < 0) {
+					printf("Could not write %s\n", argv[optind]);
+					pipeline_fail(&pl);
+					failed = 1;
+					break;
+				}
+				written++;
+			}
+
+			s->in_len = MIN(len - pos, pl.block_size);
+			s->done = 0;
+			if (i == 0) {
+				memcpy(s->in, manifest + pos, s->in_len);
+			} else if (fread(s->in, 1, s->in_len, fin[pe->src]) != s->in_len) {
+				printf("Could not read %s\n", pe->name);
+				pipeline_fail(&pl);
+				failed = 1;
+				break;
+			}
+			pos += s->in_len;
+			in_bytes += s->in_len;
+
+			pthread_mutex_lock(&pl.lock);
+			pl.filled = ++b;
+			pthread_cond_broadcast(&pl.cond);
+			pthread_mutex_unlock(&pl.lock);
+		}
+	}
+
+	// Drain the blocks still in flight
+	while (written < b && !failed) {
+		psarc_slot *s = &pl.slots[written % pl.num_slots];
+
+		pthread_mutex_lock(&pl.lock);
+		while (!s->done && !pl.failed)
+			pthread_cond_wait(&pl.cond, &pl.lock);
+		failed = pl.failed;
+		pthread_mutex_unlock(&pl.lock);
+		if (failed)
+			break;
+
+		if (write_block(s, &block_sizes[written], fout) < 0) {
+			printf("Could not write %s\n", argv[optind]);
+			pipeline_fail(&pl);
+			failed = 1;
+			break;
+		}
+		written++;
+	}
+
+	pthread_mutex_lock(&pl.lock);
+	pl.finished = 1;
+	pthread_cond_broadcast(&pl.cond);
+	pthread_mutex_unlock(&pl.lock);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (pl.failed)
+		return 1;
+
+	// Resolve the file offset of every entry from the block sizes
+	out_off = toc_len;
+	b = 0;
+	for (i = 0; i <= num_entries; i++) {
+		psarc_entry *pe = i ? &entries[i - 1] : NULL;
+		uint64_t len = pe ? pe->len : manifest_len;
+		uint64_t n = (len + pl.block_size - 1) / pl.block_size;
+
+		if (pe && pe->dropped)
+			continue;
+		if (pe)
+			pe->out_off = out_off;
+		for (j = 0; j < n; j++)
+			out_off += block_sizes[b++];
+	}
+	out_bytes = out_off;
+
+	// Header
+	p = toc;
+	memcpy(p, "PSAR", 4);
+	p += 4;
+	p = put_be(p, 1, 2);
+	p = put_be(p, 3, 2);
+	memcpy(p, pl.comp == COMP_ZLIB ? "zlib" : "lzma", 4);
+	p += 4;
+	p = put_be(p, toc_len, 4);
+	p = put_be(p, PSARC_TOC_ENTRY_SIZE, 4);
+	p = put_be(p, num_toc, 4);
+	p = put_be(p, pl.block_size, 4);
+	p = put_be(p, relative ? 0 : PSARC_FLAG_ABSOLUTE, 4);
+
+	// Manifest entry has an all zero name hash
+	memset(p, 0, 16);
+	p += 16;
+	p = put_be(p, 0, 4);
+	p = put_be(p, manifest_len, 5);
+	p = put_be(p, toc_len, 5);
+
+	for (i = 0; i < num_entries; i++) {
+		psarc_entry *pe = &entries[i];
+		if (pe->dropped)
+			continue;
+		md5(pe->name, strlen(pe->name), p);
+		p += 16;
+		p = put_be(p, pe->first_block, 4);
+		p = put_be(p, pe->len, 5);
+		p = put_be(p, pe->out_off, 5);
+	}
+
+	for (b = 0; b < num_blocks; b++)
+		p = put_be(p, block_sizes[b] == pl.block_size ? 0 : block_sizes[b], width);
+
+	if (fseeko(fout, 0, SEEK_SET) != 0 || fwrite(toc, 1, toc_len, fout) != toc_len) {
+		printf("Could not write %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (fclose(fout) != 0) {
+		printf("Could not write %s\n", argv[optind]);
+		return 1;
+	}
+
+	elapsed = now() - start;
+	printf("Packed %llu files in %llu blocks, %.2f MB -> %.2f MB in %.2f s, %.2f MB/s (%d thread%s)\n",
+		(unsigned long long)(num_toc - 1), (unsigned long long)num_blocks,
+		in_bytes / (1024.0 * 1024.0), out_bytes / (1024.0 * 1024.0), elapsed,
+		elapsed > 0 ? in_bytes / (1024.0 * 1024.0) / elapsed : 0.0,
+		num_threads, num_threads > 1 ? "s" : "");
+
+	for (i = 0; i < num_inputs; i++)
+		fclose(fin[i]);
+
+	return 0;
+}
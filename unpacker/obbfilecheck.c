@@ -0,0 +1,330 @@
+// Checks the buffered reader of loader/obb_file.c against stdio. Files of a
+// few sizes around the buffer size are written to a temporary folder, then
+// read through io_posix.c by both obb_file and a FILE, with the same random
+// getc, ungetc, read, seek and tell calls. Every result has to match: the
+// values returned, the bytes read and the position. glibc loses track of the
+// position around ungetc, so the FILE side keeps the pushed back character
+// itself, as C describes it. Each file is read from storage with both host
+// backends, and from a prefetched copy bound to its handle, which has to be
+// released once the file is closed.
+//
+// gcc -O2 -o obbfilecheck obbfilecheck.c ../loader/obb_file.c ../loader/prefetch.c ../loader/io_posix.c -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../loader/io_backend.h"
+#include "../loader/obb_file.h"
+#include "../loader/prefetch.h"
+
+#define OPS_PER_CASE 20000
+#define MAX_READ (3 * OBB_FILE_BUF_SIZE)
+
+static const int64_t file_sizes[] = {
+	0,
+	1,
+	100,
+	OBB_FILE_BUF_SIZE - 1,
+	OBB_FILE_BUF_SIZE,
+	OBB_FILE_BUF_SIZE + 1,
+	5 * OBB_FILE_BUF_SIZE + 123,
+};
+
+#define NUM_FILES (sizeof(file_sizes) / sizeof(file_sizes[0]))
+
+static uint32_t rng_state;
+
+static uint32_t rng(void) {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+// Offsets around the start, the end and the buffer boundaries, where the
+// reader changes paths, and anywhere else
+static int64_t random_offset(int64_t size) {
+	switch (rng() % 4) {
+	case 0:
+		return (int64_t)(rng() % 8) - 4;
+	case 1:
+		return size + (int64_t)(rng() % 8) - 4;
+	case 2:
+		return (int64_t)(rng() % 6) * OBB_FILE_BUF_SIZE + (int64_t)(rng() % 8) - 4;
+	default:
+		return size ? rng() % (size + 1) : 0;
+	}
+}
+
+static size_t random_length(void) {
+	switch (rng() % 4) {
+	case 0:
+		return rng() % 4;
+	case 1:
+		return rng() % 64;
+	case 2:
+		return rng() % OBB_FILE_BUF_SIZE;
+	default:
+		return rng() % MAX_READ;
+	}
+}
+
+static int write_file(const char *dir, const char *name, int64_t size, uint8_t **data) {
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "wb");
+	if (!f)
+		return -1;
+
+	*data = malloc(size ? size : 1);
+	for (int64_t i = 0; i < size; i++)
+		(*data)[i] = rng();
+
+	if (fwrite(*data, 1, size, f) != (size_t)size) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+// The FILE side, with one character of pushback
+typedef struct {
+	FILE *f;
+	int pushback;
+} ref_file;
+
+static int ref_getc(ref_file *r) {
+	int ch = r->pushback;
+	if (ch >= 0) {
+		r->pushback = -1;
+		return ch;
+	}
+	return fgetc(r->f);
+}
+
+static int ref_ungetc(ref_file *r, int ch) {
+	if (ch == EOF || r->pushback >= 0)
+		return EOF;
+	r->pushback = (uint8_t)ch;
+	return r->pushback;
+}
+
+static size_t ref_read(ref_file *r, uint8_t *ptr, size_t len) {
+	size_t done = 0;
+	if (len > 0 && r->pushback >= 0) {
+		ptr[done++] = r->pushback;
+		r->pushback = -1;
+	}
+	return done + fread(ptr + done, 1, len - done, r->f);
+}
+
+static int64_t ref_tell(ref_file *r) {
+	return ftello(r->f) - (r->pushback >= 0);
+}
+
+static int ref_seek(ref_file *r, int64_t offset, int origin) {
+	if (origin == SEEK_CUR) {
+		offset += ref_tell(r);
+		origin = SEEK_SET;
+	}
+	if (origin == SEEK_SET && offset < 0)
+		return -1;
+	if (fseeko(r->f, offset, origin) < 0)
+		return -1;
+	r->pushback = -1;
+	return 0;
+}
+
+static int check(const char *dir, const char *name, const io_backend *io, prefetch_entry *pf) {
+	static uint8_t got[MAX_READ], want[MAX_READ];
+	char path[4096];
+	ref_file ref;
+	int32_t fh;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	ref.f = fopen(path, "rb");
+	ref.pushback = -1;
+	if (!ref.f) {
+		printf("  could not open %s\n", path);
+		return -1;
+	}
+
+	if (io->open(name, &fh) < 0) {
+		printf("  %s could not open %s\n", io->name, name);
+		fclose(ref.f);
+		return -1;
+	}
+
+	if (pf) {
+		pf->refs = 1;
+		prefetch_bind(fh, pf);
+	}
+
+	obb_file *file = obb_file_new(NULL, io, fh);
+	if (!file) {
+		printf("  could not allocate the reader\n");
+		fclose(ref.f);
+		return -1;
+	}
+
+	if (file->pf != pf) {
+		printf("  the prefetched copy did not reach the reader\n");
+		obb_file_close(file);
+		fclose(ref.f);
+		return -1;
+	}
+
+	int64_t size = io->size(fh);
+	int res = 0;
+
+	for (int op = 0; op < OPS_PER_CASE && res == 0; op++) {
+		switch (rng() % 5) {
+		case 0:
+		{
+			int a = obb_file_getc(file);
+			int b = ref_getc(&ref);
+			if (a != b) {
+				printf("  op %d: getc returned %d, expected %d\n", op, a, b);
+				res = -1;
+			}
+			break;
+		}
+		case 1:
+		{
+			// One character of pushback is all C promises. The reader takes
+			// more when it can step back in its buffer.
+			if (ref.pushback >= 0)
+				break;
+			int ch = rng() % 8 == 0 ? EOF : (int)(rng() % 256);
+			int a = obb_file_ungetc(file, ch);
+			int b = ref_ungetc(&ref, ch);
+			if (a != b) {
+				printf("  op %d: ungetc(%d) returned %d, expected %d\n", op, ch, a, b);
+				res = -1;
+			}
+			break;
+		}
+		case 2:
+		{
+			size_t len = random_length();
+			size_t a = obb_file_read(file, got, len);
+			size_t b = ref_read(&ref, want, len);
+			if (a != b) {
+				printf("  op %d: read(%zu) returned %zu, expected %zu\n", op, len, a, b);
+				res = -1;
+			} else if (memcmp(got, want, a) != 0) {
+				printf("  op %d: read(%zu) returned other bytes\n", op, len);
+				res = -1;
+			}
+			break;
+		}
+		case 3:
+		{
+			static const int origins[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+			int origin = origins[rng() % 3];
+			int64_t offset = random_offset(size);
+			if (origin == SEEK_CUR)
+				offset -= ref_tell(&ref);
+			else if (origin == SEEK_END)
+				offset -= size;
+
+			int a = obb_file_seek(file, offset, origin);
+			int b = ref_seek(&ref, offset, origin);
+			if (a != b) {
+				printf("  op %d: seek(%lld, %d) returned %d, expected %d\n", op, (long long)offset, origin, a, b);
+				res = -1;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+
+		int64_t a = obb_file_tell(file);
+		int64_t b = ref_tell(&ref);
+		if (res == 0 && a != b) {
+			printf("  op %d: at %lld, expected %lld\n", op, (long long)a, (long long)b);
+			res = -1;
+		}
+	}
+
+	obb_file_close(file);
+	fclose(ref.f);
+
+	if (io->valid(fh)) {
+		printf("  the handle is still open\n");
+		res = -1;
+	}
+	if (pf && pf->refs != 0) {
+		printf("  the prefetched copy was not released\n");
+		res = -1;
+	}
+
+	return res;
+}
+
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/obbfilecheck.XXXXXX";
+	uint8_t *data[NUM_FILES];
+	int failed = 0, num_cases = 0;
+
+	rng_state = argc > 1 ? strtoul(argv[1], NULL, 0) : 0x12345678;
+	if (rng_state == 0)
+		rng_state = 1;
+
+	if (!mkdtemp(dir)) {
+		printf("Could not create a temporary folder\n");
+		return 1;
+	}
+	io_posix_set_root(dir);
+
+	for (size_t i = 0; i < NUM_FILES; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "file%zu.bin", i);
+		if (write_file(dir, name, file_sizes[i], &data[i]) < 0) {
+			printf("Could not write %s/%s\n", dir, name);
+			return 1;
+		}
+	}
+
+	static const io_backend *backends[] = { &posix_backend, &mmap_backend };
+
+	for (size_t i = 0; i < NUM_FILES; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "file%zu.bin", i);
+
+		for (size_t j = 0; j < sizeof(backends) / sizeof(backends[0]); j++) {
+			for (int prefetched = 0; prefetched < 2; prefetched++) {
+				prefetch_entry pf;
+				memset(&pf, 0, sizeof(pf));
+				pf.path = name;
+				pf.state = PREFETCH_READY;
+				pf.data = data[i];
+				pf.size = file_sizes[i];
+
+				int ok = check(dir, name, backends[j], prefetched ? &pf : NULL) == 0;
+				printf("%-8lld bytes %-5s %-10s %s\n", (long long)file_sizes[i], backends[j]->name,
+					prefetched ? "prefetched" : "storage", ok ? "ok" : "FAILED");
+				failed += !ok;
+				num_cases++;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < NUM_FILES; i++) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/file%zu.bin", dir, i);
+		unlink(path);
+		free(data[i]);
+	}
+	rmdir(dir);
+
+	printf("%d of %d cases passed\n", num_cases - failed, num_cases);
+	return failed ? 1 : 0;
+}
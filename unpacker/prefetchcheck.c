@@ -0,0 +1,306 @@
+// Checks the prefetch scheduler of loader/prefetch.c over plain files. A
+// manifest of files is written to a temporary folder and read through
+// io_posix.c, with every backend call counted. Opening an asset of the
+// manifest must load exactly the PREFETCH_AHEAD assets after it, which then
+// come back from memory with the right bytes. The pool must stay within
+// PREFETCH_POOL_MB without dropping data still in use, files over
+// PREFETCH_MAX_FILE_MB are never loaded, and handles bound to an asset
+// hand it over once, dropping it when the handle is bound again.
+//
+// gcc -O2 -o prefetchcheck prefetchcheck.c ../loader/prefetch.c ../loader/io_posix.c -lpthread
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../loader/config.h"
+#include "../loader/io_backend.h"
+#include "../loader/prefetch.h"
+
+#define MB (1024 * 1024)
+#define NUM_FILES (4 * PREFETCH_AHEAD)
+#define BIG_FIRST (PREFETCH_AHEAD + 2) // every other file of PREFETCH_MAX_FILE_MB from here
+#define TOO_BIG (NUM_FILES - 3)
+#define NUM_HELD 2
+#define WAIT_US (10 * 1000 * 1000)
+
+static char g_Dir[] = "/tmp/prefetchcheck.XXXXXX";
+static uint8_t *g_Data[NUM_FILES];
+static int64_t g_Size[NUM_FILES];
+
+static pthread_mutex_t g_CountLock = PTHREAD_MUTEX_INITIALIZER;
+static int g_Opened[NUM_FILES];
+static int g_Opens;
+static int g_Closes;
+static int g_Failed;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("  " __VA_ARGS__); \
+		printf("\n"); \
+		g_Failed++; \
+	} \
+} while (0)
+
+static int file_index(const char *path) {
+	int i;
+	if (sscanf(path, "/psarc/file%d.bin", &i) != 1 || i < 0 || i >= NUM_FILES)
+		return -1;
+	return i;
+}
+
+static int count_exists(const char *path) {
+	return posix_backend.exists(path);
+}
+
+static int count_valid(int32_t fh) {
+	return posix_backend.valid(fh);
+}
+
+static int count_open(const char *path, int32_t *fh) {
+	int i = file_index(path);
+	pthread_mutex_lock(&g_CountLock);
+	if (i >= 0)
+		g_Opened[i]++;
+	g_Opens++;
+	pthread_mutex_unlock(&g_CountLock);
+	return posix_backend.open(path, fh);
+}
+
+static int64_t count_size(int32_t fh) {
+	return posix_backend.size(fh);
+}
+
+static int64_t count_pread(int32_t fh, void *buf, int64_t len, int64_t off) {
+	return posix_backend.pread(fh, buf, len, off);
+}
+
+static void count_close(int32_t fh) {
+	posix_backend.close(fh);
+	pthread_mutex_lock(&g_CountLock);
+	g_Closes++;
+	pthread_mutex_unlock(&g_CountLock);
+}
+
+static const io_backend g_Counting = {
+	.name = "counting",
+	.exists = count_exists,
+	.valid = count_valid,
+	.open = count_open,
+	.size = count_size,
+	.pread = count_pread,
+	.close = count_close,
+};
+
+static int64_t file_size(int i) {
+	if (i == TOO_BIG)
+		return (int64_t)(PREFETCH_MAX_FILE_MB + 1) * MB;
+	if (i >= BIG_FIRST && i < TOO_BIG && (i - BIG_FIRST) % 2 == 0)
+		return (int64_t)PREFETCH_MAX_FILE_MB * MB;
+	return 1000 + i * 337;
+}
+
+static const char *file_path(int i) {
+	static char path[64];
+	snprintf(path, sizeof(path), "/psarc/file%d.bin", i);
+	return path;
+}
+
+static int write_files(void) {
+	char path[4096];
+	uint32_t seed = 0x9e3779b9;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/psarc", g_Dir);
+	if (mkdir(path, 0777) < 0)
+		return -1;
+
+	for (int i = 0; i < NUM_FILES; i++) {
+		g_Size[i] = file_size(i);
+		g_Data[i] = malloc(g_Size[i]);
+		for (int64_t j = 0; j < g_Size[i]; j++) {
+			seed = seed * 1664525 + 1013904223;
+			g_Data[i][j] = seed >> 24;
+		}
+
+		snprintf(path, sizeof(path), "%s%s", g_Dir, file_path(i));
+		f = fopen(path, "wb");
+		if (!f || fwrite(g_Data[i], 1, g_Size[i], f) != (size_t)g_Size[i])
+			return -1;
+		fclose(f);
+	}
+
+	snprintf(path, sizeof(path), "%s/manifest.txt", g_Dir);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "# first-open order\n");
+	for (int i = 0; i < NUM_FILES; i++)
+		fprintf(f, "%s\n", file_path(i));
+	fclose(f);
+	return 0;
+}
+
+// Only the background thread opens files. Asking for a file still queued
+// takes it off the queue, so the checks wait for it to be read first.
+static int wait_loaded(int i) {
+	for (int t = 0; t < WAIT_US; t += 1000) {
+		pthread_mutex_lock(&g_CountLock);
+		int done = g_Opened[i] > 0 && g_Opens == g_Closes;
+		pthread_mutex_unlock(&g_CountLock);
+		if (done)
+			return 0;
+		usleep(1000);
+	}
+	return -1;
+}
+
+static int opened(int i) {
+	pthread_mutex_lock(&g_CountLock);
+	int n = g_Opened[i];
+	pthread_mutex_unlock(&g_CountLock);
+	return n;
+}
+
+static void check_entry(prefetch_entry *e, int i) {
+	CHECK(e, "%s is not in memory", file_path(i));
+	if (!e)
+		return;
+	CHECK(e->state == PREFETCH_READY, "%s is in state %d", file_path(i), e->state);
+	CHECK(e->size == g_Size[i] && memcmp(e->data, g_Data[i], g_Size[i]) == 0,
+		"%s holds other bytes", file_path(i));
+}
+
+static void check_ahead(void) {
+	printf("ahead\n");
+
+	// The first asset itself is left to the game
+	prefetch_entry *e = prefetch_open(file_path(0));
+	CHECK(!e, "%s was not asked for and still came from memory", file_path(0));
+	CHECK(wait_loaded(PREFETCH_AHEAD) == 0, "the next %d assets were not loaded", PREFETCH_AHEAD);
+	usleep(100 * 1000);
+
+	for (int i = 0; i < NUM_FILES; i++) {
+		int want = i >= 1 && i <= PREFETCH_AHEAD;
+		CHECK(opened(i) == want, "%s was opened %d times, expected %d", file_path(i), opened(i), want);
+	}
+
+	e = prefetch_open(file_path(1));
+	check_entry(e, 1);
+	if (e) {
+		CHECK(e->refs == 1, "%s has %d refs, expected 1", file_path(1), e->refs);
+		prefetch_release(e);
+		CHECK(e->refs == 0, "%s has %d refs after release", file_path(1), e->refs);
+	}
+
+	CHECK(!prefetch_open("/psarc/unknown.bin"), "an asset outside the manifest came from memory");
+}
+
+static void check_pool(void) {
+	prefetch_entry *held[NUM_HELD] = { NULL };
+	prefetch_stats stats;
+
+	printf("pool\n");
+
+	// Walks the manifest like the game, keeping the first big files open.
+	// The big files add up to more than the pool, but the ones read ahead
+	// and the ones kept open always fit, so only files the game is done with
+	// may be dropped.
+	for (int i = 2; i < TOO_BIG; i++) {
+		CHECK(wait_loaded(i) == 0, "%s was never loaded", file_path(i));
+		prefetch_entry *e = prefetch_open(file_path(i));
+		check_entry(e, i);
+		if (!e)
+			continue;
+		if (i >= BIG_FIRST && (i - BIG_FIRST) / 2 < NUM_HELD && (i - BIG_FIRST) % 2 == 0)
+			held[(i - BIG_FIRST) / 2] = e;
+		else
+			prefetch_release(e);
+	}
+
+	CHECK(wait_loaded(NUM_FILES - 1) == 0, "%s was never loaded", file_path(NUM_FILES - 1));
+
+	for (int i = 0; i < NUM_HELD; i++) {
+		if (!held[i])
+			continue;
+		check_entry(held[i], BIG_FIRST + 2 * i);
+		prefetch_release(held[i]);
+	}
+
+	prefetch_get_stats(&stats);
+	CHECK(stats.pool_peak <= (int64_t)PREFETCH_POOL_MB * MB, "%lld bytes in the pool, it holds %d MB",
+		(long long)stats.pool_peak, PREFETCH_POOL_MB);
+	CHECK(stats.evicted > 0, "the pool never had to make room");
+	CHECK(!prefetch_open(file_path(TOO_BIG)), "%s is over PREFETCH_MAX_FILE_MB and came from memory",
+		file_path(TOO_BIG));
+}
+
+static void check_bindings(void) {
+	printf("bindings\n");
+
+	prefetch_entry *a = prefetch_open(file_path(NUM_FILES - 1));
+	prefetch_entry *b = prefetch_open(file_path(NUM_FILES - 2));
+	CHECK(a && b, "the last assets are not in memory");
+	if (!a || !b)
+		return;
+
+	int a_refs = a->refs - 1, b_refs = b->refs - 1;
+
+	prefetch_bind(0x1234, a);
+	CHECK(prefetch_take(0x1234) == a, "the bound entry was not handed over");
+	CHECK(prefetch_take(0x1234) == NULL, "the entry was handed over twice");
+	prefetch_release(a);
+	CHECK(a->refs == a_refs, "%d refs left on a released entry, expected %d", a->refs, a_refs);
+
+	// A handle closed before its lookup gets reused, by an asset outside the
+	// manifest and then by another one
+	a = prefetch_open(file_path(NUM_FILES - 1));
+	prefetch_bind(0x1234, a);
+	prefetch_bind(0x1234, NULL);
+	CHECK(a->refs == a_refs, "the stale binding kept %d refs, expected %d", a->refs, a_refs);
+	CHECK(prefetch_take(0x1234) == NULL, "the reused handle got the bytes of another file");
+
+	a = prefetch_open(file_path(NUM_FILES - 1));
+	prefetch_bind(0x1234, a);
+	prefetch_bind(0x1234, b);
+	CHECK(a->refs == a_refs, "the stale binding kept %d refs, expected %d", a->refs, a_refs);
+	CHECK(prefetch_take(0x1234) == b, "the reused handle did not get its own entry");
+	prefetch_release(b);
+	CHECK(b->refs == b_refs, "%d refs left on a released entry, expected %d", b->refs, b_refs);
+}
+
+int main(int argc, char *argv[]) {
+	char manifest[4096];
+
+	if (!mkdtemp(g_Dir)) {
+		printf("Could not create a temporary folder\n");
+		return 1;
+	}
+
+	if (write_files() < 0) {
+		printf("Could not write the files to %s\n", g_Dir);
+		return 1;
+	}
+
+	io_posix_set_root(g_Dir);
+	snprintf(manifest, sizeof(manifest), "%s/manifest.txt", g_Dir);
+	if (prefetch_init(&g_Counting, manifest) < 0) {
+		printf("Could not load %s\n", manifest);
+		return 1;
+	}
+
+	check_ahead();
+	check_pool();
+	check_bindings();
+
+	char cmd[4200];
+	snprintf(cmd, sizeof(cmd), "rm -r %s", g_Dir);
+	system(cmd);
+
+	printf(g_Failed ? "%d checks FAILED\n" : "all checks passed\n", g_Failed);
+	return g_Failed ? 1 : 0;
+}
@@ -0,0 +1,308 @@
+// Reports where time goes in a profile written by loader/so_profile.c with
+// SO_PROFILE. The profile holds cumulative counters per function and thread,
+// dumped every second, so the window reported is the difference between the
+// last whole snapshot and the last one taken before -s seconds. Functions are
+// ranked by the time spent in them alone, in total including the profiled
+// functions they called, or by calls, with the share of every thread.
+//
+// gcc -O2 -o profreport profreport.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../loader/so_profile.h"
+
+#define MAX_THREADS 256
+
+enum {
+	SORT_SELF,
+	SORT_TOTAL,
+	SORT_CALLS,
+};
+
+typedef struct {
+	uint64_t calls;
+	uint64_t ticks;
+	uint64_t self_ticks;
+	uint32_t max_ticks; // over the whole profile, it can not be told apart by window
+} totals;
+
+typedef struct {
+	uint32_t thread;
+	uint64_t calls;
+	uint64_t self_ticks;
+} thread_totals;
+
+// Counters of every function and thread as of one snapshot
+typedef struct {
+	uint64_t time;
+	uint32_t dropped;
+	totals *functions;
+	thread_totals threads[MAX_THREADS];
+	int num_threads;
+} state;
+
+typedef struct {
+	so_profile_function f;
+	char *name;
+	totals window;
+} function;
+
+static function *functions;
+static uint32_t num_functions;
+static int sort_by = SORT_SELF;
+
+static void state_reset(state *s) {
+	s->time = 0;
+	s->dropped = 0;
+	s->num_threads = 0;
+	memset(s->functions, 0, num_functions * sizeof(totals));
+}
+
+static void state_copy(state *dst, const state *src) {
+	totals *f = dst->functions;
+	memcpy(dst, src, sizeof(state));
+	dst->functions = f;
+	memcpy(dst->functions, src->functions, num_functions * sizeof(totals));
+}
+
+static thread_totals *get_thread(state *s, uint32_t thread) {
+	for (int i = 0; i < s->num_threads; i++) {
+		if (s->threads[i].thread == thread)
+			return &s->threads[i];
+	}
+
+	if (s->num_threads == MAX_THREADS)
+		return NULL;
+
+	thread_totals *t = &s->threads[s->num_threads++];
+	memset(t, 0, sizeof(thread_totals));
+	t->thread = thread;
+	return t;
+}
+
+static void account(state *s, const so_profile_record *r) {
+	totals *f = &s->functions[r->function];
+	f->calls += r->calls;
+	f->ticks += r->ticks;
+	f->self_ticks += r->self_ticks;
+	if (r->max_ticks > f->max_ticks)
+		f->max_ticks = r->max_ticks;
+
+	thread_totals *t = get_thread(s, r->thread);
+	if (t) {
+		t->calls += r->calls;
+		t->self_ticks += r->self_ticks;
+	}
+}
+
+static uint64_t sort_key(const function *f) {
+	switch (sort_by) {
+	case SORT_TOTAL:
+		return f->window.ticks;
+	case SORT_CALLS:
+		return f->window.calls;
+	default:
+		return f->window.self_ticks;
+	}
+}
+
+static int function_cmp(const void *a, const void *b) {
+	uint64_t ka = sort_key(*(const function **)a);
+	uint64_t kb = sort_key(*(const function **)b);
+	if (ka != kb)
+		return ka > kb ? -1 : 1;
+	return 0;
+}
+
+static void usage(void) {
+	printf("Usage: ./profreport [-n top] [-s seconds] [-k self|total|calls] profile.bin\n");
+	printf("  -n top      number of functions to report, default 20\n");
+	printf("  -s seconds  leave out the calls made before, default 0\n");
+	printf("  -k key      rank by time spent in the function itself, in total\n");
+	printf("              including the profiled functions it called, or by calls\n");
+}
+
+int main(int argc, char *argv[]) {
+	so_profile_header hdr;
+	so_profile_snapshot snapshot;
+	state cur, last, base;
+	double start_seconds = 0;
+	int snapshots = 0;
+	int top = 20;
+	int opt;
+	FILE *fin;
+
+	while ((opt = getopt(argc, argv, "n:s:k:")) != -1) {
+		switch (opt) {
+		case 'n':
+			top = atoi(optarg);
+			break;
+		case 's':
+			start_seconds = atof(optarg);
+			break;
+		case 'k':
+			if (strcmp(optarg, "self") == 0)
+				sort_by = SORT_SELF;
+			else if (strcmp(optarg, "total") == 0)
+				sort_by = SORT_TOTAL;
+			else if (strcmp(optarg, "calls") == 0)
+				sort_by = SORT_CALLS;
+			else {
+				usage();
+				return 1;
+			}
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 1) {
+		usage();
+		return 1;
+	}
+
+	fin = fopen(argv[optind], "rb");
+	if (!fin) {
+		printf("Could not open %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (fread(&hdr, 1, sizeof(hdr), fin) != sizeof(hdr) || hdr.magic != SO_PROFILE_MAGIC) {
+		printf("Not a profile\n");
+		return 1;
+	}
+
+	if (hdr.version != SO_PROFILE_VERSION) {
+		printf("Unsupported profile version %u\n", hdr.version);
+		return 1;
+	}
+
+	num_functions = hdr.num_functions;
+	functions = calloc(num_functions, sizeof(function));
+	for (uint32_t i = 0; i < num_functions; i++) {
+		function *f = &functions[i];
+		if (fread(&f->f, 1, sizeof(f->f), fin) != sizeof(f->f)) {
+			printf("Truncated function table\n");
+			return 1;
+		}
+
+		uint32_t padded = (f->f.name_len + 3) & ~3;
+		f->name = malloc(padded + 1);
+		if (fread(f->name, 1, padded, fin) != padded) {
+			printf("Truncated function table\n");
+			return 1;
+		}
+		f->name[f->f.name_len] = '\0';
+	}
+
+	cur.functions = malloc(num_functions * sizeof(totals));
+	last.functions = malloc(num_functions * sizeof(totals));
+	base.functions = malloc(num_functions * sizeof(totals));
+	state_reset(&last);
+	state_reset(&base);
+
+	uint64_t start_ticks = (uint64_t)(start_seconds * hdr.tick_freq);
+	double tick_ms = 1000.0 / hdr.tick_freq;
+
+	// The game may be stopped in the middle of a dump, only whole snapshots count
+	while (fread(&snapshot, 1, sizeof(snapshot), fin) == sizeof(snapshot)) {
+		so_profile_record r;
+		uint32_t n;
+
+		state_reset(&cur);
+		cur.time = snapshot.time;
+		cur.dropped = snapshot.dropped;
+
+		for (n = 0; n < snapshot.num_records; n++) {
+			if (fread(&r, 1, sizeof(r), fin) != sizeof(r))
+				break;
+			if (r.function < num_functions)
+				account(&cur, &r);
+		}
+		if (n != snapshot.num_records)
+			break;
+
+		snapshots++;
+		if (cur.time <= start_ticks)
+			state_copy(&base, &cur);
+		state_copy(&last, &cur);
+	}
+
+	fclose(fin);
+
+	if (snapshots == 0) {
+		printf("No snapshot in the profile\n");
+		return 1;
+	}
+
+	uint64_t window = last.time - base.time;
+	uint64_t calls = 0, self_ticks = 0;
+	for (uint32_t i = 0; i < num_functions; i++) {
+		function *f = &functions[i];
+		f->window.calls = last.functions[i].calls - base.functions[i].calls;
+		f->window.ticks = last.functions[i].ticks - base.functions[i].ticks;
+		f->window.self_ticks = last.functions[i].self_ticks - base.functions[i].self_ticks;
+		f->window.max_ticks = last.functions[i].max_ticks;
+		calls += f->window.calls;
+		self_ticks += f->window.self_ticks;
+	}
+
+	printf("%u functions, %d snapshots, %.3f s to %.3f s: %llu calls, %u uncounted\n\n",
+		num_functions, snapshots, base.time * tick_ms / 1000.0, last.time * tick_ms / 1000.0,
+		(unsigned long long)calls, last.dropped - base.dropped);
+
+	if (window == 0)
+		return 0;
+
+	// Time is as seen by every thread, so it adds up to more than the window
+	// when several of them run profiled functions
+	printf("Threads:\n");
+	for (int i = 0; i < last.num_threads; i++) {
+		thread_totals *t = &last.threads[i];
+		thread_totals *b = get_thread(&base, t->thread);
+		uint64_t t_calls = t->calls - (b ? b->calls : 0);
+		uint64_t t_self = t->self_ticks - (b ? b->self_ticks : 0);
+		if (t_calls == 0)
+			continue;
+		printf("  0x%08X %12llu calls %10.1f ms %6.2f%%\n", t->thread, (unsigned long long)t_calls,
+			t_self * tick_ms, 100.0 * t_self / window);
+	}
+
+	function **ranked = malloc(num_functions * sizeof(function *));
+	for (uint32_t i = 0; i < num_functions; i++)
+		ranked[i] = &functions[i];
+	qsort(ranked, num_functions, sizeof(function *), function_cmp);
+
+	if (top > (int)num_functions)
+		top = num_functions;
+
+	printf("\nHottest functions:\n");
+	printf("  %10s %9s %10s %10s %7s %9s %9s  %s\n",
+		"calls", "calls/s", "self ms", "total ms", "self%", "us/call", "max us", "name");
+	for (int i = 0; i < top; i++) {
+		function *f = ranked[i];
+		if (f->window.calls == 0)
+			break;
+		printf("  %10llu %9.1f %10.1f %10.1f %6.2f%% %9.2f %9.0f  %s\n",
+			(unsigned long long)f->window.calls,
+			f->window.calls * 1000.0 / (window * tick_ms),
+			f->window.self_ticks * tick_ms,
+			f->window.ticks * tick_ms,
+			100.0 * f->window.self_ticks / window,
+			f->window.ticks * tick_ms * 1000.0 / f->window.calls,
+			f->window.max_ticks * tick_ms * 1000.0,
+			f->name);
+	}
+
+	if (self_ticks)
+		printf("\n%.1f ms in profiled functions, %.2f%% of the window\n",
+			self_ticks * tick_ms, 100.0 * self_ticks / window);
+
+	return 0;
+}
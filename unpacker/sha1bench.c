@@ -0,0 +1,298 @@
+// Checks loader/sha1.c against the FIPS test vectors and the original byte-wise
+// implementation, then times both on shader-sized inputs (or on real shader
+// sources captured with DUMP_SHADERS).
+//
+// gcc -O2 -o sha1bench sha1bench.c ../loader/sha1.c
+// gcc -O2 -DSHA1_NO_VECTOR -o sha1bench_scalar sha1bench.c ../loader/sha1.c
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "../loader/sha1.h"
+
+// The implementation the loader shipped with, kept as the reference
+typedef struct {
+	uint8_t data[64];
+	uint32_t datalen;
+	uint64_t bitlen;
+	uint32_t state[5];
+} ref_ctx;
+
+#define ROL(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+static void ref_transform(ref_ctx *ctx, const uint8_t data[]) {
+	static const uint32_t k[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+	uint32_t a, b, c, d, e, i, j, t, m[80];
+
+	for (i = 0, j = 0; i < 16; ++i, j += 4)
+		m[i] = (data[j] << 24) + (data[j + 1] << 16) + (data[j + 2] << 8) + (data[j + 3]);
+	for ( ; i < 80; ++i) {
+		m[i] = (m[i - 3] ^ m[i - 8] ^ m[i - 14] ^ m[i - 16]);
+		m[i] = (m[i] << 1) | (m[i] >> 31);
+	}
+
+	a = ctx->state[0];
+	b = ctx->state[1];
+	c = ctx->state[2];
+	d = ctx->state[3];
+	e = ctx->state[4];
+
+	for (i = 0; i < 80; ++i) {
+		if (i < 20)
+			t = ROL(a, 5) + ((b & c) ^ (~b & d)) + e + k[0] + m[i];
+		else if (i < 40)
+			t = ROL(a, 5) + (b ^ c ^ d) + e + k[1] + m[i];
+		else if (i < 60)
+			t = ROL(a, 5) + ((b & c) ^ (b & d) ^ (c & d)) + e + k[2] + m[i];
+		else
+			t = ROL(a, 5) + (b ^ c ^ d) + e + k[3] + m[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+	ctx->state[4] += e;
+}
+
+static void ref_sha1(const uint8_t *data, size_t len, uint8_t hash[20]) {
+	ref_ctx ctx = { .state = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xc3d2e1f0 } };
+	uint32_t i;
+
+	for (size_t n = 0; n < len; ++n) {
+		ctx.data[ctx.datalen++] = data[n];
+		if (ctx.datalen == 64) {
+			ref_transform(&ctx, ctx.data);
+			ctx.bitlen += 512;
+			ctx.datalen = 0;
+		}
+	}
+
+	i = ctx.datalen;
+	ctx.data[i++] = 0x80;
+	if (ctx.datalen >= 56) {
+		while (i < 64)
+			ctx.data[i++] = 0x00;
+		ref_transform(&ctx, ctx.data);
+		i = 0;
+	}
+	while (i < 56)
+		ctx.data[i++] = 0x00;
+
+	ctx.bitlen += ctx.datalen * 8;
+	for (i = 0; i < 8; i++)
+		ctx.data[63 - i] = ctx.bitlen >> (i * 8);
+	ref_transform(&ctx, ctx.data);
+
+	for (i = 0; i < 20; ++i)
+		hash[i] = ctx.state[i / 4] >> (24 - (i % 4) * 8);
+}
+
+static void new_sha1(const uint8_t *data, size_t len, uint8_t hash[20]) {
+	SHA1_CTX ctx;
+	sha1_init(&ctx);
+	sha1_update(&ctx, data, len);
+	sha1_final(&ctx, hash);
+}
+
+static const struct {
+	const char *msg;
+	int repeat;
+	const char *digest;
+} vectors[] = {
+	{ "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+	{ "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+	{ "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 1,
+		"a49b2446a02c645bf419f995b67091253a04a259" },
+	{ "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+	{ "01234567012345670123456701234567", 20, "dea356a2cddd90c7a7ecedc5ebb563934f460452" },
+};
+
+static void to_hex(const uint8_t hash[20], char out[41]) {
+	for (int i = 0; i < 20; i++)
+		sprintf(out + i * 2, "%02x", hash[i]);
+}
+
+static int check_vectors(void) {
+	int failed = 0;
+
+	for (size_t v = 0; v < sizeof(vectors) / sizeof(*vectors); v++) {
+		size_t len = strlen(vectors[v].msg);
+		uint8_t hash[20];
+		char hex[41];
+		SHA1_CTX ctx;
+
+		// Fed one repetition at a time, so the odd lengths also exercise the partial block path
+		sha1_init(&ctx);
+		for (int r = 0; r < vectors[v].repeat; r++)
+			sha1_update(&ctx, (const BYTE *)vectors[v].msg, len);
+		sha1_final(&ctx, hash);
+
+		to_hex(hash, hex);
+		if (strcmp(hex, vectors[v].digest) != 0) {
+			printf("Vector %zu: got %s, expected %s\n", v, hex, vectors[v].digest);
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+static int check_random(void) {
+	uint8_t buf[4096 + 64];
+	uint8_t ref[20], got[20];
+	int failed = 0;
+
+	srand(1);
+	for (int n = 0; n < 2000; n++) {
+		size_t len = rand() % 4096;
+		size_t misalign = rand() % 64;
+		for (size_t i = 0; i < len; i++)
+			buf[misalign + i] = rand();
+
+		ref_sha1(buf + misalign, len, ref);
+
+		// Split the input at random points
+		SHA1_CTX ctx;
+		size_t off = 0;
+		sha1_init(&ctx);
+		while (off < len) {
+			size_t chunk = 1 + rand() % 200;
+			if (chunk > len - off)
+				chunk = len - off;
+			sha1_update(&ctx, buf + misalign + off, chunk);
+			off += chunk;
+		}
+		sha1_final(&ctx, got);
+
+		if (memcmp(ref, got, 20) != 0) {
+			printf("Mismatch on %zu bytes at offset %zu\n", len, misalign);
+			failed++;
+		}
+	}
+
+	return failed;
+}
+
+typedef struct {
+	uint8_t *data;
+	size_t len;
+} sample;
+
+static sample *samples;
+static size_t num_samples;
+
+static void add_sample(uint8_t *data, size_t len) {
+	samples = realloc(samples, (num_samples + 1) * sizeof(sample));
+	samples[num_samples].data = data;
+	samples[num_samples].len = len;
+	num_samples++;
+}
+
+static int load_samples(const char *dir) {
+	char path[4096];
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	if (!d) {
+		printf("Could not open %s\n", dir);
+		return -1;
+	}
+
+	while ((de = readdir(d))) {
+		size_t n = strlen(de->d_name);
+		if (n < 5 || strcmp(de->d_name + n - 5, ".glsl") != 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		FILE *fin = fopen(path, "rb");
+		if (!fin)
+			continue;
+		fseek(fin, 0, SEEK_END);
+		long size = ftell(fin);
+		fseek(fin, 0, SEEK_SET);
+		uint8_t *data = malloc(size ? size : 1);
+		if (fread(data, 1, size, fin) == (size_t)size)
+			add_sample(data, size);
+		else
+			free(data);
+		fclose(fin);
+	}
+
+	closedir(d);
+	return 0;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static double bench(void (*fn)(const uint8_t *, size_t, uint8_t *), int rounds, size_t *bytes) {
+	uint8_t hash[20];
+	double start = now();
+
+	*bytes = 0;
+	for (int r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < num_samples; i++) {
+			fn(samples[i].data, samples[i].len, hash);
+			*bytes += samples[i].len;
+		}
+	}
+
+	return now() - start;
+}
+
+int main(int argc, char *argv[]) {
+	size_t bytes;
+	int failed;
+
+	failed = check_vectors() + check_random();
+	printf("Test vectors and reference comparison: %s\n", failed ? "FAILED" : "ok");
+	if (failed)
+		return 1;
+
+	if (argc > 1) {
+		if (load_samples(argv[1]) < 0)
+			return 1;
+	} else {
+		// Same spread of sizes as the game's shaders
+		static const size_t sizes[] = { 1500, 3000, 4500, 6000, 9000 };
+		srand(2);
+		for (size_t i = 0; i < 200; i++) {
+			size_t len = sizes[i % 5];
+			uint8_t *data = malloc(len);
+			for (size_t j = 0; j < len; j++)
+				data[j] = ' ' + rand() % 95;
+			add_sample(data, len);
+		}
+	}
+
+	if (num_samples == 0) {
+		printf("No samples\n");
+		return 1;
+	}
+
+	int rounds = 200;
+	double t_ref = bench(ref_sha1, rounds, &bytes);
+	double t_new = bench(new_sha1, rounds, &bytes);
+	double calls = (double)rounds * num_samples;
+
+	printf("%zu samples, %.1f KB on average\n", num_samples, bytes / calls / 1024.0);
+	printf("reference: %8.2f us per shader, %8.2f MB/s\n", t_ref * 1e6 / calls, bytes / t_ref / (1024.0 * 1024.0));
+	printf("sha1.c:    %8.2f us per shader, %8.2f MB/s (%.2fx)\n", t_new * 1e6 / calls, bytes / t_new / (1024.0 * 1024.0),
+		t_ref / t_new);
+
+	return 0;
+}
@@ -0,0 +1,568 @@
+// Enumerates the shader permutations the game can request and writes, for
+// each one that has no gxp yet, the exact Cg source the loader would compile
+// for it (see glShaderSource_fake). The loader compiles those at startup
+// (shader_precompile.c), so the game never has to wait on the compiler.
+//
+// The game sources cannot be derived from vert.cg/frag.cg: they are a fixed
+// GLSL body per stage behind a prelude of #defines. Both are learned from
+// sources captured with DUMP_SHADERS in config.h. Every macro takes the values
+// seen in the captures, or the ones given with -D.
+//
+// gcc -O2 -o shaderperm shaderperm.c ../loader/shader_key.c ../loader/sha1.c
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../loader/shader_key.h"
+
+#define GL_ES_MARKER "#if defined GL_ES"
+
+#define MAX_LINES 256
+#define MAX_VALUES 8
+#define MAX_OVERRIDES 64
+#define MAX_DIRS 8
+#define DEFAULT_MAX_PERMUTATIONS 4096
+
+enum {
+	STAGE_VERTEX,
+	STAGE_FRAGMENT,
+	NUM_STAGES,
+};
+
+static const char *stage_names[] = { "vertex", "fragment" };
+
+typedef struct {
+	char *text;   // whole line for literals, text before the value for macros
+	char *suffix; // text after the value
+	int is_macro;
+	char name[64];
+	int values[MAX_VALUES];
+	int num_values;
+	int known; // the macro is tested by the .cg file
+} prelude_line;
+
+typedef struct {
+	int num_samples;
+	int num_lines;
+	prelude_line lines[MAX_LINES];
+	char *body;
+	char *cg;
+} stage_template;
+
+typedef struct {
+	char name[64];
+	int values[MAX_VALUES];
+	int num_values;
+} override;
+
+static stage_template stages[NUM_STAGES];
+static char **samples; // samples that were learned from
+static int num_samples;
+static override overrides[MAX_OVERRIDES];
+static int num_overrides;
+
+static char *read_file(const char *path, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	char *buf;
+	long size;
+
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	buf = malloc(size + 1);
+	if (fread(buf, 1, size, f) != (size_t)size) {
+		free(buf);
+		fclose(f);
+		return NULL;
+	}
+	buf[size] = '\0';
+	fclose(f);
+
+	if (len)
+		*len = size;
+	return buf;
+}
+
+static const shader_key_hash *key_hash = &murmur3_key;
+
+// Same key as glShaderSource_fake, printed as hex
+static void shader_name(const char *src, size_t len, char name[SHADER_KEY_CHARS + 1]) {
+	uint32_t key[SHADER_KEY_WORDS];
+
+	key_hash->hash(src, len, key);
+	shader_key_name(key, name);
+}
+
+static int add_value(prelude_line *l, int v) {
+	for (int i = 0; i < l->num_values; i++) {
+		if (l->values[i] == v)
+			return 0;
+	}
+	if (l->num_values == MAX_VALUES)
+		return -1;
+	l->values[l->num_values++] = v;
+	return 0;
+}
+
+// Split "#define NAME VALUE" into the text around an integer value
+static int parse_macro(const char *line, char *name, size_t name_size, size_t *value_off, size_t *value_len, int *value) {
+	const char *p = line;
+	const char *n, *v;
+	char *end;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (strncmp(p, "#define", 7) != 0 || (p[7] != ' ' && p[7] != '\t'))
+		return -1;
+	p += 7;
+	while (*p == ' ' || *p == '\t')
+		p++;
+
+	n = p;
+	while (*p && *p != ' ' && *p != '\t')
+		p++;
+	if (p == n || (size_t)(p - n) >= name_size)
+		return -1;
+	memcpy(name, n, p - n);
+	name[p - n] = '\0';
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	v = p;
+	*value = strtol(v, &end, 10);
+	if (end == v)
+		return -1;
+
+	*value_off = v - line;
+	*value_len = end - v;
+	return 0;
+}
+
+static int split_lines(char *text, char **lines) {
+	int n = 0;
+	char *p = text;
+
+	for (;;) {
+		if (n == MAX_LINES)
+			return -1;
+		lines[n++] = p;
+		p = strchr(p, '\n');
+		if (!p)
+			break;
+		*p++ = '\0';
+	}
+
+	return n;
+}
+
+static int learn_sample(const char *path) {
+	char *lines[MAX_LINES];
+	size_t len;
+	char *src = read_file(path, &len);
+	char *marker;
+	int stage, n;
+
+	if (!src) {
+		printf("Could not read %s\n", path);
+		return -1;
+	}
+
+	marker = strstr(src, GL_ES_MARKER);
+	if (!marker) {
+		printf("%s: no \"%s\", skipped\n", path, GL_ES_MARKER);
+		free(src);
+		return 0;
+	}
+
+	stage = strstr(src, "u_modelViewProjectionMatrix") ? STAGE_VERTEX : STAGE_FRAGMENT;
+	stage_template *t = &stages[stage];
+
+	if (!t->body) {
+		t->body = strdup(marker);
+	} else if (strcmp(t->body, marker) != 0) {
+		printf("%s: %s body differs from the other samples, skipped\n", path, stage_names[stage]);
+		free(src);
+		return 0;
+	}
+
+	*marker = '\0';
+	n = split_lines(src, lines);
+	if (n < 0) {
+		printf("%s: prelude too long\n", path);
+		free(src);
+		return -1;
+	}
+
+	if (t->num_samples > 0 && n != t->num_lines) {
+		printf("%s: prelude layout differs from the other samples, skipped\n", path);
+		free(src);
+		return 0;
+	}
+
+	// Check the whole layout first, so that a rejected sample leaves no values behind
+	for (int i = 0; i < n && t->num_samples > 0; i++) {
+		prelude_line *l = &t->lines[i];
+		char name[64];
+		size_t off, vlen;
+		int value;
+		int is_macro = parse_macro(lines[i], name, sizeof(name), &off, &vlen, &value) == 0;
+
+		if (l->is_macro != is_macro || (is_macro ? strcmp(l->name, name) != 0 : strcmp(l->text, lines[i]) != 0)) {
+			printf("%s: line %d differs from the other samples, skipped\n", path, i + 1);
+			free(src);
+			return 0;
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		prelude_line *l = &t->lines[i];
+		char name[64];
+		size_t off, vlen;
+		int value;
+		int is_macro = parse_macro(lines[i], name, sizeof(name), &off, &vlen, &value) == 0;
+
+		if (t->num_samples == 0) {
+			l->is_macro = is_macro;
+			if (is_macro) {
+				l->text = strndup(lines[i], off);
+				l->suffix = strdup(lines[i] + off + vlen);
+				strcpy(l->name, name);
+			} else {
+				l->text = strdup(lines[i]);
+			}
+		}
+
+		if (is_macro && add_value(l, value) < 0) {
+			printf("%s: too many values for %s\n", path, name);
+			free(src);
+			return -1;
+		}
+	}
+
+	t->num_lines = n;
+	t->num_samples++;
+	samples = realloc(samples, (num_samples + 1) * sizeof(char *));
+	samples[num_samples++] = strdup(path);
+	free(src);
+	return 0;
+}
+
+// Prelude for the i-th permutation, or for the given values when values is not NULL
+static size_t build_prelude(stage_template *t, uint64_t perm, const int *values, char *out, size_t size) {
+	size_t len = 0;
+	int m = 0;
+
+	for (int i = 0; i < t->num_lines; i++) {
+		prelude_line *l = &t->lines[i];
+		if (l->is_macro) {
+			int v;
+			if (values) {
+				v = values[m++];
+			} else {
+				v = l->values[perm % l->num_values];
+				perm /= l->num_values;
+			}
+			len += snprintf(out + len, size > len ? size - len : 0, "%s%d%s", l->text, v, l->suffix);
+		} else {
+			len += snprintf(out + len, size > len ? size - len : 0, "%s", l->text);
+		}
+		if (i < t->num_lines - 1)
+			len += snprintf(out + len, size > len ? size - len : 0, "\n");
+	}
+
+	return len;
+}
+
+static int has_gxp(char **dirs, int num_dirs, const char *name) {
+	char path[4096];
+	struct stat st;
+
+	for (int i = 0; i < num_dirs; i++) {
+		snprintf(path, sizeof(path), "%s/%s.gxp", dirs[i], name);
+		if (stat(path, &st) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+// Re-create every captured sample from its own macro values, proving that the keys will match the game's
+static int self_test(void) {
+	char name[SHADER_KEY_CHARS + 1];
+	char expected[SHADER_KEY_CHARS + 1];
+	int passed = 0;
+
+	for (int k = 0; k < num_samples; k++) {
+		char *lines[MAX_LINES];
+		int values[MAX_LINES];
+		int m = 0;
+		size_t len;
+		char *src = read_file(samples[k], &len);
+		char *orig = strdup(src);
+		char *marker = strstr(src, GL_ES_MARKER);
+		stage_template *t = &stages[strstr(src, "u_modelViewProjectionMatrix") ? STAGE_VERTEX : STAGE_FRAGMENT];
+
+		*marker = '\0';
+		int n = split_lines(src, lines);
+		for (int i = 0; i < n; i++) {
+			char macro[64];
+			size_t off, vlen;
+			if (t->lines[i].is_macro && parse_macro(lines[i], macro, sizeof(macro), &off, &vlen, &values[m]) == 0)
+				m++;
+		}
+
+		char *gen = malloc(len + 1);
+		size_t plen = build_prelude(t, 0, values, gen, len + 1);
+		if (plen + strlen(t->body) == len) {
+			memcpy(gen + plen, t->body, len - plen);
+			shader_name(orig, len, expected);
+			shader_name(gen, len, name);
+			if (strcmp(expected, name) == 0)
+				passed++;
+			else
+				printf("%s: regenerated as %s\n", samples[k], name);
+		} else {
+			printf("%s: could not be regenerated\n", samples[k]);
+		}
+
+		free(gen);
+		free(orig);
+		free(src);
+	}
+
+	printf("Self test: %d/%d samples reproduced\n", passed, num_samples);
+	return passed == num_samples ? 0 : -1;
+}
+
+static int parse_override(const char *arg) {
+	override *o;
+	const char *eq = strchr(arg, '=');
+	char *p, *end;
+
+	if (!eq || eq == arg || (size_t)(eq - arg) >= sizeof(o->name) || num_overrides == MAX_OVERRIDES)
+		return -1;
+
+	o = &overrides[num_overrides++];
+	memcpy(o->name, arg, eq - arg);
+	o->name[eq - arg] = '\0';
+	o->num_values = 0;
+
+	for (p = (char *)eq + 1; *p; p = end + (*end == ',')) {
+		if (o->num_values == MAX_VALUES)
+			return -1;
+		o->values[o->num_values++] = strtol(p, &end, 10);
+		if (end == p || (*end != ',' && *end != '\0'))
+			return -1;
+	}
+
+	return o->num_values > 0 ? 0 : -1;
+}
+
+static void apply_overrides(stage_template *t) {
+	for (int i = 0; i < t->num_lines; i++) {
+		prelude_line *l = &t->lines[i];
+		if (!l->is_macro)
+			continue;
+		for (int j = 0; j < num_overrides; j++) {
+			if (strcmp(overrides[j].name, l->name) == 0) {
+				memcpy(l->values, overrides[j].values, sizeof(l->values));
+				l->num_values = overrides[j].num_values;
+			}
+		}
+	}
+}
+
+// Note the macros the .cg file never tests, they only change the key
+static void check_macros(stage_template *t, const char *cg_path) {
+	char pattern[128];
+
+	for (int i = 0; i < t->num_lines; i++) {
+		prelude_line *l = &t->lines[i];
+		if (!l->is_macro)
+			continue;
+		snprintf(pattern, sizeof(pattern), "defined(%s)", l->name);
+		l->known = strstr(t->cg, pattern) != NULL;
+		if (!l->known)
+			printf("Note: %s is not tested by %s\n", l->name, cg_path);
+	}
+}
+
+static void usage(void) {
+	printf("Usage: ./shaderperm [options] samples_dir vert.cg frag.cg\n");
+	printf("  -o dir        write the Cg sources of missing shaders to dir\n");
+	printf("  -x gxp_dir    skip shaders that already have a gxp there (may be repeated)\n");
+	printf("  -k hash       key hash the loader uses (SHADER_KEY in config.h), murmur3 or sha1 (default murmur3)\n");
+	printf("  -D NAME=a,b   values to enumerate for a macro (may be repeated)\n");
+	printf("  -n max        refuse to enumerate more than max shaders per stage (default %d)\n", DEFAULT_MAX_PERMUTATIONS);
+	printf("  -t            only check that the captured samples can be regenerated\n");
+}
+
+int main(int argc, char *argv[]) {
+	char *exist_dirs[MAX_DIRS];
+	int num_exist_dirs = 0;
+	const char *out_dir = NULL;
+	uint64_t max_perms = DEFAULT_MAX_PERMUTATIONS;
+	int test_only = 0;
+	struct dirent *de;
+	char path[4096];
+	int opt;
+	DIR *d;
+
+	while ((opt = getopt(argc, argv, "o:x:k:D:n:t")) != -1) {
+		switch (opt) {
+		case 'o':
+			out_dir = optarg;
+			break;
+		case 'x':
+			if (num_exist_dirs == MAX_DIRS) {
+				printf("Too many gxp directories\n");
+				return 1;
+			}
+			exist_dirs[num_exist_dirs++] = optarg;
+			break;
+		case 'k':
+			key_hash = shader_key_find(optarg);
+			if (!key_hash) {
+				printf("Unknown key hash %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'D':
+			if (parse_override(optarg) < 0) {
+				printf("Invalid macro values %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			max_perms = strtoull(optarg, NULL, 10);
+			break;
+		case 't':
+			test_only = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (argc - optind < 3) {
+		usage();
+		return 1;
+	}
+
+	d = opendir(argv[optind]);
+	if (!d) {
+		printf("Could not open %s\n", argv[optind]);
+		return 1;
+	}
+
+	while ((de = readdir(d))) {
+		if (!strstr(de->d_name, ".glsl"))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", argv[optind], de->d_name);
+		if (learn_sample(path) < 0) {
+			closedir(d);
+			return 1;
+		}
+	}
+	closedir(d);
+
+	if (self_test() < 0)
+		return 1;
+	if (test_only)
+		return 0;
+
+	for (int s = 0; s < NUM_STAGES; s++) {
+		stage_template *t = &stages[s];
+		const char *cg_path = argv[optind + 1 + s];
+		uint64_t perms = 1;
+		int written = 0, present = 0;
+
+		if (t->num_samples == 0) {
+			printf("No %s samples\n", stage_names[s]);
+			continue;
+		}
+
+		t->cg = read_file(cg_path, NULL);
+		if (!t->cg) {
+			printf("Could not read %s\n", cg_path);
+			return 1;
+		}
+
+		apply_overrides(t);
+		check_macros(t, cg_path);
+
+		printf("%s: %d samples, macros:", stage_names[s], t->num_samples);
+		for (int i = 0; i < t->num_lines; i++) {
+			prelude_line *l = &t->lines[i];
+			if (!l->is_macro)
+				continue;
+			perms *= l->num_values;
+			if (l->num_values > 1) {
+				printf(" %s={", l->name);
+				for (int v = 0; v < l->num_values; v++)
+					printf("%s%d", v ? "," : "", l->values[v]);
+				printf("}");
+			}
+		}
+		printf(" -> %llu permutations\n", (unsigned long long)perms);
+
+		if (perms > max_perms) {
+			printf("Too many permutations, restrict the macros with -D or raise -n\n");
+			return 1;
+		}
+
+		size_t body_len = strlen(t->body);
+		size_t cg_len = strlen(t->cg);
+
+		for (uint64_t p = 0; p < perms; p++) {
+			char prelude[64 * 1024];
+			char name[SHADER_KEY_CHARS + 1];
+			size_t plen = build_prelude(t, p, NULL, prelude, sizeof(prelude));
+
+			if (plen >= sizeof(prelude)) {
+				printf("Prelude too long\n");
+				return 1;
+			}
+
+			char *src = malloc(plen + body_len);
+			memcpy(src, prelude, plen);
+			memcpy(src + plen, t->body, body_len);
+			shader_name(src, plen + body_len, name);
+			free(src);
+
+			if (has_gxp(exist_dirs, num_exist_dirs, name)) {
+				present++;
+				continue;
+			}
+
+			if (out_dir) {
+				snprintf(path, sizeof(path), "%s/%s.cg", out_dir, name);
+				FILE *f = fopen(path, "wb");
+				if (!f) {
+					printf("Could not open %s\n", path);
+					return 1;
+				}
+				fwrite(prelude, 1, plen, f);
+				fwrite(t->cg, 1, cg_len, f);
+				fclose(f);
+			} else {
+				printf("%s\n", name);
+			}
+			written++;
+		}
+
+		printf("%s: %d already compiled, %d to compile\n", stage_names[s], present, written);
+	}
+
+	return 0;
+}
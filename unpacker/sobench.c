@@ -0,0 +1,333 @@
+// Loads .so modules on a host through the ELF loader of loader/so_elf.c, with
+// the anonymous mappings of mmap_platform, at the addresses main.c uses.
+// Imports are resolved against the default_dynlib names of loader/main.c, each
+// bound to a made up address. Times so_file_load, then so_relocate followed by
+// so_resolve against the single pass of so_link, per module. Prints a digest
+// of every relocated image so that changes to the loader can be checked for
+// producing the same memory; both ways of linking must agree on it. Pass the
+// modules in load order: the game's armeabi-v7a libraries or the ones sogen
+// writes. With -l, so_link_lazy is timed too, and the slots it leaves to the
+// resolver are then bound with so_lazy_bind_all, which must give the same
+// images. With -s, the linked modules are also saved as snapshots in a
+// directory and restored from there, which must give the same images again.
+//
+// gcc -O2 -o sobench sobench.c ../loader/so_elf.c ../loader/so_arena.c ../loader/so_snapshot.c ../loader/so_symtab.c ../loader/so_dynlib.c ../loader/so_platform_posix.c ../loader/shader_key.c ../loader/sha1.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../loader/config.h"
+#include "../loader/so_util.h"
+#include "../loader/so_snapshot.h"
+#include "../loader/shader_key.h"
+
+#define MAX_MODULES 8
+
+enum {
+	PHASE_LOAD,
+	PHASE_RELOCATE,
+	PHASE_RESOLVE,
+	PHASE_LINK,
+	PHASE_LAZY,
+	PHASE_BIND,
+	PHASE_RESTORE,
+	NUM_PHASES,
+};
+
+static const char *phase_names[NUM_PHASES] = { "load", "relocate", "resolve", "link", "lazy", "bind", "restore" };
+
+static so_default_dynlib *dynlib;
+static int num_dynlib;
+
+enum {
+	LINK_SEPARATE, // so_relocate then so_resolve
+	LINK_FUSED, // so_link
+	LINK_LAZY, // so_link_lazy then so_lazy_bind_all
+};
+
+static const char *link_names[] = { "so_relocate and so_resolve", "so_link", "so_link_lazy" };
+
+static so_module modules[MAX_MODULES];
+static int num_lazy[MAX_MODULES], num_jump_slots[MAX_MODULES];
+static double times[MAX_MODULES][NUM_PHASES];
+
+static char *read_text(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = malloc(size + 1);
+	if (fread(buf, 1, size, f) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	} else {
+		buf[size] = '\0';
+	}
+	fclose(f);
+
+	return buf;
+}
+
+// Every { "name", ... } line of the default_dynlib initializer
+static int load_dynlib(const char *main_c) {
+	char *src = read_text(main_c);
+	if (!src) {
+		printf("Could not open %s\n", main_c);
+		return -1;
+	}
+
+	char *p = strstr(src, "so_default_dynlib default_dynlib[]");
+	char *end = p ? strstr(p, "\n};") : NULL;
+	if (!end) {
+		printf("No default_dynlib in %s\n", main_c);
+		return -1;
+	}
+	*end = '\0';
+
+	for (char *line = strtok(p, "\n"); line; line = strtok(NULL, "\n")) {
+		char *q = strchr(line, '{');
+		if (!q || !(q = strchr(q, '"')))
+			continue;
+		char *e = strchr(q + 1, '"');
+		if (!e)
+			continue;
+		*e = '\0';
+
+		dynlib = realloc(dynlib, (num_dynlib + 1) * sizeof(so_default_dynlib));
+		dynlib[num_dynlib].symbol = q + 1;
+		dynlib[num_dynlib].func = 0x81000000 + num_dynlib * 0x10;
+		num_dynlib++;
+	}
+
+	return 0;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// The stubs unresolved imports point at move with every build of this tool
+static void hash_words(uint32_t *digest, const void *data, size_t size) {
+	uint32_t unresolved = (uint32_t)(uintptr_t)mmap_platform.unresolved;
+	uint32_t dummy = (uint32_t)(uintptr_t)mmap_platform.dummy;
+	uint32_t *copy = malloc(size + 4);
+	uint32_t out[4];
+
+	memcpy(copy, data, size);
+	for (size_t i = 0; i < size / 4; i++) {
+		if (copy[i] == unresolved || copy[i] == dummy)
+			copy[i] = 0;
+	}
+
+	murmur3_x86_128(copy, size, digest[0], out);
+	for (int i = 0; i < 4; i++)
+		digest[i] ^= out[i];
+	free(copy);
+}
+
+static void module_digest(so_module *mod, char name[SHADER_KEY_CHARS + 1]) {
+	uint32_t digest[4] = { 0, 0, 0, 0 };
+
+	hash_words(digest, (void *)mod->text_base, mod->text_size);
+	for (int i = 0; i < mod->n_data; i++)
+		hash_words(digest, (void *)mod->data_base[i], mod->data_size[i]);
+
+	shader_key_name(digest, name);
+}
+
+static int load_all(char **paths, int count, so_dynlib_table *table, int mode) {
+	for (int i = 0; i < count; i++) {
+		double start = now();
+		if (so_file_load(&modules[i], paths[i], LOAD_ADDRESS + i * 0x1000000) < 0) {
+			printf("Could not load %s\n", paths[i]);
+			return -1;
+		}
+		double loaded = now();
+		times[i][PHASE_LOAD] += loaded - start;
+
+		if (mode == LINK_FUSED) {
+			so_link(&modules[i], table, 0);
+			times[i][PHASE_LINK] += now() - loaded;
+		} else if (mode == LINK_LAZY) {
+			so_link_lazy(&modules[i], table, 0);
+			double linked = now();
+			num_lazy[i] = modules[i].num_lazy;
+			so_lazy_bind_all(&modules[i]);
+			num_jump_slots[i] = modules[i].num_relplt;
+			times[i][PHASE_LAZY] += linked - loaded;
+			times[i][PHASE_BIND] += now() - linked;
+		} else {
+			so_relocate(&modules[i]);
+			double relocated = now();
+			so_resolve(&modules[i], table, 0);
+			times[i][PHASE_RELOCATE] += relocated - loaded;
+			times[i][PHASE_RESOLVE] += now() - relocated;
+		}
+	}
+
+	return 0;
+}
+
+// Links every module once to save its snapshot, then restores them all
+static int snapshot_all(char **paths, int count, so_dynlib_table *table, const char *dir, int restore) {
+	for (int i = 0; i < count; i++) {
+		uintptr_t load_addr = LOAD_ADDRESS + i * 0x1000000;
+		char snapshot_path[512];
+		uint32_t key[4];
+
+		snprintf(snapshot_path, sizeof(snapshot_path), "%s/%d.bin", dir, i);
+
+		double start = now();
+		so_snapshot_key(paths[i], load_addr, table, 0, key);
+		if (restore) {
+			if (so_snapshot_restore(&modules[i], snapshot_path, key, load_addr) < 0) {
+				printf("Could not restore %s from %s\n", paths[i], snapshot_path);
+				return -1;
+			}
+			times[i][PHASE_RESTORE] += now() - start;
+			continue;
+		}
+
+		if (so_file_load(&modules[i], paths[i], load_addr) < 0 || so_link(&modules[i], table, 0) < 0) {
+			printf("Could not load %s\n", paths[i]);
+			return -1;
+		}
+		memcpy(modules[i].snapshot_key, key, sizeof(key));
+		if (so_snapshot_save(&modules[i], snapshot_path) < 0) {
+			printf("Could not save %s\n", snapshot_path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	so_dynlib_table table;
+	char digest[MAX_MODULES][SHADER_KEY_CHARS + 1];
+	const char *snapshot_dir = NULL;
+	int num_modes = 2;
+	int rounds = 10;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "ln:s:")) != -1) {
+		switch (opt) {
+		case 'l':
+			num_modes = 3;
+			break;
+		case 'n':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			snapshot_dir = optarg;
+			break;
+		default:
+			printf("Usage: ./sobench [-l] [-n rounds] [-s dir] main.c module.so [module.so...]\n");
+			return 1;
+		}
+	}
+
+	int count = argc - optind - 1;
+	if (count < 1 || count > MAX_MODULES || rounds < 1) {
+		printf("Usage: ./sobench [-l] [-n rounds] [-s dir] main.c module.so [module.so...]\n");
+		printf("  -l            also link lazily, then bind every slot\n");
+		printf("  -n rounds     times to load the modules (default 10)\n");
+		printf("  -s dir        also restore the modules from snapshots saved in dir\n");
+		return 1;
+	}
+
+	if (load_dynlib(argv[optind]) < 0)
+		return 1;
+
+	if (so_dynlib_init(&table, dynlib, num_dynlib) < 0)
+		return 1;
+
+	so_set_platform(&mmap_platform);
+
+	for (int r = 0; r < rounds * num_modes; r++) {
+		if (load_all(&argv[optind + 1], count, &table, r % num_modes) < 0)
+			return 1;
+
+		for (int i = 0; i < count; i++) {
+			char name[SHADER_KEY_CHARS + 1];
+			module_digest(&modules[i], name);
+			if (r == 0) {
+				strcpy(digest[i], name);
+			} else if (strcmp(name, digest[i]) != 0) {
+				printf("%s relocated differently by %s\n", argv[optind + 1 + i], link_names[r % num_modes]);
+				return 1;
+			}
+		}
+
+		for (int i = count - 1; i >= 0; i--)
+			so_unload(&modules[i]);
+	}
+
+	for (int r = 0; snapshot_dir && r <= rounds; r++) {
+		if (snapshot_all(&argv[optind + 1], count, &table, snapshot_dir, r > 0) < 0)
+			return 1;
+
+		for (int i = 0; i < count; i++) {
+			char name[SHADER_KEY_CHARS + 1];
+			module_digest(&modules[i], name);
+			if (strcmp(name, digest[i]) != 0) {
+				printf("%s %s differently from its snapshot\n", argv[optind + 1 + i], r ? "restored" : "linked");
+				return 1;
+			}
+		}
+
+		for (int i = count - 1; i >= 0; i--)
+			so_unload(&modules[i]);
+	}
+
+	int shown[NUM_PHASES] = { 1, 1, 1, 1, num_modes > LINK_LAZY, num_modes > LINK_LAZY, snapshot_dir != NULL };
+	double total[NUM_PHASES] = { 0 };
+	printf("%-24s", "module");
+	for (int p = 0; p < NUM_PHASES; p++) {
+		if (shown[p])
+			printf(" %10s", phase_names[p]);
+	}
+	printf("  %s\n", "image digest");
+	for (int i = 0; i < count; i++) {
+		const char *base = strrchr(argv[optind + 1 + i], '/');
+		printf("%-24s", base ? base + 1 : argv[optind + 1 + i]);
+		for (int p = 0; p < NUM_PHASES; p++) {
+			if (shown[p])
+				printf(" %7.3f ms", times[i][p] * 1000.0 / (p == PHASE_LOAD ? rounds * num_modes : rounds));
+			total[p] += times[i][p];
+		}
+		printf("  %s\n", digest[i]);
+	}
+	printf("%-24s", "total");
+	for (int p = 0; p < NUM_PHASES; p++) {
+		if (shown[p])
+			printf(" %7.3f ms", total[p] * 1000.0 / (p == PHASE_LOAD ? rounds * num_modes : rounds));
+	}
+	printf("\n");
+	printf("so_link: %.2fx the speed of so_relocate and so_resolve\n",
+		(total[PHASE_RELOCATE] + total[PHASE_RESOLVE]) / total[PHASE_LINK]);
+	if (num_modes > LINK_LAZY) {
+		int lazy = 0, slots = 0;
+		for (int i = 0; i < count; i++) {
+			lazy += num_lazy[i];
+			slots += num_jump_slots[i];
+		}
+		printf("so_link_lazy: %.2fx the speed of so_link, %d of %d jump slots left to the resolver\n",
+			total[PHASE_LINK] / total[PHASE_LAZY], lazy, slots);
+	}
+	if (snapshot_dir)
+		printf("snapshot: %.2fx the speed of so_file_load and so_link\n",
+			(total[PHASE_LOAD] / num_modes + total[PHASE_LINK]) / total[PHASE_RESTORE]);
+
+	return 0;
+}
@@ -0,0 +1,473 @@
+// Writes synthetic armeabi-v7a modules shaped like the ones the loader runs,
+// for trying the ELF loader on a host without the game's libraries:
+// libc++_shared.so, libiconv.so and libFahrenheit.so with the same kinds of
+// relocations, DT_NEEDED links and hash tables, and C library imports taken
+// from the default_dynlib table of loader/main.c. The code is filler and
+// cannot run; only loading, relocating and resolving are meaningful.
+//
+// gcc -O2 -o sogen sogen.c ../loader/so_symtab.c ../loader/so_dynlib.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../loader/elf.h"
+#include "../loader/so_dynlib.h"
+#include "../loader/so_symtab.h"
+
+#define PAGE 0x1000
+
+typedef struct {
+	const char *soname;
+	const char *needed[2];
+	int num_exports;
+	int num_libc_imports;
+	int num_dep_imports; // from the modules in needed[]
+	int num_relative;
+	int num_abs32;
+	size_t text_size;
+} module_spec;
+
+// Roughly the proportions of the real modules
+static const module_spec specs[] = {
+	{ "libc++_shared.so", { NULL }, 2600, 180, 0, 9000, 300, 0x90000 },
+	{ "libiconv.so", { NULL }, 40, 45, 0, 600, 20, 0xe0000 },
+	{ "libFahrenheit.so", { "libc++_shared.so", "libiconv.so" }, 24000, 900, 1400, 60000, 9000, 0x900000 },
+};
+
+#define NUM_MODULES (sizeof(specs) / sizeof(*specs))
+
+typedef struct {
+	char *name;
+	uint32_t value;
+	uint16_t shndx;
+	uint32_t hash;
+} gen_sym;
+
+typedef struct {
+	char **names;
+	int num_names;
+} name_list;
+
+static name_list libc_names;
+static name_list exports[NUM_MODULES];
+static int scale = 100;
+
+static char *read_text(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	char *buf = malloc(size + 1);
+	if (fread(buf, 1, size, f) != (size_t)size) {
+		free(buf);
+		buf = NULL;
+	} else {
+		buf[size] = '\0';
+	}
+	fclose(f);
+
+	return buf;
+}
+
+static void add_name(name_list *list, char *name) {
+	list->names = realloc(list->names, (list->num_names + 1) * sizeof(char *));
+	list->names[list->num_names++] = name;
+}
+
+// Every { "name", ... } line of the default_dynlib initializer
+static int load_dynlib(const char *main_c) {
+	char *src = read_text(main_c);
+	if (!src) {
+		printf("Could not open %s\n", main_c);
+		return -1;
+	}
+
+	char *p = strstr(src, "so_default_dynlib default_dynlib[]");
+	char *end = p ? strstr(p, "\n};") : NULL;
+	if (!end) {
+		printf("No default_dynlib in %s\n", main_c);
+		return -1;
+	}
+	*end = '\0';
+
+	for (char *line = strtok(p, "\n"); line; line = strtok(NULL, "\n")) {
+		char *q = strchr(line, '{');
+		if (!q || !(q = strchr(q, '"')))
+			continue;
+		char *e = strchr(q + 1, '"');
+		if (!e)
+			continue;
+		*e = '\0';
+		add_name(&libc_names, q + 1);
+	}
+
+	return libc_names.num_names ? 0 : -1;
+}
+
+// Itanium-mangled looking names, sharing namespace prefixes like real C++ exports do
+static char *make_name(int module, int i) {
+	static const char *spaces[] = { "3QDT", "3ASL", "3QDT3KRN", "3QDT3M3D", "3QDT3SND", "3QDT3COM", "6physx", "NSt3__1" };
+	static const char *words[] = { "MANAGER", "Display", "Update", "Texture", "Buffer", "Stream", "Mesh", "Node", "Entity", "Camera", "Input", "Sound", "Vfs", "Path", "Render" };
+	char buf[256];
+
+	int n = snprintf(buf, sizeof(buf), "_ZN%s", spaces[(i * 7 + module) % 8]);
+	for (int w = 0, parts = 1 + rand() % 3; w < parts; w++) {
+		const char *word = words[rand() % 15];
+		n += snprintf(buf + n, sizeof(buf) - n, "%d%s", (int)strlen(word), word);
+	}
+	snprintf(buf + n, sizeof(buf) - n, "%d_%d_%dEv", module, i, (int)(rand() % 1000));
+	return strdup(buf);
+}
+
+static uint32_t pick(int count) {
+	return ((uint32_t)rand() << 8 ^ rand()) % count;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	memcpy(p, &v, 4);
+}
+
+static int cmp_bucket_nbucket;
+static int cmp_bucket(const void *a, const void *b) {
+	uint32_t ba = ((const gen_sym *)a)->hash % cmp_bucket_nbucket;
+	uint32_t bb = ((const gen_sym *)b)->hash % cmp_bucket_nbucket;
+	return ba < bb ? -1 : ba > bb;
+}
+
+typedef struct {
+	uint8_t *data;
+	size_t size;
+} blob;
+
+static size_t blob_add(blob *b, const void *data, size_t size, size_t align) {
+	size_t off = (b->size + align - 1) & ~(align - 1);
+	b->data = realloc(b->data, off + size);
+	memset(b->data + b->size, 0, off - b->size);
+	if (data)
+		memcpy(b->data + off, data, size);
+	else
+		memset(b->data + off, 0, size);
+	b->size = off + size;
+	return off;
+}
+
+static size_t str_add(blob *b, const char *s) {
+	return blob_add(b, s, strlen(s) + 1, 1);
+}
+
+enum {
+	SEC_NULL,
+	SEC_DYNSYM,
+	SEC_DYNSTR,
+	SEC_HASH,
+	SEC_GNU_HASH,
+	SEC_RELDYN,
+	SEC_RELPLT,
+	SEC_TEXT,
+	SEC_DATA,
+	SEC_GOT,
+	SEC_DYNAMIC,
+	SEC_SHSTRTAB,
+	NUM_SECTIONS,
+};
+
+static const char *sec_names[NUM_SECTIONS] = {
+	"", ".dynsym", ".dynstr", ".hash", ".gnu.hash", ".rel.dyn", ".rel.plt",
+	".text", ".data", ".got", ".dynamic", ".shstrtab",
+};
+
+static int write_module(int m, const char *dir) {
+	const module_spec *spec = &specs[m];
+	int num_exports = spec->num_exports * scale / 100;
+	int num_libc = spec->num_libc_imports * scale / 100;
+	int num_dep = spec->needed[0] ? spec->num_dep_imports * scale / 100 : 0;
+	int num_relative = spec->num_relative * scale / 100;
+	int num_abs32 = spec->num_abs32 * scale / 100;
+	size_t text_size = (spec->text_size * scale / 100 + 3) & ~3;
+
+	if (num_libc > libc_names.num_names)
+		num_libc = libc_names.num_names;
+
+	int num_imports = num_libc + num_dep;
+	int num_syms = 1 + num_imports + num_exports;
+	gen_sym *syms = calloc(num_syms, sizeof(gen_sym));
+	blob dynstr = { 0 }, out = { 0 };
+	Elf32_Shdr shdr[NUM_SECTIONS];
+
+	memset(shdr, 0, sizeof(shdr));
+	str_add(&dynstr, "");
+	uint32_t soname_off = str_add(&dynstr, spec->soname);
+	uint32_t needed_off[2] = { 0, 0 };
+	for (int n = 0; n < 2 && spec->needed[n]; n++)
+		needed_off[n] = str_add(&dynstr, spec->needed[n]);
+
+	// Imports first, the exports after them as .gnu.hash wants
+	for (int i = 0; i < num_libc; i++)
+		syms[1 + i].name = libc_names.names[i];
+	for (int i = 0; i < num_dep; i++) {
+		int d = (spec->needed[1] && i % 8 == 7) ? 1 : 0;
+		for (int j = 0; j < (int)NUM_MODULES; j++) {
+			if (strcmp(specs[j].soname, spec->needed[d]) == 0) {
+				syms[1 + num_libc + i].name = exports[j].names[(i * 7919) % exports[j].num_names];
+				break;
+			}
+		}
+	}
+
+	for (int i = 0; i < num_exports; i++) {
+		gen_sym *s = &syms[1 + num_imports + i];
+		s->name = make_name(m, i);
+		add_name(&exports[m], s->name);
+		s->value = pick(text_size / 4) * 4;
+		s->shndx = SEC_TEXT;
+		s->hash = so_gnu_hash(s->name);
+	}
+
+	uint32_t gnu_nbucket = num_exports / 4 + 1;
+	cmp_bucket_nbucket = gnu_nbucket;
+	qsort(&syms[1 + num_imports], num_exports, sizeof(gen_sym), cmp_bucket);
+
+	// Text segment: headers, symbols, hash tables, relocations, code
+	blob_add(&out, NULL, sizeof(Elf32_Ehdr) + 3 * sizeof(Elf32_Phdr), 4);
+
+	Elf32_Sym *dynsym = calloc(num_syms, sizeof(Elf32_Sym));
+	for (int i = 1; i < num_syms; i++) {
+		dynsym[i].st_name = str_add(&dynstr, syms[i].name);
+		dynsym[i].st_value = syms[i].value;
+		dynsym[i].st_size = syms[i].shndx ? 64 : 0;
+		dynsym[i].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+		dynsym[i].st_shndx = syms[i].shndx;
+	}
+
+	shdr[SEC_DYNSYM].sh_offset = blob_add(&out, dynsym, num_syms * sizeof(Elf32_Sym), 4);
+	shdr[SEC_DYNSYM].sh_size = num_syms * sizeof(Elf32_Sym);
+	shdr[SEC_DYNSYM].sh_type = SHT_DYNSYM;
+	shdr[SEC_DYNSYM].sh_link = SEC_DYNSTR;
+	shdr[SEC_DYNSYM].sh_info = 1;
+	shdr[SEC_DYNSYM].sh_entsize = sizeof(Elf32_Sym);
+
+	shdr[SEC_DYNSTR].sh_offset = blob_add(&out, dynstr.data, dynstr.size, 1);
+	shdr[SEC_DYNSTR].sh_size = dynstr.size;
+	shdr[SEC_DYNSTR].sh_type = SHT_STRTAB;
+
+	// SysV .hash over every symbol
+	uint32_t nbucket = num_syms / 2 + 1;
+	uint32_t *hash = calloc(2 + nbucket + num_syms, 4);
+	hash[0] = nbucket;
+	hash[1] = num_syms;
+	for (int i = 1; i < num_syms; i++) {
+		uint32_t b = so_hash((const uint8_t *)syms[i].name) % nbucket;
+		hash[2 + nbucket + i] = hash[2 + b];
+		hash[2 + b] = i;
+	}
+	shdr[SEC_HASH].sh_offset = blob_add(&out, hash, (2 + nbucket + num_syms) * 4, 4);
+	shdr[SEC_HASH].sh_size = (2 + nbucket + num_syms) * 4;
+	shdr[SEC_HASH].sh_type = SHT_HASH;
+	shdr[SEC_HASH].sh_link = SEC_DYNSYM;
+
+	// .gnu.hash over the exports
+	uint32_t bloom_size = 1;
+	while (bloom_size * 32 < (uint32_t)num_exports)
+		bloom_size *= 2;
+	uint32_t bloom_shift = 6;
+	size_t gnu_words = 4 + bloom_size + gnu_nbucket + num_exports;
+	uint32_t *gnu = calloc(gnu_words, 4);
+	uint32_t *bloom = &gnu[4], *bucket = &bloom[bloom_size], *chain = &bucket[gnu_nbucket];
+	uint32_t symoffset = 1 + num_imports;
+	gnu[0] = gnu_nbucket;
+	gnu[1] = symoffset;
+	gnu[2] = bloom_size;
+	gnu[3] = bloom_shift;
+	for (int i = 0; i < num_exports; i++) {
+		uint32_t h = syms[symoffset + i].hash;
+		uint32_t b = h % gnu_nbucket;
+		bloom[(h / 32) % bloom_size] |= (1u << (h % 32)) | (1u << ((h >> bloom_shift) % 32));
+		if (!bucket[b])
+			bucket[b] = symoffset + i;
+		chain[i] = h & ~1;
+		if (i == num_exports - 1 || syms[symoffset + i + 1].hash % gnu_nbucket != b)
+			chain[i] |= 1;
+	}
+	shdr[SEC_GNU_HASH].sh_offset = blob_add(&out, gnu, gnu_words * 4, 4);
+	shdr[SEC_GNU_HASH].sh_size = gnu_words * 4;
+	shdr[SEC_GNU_HASH].sh_type = SHT_GNU_HASH;
+	shdr[SEC_GNU_HASH].sh_link = SEC_DYNSYM;
+
+	// Data words and GOT entries the relocations point at, laid out below
+	int num_got = num_imports + num_exports / 8;
+	int num_plt = num_imports;
+	int num_reldyn = num_relative + num_abs32 + num_got;
+	Elf32_Rel *reldyn = calloc(num_reldyn, sizeof(Elf32_Rel));
+	Elf32_Rel *relplt = calloc(num_plt, sizeof(Elf32_Rel));
+
+	size_t reldyn_off = blob_add(&out, NULL, num_reldyn * sizeof(Elf32_Rel), 4);
+	size_t relplt_off = blob_add(&out, NULL, num_plt * sizeof(Elf32_Rel), 4);
+
+	shdr[SEC_TEXT].sh_offset = blob_add(&out, NULL, text_size, 4);
+	shdr[SEC_TEXT].sh_size = text_size;
+	shdr[SEC_TEXT].sh_type = SHT_PROGBITS;
+	shdr[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+	for (size_t i = 0; i < text_size; i += 4)
+		put32(out.data + shdr[SEC_TEXT].sh_offset + i, 0xe1a00000 ^ (uint32_t)i); // not real code
+
+	size_t text_end = out.size;
+	uint32_t data_vaddr = (text_end + PAGE - 1) & ~(PAGE - 1);
+
+	// Data segment, at the same offset in the file as in memory
+	blob_add(&out, NULL, data_vaddr - text_end, 1);
+	size_t data_words = num_relative + num_abs32;
+	shdr[SEC_DATA].sh_offset = blob_add(&out, NULL, data_words * 4, 4);
+	shdr[SEC_DATA].sh_size = data_words * 4;
+	shdr[SEC_GOT].sh_offset = blob_add(&out, NULL, (num_got + num_plt) * 4, 4);
+	shdr[SEC_GOT].sh_size = (num_got + num_plt) * 4;
+
+	Elf32_Dyn dyn[12];
+	int num_dyn = 0;
+	for (int n = 0; n < 2 && spec->needed[n]; n++)
+		dyn[num_dyn++] = (Elf32_Dyn){ DT_NEEDED, { needed_off[n] } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_SONAME, { soname_off } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_HASH, { shdr[SEC_HASH].sh_offset } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_GNU_HASH, { shdr[SEC_GNU_HASH].sh_offset } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_SYMTAB, { shdr[SEC_DYNSYM].sh_offset } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_STRTAB, { shdr[SEC_DYNSTR].sh_offset } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_REL, { reldyn_off } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_RELSZ, { num_reldyn * sizeof(Elf32_Rel) } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_JMPREL, { relplt_off } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_PLTRELSZ, { num_plt * sizeof(Elf32_Rel) } };
+	dyn[num_dyn++] = (Elf32_Dyn){ DT_NULL, { 0 } };
+	shdr[SEC_DYNAMIC].sh_offset = blob_add(&out, dyn, num_dyn * sizeof(Elf32_Dyn), 4);
+	shdr[SEC_DYNAMIC].sh_size = num_dyn * sizeof(Elf32_Dyn);
+	shdr[SEC_DYNAMIC].sh_type = SHT_DYNAMIC;
+	shdr[SEC_DYNAMIC].sh_link = SEC_DYNSTR;
+	shdr[SEC_DYNAMIC].sh_entsize = sizeof(Elf32_Dyn);
+	size_t data_end = out.size;
+
+	// Relocations, in the order linkers emit them: RELATIVE first
+	uint32_t data = shdr[SEC_DATA].sh_offset, got = shdr[SEC_GOT].sh_offset;
+	int r = 0;
+	for (int i = 0; i < num_relative; i++, r++) {
+		reldyn[r].r_offset = data + i * 4;
+		reldyn[r].r_info = ELF32_R_INFO(0, R_ARM_RELATIVE);
+		put32(out.data + data + i * 4, shdr[SEC_TEXT].sh_offset + pick(text_size / 4) * 4);
+	}
+	for (int i = 0; i < num_abs32; i++, r++) {
+		// Mostly the module's own symbols, some imported data
+		int s = (i % 10 == 9 && num_imports) ? 1 + pick(num_imports) : symoffset + pick(num_exports);
+		reldyn[r].r_offset = data + (num_relative + i) * 4;
+		reldyn[r].r_info = ELF32_R_INFO(s, R_ARM_ABS32);
+	}
+	for (int i = 0; i < num_got; i++, r++) {
+		int s = i < num_imports ? 1 + i : symoffset + pick(num_exports);
+		reldyn[r].r_offset = got + i * 4;
+		reldyn[r].r_info = ELF32_R_INFO(s, R_ARM_GLOB_DAT);
+	}
+	for (int i = 0; i < num_plt; i++) {
+		relplt[i].r_offset = got + (num_got + i) * 4;
+		relplt[i].r_info = ELF32_R_INFO(1 + i, R_ARM_JUMP_SLOT);
+	}
+	memcpy(out.data + reldyn_off, reldyn, num_reldyn * sizeof(Elf32_Rel));
+	memcpy(out.data + relplt_off, relplt, num_plt * sizeof(Elf32_Rel));
+
+	shdr[SEC_RELDYN].sh_offset = reldyn_off;
+	shdr[SEC_RELDYN].sh_size = num_reldyn * sizeof(Elf32_Rel);
+	shdr[SEC_RELDYN].sh_type = SHT_REL;
+	shdr[SEC_RELDYN].sh_link = SEC_DYNSYM;
+	shdr[SEC_RELDYN].sh_entsize = sizeof(Elf32_Rel);
+	shdr[SEC_RELPLT].sh_offset = relplt_off;
+	shdr[SEC_RELPLT].sh_size = num_plt * sizeof(Elf32_Rel);
+	shdr[SEC_RELPLT].sh_type = SHT_REL;
+	shdr[SEC_RELPLT].sh_link = SEC_DYNSYM;
+	shdr[SEC_RELPLT].sh_entsize = sizeof(Elf32_Rel);
+	shdr[SEC_DATA].sh_type = SHT_PROGBITS;
+	shdr[SEC_GOT].sh_type = SHT_PROGBITS;
+
+	// Section names, then the section headers; offsets double as addresses
+	blob shstr = { 0 };
+	for (int i = 0; i < NUM_SECTIONS; i++)
+		shdr[i].sh_name = str_add(&shstr, sec_names[i]);
+	shdr[SEC_SHSTRTAB].sh_offset = blob_add(&out, shstr.data, shstr.size, 1);
+	shdr[SEC_SHSTRTAB].sh_size = shstr.size;
+	shdr[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+	for (int i = 1; i < SEC_SHSTRTAB; i++) {
+		shdr[i].sh_addr = shdr[i].sh_offset;
+		shdr[i].sh_flags |= SHF_ALLOC;
+		shdr[i].sh_addralign = 4;
+	}
+	size_t shoff = blob_add(&out, shdr, sizeof(shdr), 4);
+
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)out.data;
+	memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+	ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+	ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr->e_type = ET_DYN;
+	ehdr->e_machine = EM_ARM;
+	ehdr->e_version = EV_CURRENT;
+	ehdr->e_phoff = sizeof(Elf32_Ehdr);
+	ehdr->e_shoff = shoff;
+	ehdr->e_flags = EF_ARM_EABI_VER5;
+	ehdr->e_ehsize = sizeof(Elf32_Ehdr);
+	ehdr->e_phentsize = sizeof(Elf32_Phdr);
+	ehdr->e_phnum = 3;
+	ehdr->e_shentsize = sizeof(Elf32_Shdr);
+	ehdr->e_shnum = NUM_SECTIONS;
+	ehdr->e_shstrndx = SEC_SHSTRTAB;
+
+	Elf32_Phdr *phdr = (Elf32_Phdr *)(out.data + sizeof(Elf32_Ehdr));
+	phdr[0] = (Elf32_Phdr){ PT_LOAD, 0, 0, 0, text_end, text_end, PF_R | PF_X, PAGE };
+	phdr[1] = (Elf32_Phdr){ PT_LOAD, data_vaddr, data_vaddr, data_vaddr, data_end - data_vaddr, data_end - data_vaddr + 0x4000, PF_R | PF_W, PAGE };
+	phdr[2] = (Elf32_Phdr){ PT_DYNAMIC, shdr[SEC_DYNAMIC].sh_offset, shdr[SEC_DYNAMIC].sh_offset, shdr[SEC_DYNAMIC].sh_offset,
+		shdr[SEC_DYNAMIC].sh_size, shdr[SEC_DYNAMIC].sh_size, PF_R | PF_W, 4 };
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%s", dir, spec->soname);
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		printf("Could not open %s\n", path);
+		return -1;
+	}
+	fwrite(out.data, 1, out.size, f);
+	fclose(f);
+
+	printf("%s: %d exports, %d imports, %d relocations, %zu KB\n", path, num_exports, num_imports, num_reldyn + num_plt, out.size / 1024);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+		case 's':
+			scale = atoi(optarg);
+			break;
+		default:
+			printf("Usage: ./sogen [-s percent] main.c out_dir\n");
+			return 1;
+		}
+	}
+
+	if (argc - optind < 2 || scale <= 0) {
+		printf("Usage: ./sogen [-s percent] main.c out_dir\n");
+		printf("  -s percent    size of the modules relative to the defaults (default 100)\n");
+		return 1;
+	}
+
+	if (load_dynlib(argv[optind]) < 0)
+		return 1;
+
+	srand(1);
+	for (int m = 0; m < (int)NUM_MODULES; m++) {
+		if (write_module(m, argv[optind + 1]) < 0)
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+// Times the import resolution of so_resolve for the full relocation set of
+// the game's modules, with the old linear strcmp scan over default_dynlib and
+// with the hash index of loader/so_dynlib.c. The symbol names are read out
+// of the default_dynlib table in loader/main.c.
+//
+// gcc -O2 -o symbench symbench.c ../loader/so_dynlib.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "../loader/elf.h"
+#include "../loader/so_dynlib.h"
+
+static so_default_dynlib *dynlib;
+static int num_dynlib;
+
+static const char **imports;
+static size_t num_imports;
+
+static uint8_t *read_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	uint8_t *buf = malloc(*size + 1);
+	if (fread(buf, 1, *size, f) != *size) {
+		free(buf);
+		buf = NULL;
+	} else {
+		buf[*size] = 0;
+	}
+	fclose(f);
+
+	return buf;
+}
+
+// Every { "name", ... } line of the default_dynlib initializer
+static int load_dynlib(const char *main_c) {
+	size_t size;
+	char *src = (char *)read_file(main_c, &size);
+	if (!src) {
+		printf("Could not open %s\n", main_c);
+		return -1;
+	}
+
+	char *p = strstr(src, "so_default_dynlib default_dynlib[]");
+	char *end = p ? strstr(p, "\n};") : NULL;
+	if (!end) {
+		printf("No default_dynlib in %s\n", main_c);
+		return -1;
+	}
+	*end = '\0';
+
+	for (char *line = strtok(p, "\n"); line; line = strtok(NULL, "\n")) {
+		char *q = strchr(line, '{');
+		if (!q || !(q = strchr(q, '"')))
+			continue;
+		char *e = strchr(q + 1, '"');
+		if (!e)
+			continue;
+		*e = '\0';
+
+		dynlib = realloc(dynlib, (num_dynlib + 1) * sizeof(so_default_dynlib));
+		dynlib[num_dynlib].symbol = q + 1;
+		dynlib[num_dynlib].func = num_dynlib + 1;
+		num_dynlib++;
+	}
+
+	return 0;
+}
+
+// The undefined symbols so_resolve looks up, one per relocation as it does
+static int load_imports(const char *path) {
+	size_t size;
+	uint8_t *elf = read_file(path, &size);
+	if (!elf || size < sizeof(Elf32_Ehdr) || memcmp(elf, ELFMAG, SELFMAG) != 0 || elf[EI_CLASS] != ELFCLASS32) {
+		printf("%s is not a 32-bit ELF\n", path);
+		return -1;
+	}
+
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)elf;
+	Elf32_Shdr *shdr = (Elf32_Shdr *)(elf + ehdr->e_shoff);
+	const char *shstr = (const char *)elf + shdr[ehdr->e_shstrndx].sh_offset;
+	Elf32_Sym *dynsym = NULL;
+	const char *dynstr = NULL;
+	size_t before = num_imports;
+
+	for (int i = 0; i < ehdr->e_shnum; i++) {
+		if (strcmp(shstr + shdr[i].sh_name, ".dynsym") == 0)
+			dynsym = (Elf32_Sym *)(elf + shdr[i].sh_offset);
+		else if (strcmp(shstr + shdr[i].sh_name, ".dynstr") == 0)
+			dynstr = (const char *)elf + shdr[i].sh_offset;
+	}
+
+	if (!dynsym || !dynstr) {
+		printf("%s has no dynamic symbols\n", path);
+		return -1;
+	}
+
+	for (int i = 0; i < ehdr->e_shnum; i++) {
+		if (shdr[i].sh_type != SHT_REL)
+			continue;
+
+		Elf32_Rel *rel = (Elf32_Rel *)(elf + shdr[i].sh_offset);
+		for (size_t j = 0; j < shdr[i].sh_size / sizeof(Elf32_Rel); j++) {
+			Elf32_Sym *sym = &dynsym[ELF32_R_SYM(rel[j].r_info)];
+			if (ELF32_R_SYM(rel[j].r_info) == 0 || sym->st_shndx != SHN_UNDEF)
+				continue;
+
+			imports = realloc(imports, (num_imports + 1) * sizeof(char *));
+			imports[num_imports++] = dynstr + sym->st_name;
+		}
+	}
+
+	printf("%s: %zu undefined relocations\n", path, num_imports - before);
+	return 0;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static uintptr_t find_linear(const char *symbol) {
+	for (int j = 0; j < num_dynlib; j++) {
+		if (strcmp(symbol, dynlib[j].symbol) == 0)
+			return dynlib[j].func;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	so_dynlib_table table;
+	uintptr_t sum_linear = 0, sum_index = 0;
+	size_t found = 0;
+	int rounds = 20;
+
+	if (argc < 3) {
+		printf("Usage: ./symbench main.c module.so [module.so...]\n");
+		return 1;
+	}
+
+	if (load_dynlib(argv[1]) < 0)
+		return 1;
+
+	for (int i = 2; i < argc; i++) {
+		if (load_imports(argv[i]) < 0)
+			return 1;
+	}
+
+	double start = now();
+	if (so_dynlib_init(&table, dynlib, num_dynlib) < 0)
+		return 1;
+	double t_init = now() - start;
+
+	// Both must agree on every symbol, including which of two duplicates wins
+	for (size_t i = 0; i < num_imports; i++) {
+		so_default_dynlib *e = so_dynlib_find(&table, imports[i]);
+		uintptr_t linear = find_linear(imports[i]);
+		if ((e ? e->func : 0) != linear) {
+			printf("Mismatch on %s\n", imports[i]);
+			return 1;
+		}
+		if (linear)
+			found++;
+	}
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < num_imports; i++)
+			sum_linear += find_linear(imports[i]);
+	}
+	double t_linear = (now() - start) / rounds;
+
+	start = now();
+	for (int r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < num_imports; i++) {
+			so_default_dynlib *e = so_dynlib_find(&table, imports[i]);
+			sum_index += e ? e->func : 0;
+		}
+	}
+	double t_index = (now() - start) / rounds;
+
+	if (sum_linear != sum_index)
+		return 1;
+
+	printf("%d provided symbols, %zu lookups, %zu provided\n", num_dynlib, num_imports, found);
+	printf("linear: %8.3f ms\n", t_linear * 1000.0);
+	printf("index:  %8.3f ms (+%.3f ms to build, %.1fx)\n", t_index * 1000.0, t_init * 1000.0, t_linear / t_index);
+
+	return 0;
+}
@@ -0,0 +1,339 @@
+// Checks the symbol lookups of loader/so_symtab.c against a plain scan of
+// .dynsym, then times how the imports of a set of modules resolve against
+// their DT_NEEDED dependencies, the way so_resolve does at startup: with the
+// old .hash lookup that fell back to a scan on every miss, with .hash alone,
+// with .hash and the lookup memo and with .gnu.hash when the modules have one.
+// Pass the modules in load order, e.g. libc++_shared.so libiconv.so
+// libFahrenheit.so.
+//
+// gcc -O2 -o symtabbench symtabbench.c ../loader/so_symtab.c ../loader/so_dynlib.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "../loader/elf.h"
+#include "../loader/so_dynlib.h"
+#include "../loader/so_symtab.h"
+
+#define MAX_MODULES 16
+
+typedef struct {
+	const char *path;
+	const char *soname;
+	const char *needed[MAX_MODULES];
+	int num_needed;
+	int deps[MAX_MODULES]; // modules providing needed[]
+	int num_deps;
+
+	Elf32_Sym *dynsym;
+	char *dynstr;
+	int num_dynsym;
+	uint32_t *hash;
+	uint32_t *gnu_hash;
+
+	so_symtab tab;
+} module;
+
+typedef enum {
+	LOOKUP_LEGACY,
+	LOOKUP_SYSV,
+	LOOKUP_SYSV_MEMO,
+	LOOKUP_GNU,
+	NUM_LOOKUPS,
+} lookup_mode;
+
+static const char *mode_names[] = { "legacy", "hash", "hash+memo", "gnu.hash" };
+
+static module modules[MAX_MODULES];
+static int num_modules;
+
+static const char **imports;
+static int *importers;
+static size_t num_imports;
+
+static uint8_t *read_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	uint8_t *buf = malloc(*size ? *size : 1);
+	if (fread(buf, 1, *size, f) != *size) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+
+	return buf;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// File offset of a virtual address, through the PT_LOAD segments
+static void *vaddr_ptr(uint8_t *elf, uint32_t vaddr) {
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)elf;
+	Elf32_Phdr *phdr = (Elf32_Phdr *)(elf + ehdr->e_phoff);
+
+	for (int i = 0; i < ehdr->e_phnum; i++) {
+		if (phdr[i].p_type == PT_LOAD && vaddr >= phdr[i].p_vaddr && vaddr < phdr[i].p_vaddr + phdr[i].p_filesz)
+			return elf + phdr[i].p_offset + (vaddr - phdr[i].p_vaddr);
+	}
+	return NULL;
+}
+
+static int load_module(const char *path) {
+	module *m = &modules[num_modules];
+	size_t size;
+	uint8_t *elf = read_file(path, &size);
+
+	if (!elf || size < sizeof(Elf32_Ehdr) || memcmp(elf, ELFMAG, SELFMAG) != 0 || elf[EI_CLASS] != ELFCLASS32) {
+		printf("%s is not a 32-bit ELF\n", path);
+		return -1;
+	}
+
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)elf;
+	Elf32_Shdr *shdr = (Elf32_Shdr *)(elf + ehdr->e_shoff);
+	const char *shstr = (const char *)elf + shdr[ehdr->e_shstrndx].sh_offset;
+	Elf32_Dyn *dynamic = NULL;
+	int num_dynamic = 0;
+
+	memset(m, 0, sizeof(module));
+	m->path = path;
+	m->soname = path;
+
+	// Same section names as _so_load
+	for (int i = 0; i < ehdr->e_shnum; i++) {
+		const char *name = shstr + shdr[i].sh_name;
+		if (strcmp(name, ".dynamic") == 0) {
+			dynamic = (Elf32_Dyn *)(elf + shdr[i].sh_offset);
+			num_dynamic = shdr[i].sh_size / sizeof(Elf32_Dyn);
+		} else if (strcmp(name, ".dynstr") == 0) {
+			m->dynstr = (char *)elf + shdr[i].sh_offset;
+		} else if (strcmp(name, ".dynsym") == 0) {
+			m->dynsym = (Elf32_Sym *)(elf + shdr[i].sh_offset);
+			m->num_dynsym = shdr[i].sh_size / sizeof(Elf32_Sym);
+		} else if (strcmp(name, ".hash") == 0) {
+			m->hash = (uint32_t *)(elf + shdr[i].sh_offset);
+		} else if (strcmp(name, ".gnu.hash") == 0) {
+			m->gnu_hash = (uint32_t *)(elf + shdr[i].sh_offset);
+		}
+	}
+
+	if (!dynamic || !m->dynstr || !m->dynsym) {
+		printf("%s has no dynamic symbols\n", path);
+		return -1;
+	}
+
+	for (int i = 0; i < num_dynamic; i++) {
+		switch (dynamic[i].d_tag) {
+		case DT_SONAME:
+			m->soname = m->dynstr + dynamic[i].d_un.d_val;
+			break;
+		case DT_NEEDED:
+			if (m->num_needed < MAX_MODULES)
+				m->needed[m->num_needed++] = m->dynstr + dynamic[i].d_un.d_val;
+			break;
+		case DT_HASH:
+			if (!m->hash)
+				m->hash = vaddr_ptr(elf, dynamic[i].d_un.d_ptr);
+			break;
+		case DT_GNU_HASH:
+			if (!m->gnu_hash)
+				m->gnu_hash = vaddr_ptr(elf, dynamic[i].d_un.d_ptr);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// One lookup per relocation against an undefined symbol, as in so_resolve
+	for (int i = 0; i < ehdr->e_shnum; i++) {
+		if (shdr[i].sh_type != SHT_REL)
+			continue;
+
+		Elf32_Rel *rel = (Elf32_Rel *)(elf + shdr[i].sh_offset);
+		for (size_t j = 0; j < shdr[i].sh_size / sizeof(Elf32_Rel); j++) {
+			Elf32_Sym *sym = &m->dynsym[ELF32_R_SYM(rel[j].r_info)];
+			if (ELF32_R_SYM(rel[j].r_info) == 0 || sym->st_shndx != SHN_UNDEF)
+				continue;
+
+			imports = realloc(imports, (num_imports + 1) * sizeof(char *));
+			importers = realloc(importers, (num_imports + 1) * sizeof(int));
+			imports[num_imports] = m->dynstr + sym->st_name;
+			importers[num_imports] = num_modules;
+			num_imports++;
+		}
+	}
+
+	printf("%s: %s, %d symbols,%s%s\n", path, m->soname, m->num_dynsym,
+		m->hash ? " .hash" : "", m->gnu_hash ? " .gnu.hash" : " no .gnu.hash");
+
+	num_modules++;
+	return 0;
+}
+
+static void set_mode(lookup_mode mode) {
+	for (int i = 0; i < num_modules; i++) {
+		module *m = &modules[i];
+		so_symtab_free(&m->tab);
+		so_symtab_init(&m->tab, m->dynsym, m->num_dynsym, m->dynstr, m->hash,
+			mode == LOOKUP_GNU ? m->gnu_hash : NULL);
+		if (mode == LOOKUP_SYSV)
+			so_symtab_free(&m->tab);
+	}
+}
+
+static int is_defined(const Elf32_Sym *sym) {
+	return sym->st_shndx != SHN_UNDEF && sym->st_info != 0;
+}
+
+static int linear_index(module *m, const char *symbol) {
+	for (int i = 0; i < m->num_dynsym; i++) {
+		if (is_defined(&m->dynsym[i]) && strcmp(m->dynstr + m->dynsym[i].st_name, symbol) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// so_symbol_index before .gnu.hash support
+static int legacy_index(module *m, const char *symbol) {
+	if (m->hash) {
+		uint32_t hash = so_hash((const uint8_t *)symbol);
+		uint32_t nbucket = m->hash[0];
+		uint32_t *bucket = &m->hash[2];
+		uint32_t *chain = &bucket[nbucket];
+		for (int i = bucket[hash % nbucket]; i; i = chain[i]) {
+			if (is_defined(&m->dynsym[i]) && strcmp(m->dynstr + m->dynsym[i].st_name, symbol) == 0)
+				return i;
+		}
+	}
+
+	return linear_index(m, symbol);
+}
+
+static int module_index(module *m, const char *symbol, uint32_t hash, lookup_mode mode) {
+	if (mode == LOOKUP_LEGACY)
+		return legacy_index(m, symbol);
+	return so_symtab_lookup_hash(&m->tab, symbol, hash);
+}
+
+// Same search order as so_resolve_link; returns the providing module and index
+static int resolve(module *m, const char *symbol, lookup_mode mode, int *index) {
+	uint32_t hash = so_gnu_hash(symbol);
+
+	for (int d = 0; d < m->num_deps; d++) {
+		*index = module_index(&modules[m->deps[d]], symbol, hash, mode);
+		if (*index != -1)
+			return m->deps[d];
+	}
+	return -1;
+}
+
+// Every defined symbol must be found at its own index, and a few made up names not at all
+static int check_lookups(lookup_mode mode) {
+	char name[512];
+
+	set_mode(mode);
+	for (int i = 0; i < num_modules; i++) {
+		module *m = &modules[i];
+		for (int pass = 0; pass < 2; pass++) {
+			for (int s = 1; s < m->num_dynsym; s++) {
+				const char *symbol = m->dynstr + m->dynsym[s].st_name;
+				if (!is_defined(&m->dynsym[s]))
+					continue;
+
+				if (so_symtab_lookup(&m->tab, symbol) != linear_index(m, symbol)) {
+					printf("%s: %s lookup of %s does not match .dynsym\n", m->path, mode_names[mode], symbol);
+					return -1;
+				}
+
+				snprintf(name, sizeof(name), "%s_", symbol);
+				if (so_symtab_lookup(&m->tab, name) != linear_index(m, name)) {
+					printf("%s: %s lookup of %s does not match .dynsym\n", m->path, mode_names[mode], name);
+					return -1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int *expect_mod, *expect_idx;
+	double times[NUM_LOOKUPS];
+	int rounds = 20;
+
+	if (argc < 2) {
+		printf("Usage: ./symtabbench module.so [module.so...]\n");
+		return 1;
+	}
+
+	for (int i = 1; i < argc && num_modules < MAX_MODULES; i++) {
+		if (load_module(argv[i]) < 0)
+			return 1;
+	}
+
+	for (int i = 0; i < num_modules; i++) {
+		module *m = &modules[i];
+		for (int n = 0; n < m->num_needed; n++) {
+			for (int j = 0; j < num_modules; j++) {
+				if (j != i && strcmp(modules[j].soname, m->needed[n]) == 0)
+					m->deps[m->num_deps++] = j;
+			}
+		}
+	}
+
+	for (lookup_mode mode = LOOKUP_SYSV; mode < NUM_LOOKUPS; mode++) {
+		if (check_lookups(mode) < 0)
+			return 1;
+	}
+
+	// Each strategy has to bind every import to the same definition
+	expect_mod = malloc((num_imports + 1) * sizeof(int));
+	expect_idx = malloc((num_imports + 1) * sizeof(int));
+	size_t linked = 0;
+	for (size_t i = 0; i < num_imports; i++) {
+		expect_mod[i] = resolve(&modules[importers[i]], imports[i], LOOKUP_LEGACY, &expect_idx[i]);
+		if (expect_mod[i] != -1)
+			linked++;
+	}
+
+	for (lookup_mode mode = LOOKUP_LEGACY; mode < NUM_LOOKUPS; mode++) {
+		int index;
+
+		set_mode(mode);
+		for (size_t i = 0; i < num_imports; i++) {
+			int mod = resolve(&modules[importers[i]], imports[i], mode, &index);
+			if (mod != expect_mod[i] || (mod != -1 && index != expect_idx[i])) {
+				printf("%s resolves %s differently\n", mode_names[mode], imports[i]);
+				return 1;
+			}
+		}
+
+		// Starting from an empty memo each time, as every boot does
+		double start = now();
+		for (int r = 0; r < rounds; r++) {
+			set_mode(mode);
+			for (size_t i = 0; i < num_imports; i++)
+				resolve(&modules[importers[i]], imports[i], mode, &index);
+		}
+		times[mode] = (now() - start) / rounds;
+	}
+
+	printf("%zu import relocations, %zu bound to dependencies\n", num_imports, linked);
+	for (lookup_mode mode = LOOKUP_LEGACY; mode < NUM_LOOKUPS; mode++)
+		printf("%-9s %8.3f ms (%.1fx)\n", mode_names[mode], times[mode] * 1000.0, times[LOOKUP_LEGACY] / times[mode]);
+
+	return 0;
+}
@@ -0,0 +1,348 @@
+// Checks the trampolines loader/so_trampoline.c builds for hooked functions.
+// Every case relocates a PC-relative ARM or Thumb instruction, then runs the
+// trampoline on a small interpreter for the instructions trampolines are made
+// of, and compares where it ends up, and what it loaded, with what the
+// original instruction does at its original address. Branches are followed
+// both ways, calls are returned from to see them come back to the rest of the
+// function. Instructions that can not be moved must be refused.
+//
+// gcc -O2 -o trampcheck trampcheck.c ../loader/so_trampoline.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../loader/so_trampoline.h"
+
+#define TRAMP_BASE 0x70000000
+#define MAX_STEPS 64
+
+enum {
+	EXPECT_BRANCH, // ends up at value
+	EXPECT_CALL, // ends up at value, then back from LR to the rest of the function
+	EXPECT_LOAD, // reg holds the word at value
+	EXPECT_VALUE, // reg holds value
+	EXPECT_COPY, // ends up at the rest of the function
+	EXPECT_REFUSED,
+};
+
+typedef struct {
+	const char *name;
+	int thumb;
+	uint32_t pc;
+	uint8_t code[16];
+	int code_size;
+	int cond; // condition the instruction depends on, -1 for none
+	int expect;
+	int reg;
+	uint32_t value;
+} test_case;
+
+#define ARM_NOP 0x00, 0x00, 0xa0, 0xe1 // mov r0, r0
+#define T_NOP 0x00, 0xbf
+#define EQ 0
+#define NE 1
+
+// Encodings from llvm-mc, values worked out by hand from the pc
+static const test_case cases[] = {
+	{ "arm b", 0, 0x10000, { 0x3e, 0x00, 0x00, 0xea, ARM_NOP }, 8, -1, EXPECT_BRANCH, 0, 0x10000 + 8 + 0xf8 },
+	{ "arm bne backwards", 0, 0x10000, { 0xfa, 0xff, 0xff, 0x1a, ARM_NOP }, 8, NE, EXPECT_BRANCH, 0, 0x10000 + 8 - 0x18 },
+	{ "arm bl", 0, 0x10000, { 0x40, 0x00, 0x00, 0xeb, ARM_NOP }, 8, -1, EXPECT_CALL, 0, 0x10000 + 8 + 0x100 },
+	{ "arm bleq", 0, 0x10000, { 0x40, 0x00, 0x00, 0x0b, ARM_NOP }, 8, EQ, EXPECT_CALL, 0, 0x10000 + 8 + 0x100 },
+	{ "arm blx to thumb", 0, 0x10004, { ARM_NOP, 0x08, 0x00, 0x00, 0xfa }, 8, -1, EXPECT_CALL, 0, (0x10008 + 8 + 0x20) | 1 },
+	{ "arm ldr literal", 0, 0x10000, { 0x10, 0x30, 0x9f, 0xe5, ARM_NOP }, 8, -1, EXPECT_LOAD, 3, 0x10000 + 8 + 0x10 },
+	{ "arm ldrne literal back", 0, 0x10004, { ARM_NOP, 0x0c, 0x30, 0x1f, 0x15 }, 8, NE, EXPECT_LOAD, 3, 0x10008 + 8 - 0xc },
+	{ "arm adr", 0, 0x10000, { 0x40, 0x20, 0x8f, 0xe2, ARM_NOP }, 8, -1, EXPECT_VALUE, 2, 0x10000 + 8 + 0x40 },
+	{ "arm sub from pc", 0, 0x10000, { 0x20, 0x20, 0x4f, 0xe2, ARM_NOP }, 8, -1, EXPECT_VALUE, 2, 0x10000 + 8 - 0x20 },
+	{ "arm push and mov", 0, 0x10000, { 0x10, 0x40, 0x2d, 0xe9, 0x00, 0x40, 0xa0, 0xe1 }, 8, -1, EXPECT_COPY },
+	{ "arm add pc register", 0, 0x10000, { 0x01, 0x00, 0x8f, 0xe0, ARM_NOP }, 8, -1, EXPECT_REFUSED },
+	{ "arm ldr pc literal", 0, 0x10000, { 0x04, 0xf0, 0x9f, 0xe5, ARM_NOP }, 8, -1, EXPECT_REFUSED },
+	{ "arm vldr literal", 0, 0x10000, { 0x04, 0x0b, 0x9f, 0xed, ARM_NOP }, 8, -1, EXPECT_REFUSED },
+
+	{ "thumb b", 1, 0x10000, { 0x7e, 0xe0, T_NOP, T_NOP, T_NOP }, 8, -1, EXPECT_BRANCH, 0, (0x10000 + 4 + 0xfc) | 1 },
+	{ "thumb bne", 1, 0x10000, { 0xf6, 0xd1, T_NOP, T_NOP, T_NOP }, 8, NE, EXPECT_BRANCH, 0, (0x10000 + 4 - 0x14) | 1 },
+	{ "thumb beq.w", 1, 0x10000, { 0x01, 0xf0, 0x00, 0x80, T_NOP, T_NOP }, 8, EQ, EXPECT_BRANCH, 0, (0x10000 + 4 + 0x1000) | 1 },
+	{ "thumb b.w", 1, 0x10002, { 0x00, 0xf0, 0x00, 0xb0, T_NOP, T_NOP }, 8, -1, EXPECT_BRANCH, 0, (0x10002 + 4 + 0x400000) | 1 },
+	{ "thumb cbz", 1, 0x10000, { 0x52, 0xb1, T_NOP, T_NOP, T_NOP }, 8, EQ, EXPECT_BRANCH, 0, (0x10000 + 4 + 20) | 1 },
+	{ "thumb cbnz", 1, 0x10000, { 0x52, 0xb9, T_NOP, T_NOP, T_NOP }, 8, NE, EXPECT_BRANCH, 0, (0x10000 + 4 + 20) | 1 },
+	{ "thumb bl", 1, 0x10002, { 0x00, 0xf0, 0x80, 0xf8, T_NOP, T_NOP }, 8, -1, EXPECT_CALL, 0, (0x10002 + 4 + 0x100) | 1 },
+	{ "thumb blx to arm", 1, 0x10006, { 0x00, 0xf0, 0x00, 0xe9, T_NOP, T_NOP }, 8, -1, EXPECT_CALL, 0, 0x10008 + 0x200 },
+	{ "thumb ldr literal", 1, 0x10006, { 0x02, 0x4b, T_NOP, T_NOP, T_NOP }, 8, -1, EXPECT_LOAD, 3, 0x10008 + 8 },
+	{ "thumb ldr.w literal back", 1, 0x10002, { 0x5f, 0xf8, 0x64, 0x00, T_NOP, T_NOP }, 8, -1, EXPECT_LOAD, 0, 0x10004 - 100 },
+	{ "thumb adr", 1, 0x10002, { 0x04, 0xa1, T_NOP, T_NOP, T_NOP }, 8, -1, EXPECT_VALUE, 1, 0x10004 + 16 },
+	{ "thumb adr.w", 1, 0x10000, { 0x0f, 0xf2, 0x34, 0x18, T_NOP, T_NOP }, 8, -1, EXPECT_VALUE, 8, 0x10004 + 0x134 },
+	{ "thumb straddling push.w", 1, 0x10000, { 0x10, 0xb5, T_NOP, T_NOP, 0x2d, 0xe9, 0xf0, 0x41 }, 8, -1, EXPECT_COPY },
+	{ "thumb add pc", 1, 0x10000, { 0x78, 0x44, T_NOP, T_NOP, T_NOP }, 8, -1, EXPECT_REFUSED },
+	{ "thumb it block", 1, 0x10000, { 0x08, 0xbf, 0x01, 0x20, T_NOP, T_NOP }, 8, -1, EXPECT_REFUSED },
+	{ "thumb tbb", 1, 0x10000, { 0xdf, 0xe8, 0x00, 0xf0, T_NOP, T_NOP }, 8, -1, EXPECT_REFUSED },
+	{ "thumb ldrd literal", 1, 0x10000, { 0xdf, 0xe9, 0x01, 0x23, T_NOP, T_NOP }, 8, -1, EXPECT_REFUSED },
+};
+
+typedef struct {
+	uint32_t r[16];
+	int thumb;
+	int z;
+	const uint8_t *tramp;
+	int tramp_size;
+} cpu;
+
+// Whatever the trampoline reads outside of itself
+static uint32_t memory_word(uint32_t addr) {
+	return addr ^ 0xd00dfeed;
+}
+
+static uint32_t read32(cpu *c, uint32_t addr) {
+	uint32_t w;
+	if (addr >= TRAMP_BASE && addr + 4 <= TRAMP_BASE + c->tramp_size) {
+		memcpy(&w, c->tramp + addr - TRAMP_BASE, sizeof(w));
+		return w;
+	}
+	return memory_word(addr);
+}
+
+static uint16_t read16(cpu *c, uint32_t addr) {
+	uint16_t h;
+	memcpy(&h, c->tramp + addr - TRAMP_BASE, sizeof(h));
+	return h;
+}
+
+static int in_tramp(cpu *c, uint32_t pc) {
+	return pc >= TRAMP_BASE && pc < TRAMP_BASE + c->tramp_size;
+}
+
+static int cond_passed(cpu *c, int cond) {
+	switch (cond) {
+	case 0x0: return c->z;
+	case 0x1: return !c->z;
+	case 0xE: return 1;
+	default: return -1;
+	}
+}
+
+// Loads into PC interwork on bit 0
+static void write_pc(cpu *c, uint32_t value) {
+	c->thumb = value & 1;
+	c->r[15] = value & ~1;
+}
+
+static int step_arm(cpu *c) {
+	uint32_t pc = c->r[15];
+	uint32_t insn = read32(c, pc);
+	int pass = cond_passed(c, insn >> 28);
+	int rn = (insn >> 16) & 0xF;
+	int rd = (insn >> 12) & 0xF;
+
+	c->r[15] += 4;
+	if (pass < 0)
+		return -1;
+	if (!pass)
+		return 0;
+
+	if (insn == 0xe1a00000 || (insn & 0x0FFF0000) == 0x092D0000 || (insn & 0x0FFF0FF0) == 0x01A00000)
+		return 0; // copied nop, push, mov
+	if ((insn & 0x0F000000) == 0x0A000000) {
+		c->r[15] = pc + 8 + (((int32_t)(insn << 8)) >> 6);
+		return 0;
+	}
+	if ((insn & 0x0E000000) == 0x04000000 && (insn & 0x01300000) == 0x01100000) {
+		uint32_t base = rn == 15 ? pc + 8 : c->r[rn];
+		uint32_t addr = (insn & 0x00800000) ? base + (insn & 0xFFF) : base - (insn & 0xFFF);
+		uint32_t value = read32(c, addr);
+		if (insn & 0x00400000)
+			value &= 0xFF;
+		if (rd == 15)
+			write_pc(c, value);
+		else
+			c->r[rd] = value;
+		return 0;
+	}
+	if ((insn & 0x0FE00000) == 0x02800000 && ((insn >> 8) & 0xF) == 0) {
+		c->r[rd] = (rn == 15 ? pc + 8 : c->r[rn]) + (insn & 0xFF);
+		return 0;
+	}
+
+	printf("  unexpected arm instruction %08x at %08x\n", insn, pc);
+	return -1;
+}
+
+static int step_thumb(cpu *c) {
+	uint32_t pc = c->r[15];
+	uint32_t pc_align = (pc + 4) & ~3;
+	uint16_t hw = read16(c, pc);
+
+	if ((hw >> 11) >= 0x1D) {
+		uint16_t hw2 = read16(c, pc + 2);
+		c->r[15] += 4;
+		if ((hw & 0xFF70) == 0xF850 && (hw & 0x80 || (hw & 0xF) == 0xF)) {
+			// LDR.W Rt, [Rn, #+/-imm12]
+			int rn = hw & 0xF;
+			uint32_t base = rn == 15 ? pc_align : c->r[rn];
+			uint32_t addr = (hw & 0x80) ? base + (hw2 & 0xFFF) : base - (hw2 & 0xFFF);
+			uint32_t value = read32(c, addr);
+			if ((hw2 >> 12) == 15)
+				write_pc(c, value);
+			else
+				c->r[hw2 >> 12] = value;
+			return 0;
+		}
+		if (hw == 0xF20F && !(hw2 & 0x8000)) {
+			// ADDW Rd, PC, #imm
+			c->r[(hw2 >> 8) & 0xF] = pc_align + (((hw2 >> 4) & 0x700) | (hw2 & 0xFF));
+			return 0;
+		}
+		if (hw == 0xE92D)
+			return 0; // copied push.w
+		printf("  unexpected thumb instruction %04x %04x at %08x\n", hw, hw2, pc);
+		return -1;
+	}
+
+	c->r[15] += 2;
+	if (hw == 0xbf00 || (hw & 0xFE00) == 0xB400)
+		return 0; // nop, push
+	if ((hw & 0xF000) == 0xD000) {
+		int pass = cond_passed(c, (hw >> 8) & 0xF);
+		if (pass < 0)
+			return -1;
+		if (pass)
+			c->r[15] = pc + 4 + ((int32_t)(hw << 24) >> 23);
+		return 0;
+	}
+	if ((hw & 0xF800) == 0xE000) {
+		c->r[15] = pc + 4 + ((int32_t)(hw << 21) >> 20);
+		return 0;
+	}
+	if ((hw & 0xF500) == 0xB100) {
+		// The cases keep the tested register zero when Z is set
+		int zero = c->z;
+		int nonzero_branch = hw & 0x800;
+		if (zero != !!nonzero_branch)
+			c->r[15] = pc + 4 + ((((hw >> 9) & 1) << 6) | (((hw >> 3) & 0x1F) << 1));
+		return 0;
+	}
+
+	printf("  unexpected thumb instruction %04x at %08x\n", hw, pc);
+	return -1;
+}
+
+// Runs from pc until it leaves the trampoline, returns where to
+static int run(cpu *c, uint32_t pc, uint32_t *exit_pc) {
+	write_pc(c, pc);
+	for (int i = 0; i < MAX_STEPS; i++) {
+		if (!in_tramp(c, c->r[15])) {
+			*exit_pc = c->r[15] | c->thumb;
+			return 0;
+		}
+		if ((c->thumb ? step_thumb(c) : step_arm(c)) < 0)
+			return -1;
+	}
+
+	printf("  no way out after %d steps\n", MAX_STEPS);
+	return -1;
+}
+
+static int check(const test_case *t, uint8_t *tramp, int size, int taken) {
+	uint32_t resume = (t->pc + t->code_size) | t->thumb;
+	uint32_t exit_pc;
+	cpu c;
+
+	// Straddling instructions are moved whole
+	if (t->thumb && t->code_size < (int)sizeof(t->code) && (t->code[t->code_size - 1] >> 3) >= 0x1D)
+		resume += 2;
+
+	memset(&c, 0, sizeof(c));
+	c.tramp = tramp;
+	c.tramp_size = size;
+	c.z = (t->cond == EQ) ? taken : !taken;
+	for (int i = 0; i < 13; i++)
+		c.r[i] = 0xaaaa0000 + i;
+
+	if (run(&c, TRAMP_BASE | t->thumb, &exit_pc) < 0)
+		return -1;
+
+	if (!taken) {
+		if (exit_pc != resume || (t->expect >= EXPECT_LOAD && t->expect <= EXPECT_VALUE && c.r[t->reg] != 0xaaaa0000u + t->reg)) {
+			printf("  not taken: left at %08x, expected %08x\n", exit_pc, resume);
+			return -1;
+		}
+		return 0;
+	}
+
+	switch (t->expect) {
+	case EXPECT_BRANCH:
+		if (exit_pc != t->value) {
+			printf("  branched to %08x, expected %08x\n", exit_pc, t->value);
+			return -1;
+		}
+		return 0;
+	case EXPECT_CALL:
+		if (exit_pc != t->value) {
+			printf("  called %08x, expected %08x\n", exit_pc, t->value);
+			return -1;
+		}
+		if (!in_tramp(&c, c.r[14] & ~1) || (c.r[14] & 1) != (uint32_t)t->thumb) {
+			printf("  returns to %08x, outside of the trampoline\n", c.r[14]);
+			return -1;
+		}
+		if (run(&c, c.r[14], &exit_pc) < 0)
+			return -1;
+		break;
+	case EXPECT_LOAD:
+	case EXPECT_VALUE:
+	{
+		uint32_t want = t->expect == EXPECT_LOAD ? memory_word(t->value) : t->value;
+		if (c.r[t->reg] != want) {
+			printf("  r%d = %08x, expected %08x\n", t->reg, c.r[t->reg], want);
+			return -1;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	if (exit_pc != resume) {
+		printf("  left at %08x, expected %08x\n", exit_pc, resume);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+	int failed = 0;
+	int num_cases = sizeof(cases) / sizeof(cases[0]);
+
+	for (int i = 0; i < num_cases; i++) {
+		const test_case *t = &cases[i];
+		uint8_t tramp[SO_TRAMPOLINE_MAX] __attribute__((aligned(4)));
+
+		int size = so_trampoline_build(t->code, t->pc | t->thumb, t->thumb, 8, tramp);
+
+		int ok;
+		if (t->expect == EXPECT_REFUSED) {
+			ok = size < 0;
+			if (!ok)
+				printf("  moved an instruction that uses PC\n");
+		} else if (size < 0) {
+			printf("  refused\n");
+			ok = 0;
+		} else {
+			ok = check(t, tramp, size, 1) == 0;
+			if (ok && t->cond >= 0)
+				ok = check(t, tramp, size, 0) == 0;
+		}
+
+		printf("%-28s %s\n", t->name, ok ? "ok" : "FAILED");
+		if (verbose && size > 0) {
+			// llvm-mc -triple=armv7 (or thumbv7) -disassemble
+			for (int j = 0; j < size; j++)
+				printf("0x%02x ", tramp[j]);
+			printf("\n");
+		}
+		failed += !ok;
+	}
+
+	printf("%d of %d cases passed\n", num_cases - failed, num_cases);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,245 @@
+// Checks the loads and stores loader/so_unaligned.c rewrites for misaligned
+// data. Every case rewrites an ARM or Thumb-2 LDM/STM, LDRD/STRD or VLDM/VSTM
+// at a made up address, disassembles the sequence it gets with llvm-mc and
+// compares it with the one expected, and checks that the jump at its end
+// returns to the next instruction. Forms that must be left alone must be
+// refused. With modules, loads them with mmap_platform and reports what
+// so_fix_unaligned finds in them, rewriting it in the functions matching the
+// -f patterns.
+//
+// gcc -O2 -o unalignedcheck unalignedcheck.c ../loader/so_unaligned.c ../loader/so_elf.c ../loader/so_arena.c ../loader/so_symtab.c ../loader/so_dynlib.c ../loader/so_platform_posix.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "../loader/config.h"
+#include "../loader/so_util.h"
+#include "../loader/so_unaligned.h"
+
+#define PC 0x10000
+#define MAX_PATTERNS 32
+
+typedef struct {
+	int thumb;
+	uint8_t code[4]; // as in memory
+	const char *source;
+	const char *expected; // disassembly, NULL if it must be refused
+} test_case;
+
+// Encodings from llvm-mc -show-encoding
+static const test_case cases[] = {
+	{ 0, { 0x0e, 0x00, 0x90, 0xe8 }, "ldm r0, {r1, r2, r3}",
+		"ldr r1, [r0]\nldr r2, [r0, #4]\nldr r3, [r0, #8]\n" },
+	{ 0, { 0x21, 0x00, 0xb4, 0xe9 }, "ldmib r4!, {r0, r5}",
+		"ldr r0, [r4, #4]\nldr r5, [r4, #8]\nadd r4, r4, #8\n" },
+	{ 0, { 0x18, 0x00, 0x12, 0xe8 }, "ldmda r2, {r3, r4}",
+		"ldr r3, [r2, #-4]\nldr r4, [r2]\n" },
+	{ 0, { 0x03, 0x00, 0x90, 0x18 }, "ldmne r0, {r0, r1}",
+		"ldr r1, [r0, #4]\nldr r0, [r0]\n" },
+	{ 0, { 0x02, 0x80, 0x90, 0xe8 }, "ldm r0, {r1, pc}",
+		"ldr r1, [r0]\nldr pc, [r0, #4]\n" },
+	{ 0, { 0xf0, 0x00, 0x22, 0xe9 }, "stmdb r2!, {r4, r5, r6, r7}",
+		"str r4, [r2, #-16]\nstr r5, [r2, #-12]\nstr r6, [r2, #-8]\nstr r7, [r2, #-4]\nsub r2, r2, #16\n" },
+	{ 0, { 0xd8, 0x20, 0xc0, 0xe1 }, "ldrd r2, r3, [r0, #8]",
+		"ldr r2, [r0, #8]\nldr r3, [r0, #12]\n" },
+	{ 0, { 0xd4, 0x00, 0x40, 0xe1 }, "ldrd r0, r1, [r0, #-4]",
+		"ldr r1, [r0]\nldr r0, [r0, #-4]\n" },
+	{ 0, { 0xf0, 0x41, 0xe1, 0xe1 }, "strd r4, r5, [r1, #16]!",
+		"add r1, r1, #16\nstr r4, [r1]\nstr r5, [r1, #4]\n" },
+	{ 0, { 0xd8, 0x60, 0x42, 0xe0 }, "ldrd r6, r7, [r2], #-8",
+		"ldr r6, [r2]\nldr r7, [r2, #4]\nsub r2, r2, #8\n" },
+	{ 0, { 0x0c, 0x8b, 0x90, 0xec }, "vldmia r0, {d8-d13}",
+		"vld1.8 {d8, d9, d10, d11}, [r0]!\nvld1.8 {d12, d13}, [r0]!\nsub r0, r0, #48\n" },
+	{ 0, { 0x03, 0x1a, 0x21, 0xed }, "vstmdb r1!, {s2, s3, s4}",
+		"sub r1, r1, #12\nvst1.32 {d1[0]}, [r1]!\nvst1.32 {d1[1]}, [r1]!\nvst1.32 {d2[0]}, [r1]!\nsub r1, r1, #12\n" },
+	{ 0, { 0x04, 0x0b, 0x13, 0xed }, "vldr d0, [r3, #-16]",
+		"sub r3, r3, #16\nvld1.8 {d0}, [r3]!\nadd r3, r3, #8\n" },
+	{ 0, { 0xff, 0x0a, 0xc2, 0xed }, "vstr s1, [r2, #1020]",
+		"add r2, r2, #1020\nvst1.32 {d0[1]}, [r2]!\nsub r2, r2, #1024\n" },
+	{ 0, { 0x08, 0x0b, 0xb2, 0xec }, "vldmia r2!, {d0-d3}",
+		"vld1.8 {d0, d1, d2, d3}, [r2]!\n" },
+	{ 0, { 0xd3, 0x00, 0x82, 0xe1 }, "ldrd r0, r1, [r2, r3]", NULL },
+	{ 0, { 0x02, 0x80, 0x80, 0xe8 }, "stm r0, {r1, pc}", NULL },
+	{ 0, { 0x02, 0x0b, 0x9f, 0xed }, "vldr d0, [pc, #8]", NULL },
+	{ 0, { 0x00, 0x00, 0x91, 0xe5 }, "ldr r0, [r1]", NULL },
+
+	{ 1, { 0x90, 0xe8, 0x06, 0x01 }, "ldm.w r0, {r1, r2, r8}",
+		"ldr.w r1, [r0]\nldr.w r2, [r0, #4]\nldr.w r8, [r0, #8]\n" },
+	{ 1, { 0x33, 0xe9, 0x30, 0x00 }, "ldmdb r3!, {r4, r5}",
+		"ldr r4, [r3, #-8]\nldr r5, [r3, #-4]\nsubw r3, r3, #8\n" },
+	{ 1, { 0xa1, 0xe8, 0x1c, 0x00 }, "stm.w r1!, {r2, r3, r4}",
+		"str.w r2, [r1]\nstr.w r3, [r1, #4]\nstr.w r4, [r1, #8]\naddw r1, r1, #12\n" },
+	{ 1, { 0x50, 0xe9, 0x02, 0x23 }, "ldrd r2, r3, [r0, #-8]",
+		"ldr r2, [r0, #-8]\nldr r3, [r0, #-4]\n" },
+	{ 1, { 0xd0, 0xe9, 0x02, 0x04 }, "ldrd r0, r4, [r0, #8]",
+		"ldr.w r4, [r0, #12]\nldr.w r0, [r0, #8]\n" },
+	{ 1, { 0xe1, 0xe9, 0x04, 0x45 }, "strd r4, r5, [r1, #16]!",
+		"addw r1, r1, #16\nstr.w r4, [r1]\nstr.w r5, [r1, #4]\n" },
+	{ 1, { 0x72, 0xe8, 0x40, 0x67 }, "ldrd r6, r7, [r2], #-256",
+		"ldr.w r6, [r2]\nldr.w r7, [r2, #4]\nsubw r2, r2, #256\n" },
+	{ 1, { 0xf0, 0xec, 0x0a, 0x0b }, "vldmia r0!, {d16-d20}",
+		"vld1.8 {d16, d17, d18, d19}, [r0]!\nvld1.8 {d20}, [r0]!\n" },
+	{ 1, { 0x45, 0xed, 0x01, 0x1a }, "vstr s3, [r5, #-4]",
+		"subw r5, r5, #4\nvst1.32 {d1[1]}, [r5]!\n" },
+	{ 1, { 0x36, 0xed, 0x02, 0x0a }, "vldmdb r6!, {s0, s1}",
+		"subw r6, r6, #8\nvld1.32 {d0[0]}, [r6]!\nvld1.32 {d0[1]}, [r6]!\nsubw r6, r6, #8\n" },
+	{ 1, { 0x90, 0xe8, 0x02, 0x80 }, "ldm.w r0, {r1, pc}",
+		"ldr.w r1, [r0]\nldr.w pc, [r0, #4]\n" },
+	{ 1, { 0xdf, 0xe9, 0x02, 0x01 }, "ldrd r0, r1, [pc, #8]", NULL },
+	{ 1, { 0x52, 0xe9, 0x80, 0x01 }, "ldrd r0, r1, [r2, #-512]", NULL },
+	{ 1, { 0x51, 0xe8, 0x00, 0x0f }, "ldrex r0, [r1]", NULL },
+	{ 1, { 0xd0, 0xe8, 0x01, 0xf0 }, "tbb [r0, r1]", NULL },
+};
+
+// llvm-mc output without its directives, one instruction per line, single spaces
+static int disassemble(const uint8_t *code, int size, int thumb, char *out, size_t out_size) {
+	char path[] = "/tmp/unalignedcheckXXXXXX";
+	char cmd[256], line[256];
+	size_t len = 0;
+
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+	FILE *f = fdopen(fd, "w");
+	for (int i = 0; i < size; i++)
+		fprintf(f, "0x%02x ", code[i]);
+	fclose(f);
+
+	snprintf(cmd, sizeof(cmd), "llvm-mc -triple=%s -mattr=+neon,+vfp3 -disassemble %s 2>&1",
+		thumb ? "thumbv7" : "armv7", path);
+	FILE *p = popen(cmd, "r");
+	if (!p) {
+		remove(path);
+		return -1;
+	}
+
+	out[0] = '\0';
+	while (fgets(line, sizeof(line), p)) {
+		char *s = line;
+		while (isspace((unsigned char)*s))
+			s++;
+		if (*s == '\0' || *s == '.')
+			continue;
+		for (int space = 0; *s && len + 2 < out_size; s++) {
+			if (isspace((unsigned char)*s)) {
+				space = 1;
+				continue;
+			}
+			if (space && len && out[len - 1] != '\n')
+				out[len++] = ' ';
+			space = 0;
+			out[len++] = *s;
+		}
+		out[len++] = '\n';
+		out[len] = '\0';
+	}
+
+	int res = pclose(p);
+	remove(path);
+	return res == 0 ? 0 : -1;
+}
+
+static int check(const test_case *t) {
+	uint8_t out[SO_UNALIGNED_MAX] __attribute__((aligned(4)));
+	uint32_t insn, literal;
+	char text[4096];
+
+	if (t->thumb)
+		insn = (uint32_t)(t->code[0] | t->code[1] << 8) << 16 | (t->code[2] | t->code[3] << 8);
+	else
+		memcpy(&insn, t->code, sizeof(insn));
+
+	int size = so_unaligned_build(insn, t->thumb, PC, out);
+	if (!t->expected) {
+		if (size >= 0)
+			printf("  rewrote a form it should have refused\n");
+		return size < 0 ? 0 : -1;
+	}
+	if (size < 0) {
+		printf("  refused\n");
+		return -1;
+	}
+
+	// Ends with LDR PC, [PC, #-4] or LDR.W PC, [PC] and the address to go on at
+	memcpy(&literal, out + size - 4, sizeof(literal));
+	if (literal != ((PC + 4) | t->thumb)) {
+		printf("  returns to 0x%08x, expected 0x%08x\n", literal, (PC + 4) | t->thumb);
+		return -1;
+	}
+
+	if (disassemble(out, size - 4, t->thumb, text, sizeof(text)) < 0) {
+		printf("  llvm-mc failed:\n%s", text);
+		return -1;
+	}
+
+	char expected[1024];
+	snprintf(expected, sizeof(expected), "%s%s", t->expected, t->thumb ? "ldr.w pc, [pc, #0]\n" : "ldr pc, [pc, #-4]\n");
+	if (strcmp(text, expected) != 0) {
+		printf("  got:\n%s  expected:\n%s", text, expected);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int check_cases(void) {
+	int num_cases = sizeof(cases) / sizeof(cases[0]);
+	int failed = 0;
+
+	for (int i = 0; i < num_cases; i++) {
+		const test_case *t = &cases[i];
+		int ok = check(t) == 0;
+		printf("%-6s %-32s %s\n", t->thumb ? "thumb" : "arm", t->source, ok ? "ok" : "FAILED");
+		failed += !ok;
+	}
+
+	printf("%d of %d cases passed\n", num_cases - failed, num_cases);
+	return failed;
+}
+
+// so_unaligned_report goes to the debug output, which mmap_platform drops
+static void print_stats(const char *path, const so_unaligned_stats *stats) {
+	static const char *names[SO_UNALIGNED_KINDS] = { "LDM", "STM", "LDRD", "STRD", "VLDM", "VSTM" };
+
+	printf("%s: %d functions, %d on SP or PC, %d unsupported, %d out of trampoline space\n",
+		path, stats->functions, stats->stack, stats->unsupported, stats->no_space);
+	for (int k = 0; k < SO_UNALIGNED_KINDS; k++)
+		printf("  %-4s %6d found, %6d rewritten\n", names[k], stats->found[k], stats->rewritten[k]);
+}
+
+int main(int argc, char *argv[]) {
+	const char *patterns[MAX_PATTERNS];
+	int num_patterns = 0;
+	int num_modules = 0;
+
+	so_set_platform(&mmap_platform);
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			if (num_patterns < MAX_PATTERNS)
+				patterns[num_patterns++] = argv[++i];
+			continue;
+		}
+
+		so_module mod;
+		so_unaligned_stats stats;
+		memset(&mod, 0, sizeof(mod));
+		if (so_file_load(&mod, argv[i], LOAD_ADDRESS + num_modules * 0x1000000) < 0) {
+			fprintf(stderr, "Could not load %s\n", argv[i]);
+			return 1;
+		}
+
+		so_fix_unaligned(&mod, patterns, num_patterns, &stats);
+		print_stats(argv[i], &stats);
+		so_unload(&mod);
+		num_modules++;
+	}
+
+	if (num_modules)
+		return 0;
+
+	return check_cases() ? 1 : 0;
+}
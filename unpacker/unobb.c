@@ -1,13 +1,52 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <unistd.h>
 #include <zlib.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+
+#ifndef MINGW
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+#include "obb.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+#define MAX_THREADS 64
+#define QUEUE_SIZE 256
+
+typedef struct {
+	const char *out_dir;
+	int quiet;
+#ifndef MINGW
+	int fd;
+	const uint8_t *map;
+	uint64_t map_len;
+
+	// Entries flow from the index parser to the workers through this ring
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	obb_entry queue[QUEUE_SIZE];
+	unsigned int head;
+	unsigned int tail;
+	int done;
+#endif
+	uint64_t bytes;
+	uint64_t files;
+	int failed;
+} obb_job;
+
 void mkdir_rec(char *path) {
 	char *p = strrchr(path, '/');
 	if (p) {
@@ -22,118 +61,322 @@ void mkdir_rec(char *path) {
 	}
 }
 
-int main(int argc, char *argv[]) {
-	z_stream z;
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int extract_serial(obb_job *job, obb_index *idx, FILE *fin) {
+	obb_entry e;
 	char path[PATH_MAX];
-	char name[PATH_MAX];
 	char buf[4096];
 	uint64_t i;
 	uint64_t remain;
-	uint64_t name_len;
-	uint64_t file_len;
-	uint64_t file_off;
-	uint64_t idx_off;
-	uint64_t idx_comp_len;
-	uint64_t idx_uncomp_len;
-	uint8_t *idx_comp;
-	uint8_t *idx_uncomp;
-	uint8_t *idx;
-	uint8_t *idx_end;
-	FILE *fin;
 	FILE *fout;
+	int res;
 
-	if (argc < 3) {
-		printf("Usage: ./unobb in_obb out_dir");
-		return 1;
+	while ((res = obb_index_next(idx, &e)) > 0) {
+		if (snprintf(path, sizeof(path), "%s/%s", job->out_dir, e.name) >= (int)sizeof(path)) {
+			printf("Path too long for %s\n", e.name);
+			return -1;
+		}
+
+		if (!job->quiet)
+			printf("Writing %s...\n", path);
+
+		fseeko(fin, e.off, SEEK_SET);
+
+		mkdir_rec(path);
+
+		fout = fopen(path, "wb");
+		if (!fout) {
+			printf("Could not open %s\n", path);
+			return -1;
+		}
+
+		i = 0;
+		while (i < e.len) {
+			remain = MIN(e.len - i, sizeof(buf));
+			fread(buf, 1, remain, fin);
+			fwrite(buf, 1, remain, fout);
+			i += remain;
+		}
+
+		fclose(fout);
+
+		job->bytes += e.len;
+		job->files++;
 	}
 
-	fin = fopen(argv[1], "rb");
-	if (!fin) {
-		printf("Could not open %s\n", argv[1]);
-		return 1;
+	if (res < 0) {
+		printf("Invalid index\n");
+		return -1;
 	}
 
-	fseek(fin, -(sizeof(idx_off) + sizeof(idx_uncomp_len)), SEEK_END);
-	idx_comp_len = ftell(fin);
+	return 0;
+}
 
-	fread(&idx_off, 1, sizeof(idx_off), fin);
-	fread(&idx_uncomp_len, 1, sizeof(idx_uncomp_len), fin);
+#ifndef MINGW
+static int write_entry(obb_job *job, obb_entry *e, int fout) {
+	uint64_t i = 0;
+	ssize_t res;
 
-	idx_comp = malloc(idx_comp_len);
-	idx_uncomp = malloc(idx_uncomp_len);
-	if (!idx_comp || !idx_uncomp) {
-		printf("Could not allocate index buffers\n");
-		return 1;
+	if (e->off > job->map_len || e->len > job->map_len - e->off) {
+		printf("Entry out of bounds\n");
+		return -1;
 	}
 
-	fseek(fin, idx_off, SEEK_SET);
-	fread(idx_comp, 1, idx_comp_len, fin);
+#ifdef __linux__
+	// Let the kernel move the data directly between the two files
+	loff_t off_in = e->off;
+	while (i < e->len) {
+		res = copy_file_range(job->fd, &off_in, fout, NULL, e->len - i, 0);
+		if (res <= 0)
+			break;
+		i += res;
+	}
+#endif
 
-	memset(&z, 0, sizeof(z_stream));
-	z.avail_in = idx_comp_len;
-	z.next_in = idx_comp;
-	z.avail_out = idx_uncomp_len;
-	z.next_out = idx_uncomp;
+	// Fall back to writing straight out of the mapping
+	while (i < e->len) {
+		res = pwrite(fout, job->map + e->off + i, e->len - i, i);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		i += res;
+	}
 
-	if (inflateInit(&z) != Z_OK) {
-		printf("inflateInit failed\n");
-		return 1;
+	return 0;
+}
+
+// Stops the parser and every worker, all of them read failed under the lock
+static void job_fail(obb_job *job) {
+	pthread_mutex_lock(&job->lock);
+	job->failed = 1;
+	pthread_cond_broadcast(&job->not_empty);
+	pthread_cond_broadcast(&job->not_full);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void *extract_worker(void *arg) {
+	obb_job *job = (obb_job *)arg;
+	obb_entry e;
+	char path[PATH_MAX];
+	uint64_t bytes = 0;
+	uint64_t files = 0;
+	int fout;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		while (job->head == job->tail && !job->done && !job->failed)
+			pthread_cond_wait(&job->not_empty, &job->lock);
+		if (job->head == job->tail || job->failed) {
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+		e = job->queue[job->tail++ % QUEUE_SIZE];
+		pthread_cond_signal(&job->not_full);
+		pthread_mutex_unlock(&job->lock);
+
+		if (snprintf(path, sizeof(path), "%s/%s", job->out_dir, e.name) >= (int)sizeof(path)) {
+			printf("Path too long for %s\n", e.name);
+			job_fail(job);
+			break;
+		}
+
+		if (!job->quiet)
+			printf("Writing %s...\n", path);
+
+		mkdir_rec(path);
+
+		fout = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fout < 0) {
+			printf("Could not open %s\n", path);
+			job_fail(job);
+			break;
+		}
+
+		if (write_entry(job, &e, fout) < 0) {
+			printf("Could not write %s\n", path);
+			job_fail(job);
+		}
+
+		close(fout);
+
+		bytes += e.len;
+		files++;
 	}
 
-	if (inflate(&z, Z_FINISH) != Z_STREAM_END) {
-		printf("inflate failed\n");
-		return 1;
+	__sync_fetch_and_add(&job->bytes, bytes);
+	__sync_fetch_and_add(&job->files, files);
+
+	// Wake up the parser in case it is waiting on a full queue
+	pthread_mutex_lock(&job->lock);
+	pthread_cond_broadcast(&job->not_full);
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
+}
+
+static int extract_parallel(obb_job *job, obb_index *idx, FILE *fin, int num_threads) {
+	pthread_t threads[MAX_THREADS];
+	struct stat st;
+	int res = 0;
+	int failed;
+	int i;
+
+	job->fd = fileno(fin);
+	if (fstat(job->fd, &st) < 0) {
+		printf("Could not stat input\n");
+		return -1;
 	}
 
-	inflateEnd(&z);
+	job->map_len = st.st_size;
+	job->map = mmap(NULL, job->map_len, PROT_READ, MAP_SHARED, job->fd, 0);
+	if (job->map == MAP_FAILED) {
+		printf("Could not map input\n");
+		return -1;
+	}
 
-	idx = idx_uncomp;
-	idx_end = idx + idx_uncomp_len;
-	while (idx + sizeof(uint64_t) < idx_end) {
-		name_len = *(uint64_t *)(idx + 0x08);
+	// Entries are laid out in file order, hint the kernel to read ahead
+	madvise((void *)job->map, job->map_len, MADV_SEQUENTIAL);
 
-		if (name_len >= PATH_MAX) {
-			printf("Invalid size\n");
-			return 1;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->not_empty, NULL);
+	pthread_cond_init(&job->not_full, NULL);
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, extract_worker, job) != 0) {
+			printf("Could not create worker thread\n");
+			job_fail(job);
+			break;
 		}
+	}
 
-		strncpy(name, idx + 0x10, name_len);
-		name[name_len] = '\0';
+	// Workers start extracting as soon as the first entries are decoded
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		while (job->head - job->tail == QUEUE_SIZE && !job->failed)
+			pthread_cond_wait(&job->not_full, &job->lock);
+		failed = job->failed;
+		pthread_mutex_unlock(&job->lock);
 
-		snprintf(path, sizeof(path), "%s/%s", argv[2], name);
+		if (failed)
+			break;
 
-		printf("Writing %s...\n", path);
+		// Only the parser advances head, so the slot can be filled unlocked
+		res = obb_index_next(idx, &job->queue[job->head % QUEUE_SIZE]);
+		if (res <= 0)
+			break;
 
-		file_off = *(uint64_t *)(idx + 0x10 + name_len);
-		file_len = *(uint64_t *)(idx + 0x18 + name_len);
+		pthread_mutex_lock(&job->lock);
+		job->head++;
+		pthread_cond_signal(&job->not_empty);
+		pthread_mutex_unlock(&job->lock);
+	}
 
-		fseek(fin, file_off, SEEK_SET);
+	if (res < 0) {
+		printf("Invalid index\n");
+		job_fail(job);
+	}
 
-		mkdir_rec(path);
+	pthread_mutex_lock(&job->lock);
+	job->done = 1;
+	pthread_cond_broadcast(&job->not_empty);
+	pthread_mutex_unlock(&job->lock);
 
-		fout = fopen(path, "wb");
-		if (!fout) {
-			printf("Could not open %s\n", path);
+	while (--i >= 0)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&job->not_full);
+	pthread_cond_destroy(&job->not_empty);
+	pthread_mutex_destroy(&job->lock);
+
+	munmap((void *)job->map, job->map_len);
+
+	return job->failed ? -1 : 0;
+}
+#endif
+
+static void usage(void) {
+	printf("Usage: ./unobb [-j threads] [-q] in_obb out_dir\n");
+	printf("  -j threads  extract in parallel from a memory mapped obb\n");
+	printf("  -q          do not print every extracted file\n");
+}
+
+int main(int argc, char *argv[]) {
+	static obb_job job;
+	static obb_index idx;
+	int res;
+	int opt;
+	int num_threads = 0;
+	double start, elapsed;
+	FILE *fin;
+
+	while ((opt = getopt(argc, argv, "j:q")) != -1) {
+		switch (opt) {
+		case 'j':
+			num_threads = atoi(optarg);
+			if (num_threads < 1 || num_threads > MAX_THREADS) {
+				printf("Thread count must be between 1 and %d\n", MAX_THREADS);
+				return 1;
+			}
+			break;
+		case 'q':
+			job.quiet = 1;
+			break;
+		default:
+			usage();
 			return 1;
 		}
+	}
 
-		i = 0;
-		while (i < file_len) {
-			remain = MIN(file_len - i, sizeof(buf));
-			fread(buf, 1, remain, fin);
-			fwrite(buf, 1, remain, fout);
-			i += remain;
-		}
+	if (argc - optind < 2) {
+		usage();
+		return 1;
+	}
 
-		fclose(fout);
+	job.out_dir = argv[optind + 1];
+
+	fin = fopen(argv[optind], "rb");
+	if (!fin) {
+		printf("Could not open %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (obb_index_open(&idx, fin) < 0) {
+		printf("Could not read index\n");
+		return 1;
+	}
+
+	start = now();
 
-		idx += 0x20 + name_len;
+	if (num_threads > 0) {
+#ifdef MINGW
+		printf("Parallel extraction is not supported on this platform\n");
+		return 1;
+#else
+		res = extract_parallel(&job, &idx, fin, num_threads);
+#endif
+	} else {
+		res = extract_serial(&job, &idx, fin);
 	}
 
+	if (res < 0)
+		return 1;
+
+	elapsed = now() - start;
+	printf("Extracted %llu files (%.2f MB) in %.2f s, %.2f MB/s (%s, %d thread%s)\n",
+		(unsigned long long)job.files, job.bytes / (1024.0 * 1024.0), elapsed,
+		elapsed > 0 ? job.bytes / (1024.0 * 1024.0) / elapsed : 0.0,
+		num_threads > 0 ? "mmap" : "serial", num_threads > 0 ? num_threads : 1,
+		num_threads > 1 ? "s" : "");
 
-	free(idx_uncomp);
-	free(idx_comp);
+	obb_index_close(&idx);
 	fclose(fin);
 
 	return 0;
-}
\ No newline at end of file
+}